@@ -290,14 +290,7 @@ typedef struct {
 
     // Bytes 0-3.
     uint8_t id[4];              // Up to 8 BCD digits
-#define GET_ID(x) (((x)[0] >> 4) * 10000000 +\
-                   ((x)[0] & 15) * 1000000 +\
-                   ((x)[1] >> 4) * 100000 +\
-                   ((x)[1] & 15) * 10000 +\
-                   ((x)[2] >> 4) * 1000 +\
-                   ((x)[2] & 15) * 100 +\
-                   ((x)[3] >> 4) * 10 +\
-                   ((x)[3] & 15))
+#define GET_ID(x) bcd_get(x, 4)
     // Byte 4.
     uint8_t _unused4;           // 0
 
@@ -426,20 +419,6 @@ static const char *BANDWIDTH[] = { "12.5", "25" };
 static const char *CONTACT_TYPE[] = { "Private", "Group", "All", "Unknown" };
 static const char *ALERT_TYPE[] = { "-", "+", "Online", "Unknown" };
 
-//
-// CTCSS tones, Hz*10.
-//
-#define NCTCSS  51
-
-static const int CTCSS_TONES[NCTCSS] = {
-     625,  670,  693,  719,  744,  770,  797,  825,  854,  885,
-     915,  948,  974, 1000, 1035, 1072, 1109, 1148, 1188, 1230,
-    1273, 1318, 1365, 1413, 1462, 1514, 1567, 1598, 1622, 1655,
-    1679, 1713, 1738, 1773, 1799, 1835, 1862, 1899, 1928, 1966,
-    1995, 2035, 2065, 2107, 2181, 2257, 2291, 2336, 2418, 2503,
-    2541,
-};
-
 //
 // Print a generic information about the device.
 //
@@ -452,7 +431,7 @@ static void anytone_ht_print_version(radio_device_t *radio, FILE *out)
 // Return true when the specified region has to be skipped.
 // Skip unused channels, contacts, zones and scanlists.
 //
-static int skip_region(unsigned addr, unsigned file_offset, uint8_t *mem, unsigned nbytes)
+static int skip_region(unsigned addr, unsigned file_offset)
 {
     int index;
 
@@ -466,11 +445,7 @@ static int skip_region(unsigned addr, unsigned file_offset, uint8_t *mem, unsign
                 // Channel is valid, don't skip.
                 return 0;
             }
-
-            // Invalid channel: skip it, erase data.
-            if (mem) {
-                memset(mem, 0xff, nbytes);
-            }
+            // Invalid channel: skip it.
             return 1;
         }
     }
@@ -482,10 +457,7 @@ static int skip_region(unsigned addr, unsigned file_offset, uint8_t *mem, unsign
             uint8_t *cmap = GET_CONTACT_MAP();
 
             if ((cmap[index / 8] >> (index & 7)) & 1) {
-                // Invalid contact: skip it, erase data.
-                if (mem) {
-                    memset(mem, 0xff, nbytes);
-                }
+                // Invalid contact: skip it.
                 return 1;
             }
 
@@ -504,11 +476,7 @@ static int skip_region(unsigned addr, unsigned file_offset, uint8_t *mem, unsign
                 // Zone is valid, don't skip.
                 return 0;
             }
-
-            // Invalid zone: skip it, erase data.
-            if (mem) {
-                memset(mem, 0xff, nbytes);
-            }
+            // Invalid zone: skip it.
             return 1;
         }
     }
@@ -523,11 +491,7 @@ static int skip_region(unsigned addr, unsigned file_offset, uint8_t *mem, unsign
                 // Scanlist is valid, don't skip.
                 return 0;
             }
-
-            // Invalid scanlist: skip it, erase data.
-            if (mem) {
-                memset(mem, 0xff, nbytes);
-            }
+            // Invalid scanlist: skip it.
             return 1;
         }
     }
@@ -535,46 +499,206 @@ static int skip_region(unsigned addr, unsigned file_offset, uint8_t *mem, unsign
 }
 
 //
-// Read memory image from the device.
+// Vocabulary of configuration script.
 //
-static void anytone_ht_download(radio_device_t *radio)
+enum {
+    PARAM_RADIO, PARAM_NAME, PARAM_ID, PARAM_INTRO1, PARAM_INTRO2, PARAM_MODE,
+};
+
+static const keyword_t PARAMETER_WORDS[] = {
+    { "Radio",         PARAM_RADIO },
+    { "Name",          PARAM_NAME },
+    { "ID",            PARAM_ID },
+    { "Intro Line 1",  PARAM_INTRO1 },
+    { "Intro Line 2",  PARAM_INTRO2 },
+    { "Working Mode",  PARAM_MODE },
+    { 0 },
+};
+static keyword_table_t parameter_table = { PARAMETER_WORDS };
+
+static const keyword_t HEADER_WORDS[] = {
+    { "Digital",    'D' },
+    { "Analog",     'A' },
+    { "Zone",       'Z' },
+    { "Scanlist",   'S' },
+    { "Contact",    'C' },
+    { "Grouplist",  'G' },
+    { "Message",    'M' },
+    { 0 },
+};
+static keyword_table_t header_table = { HEADER_WORDS };
+
+static const keyword_t POWER_WORDS[] = {
+    { "Low",    POWER_LOW },
+    { "Mid",    POWER_MIDDLE },
+    { "High",   POWER_HIGH },
+    { "Turbo",  POWER_TURBO },
+    { 0 },
+};
+static keyword_table_t power_table = { POWER_WORDS };
+
+static const keyword_t DIGITAL_ADMIT_WORDS[] = {
+    { "Always",  PERMIT_ALWAYS },
+    { "Free",    PERMIT_CH_FREE },
+    { "Color",   PERMIT_CC_SAME },
+    { "NColor",  PERMIT_CC_DIFF },
+    { 0 },
+};
+static keyword_table_t digital_admit_table = { DIGITAL_ADMIT_WORDS };
+
+static const keyword_t ANALOG_ADMIT_WORDS[] = {
+    { "Always",  PERMIT_ALWAYS },
+    { "Free",    PERMIT_CH_FREE },     // Busy Lock = Repeater
+    { "Tone",    PERMIT_CC_SAME },     // Busy Lock = Busy
+    { 0 },
+};
+static keyword_table_t analog_admit_table = { ANALOG_ADMIT_WORDS };
+
+static const keyword_t WIDTH_WORDS[] = {
+    { "12.5",  BW_12_5_KHZ },
+    { "25",    BW_25_KHZ },
+    { 0 },
+};
+static keyword_table_t width_table = { WIDTH_WORDS };
+
+static const keyword_t CALL_TYPE_WORDS[] = {
+    { "Group",    CALL_GROUP },
+    { "Private",  CALL_PRIVATE },
+    { "All",      CALL_ALL },
+    { 0 },
+};
+static keyword_table_t call_type_table = { CALL_TYPE_WORDS };
+
+static const keyword_t ALERT_WORDS[] = {
+    { "No",      ALERT_NONE },
+    { "Yes",     ALERT_RING },
+    { "Online",  ALERT_ONLINE },
+    { 0 },
+};
+static keyword_table_t alert_table = { ALERT_WORDS };
+
+static const keyword_t MODE_WORDS[] = {
+    { "Amateur",       WMODE_AMATEUR },
+    { "Professional",  WMODE_PRO },
+    { 0 },
+};
+static keyword_table_t mode_table = { MODE_WORDS };
+
+//
+// Map of tables in memory image.
+//
+static const table_range_t anytone_ht_tables[] = {
+    { TABLE_VERSION,    0,                      OFFSET_BANK1 },
+    { TABLE_CHANNELS,   OFFSET_BANK1,           OFFSET_ZONELISTS - OFFSET_BANK1 },
+    { TABLE_ZONES,      OFFSET_ZONELISTS,       NZONES * 512 },
+    { TABLE_SCANLISTS,  OFFSET_SCANLISTS,       NSCANL * 192 },
+    { TABLE_MESSAGES,   OFFSET_MESSAGES,        NMESSAGES * 256 },
+    { TABLE_ZONES,      OFFSET_ZONE_MAP,        (NZONES + 7) / 8 },
+    { TABLE_SCANLISTS,  OFFSET_SCANL_MAP,       (NSCANL + 7) / 8 },
+    { TABLE_CHANNELS,   OFFSET_CHAN_MAP,        (NCHAN + 7) / 8 },
+    { TABLE_SETTINGS,   OFFSET_SETTINGS,        0x640 },
+    { TABLE_ZONES,      OFFSET_ZCHAN_A,         NZONES * 2 },
+    { TABLE_ZONES,      OFFSET_ZCHAN_B,         NZONES * 2 },
+    { TABLE_ZONES,      OFFSET_ZONENAMES,       NZONES * 32 },
+    { TABLE_SETTINGS,   OFFSET_RADIOID,         250 * sizeof(radioid_t) },
+    { TABLE_CONTACTS,   OFFSET_CONTACT_LIST,    NCONTACTS * 4 },
+    { TABLE_CONTACTS,   OFFSET_CONTACT_MAP,     (NCONTACTS + 7) / 8 },
+    { TABLE_CONTACTS,   OFFSET_CONTACTS,        NCONTACTS * 100 },
+    { TABLE_GROUPLISTS, OFFSET_GLISTS,          NGLISTS * 320 },
+    { 0 },
+};
+
+//
+// Transfer plan: ordered list of address ranges of the radio memory,
+// built from the region map and bitmaps of valid channels, zones,
+// scanlists and contacts. Adjacent pieces of the same kind are coalesced,
+// so every range is transferred by one call, split into commands
+// of the maximal size the radio accepts.
+//
+enum {
+    RANGE_DATA,             // Transfer the data
+    RANGE_SKIP,             // Unused entries: don't transfer, erase on download
+    RANGE_BITMAP,           // Bitmap: read before the rest of data
+    RANGE_UNSELECTED,       // Table not selected: don't transfer, keep as is
+};
+
+typedef struct {
+    unsigned address;       // Address in radio memory
+    unsigned offset;        // Offset in the image
+    unsigned length;        // Size in bytes
+    int kind;               // RANGE_DATA, RANGE_SKIP, RANGE_BITMAP or RANGE_UNSELECTED
+} range_t;
+
+static range_t *plan;       // Array of ranges
+static int plan_count;      // Number of ranges in the plan
+static int plan_alloc;      // Allocated size of the array
+
+//
+// Append a piece to the plan: extend the last range when possible.
+//
+static void plan_add(unsigned addr, unsigned file_offset, unsigned nbytes, int kind)
 {
-    fragment_t *f;
+    if (plan_count > 0) {
+        range_t *last = &plan[plan_count - 1];
 
-    // Read bitmaps first.
-    for (f=region_map; f->length; f++) {
-        if (f->offset != 0) {
-            serial_read_region(f->address, &radio_mem[f->offset], f->length);
+        if (last->kind == kind &&
+            last->address + last->length == addr &&
+            last->offset + last->length == file_offset) {
+            last->length += nbytes;
+            return;
+        }
+    }
+    if (plan_count >= plan_alloc) {
+        plan_alloc = plan_alloc ? plan_alloc * 2 : 1024;
+        plan = realloc(plan, plan_alloc * sizeof(range_t));
+        if (! plan) {
+            fprintf(stderr, "Out of memory!\n");
+            exit(-1);
         }
     }
+    plan[plan_count].address = addr;
+    plan[plan_count].offset = file_offset;
+    plan[plan_count].length = nbytes;
+    plan[plan_count].kind = kind;
+    plan_count++;
+}
 
-    // Read other regions sequentially.
+//
+// Build the transfer plan for current contents of the bitmaps.
+// Entries are tested by pieces of 64 bytes.
+// Bitmap of contacts is placed in the middle of data,
+// but it is needed in advance, like other bitmaps.
+// Regions of tables which are not selected are left out.
+//
+static void plan_build()
+{
+    fragment_t *f;
     unsigned file_offset = 0;
-    unsigned bytes_transferred = 0;
-    unsigned last_printed = 0;
-    //printf("Address     Offset\n");
+
+    plan_count = 0;
     for (f=region_map; f->length; f++) {
         unsigned addr = f->address;
         unsigned nbytes = f->length;
 
-        //printf("%08x    %06x\n", addr, file_offset);
+        if (! radio_range_selected(file_offset, nbytes)) {
+            plan_add(addr, file_offset, nbytes, RANGE_UNSELECTED);
+            file_offset += nbytes;
+            continue;
+        }
+        if (f->offset != 0 || file_offset == OFFSET_CONTACT_MAP) {
+            plan_add(addr, file_offset, nbytes, RANGE_BITMAP);
+            file_offset += nbytes;
+            continue;
+        }
         while (nbytes > 0) {
             unsigned n = (nbytes > 64) ? 64 : nbytes;
 
-            if (! skip_region(addr, file_offset, &radio_mem[file_offset], n)) {
-                if (f->offset == 0)
-                    serial_read_region(addr, &radio_mem[file_offset], n);
-                bytes_transferred += n;
-            }
+            plan_add(addr, file_offset, n,
+                skip_region(addr, file_offset) ? RANGE_SKIP :
+                ! radio_range_selected(file_offset, n) ? RANGE_UNSELECTED : RANGE_DATA);
             file_offset += n;
             addr += n;
             nbytes -= n;
-
-            if (bytes_transferred / (32*1024) != last_printed) {
-                fprintf(stderr, "#");
-                fflush(stderr);
-                last_printed = bytes_transferred / (32*1024);
-            }
         }
     }
     if (file_offset != MEMSZ) {
@@ -584,6 +708,52 @@ static void anytone_ht_download(radio_device_t *radio)
     }
 }
 
+//
+// Print a progress mark for every 32 kbytes transferred.
+//
+static void plan_progress(unsigned *bytes_transferred, unsigned nbytes)
+{
+    unsigned last_printed = *bytes_transferred / (32*1024);
+
+    *bytes_transferred += nbytes;
+    if (*bytes_transferred / (32*1024) != last_printed) {
+        fprintf(stderr, "#");
+        fflush(stderr);
+    }
+}
+
+//
+// Read memory image from the device.
+//
+static void anytone_ht_download(radio_device_t *radio)
+{
+    range_t *r;
+    unsigned bytes_transferred = 0;
+
+    // Read bitmaps first.
+    plan_build();
+    for (r=plan; r<plan+plan_count; r++) {
+        if (r->kind == RANGE_BITMAP) {
+            serial_read_region(r->address, &radio_mem[r->offset], r->length);
+            plan_progress(&bytes_transferred, r->length);
+        }
+    }
+
+    // Read other regions according to the plan.
+    plan_build();
+    for (r=plan; r<plan+plan_count; r++) {
+        switch (r->kind) {
+        case RANGE_DATA:
+            serial_read_region(r->address, &radio_mem[r->offset], r->length);
+            plan_progress(&bytes_transferred, r->length);
+            break;
+        case RANGE_SKIP:
+            memset(&radio_mem[r->offset], 0xff, r->length);
+            break;
+        }
+    }
+}
+
 //
 // Get contact by index.
 //
@@ -597,42 +767,54 @@ static contact_t *get_contact(int i)
     return GET_CONTACT(i);
 }
 
+//
+// Read back the map of contact IDs just written, and write it again
+// when it differs. The map is not a part of radio memory image,
+// so it is checked here, not by the common read-back pass.
+//
+static void check_contact_map(const uint8_t *map, unsigned nbytes)
+{
+    uint8_t *buf = malloc(nbytes);
+    int attempt;
+
+    if (! buf) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(-1);
+    }
+    for (attempt=1; ; attempt++) {
+        serial_read_region(ADDR_CONT_ID_LIST, buf, nbytes);
+        if (memcmp(buf, map, nbytes) == 0)
+            break;
+        if (attempt >= READBACK_TRIES) {
+            fprintf(stderr, "\nRead back: map of contacts still differs after %d writes.\n",
+                attempt);
+            exit(-1);
+        }
+        fprintf(stderr, "\nRead back: map of contacts differs, write again.\n");
+        serial_write_region(ADDR_CONT_ID_LIST, (uint8_t*)map, nbytes);
+    }
+    free(buf);
+}
+
 //
 // Write memory image to the device.
 //
 static void anytone_ht_upload(radio_device_t *radio, int cont_flag)
 {
-    fragment_t *f;
-    unsigned file_offset = 0;
+    range_t *r;
     unsigned bytes_transferred = 0;
-    unsigned last_printed = 0;
-
-    for (f=region_map; f->length; f++) {
-        unsigned addr = f->address;
-        unsigned nbytes = f->length;
-
-        while (nbytes > 0) {
-            unsigned n = (nbytes > 64) ? 64 : nbytes;
 
-            if (! skip_region(addr, file_offset, 0, 0)) {
-                serial_write_region(addr, &radio_mem[file_offset], n);
-                bytes_transferred += n;
-            }
-            file_offset += n;
-            addr += n;
-            nbytes -= n;
-
-            if (bytes_transferred / (32*1024) != last_printed) {
-                fprintf(stderr, "#");
-                fflush(stderr);
-                last_printed = bytes_transferred / (32*1024);
-            }
-        }
+    plan_build();
+    for (r=plan; r<plan+plan_count; r++) {
+        if (r->kind == RANGE_SKIP || r->kind == RANGE_UNSELECTED)
+            continue;
+        serial_write_region(r->address, &radio_mem[r->offset], r->length);
+        radio_mark_written(r->offset, r->length);
+        plan_progress(&bytes_transferred, r->length);
     }
-    if (file_offset != MEMSZ) {
-        fprintf(stderr, "\nWrong MEMSZ=%u for D868UV/D878UV/D878UV2!\n", MEMSZ);
-        fprintf(stderr, "Should be %u; check anytone_ht-map.h!\n", file_offset);
-        exit(-1);
+    if (! radio_table_modified(TABLE_CONTACTS)) {
+        // Contacts not changed: keep the map.
+        return;
     }
 
     //
@@ -641,6 +823,7 @@ static void anytone_ht_upload(radio_device_t *radio, int cont_flag)
     //
     uint64_t map[8*NCONTACTS + 72];
     int index, ncontacts = 0;
+    unsigned nbytes;
 
     memset(map, 0xff, sizeof(map));
     for (index=0; index<NCONTACTS; index++) {
@@ -681,7 +864,43 @@ static void anytone_ht_upload(radio_device_t *radio, int cont_flag)
     //printf("\n");
     //print_hex((uint8_t*)map, ncontacts*8 + 8);
     //printf("\n");
-    serial_write_region(ADDR_CONT_ID_LIST, (uint8_t*)map, (ncontacts*8 + 8 + 63) / 64 * 64);
+    nbytes = (ncontacts*8 + 8 + 63) / 64 * 64;
+    serial_write_region(ADDR_CONT_ID_LIST, (uint8_t*)map, nbytes);
+    if (radio_read_back && ! dry_run)
+        check_contact_map((uint8_t*)map, nbytes);
+}
+
+//
+// Print the transfer plan for current image.
+//
+static void anytone_ht_print_plan(radio_device_t *radio, FILE *out)
+{
+    static const char *KIND_NAME[] = { "data", "skip", "bitmap", "unselected" };
+    unsigned nreads = 0, nwrites = 0, nbytes = 0, nskipped = 0;
+    range_t *r;
+
+    plan_build();
+    fprintf(out, "# Transfer plan for %s.\n", radio->name);
+    fprintf(out, "# Address  Offset   Length  Reads Writes Kind\n");
+    for (r=plan; r<plan+plan_count; r++) {
+        unsigned reads = 0, writes = 0;
+
+        if (r->kind == RANGE_SKIP || r->kind == RANGE_UNSELECTED) {
+            nskipped += r->length;
+        } else {
+            reads = (r->length + SERIAL_READ_SIZE - 1) / SERIAL_READ_SIZE;
+            writes = (r->length + SERIAL_WRITE_SIZE - 1) / SERIAL_WRITE_SIZE;
+            nreads += reads;
+            nwrites += writes;
+            nbytes += r->length;
+        }
+        fprintf(out, "%08x   %06x %8u %6u %6u %s\n", r->address, r->offset,
+            r->length, reads, writes, KIND_NAME[r->kind]);
+    }
+    fprintf(out, "# Total %u ranges, %u bytes to transfer, %u bytes skipped.\n",
+        plan_count, nbytes, nskipped);
+    fprintf(out, "# Download: %u read commands of %u bytes.\n", nreads, SERIAL_READ_SIZE);
+    fprintf(out, "# Upload: %u write commands of %u bytes.\n", nwrites, SERIAL_WRITE_SIZE);
 }
 
 //
@@ -838,31 +1057,13 @@ static void print_rx_freq(FILE *out, unsigned data)
     }
 }
 
-//
-// Convert a 4-byte frequency value from binary coded decimal
-// to integer format (in Hertz).
-//
-static int bcd_to_hz(unsigned bcd)
-{
-    int a = (bcd >> 4)  & 15;
-    int b =  bcd        & 15;
-    int c = (bcd >> 12) & 15;
-    int d = (bcd >> 8)  & 15;
-    int e = (bcd >> 20) & 15;
-    int f = (bcd >> 16) & 15;
-    int g = (bcd >> 28) & 15;
-    int h = (bcd >> 24) & 15;
-
-    return (((((((a*10 + b) * 10 + c) * 10 + d) * 10 + e) * 10 + f) * 10 + g) * 10 + h) * 10;
-}
-
 //
 // Print the transmit offset or frequency.
 // TX value is a delta.
 //
 static void print_tx_offset(FILE *out, unsigned tx_offset_bcd, unsigned mode)
 {
-    int offset;
+    freq_t offset;
 
     switch (mode) {
     default:
@@ -871,13 +1072,13 @@ static void print_tx_offset(FILE *out, unsigned tx_offset_bcd, unsigned mode)
         break;
 
     case RM_TXPOS:              // Positive TX offset
-        offset = bcd_to_hz(tx_offset_bcd);
+        offset = ghefcdab_to_hz(tx_offset_bcd);
         fprintf(out, "+");
         print_mhz(out, offset);
         break;
 
     case RM_TXNEG:              // Negative TX offset
-        offset = bcd_to_hz(tx_offset_bcd);
+        offset = ghefcdab_to_hz(tx_offset_bcd);
         fprintf(out, "-");
         print_mhz(out, offset);
         break;
@@ -1003,7 +1204,7 @@ static void print_digital_channels(FILE *out, radio_device_t *radio, int verbose
 //
 static void print_ctcss(FILE *out, unsigned index, unsigned custom)
 {
-    int      dhz = (index < NCTCSS) ? CTCSS_TONES[index] : custom;
+    int      dhz = (index < NCTCSS) ? ctcss_tone(index) : custom;
     unsigned a   = dhz / 1000;
     unsigned b   = (dhz / 100) % 10;
     unsigned c   = (dhz / 10) % 10;
@@ -1253,18 +1454,20 @@ static void anytone_ht_print_config(radio_device_t *radio, FILE *out, int verbos
 {
     int i;
 
-    fprintf(out, "Radio: %s\n", radio->name);
-    if (verbose)
-        anytone_ht_print_version(radio, out);
+    if (radio_table_selected(TABLE_VERSION)) {
+        fprintf(out, "Radio: %s\n", radio->name);
+        if (verbose)
+            anytone_ht_print_version(radio, out);
+    }
 
     //
     // Channels.
     //
-    if (have_channels(MODE_DIGITAL)) {
+    if (radio_table_selected(TABLE_CHANNELS) && have_channels(MODE_DIGITAL)) {
         fprintf(out, "\n");
         print_digital_channels(out, radio, verbose);
     }
-    if (have_channels(MODE_ANALOG)) {
+    if (radio_table_selected(TABLE_CHANNELS) && have_channels(MODE_ANALOG)) {
         fprintf(out, "\n");
         print_analog_channels(out, radio, verbose);
     }
@@ -1272,7 +1475,7 @@ static void anytone_ht_print_config(radio_device_t *radio, FILE *out, int verbos
     //
     // Zones.
     //
-    if (have_zones()) {
+    if (radio_table_selected(TABLE_ZONES) && have_zones()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of channel zones.\n");
@@ -1306,7 +1509,7 @@ static void anytone_ht_print_config(radio_device_t *radio, FILE *out, int verbos
     //
     // Scan lists.
     //
-    if (have_scanlists()) {
+    if (radio_table_selected(TABLE_SCANLISTS) && have_scanlists()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of scan lists.\n");
@@ -1372,7 +1575,7 @@ static void anytone_ht_print_config(radio_device_t *radio, FILE *out, int verbos
     //
     // Contacts.
     //
-    if (have_contacts()) {
+    if (radio_table_selected(TABLE_CONTACTS) && have_contacts()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of contacts.\n");
@@ -1410,7 +1613,7 @@ static void anytone_ht_print_config(radio_device_t *radio, FILE *out, int verbos
     //
     // Group lists.
     //
-    if (have_grouplists()) {
+    if (radio_table_selected(TABLE_GROUPLISTS) && have_grouplists()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of group lists.\n");
@@ -1439,7 +1642,7 @@ static void anytone_ht_print_config(radio_device_t *radio, FILE *out, int verbos
     //
     // Text messages.
     //
-    if (have_messages()) {
+    if (radio_table_selected(TABLE_MESSAGES) && have_messages()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of text messages.\n");
@@ -1463,9 +1666,11 @@ static void anytone_ht_print_config(radio_device_t *radio, FILE *out, int verbos
     }
 
     // General settings.
-    print_id(out, verbose);
-    print_intro(out, verbose);
-    print_working_mode(out, verbose);
+    if (radio_table_selected(TABLE_SETTINGS)) {
+        print_id(out, verbose);
+        print_intro(out, verbose);
+        print_working_mode(out, verbose);
+    }
 }
 
 //
@@ -1507,7 +1712,9 @@ static void anytone_ht_save_image(radio_device_t *radio, FILE *img)
 //
 static void anytone_ht_parse_parameter(radio_device_t *radio, char *param, char *value)
 {
-    if (strcasecmp("Radio", param) == 0) {
+    int kw = keyword_lookup(&parameter_table, param);
+
+    if (kw == PARAM_RADIO) {
         if (!radio_is_compatible(value)) {
             fprintf(stderr, "Incompatible model: %s\n", value);
             exit(-1);
@@ -1516,38 +1723,39 @@ static void anytone_ht_parse_parameter(radio_device_t *radio, char *param, char
     }
 
     radioid_t *ri = GET_RADIOID();
-    if (strcasecmp ("Name", param) == 0) {
+    if (kw == PARAM_NAME) {
         ascii_decode(ri->name, value, 16, 0);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("ID", param) == 0) {
+    if (kw == PARAM_ID) {
         uint32_t id = strtoul(value, 0, 0);
-        ri->id[0] = ((id / 10000000) << 4) | ((id / 1000000) % 10);
-        ri->id[1] = ((id / 100000 % 10) << 4) | ((id / 10000) % 10);
-        ri->id[2] = ((id / 1000 % 10) << 4) | ((id / 100) % 10);
-        ri->id[3] = ((id / 10 % 10) << 4) | (id % 10);
+        bcd_put(ri->id, 4, id);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
 
     general_settings_t *gs = GET_SETTINGS();
-    if (strcasecmp ("Intro Line 1", param) == 0) {
+    if (kw == PARAM_INTRO1) {
         ascii_decode_uppercase(gs->intro_line1, value, 14, 0);
         gs->power_on = PWON_CUST_CHAR;
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("Intro Line 2", param) == 0) {
+    if (kw == PARAM_INTRO2) {
         ascii_decode_uppercase(gs->intro_line2, value, 14, 0);
         gs->power_on = PWON_CUST_CHAR;
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("Working Mode", param) == 0) {
-        if (strcasecmp ("Professional", value) == 0) {
-            gs->working_mode = WMODE_PRO;
-        } else if (strcasecmp ("Amateur", value) == 0) {
-            gs->working_mode = WMODE_AMATEUR;
-        } else {
+    if (kw == PARAM_MODE) {
+        int mode = keyword_lookup(&mode_table, value);
+        if (mode < 0) {
             fprintf(stderr, "Ignoring unknown working mode %s\n", value);
+        } else {
+            gs->working_mode = mode;
         }
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
     fprintf(stderr, "Unknown parameter: %s = %s\n", param, value);
@@ -1557,8 +1765,10 @@ static void anytone_ht_parse_parameter(radio_device_t *radio, char *param, char
 //
 // Check that the radio does support this frequency.
 //
-static int is_valid_frequency(int mhz)
+static int is_valid_frequency(freq_t hz)
 {
+    int mhz = hz / 1000000;
+
     if (mhz >= 136 && mhz <= 174)
         return 1;
     if (mhz >= 400 && mhz <= 480)
@@ -1566,25 +1776,11 @@ static int is_valid_frequency(int mhz)
     return 0;
 }
 
-//
-// Find CTCSS value in standard table.
-// Otherwise return NCTCSS.
-//
-static int ctcss_index(unsigned value)
-{
-    int i;
-
-    for (i=0; i<NCTCSS; i++)
-        if (value == CTCSS_TONES[i])
-            break;
-    return i;
-}
-
 //
 // Set the parameters for a given memory channel.
 //
 static void setup_channel(radio_device_t *radio, int i, int mode, char *name,
-    double rx_mhz, double tx_mhz, int power, int scanlist, int rxonly,
+    freq_t rx_hz, freq_t tx_hz, int power, int scanlist, int rxonly,
     int admit, int colorcode, int timeslot, int grouplist, int contact,
     int rxtone, int txtone, int width)
 {
@@ -1596,13 +1792,13 @@ static void setup_channel(radio_device_t *radio, int i, int mode, char *name,
     memset(ch, 0, sizeof(channel_t));
     ascii_decode(ch->name, name, 16, 0);
 
-    ch->rx_frequency = mhz_to_ghefcdab(rx_mhz);
-    if (tx_mhz > rx_mhz) {
+    ch->rx_frequency = hz_to_ghefcdab(rx_hz);
+    if (tx_hz > rx_hz) {
         ch->repeater_mode   = RM_TXPOS;
-        ch->tx_offset       = mhz_to_ghefcdab(tx_mhz - rx_mhz);
-    } else if (tx_mhz < rx_mhz) {
+        ch->tx_offset       = hz_to_ghefcdab(tx_hz - rx_hz);
+    } else if (tx_hz < rx_hz) {
         ch->repeater_mode   = RM_TXNEG;
-        ch->tx_offset       = mhz_to_ghefcdab(rx_mhz - tx_mhz);
+        ch->tx_offset       = hz_to_ghefcdab(rx_hz - tx_hz);
     } else {
         ch->repeater_mode   = RM_SIMPLEX;
         ch->tx_offset       = 0x00000100;
@@ -1634,8 +1830,9 @@ static void setup_channel(radio_device_t *radio, int i, int mode, char *name,
         ch->dcs_receive = rxtone - 1;
     } else if (rxtone < 0) {            // Receive CTCSS
         ch->rx_ctcss = 1;
-        ch->ctcss_receive = ctcss_index(-rxtone);
-        if (ch->ctcss_receive == NCTCSS) {
+        int index = ctcss_index(-rxtone);
+        ch->ctcss_receive = (index < 0) ? NCTCSS : index;
+        if (index < 0) {
             ch->custom_ctcss = -rxtone;
         }
     }
@@ -1651,8 +1848,9 @@ static void setup_channel(radio_device_t *radio, int i, int mode, char *name,
         ch->dcs_transmit = txtone - 1;
     } else if (txtone < 0) {            // Transmit CTCSS
         ch->tx_ctcss = 1;
-        ch->ctcss_transmit = ctcss_index(-txtone);
-        if (ch->ctcss_transmit == NCTCSS) {
+        int index = ctcss_index(-txtone);
+        ch->ctcss_transmit = (index < 0) ? NCTCSS : index;
+        if (index < 0) {
             ch->custom_ctcss = -txtone;
         }
     }
@@ -1699,22 +1897,30 @@ static void erase_scanlists()
 // Start_flag is 1 for the first table row.
 // Return 0 on failure.
 //
-static int parse_digital_channel(radio_device_t *radio, int first_row, char *line)
+static int parse_digital_channel(radio_device_t *radio, int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], rxfreq_str[256], offset_str[256];
-    char power_str[256], scanlist_str[256];
-    char tot_str[256], rxonly_str[256], admit_str[256], colorcode_str[256];
-    char slot_str[256], grouplist_str[256], contact_str[256];
+    char *num_str, *name_str, *rxfreq_str, *offset_str;
+    char *power_str, *scanlist_str;
+    char *rxonly_str, *admit_str, *colorcode_str;
+    char *slot_str, *grouplist_str, *contact_str;
     int num, power, scanlist, rxonly, admit;
     int colorcode, timeslot, grouplist, contact;
-    double rx_mhz, tx_mhz;
+    freq_t rx_hz, tx_hz;
 
-    if (sscanf(line, "%s %s %s %s %s %s %s %s %s %s %s %s %s",
-        num_str, name_str, rxfreq_str, offset_str,
-        power_str, scanlist_str,
-        tot_str, rxonly_str, admit_str, colorcode_str,
-        slot_str, grouplist_str, contact_str) != 13)
+    if (ntok < 13)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    rxfreq_str = tok[2].str;
+    offset_str = tok[3].str;
+    power_str = tok[4].str;
+    scanlist_str = tok[5].str;
+    rxonly_str = tok[7].str;
+    admit_str = tok[8].str;
+    colorcode_str = tok[9].str;
+    slot_str = tok[10].str;
+    grouplist_str = tok[11].str;
+    contact_str = tok[12].str;
 
     num = atoi(num_str);
     if (num < 1 || num > NCHAN) {
@@ -1722,29 +1928,22 @@ static int parse_digital_channel(radio_device_t *radio, int first_row, char *lin
         return 0;
     }
 
-    if (sscanf(rxfreq_str, "%lf", &rx_mhz) != 1 ||
-        !is_valid_frequency(rx_mhz)) {
+    if (!parse_freq(rxfreq_str, &rx_hz) ||
+        !is_valid_frequency(rx_hz)) {
         fprintf(stderr, "Bad receive frequency.\n");
         return 0;
     }
-    if (sscanf(offset_str, "%lf", &tx_mhz) != 1) {
+    if (!parse_freq(offset_str, &tx_hz)) {
 badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
     if (offset_str[0] == '-' || offset_str[0] == '+')
-        tx_mhz += rx_mhz;
-    if (! is_valid_frequency(tx_mhz))
+        tx_hz += rx_hz;
+    if (! is_valid_frequency(tx_hz))
         goto badtx;
 
-    if (strcasecmp("High", power_str) == 0) {
-        power = POWER_HIGH;
-    } else if (strcasecmp("Low", power_str) == 0) {
-        power = POWER_LOW;
-    } else if (strcasecmp("Mid", power_str) == 0) {
-        power = POWER_MIDDLE;
-    } else if (strcasecmp("Turbo", power_str) == 0) {
-        power = POWER_TURBO;
-    } else {
+    power = keyword_lookup(&power_table, power_str);
+    if (power < 0) {
         fprintf(stderr, "Bad power level.\n");
         return 0;
     }
@@ -1770,15 +1969,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (*admit_str == '-' || strcasecmp("Always", admit_str) == 0) {
+    if (*admit_str == '-') {
         admit = PERMIT_ALWAYS;
-    } else if (strcasecmp("Free", admit_str) == 0) {
-        admit = PERMIT_CH_FREE;
-    } else if (strcasecmp("Color", admit_str) == 0) {
-        admit = PERMIT_CC_SAME;
-    } else if (strcasecmp("NColor", admit_str) == 0) {
-        admit = PERMIT_CC_DIFF;
-    } else {
+    } else if ((admit = keyword_lookup(&digital_admit_table, admit_str)) < 0) {
         fprintf(stderr, "Bad admit criteria.\n");
         return 0;
     }
@@ -1820,9 +2013,10 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         erase_channels();
         erase_zones();
         erase_scanlists();
+        radio_touched |= TABLE_CHANNELS | TABLE_ZONES | TABLE_SCANLISTS;
     }
 
-    setup_channel(radio, num-1, MODE_DIGITAL, name_str, rx_mhz, tx_mhz,
+    setup_channel(radio, num-1, MODE_DIGITAL, name_str, rx_hz, tx_hz,
         power, scanlist, rxonly, admit, colorcode, timeslot,
         grouplist, contact, 0, 0, BW_12_5_KHZ);
 
@@ -1868,12 +2062,9 @@ static int encode_ctcss_dcs(char *str)
         //
         // CTCSS tone
         //
-        float hz;
-        if (sscanf(str, "%f", &hz) != 1)
+        val = parse_ctcss(str);
+        if (val < 0)
             return -1;
-
-        // Round to integer.
-        val = hz * 10.0 + 0.5;
         val = -val;
     } else {
         return -1;
@@ -1887,22 +2078,29 @@ static int encode_ctcss_dcs(char *str)
 // Start_flag is 1 for the first table row.
 // Return 0 on failure.
 //
-static int parse_analog_channel(radio_device_t *radio, int first_row, char *line)
+static int parse_analog_channel(radio_device_t *radio, int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], rxfreq_str[256], offset_str[256];
-    char power_str[256], scanlist_str[256], squelch_str[256];
-    char tot_str[256], rxonly_str[256], admit_str[256];
-    char rxtone_str[256], txtone_str[256], width_str[256];
+    char *num_str, *name_str, *rxfreq_str, *offset_str;
+    char *power_str, *scanlist_str;
+    char *rxonly_str, *admit_str;
+    char *rxtone_str, *txtone_str, *width_str;
     int num, power, scanlist, rxonly, admit;
     int rxtone, txtone, width;
-    double rx_mhz, tx_mhz;
+    freq_t rx_hz, tx_hz;
 
-    if (sscanf(line, "%s %s %s %s %s %s %s %s %s %s %s %s %s",
-        num_str, name_str, rxfreq_str, offset_str,
-        power_str, scanlist_str,
-        tot_str, rxonly_str, admit_str, squelch_str,
-        rxtone_str, txtone_str, width_str) != 13)
+    if (ntok < 13)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    rxfreq_str = tok[2].str;
+    offset_str = tok[3].str;
+    power_str = tok[4].str;
+    scanlist_str = tok[5].str;
+    rxonly_str = tok[7].str;
+    admit_str = tok[8].str;
+    rxtone_str = tok[10].str;
+    txtone_str = tok[11].str;
+    width_str = tok[12].str;
 
     num = atoi(num_str);
     if (num < 1 || num > NCHAN) {
@@ -1910,29 +2108,22 @@ static int parse_analog_channel(radio_device_t *radio, int first_row, char *line
         return 0;
     }
 
-    if (sscanf(rxfreq_str, "%lf", &rx_mhz) != 1 ||
-        !is_valid_frequency(rx_mhz)) {
+    if (!parse_freq(rxfreq_str, &rx_hz) ||
+        !is_valid_frequency(rx_hz)) {
         fprintf(stderr, "Bad receive frequency.\n");
         return 0;
     }
-    if (sscanf(offset_str, "%lf", &tx_mhz) != 1) {
+    if (!parse_freq(offset_str, &tx_hz)) {
 badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
     if (offset_str[0] == '-' || offset_str[0] == '+')
-        tx_mhz += rx_mhz;
-    if (! is_valid_frequency(tx_mhz))
+        tx_hz += rx_hz;
+    if (! is_valid_frequency(tx_hz))
         goto badtx;
 
-    if (strcasecmp("High", power_str) == 0) {
-        power = POWER_HIGH;
-    } else if (strcasecmp("Low", power_str) == 0) {
-        power = POWER_LOW;
-    } else if (strcasecmp("Mid", power_str) == 0) {
-        power = POWER_MIDDLE;
-    } else if (strcasecmp("Turbo", power_str) == 0) {
-        power = POWER_TURBO;
-    } else {
+    power = keyword_lookup(&power_table, power_str);
+    if (power < 0) {
         fprintf(stderr, "Bad power level.\n");
         return 0;
     }
@@ -1958,13 +2149,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (*admit_str == '-' || strcasecmp("Always", admit_str) == 0) {
+    if (*admit_str == '-') {
         admit = PERMIT_ALWAYS;
-    } else if (strcasecmp("Free", admit_str) == 0) {    // Busy Lock = Repeater
-        admit = PERMIT_CH_FREE;
-    } else if (strcasecmp("Tone", admit_str) == 0) {    // Busy Lock = Busy
-        admit = PERMIT_CC_SAME;
-    } else {
+    } else if ((admit = keyword_lookup(&analog_admit_table, admit_str)) < 0) {
         fprintf(stderr, "Bad admit criteria.\n");
         return 0;
     }
@@ -1982,21 +2169,19 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (strcasecmp ("12.5", width_str) == 0) {
-        width = BW_12_5_KHZ;
-    } else if (strcasecmp ("25", width_str) == 0) {
-        width = BW_25_KHZ;
-    } else {
-        fprintf (stderr, "Bad width.\n");
+    width = keyword_lookup(&width_table, width_str);
+    if (width < 0) {
+        fprintf(stderr, "Bad width.\n");
         return 0;
     }
 
     if (first_row && radio->channel_count == 0) {
         // On first entry, erase all channels, zones and scanlists.
         erase_channels();
+        radio_touched |= TABLE_CHANNELS;
     }
 
-    setup_channel(radio, num-1, MODE_ANALOG, name_str, rx_mhz, tx_mhz,
+    setup_channel(radio, num-1, MODE_ANALOG, name_str, rx_hz, tx_hz,
         power, scanlist, rxonly, admit, 0, 1,
         0, 0, rxtone, txtone, width);
 
@@ -2050,13 +2235,16 @@ static int zone_append(int index, int cnum)
 // Parse one line of Zones table.
 // Return 0 on failure.
 //
-static int parse_zones(int first_row, char *line)
+static int parse_zones(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], chan_str[256];
+    char *num_str, *name_str, *chan_str;
     int znum;
 
-    if (sscanf(line, "%s %s %s", num_str, name_str, chan_str) != 3)
+    if (ntok < 3)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    chan_str = tok[2].str;
 
     znum = strtoul(num_str, 0, 10);
     if (znum < 1 || znum > NZONES) {
@@ -2067,6 +2255,7 @@ static int parse_zones(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Zones table.
         erase_zones();
+        radio_touched |= TABLE_ZONES;
     }
 
     setup_zone(znum-1, name_str);
@@ -2184,15 +2373,20 @@ static int scanlist_append(int index, int cnum)
 // Parse one line of Scanlist table.
 // Return 0 on failure.
 //
-static int parse_scanlist(int first_row, char *line)
+static int parse_scanlist(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], prio1_str[256], prio2_str[256];
-    char tx_str[256], chan_str[256];
+    char *num_str, *name_str, *prio1_str, *prio2_str;
+    char *tx_str, *chan_str;
     int snum, prio1, prio2, txchan;
 
-    if (sscanf(line, "%s %s %s %s %s %s",
-        num_str, name_str, prio1_str, prio2_str, tx_str, chan_str) != 6)
+    if (ntok < 6)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    prio1_str = tok[2].str;
+    prio2_str = tok[3].str;
+    tx_str = tok[4].str;
+    chan_str = tok[5].str;
 
     snum = atoi(num_str);
     if (snum < 1 || snum > NSCANL) {
@@ -2203,6 +2397,7 @@ static int parse_scanlist(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Scanlists table.
         erase_scanlists();
+        radio_touched |= TABLE_SCANLISTS;
     }
 
     if (*prio1_str == '-') {
@@ -2308,10 +2503,7 @@ static void setup_contact(int index, const char *name, int type, int id, int rxa
     memset(ct, 0, 100);
     ascii_decode(ct->name, name, 16, 0);
 
-    ct->id[0] = ((id / 10000000) << 4) | ((id / 1000000) % 10);
-    ct->id[1] = ((id / 100000 % 10) << 4) | ((id / 10000) % 10);
-    ct->id[2] = ((id / 1000 % 10) << 4) | ((id / 100) % 10);
-    ct->id[3] = ((id / 10 % 10) << 4) | (id % 10);
+    bcd_put(ct->id, 4, id);
 
     ct->type       = type;
     ct->call_alert = rxalert;
@@ -2348,14 +2540,18 @@ static void setup_contact(int index, const char *name, int type, int id, int rxa
 // Parse one line of Contacts table.
 // Return 0 on failure.
 //
-static int parse_contact(int first_row, char *line)
+static int parse_contact(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], type_str[256], id_str[256], rxalert_str[256];
+    char *num_str, *name_str, *type_str, *id_str, *rxalert_str;
     int cnum, type, id, rxalert;
 
-    if (sscanf(line, "%s %s %s %s %s",
-        num_str, name_str, type_str, id_str, rxalert_str) != 5)
+    if (ntok < 5)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    type_str = tok[2].str;
+    id_str = tok[3].str;
+    rxalert_str = tok[4].str;
 
     cnum = atoi(num_str);
     if (cnum < 1 || cnum > NCONTACTS) {
@@ -2366,15 +2562,11 @@ static int parse_contact(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Contacts table.
         erase_contacts();
+        radio_touched |= TABLE_CONTACTS;
     }
 
-    if (strcasecmp("Group", type_str) == 0) {
-        type = CALL_GROUP;
-    } else if (strcasecmp("Private", type_str) == 0) {
-        type = CALL_PRIVATE;
-    } else if (strcasecmp("All", type_str) == 0) {
-        type = CALL_ALL;
-    } else {
+    type = keyword_lookup(&call_type_table, type_str);
+    if (type < 0) {
         fprintf(stderr, "Bad call type.\n");
         return 0;
     }
@@ -2385,13 +2577,11 @@ static int parse_contact(int first_row, char *line)
         return 0;
     }
 
-    if (*rxalert_str == '-' || strcasecmp("No", rxalert_str) == 0) {
+    if (*rxalert_str == '-') {
         rxalert = ALERT_NONE;
-    } else if (*rxalert_str == '+' || strcasecmp("Yes", rxalert_str) == 0) {
+    } else if (*rxalert_str == '+') {
         rxalert = ALERT_RING;
-    } else if (strcasecmp("Online", rxalert_str) == 0) {
-        rxalert = ALERT_ONLINE;
-    } else {
+    } else if ((rxalert = keyword_lookup(&alert_table, rxalert_str)) < 0) {
         fprintf(stderr, "Bad receive tone flag.\n");
         return 0;
     }
@@ -2432,13 +2622,16 @@ static int grouplist_append(int index, int cnum)
 // Parse one line of Grouplist table.
 // Return 0 on failure.
 //
-static int parse_grouplist(int first_row, char *line)
+static int parse_grouplist(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], list_str[256];
+    char *num_str, *name_str, *list_str;
     int glnum;
 
-    if (sscanf(line, "%s %s %s", num_str, name_str, list_str) != 3)
+    if (ntok < 3)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    list_str = tok[2].str;
 
     glnum = strtoul(num_str, 0, 10);
     if (glnum < 1 || glnum > NGLISTS) {
@@ -2449,6 +2642,7 @@ static int parse_grouplist(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Grouplists table.
         memset(&radio_mem[OFFSET_GLISTS], 0xff, NGLISTS*320);
+        radio_touched |= TABLE_GROUPLISTS;
     }
 
     setup_grouplist(glnum-1, name_str);
@@ -2521,9 +2715,9 @@ static void setup_message(int index, const char *text)
 // Parse one line of Messages table.
 // Return 0 on failure.
 //
-static int parse_messages(int first_row, char *line)
+static int parse_messages(int first_row, token_t *tok, int ntok)
 {
-    char *text;
+    char *text, *line = token_rest(tok, ntok, 0);
     int mnum;
 
     mnum = strtoul(line, &text, 10);
@@ -2535,6 +2729,7 @@ static int parse_messages(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Messages table.
         memset(&radio_mem[OFFSET_MESSAGES], 0xff, NMESSAGES*256);
+        radio_touched |= TABLE_MESSAGES;
     }
 
     setup_message(mnum-1, text);
@@ -2547,37 +2742,27 @@ static int parse_messages(int first_row, char *line)
 //
 static int anytone_ht_parse_header(radio_device_t *radio, char *line)
 {
-    if (strncasecmp(line, "Digital", 7) == 0)
-        return 'D';
-    if (strncasecmp(line, "Analog", 6) == 0)
-        return 'A';
-    if (strncasecmp(line, "Zone", 4) == 0)
-        return 'Z';
-    if (strncasecmp(line, "Scanlist", 8) == 0)
-        return 'S';
-    if (strncasecmp(line, "Contact", 7) == 0)
-        return 'C';
-    if (strncasecmp(line, "Grouplist", 9) == 0)
-        return 'G';
-    if (strncasecmp(line, "Message", 7) == 0)
-        return 'M';
-    return 0;
+    int table_id = keyword_prefix(&header_table, line);
+
+    if (table_id < 0)
+        return 0;
+    return table_id;
 }
 
 //
 // Parse one line of table data.
 // Return 0 on failure.
 //
-static int anytone_ht_parse_row(radio_device_t *radio, int table_id, int first_row, char *line)
+static int anytone_ht_parse_row(radio_device_t *radio, int table_id, int first_row, token_t *tok, int ntok)
 {
     switch (table_id) {
-    case 'D': return parse_digital_channel(radio, first_row, line);
-    case 'A': return parse_analog_channel(radio, first_row, line);
-    case 'Z': return parse_zones(first_row, line);
-    case 'S': return parse_scanlist(first_row, line);
-    case 'C': return parse_contact(first_row, line);
-    case 'G': return parse_grouplist(first_row, line);
-    case 'M': return parse_messages(first_row, line);
+    case 'D': return parse_digital_channel(radio, first_row, tok, ntok);
+    case 'A': return parse_analog_channel(radio, first_row, tok, ntok);
+    case 'Z': return parse_zones(first_row, tok, ntok);
+    case 'S': return parse_scanlist(first_row, tok, ntok);
+    case 'C': return parse_contact(first_row, tok, ntok);
+    case 'G': return parse_grouplist(first_row, tok, ntok);
+    case 'M': return parse_messages(first_row, tok, ntok);
     }
     return 0;
 }
@@ -2908,22 +3093,14 @@ static void anytone_ht_write_csv(radio_device_t *radio, FILE *csv)
         }
         callsign_map_t *m = &map[sz.count];
         sz.count++;
-        m->id = ((id / 10     % 10) << 5)  |  (id            % 10) << 1 |
-                ((id / 1000   % 10) << 13) | ((id / 100)     % 10) << 9 |
-                ((id / 100000 % 10) << 21) | ((id / 10000)   % 10) << 17 |
-                ((id / 10000000)    << 29) | ((id / 1000000) % 10) << 25;
+        m->id = id;                     // Converted to BCD below
         m->offset = nbytes;
 
         // Fill data.
         char *p = &data[nbytes];
 
-        // Radio ID.
-        *p++ = 0;
-        *p++ = ((id / 10000000) << 4) | ((id / 1000000) % 10);
-        *p++ = ((id / 100000 % 10) << 4) | ((id / 10000) % 10);
-        *p++ = ((id / 1000 % 10) << 4) | ((id / 100) % 10);
-        *p++ = ((id / 10 % 10) << 4) | (id % 10);
-        *p++ = 0;
+        // Radio ID: filled in below.
+        p += 6;
 
         // Name, city, callsign, state, country, remarks.
         strcpy(p, name);     p += strlen(p) + 1;
@@ -2937,6 +3114,33 @@ static void anytone_ht_write_csv(radio_device_t *radio, FILE *csv)
     }
     fprintf(stderr, "Total %d contacts, %d bytes.\n", sz.count, nbytes);
 
+    //
+    // Convert all IDs to BCD in one pass.
+    // Map has the ID as BCD shifted left by one bit,
+    // data record has the ID as big endian BCD at offset 1.
+    //
+    unsigned *bcd = malloc(sz.count * sizeof(unsigned) + 1);
+    unsigned k;
+
+    if (!bcd) {
+        fprintf(stderr, "Out of memory!\n");
+        free(data);
+        return;
+    }
+    for (k=0; k<sz.count; k++)
+        bcd[k] = map[k].id;
+    bin_to_bcd32_array(bcd, bcd, sz.count);
+    for (k=0; k<sz.count; k++) {
+        uint8_t *rec = (uint8_t*) &data[map[k].offset];
+
+        map[k].id = bcd[k] << 1;
+        rec[1] = bcd[k] >> 24;
+        rec[2] = bcd[k] >> 16;
+        rec[3] = bcd[k] >> 8;
+        rec[4] = bcd[k];
+    }
+    free(bcd);
+
     sz.last = ADDR_CALLDB_DATA + (nbytes / 100000) * 256*1024 + (nbytes % 100000);
 
     // Append extra zeroes and align.
@@ -3033,6 +3237,9 @@ radio_device_t radio_d868uv = {
     anytone_ht_parse_row,
     anytone_ht_update_timestamp,
     anytone_ht_write_csv,
+    anytone_ht_print_plan,
+    anytone_ht_tables,
+    MEMSZ,
 };
 
 //
@@ -3053,6 +3260,9 @@ radio_device_t radio_d878uv = {
     anytone_ht_parse_row,
     anytone_ht_update_timestamp,
     anytone_ht_write_csv,
+    anytone_ht_print_plan,
+    anytone_ht_tables,
+    MEMSZ,
 };
 
 //
@@ -3073,6 +3283,9 @@ radio_device_t radio_d878uv2 = {
     anytone_ht_parse_row,
     anytone_ht_update_timestamp,
     anytone_ht_write_csv,
+    anytone_ht_print_plan,
+    anytone_ht_tables,
+    MEMSZ,
 };
 
 //
@@ -3093,4 +3306,7 @@ radio_device_t radio_dmr6x2 = {
     anytone_ht_parse_row,
     anytone_ht_update_timestamp,
     anytone_ht_write_csv,
+    anytone_ht_print_plan,
+    anytone_ht_tables,
+    MEMSZ,
 };
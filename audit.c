@@ -0,0 +1,353 @@
+/*
+ * Audit of attached radios against golden codeplug images.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "radio.h"
+#include "util.h"
+
+//
+// Every radio is audited by a worker process, which reads
+// the timestamp, then only the tables, and compares fingerprints
+// of tables with the golden image of the same model.
+// Whole memory is read only when some table differs,
+// and saved to image file 'audit-PORT.img' for inspection.
+// Radio routines exit on error, so every radio is isolated
+// in its own process.
+//
+#define MAXTABLES   8
+
+enum {
+    AUDIT_PASS,
+    AUDIT_FAIL,
+    AUDIT_ERROR,
+};
+
+typedef struct {
+    char        *filename;      // Image file
+    char        name[64];       // Model of the radio
+    char        fingerprint[MAXTABLES][20];
+} golden_t;
+
+typedef struct {
+    int         done;           // Result is ready
+    int         status;         // Result: AUDIT_*
+    unsigned long long usec;    // Time of audit
+    char        name[64];       // Model of the radio
+    char        timestamp[32];  // Last programmed date
+    unsigned    compared;       // Tables compared
+    unsigned    differ;         // Tables which differ
+    char        message[200];   // Last line of error output
+} audit_result_t;
+
+static const char *RESULT_NAME[] = { "PASS", "FAIL", "ERROR" };
+
+static golden_t *golden;
+static int ngolden;
+static char **port;             // Serial ports, or a single NULL for any radio
+static int nports;
+static audit_result_t *result;  // Shared with workers
+static int auditing = -1;       // Radio audited by this worker
+static unsigned long long audit_start; // Start time of the worker
+static FILE *audit_log;         // Error output of the worker
+
+//
+// Name of image file for the radio: audit-PORT.img.
+//
+static void image_name(int r, char *buf, int maxlen)
+{
+    const char *name = port[r] ? port[r] : "radio";
+    const char *p = strrchr(name, '/');
+    char *q;
+
+    if (p)
+        name = p + 1;
+    snprintf(buf, maxlen, "audit-%s.img", name);
+    for (q = buf; *q; q++) {
+        if (*q == ':' || *q == '\\')
+            *q = '_';
+    }
+}
+
+#if !defined(__WIN32__) && !defined(WIN32)
+//
+// Get the last programmed date from the version info.
+// Radios without timestamp get "-".
+//
+static void read_timestamp(char *buf, int maxlen)
+{
+    static const char label[] = "Last Programmed Date:";
+    char *text, *p;
+    size_t size;
+    FILE *out;
+
+    strcpy(buf, "-");
+    out = open_memstream(&text, &size);
+    if (! out) {
+        perror("open_memstream");
+        exit(-1);
+    }
+    radio_print_version(out);
+    fclose(out);
+
+    p = strstr(text, label);
+    if (p) {
+        p += sizeof(label) - 1;
+        while (*p == ' ')
+            p++;
+        snprintf(buf, maxlen, "%.*s", (int)strcspn(p, "\r\n"), p);
+    }
+    free(text);
+}
+
+//
+// When the radio cannot be read, the worker exits:
+// fail the audit with the last error message.
+//
+static void audit_atexit()
+{
+    audit_result_t *r;
+
+    if (auditing < 0)
+        return;
+
+    r = &result[auditing];
+    r->status = AUDIT_ERROR;
+    r->usec = stats_usec() - audit_start;
+    pool_last_line(audit_log, r->message, sizeof(r->message));
+    r->done = 1;
+}
+
+//
+// Worker: audit one radio.
+//
+static void run_audit(int n, FILE *log)
+{
+    audit_result_t *r = &result[n];
+    unsigned selected = radio_tables, mask;
+    int g, i, whole;
+    char hex[20], filename[256];
+    const char *name;
+
+    audit_log = log;
+    auditing = n;
+    audit_start = stats_usec();
+    atexit(audit_atexit);
+
+    serial_port = port[n];
+    radio_connect();
+    snprintf(r->name, sizeof(r->name), "%s", radio_name());
+
+    // Read the timestamp first.
+    whole = ! radio_has_tables();
+    radio_tables = whole ? 0 : TABLE_VERSION;
+    radio_download();
+    read_timestamp(r->timestamp, sizeof(r->timestamp));
+
+    for (g=0; g<ngolden; g++) {
+        if (strcasecmp(golden[g].name, r->name) == 0)
+            break;
+    }
+    if (g >= ngolden) {
+        radio_disconnect();
+        fprintf(stderr, "No golden image for %s.\n", r->name);
+        exit(-1);
+    }
+
+    // Read only the tables, and compare fingerprints.
+    radio_tables = selected;
+    if (! whole)
+        radio_download_tables();
+    for (i=0; (name = radio_table_name(i, &mask)); i++) {
+        if (! radio_table_selected(mask))
+            continue;
+        radio_fingerprint(mask, hex);
+        r->compared |= mask;
+        if (strcmp(hex, golden[g].fingerprint[i]) != 0)
+            r->differ |= mask;
+    }
+
+    if (r->differ) {
+        // Read whole memory, and save for inspection.
+        if (! whole) {
+            radio_tables = 0;
+            radio_download();
+            radio_tables = selected;
+        }
+        image_name(n, filename, sizeof(filename));
+        radio_save_image(filename);
+    }
+    radio_disconnect();
+
+    r->status = r->differ ? AUDIT_FAIL : AUDIT_PASS;
+    r->usec = stats_usec() - audit_start;
+    r->done = 1;
+    auditing = -1;
+}
+#endif
+
+//
+// Read golden images, and compute fingerprints of all tables.
+//
+static void read_golden(char **images, int nimages)
+{
+    const char *name;
+    unsigned mask;
+    int g, i;
+
+    golden = calloc(nimages, sizeof(golden_t));
+    if (! golden) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    for (g=0; g<nimages; g++) {
+        golden_t *gp = &golden[ngolden];
+
+        radio_read_image(images[g]);
+        for (i=0; i<ngolden; i++) {
+            if (strcasecmp(golden[i].name, radio_name()) == 0) {
+                fprintf(stderr, "%s: Duplicate golden image for %s.\n",
+                    images[g], radio_name());
+                exit(-1);
+            }
+        }
+        gp->filename = images[g];
+        snprintf(gp->name, sizeof(gp->name), "%s", radio_name());
+        for (i=0; (name = radio_table_name(i, &mask)) && i < MAXTABLES; i++)
+            radio_fingerprint(mask, gp->fingerprint[i]);
+        ngolden++;
+    }
+}
+
+//
+// Get list of radios: serial ports given by --port option,
+// separated by comma, or all attached Anytone radios.
+// When none found, audit a single radio of any kind.
+//
+static void find_radios()
+{
+    char *p;
+
+    if (serial_port) {
+        for (p = strtok(serial_port, ","); p; p = strtok(0, ",")) {
+            port = realloc(port, (nports + 1) * sizeof(char*));
+            if (! port) {
+                fprintf(stderr, "Out of memory.\n");
+                exit(-1);
+            }
+            port[nports++] = p;
+        }
+    } else {
+        nports = serial_find_all(0x28e9, 0x018a, &port);
+    }
+    if (nports == 0) {
+        port = realloc(port, sizeof(char*));
+        if (! port) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+        port[nports++] = 0;
+    }
+}
+
+//
+// Audit all attached radios by given number of workers,
+// comparing them with golden images.
+// Print the matrix of results, table by table, and the summary.
+// Return number of radios which failed.
+//
+int audit_run(char **images, int nimages, int nworkers)
+{
+#if defined(__WIN32__) || defined(WIN32)
+    fprintf(stderr, "Audit is not supported on Windows.\n");
+    exit(-1);
+#else
+    unsigned long long start = stats_usec();
+    int i, n, width, count[3];
+    const char *name;
+    unsigned mask;
+    char filename[256];
+
+    read_golden(images, nimages);
+    find_radios();
+    if (nworkers <= 0 || nworkers > nports)
+        nworkers = nports;
+    fprintf(stderr, "Audit %d radios against %d golden images by %d workers.\n",
+        nports, ngolden, nworkers);
+
+    result = pool_alloc(nports * sizeof(audit_result_t));
+    pool_run(nports, nworkers, run_audit, 0);
+
+    // Print the matrix.
+    width = 5;
+    for (n=0; n<nports; n++) {
+        if (port[n] && (int)strlen(port[n]) > width)
+            width = strlen(port[n]);
+    }
+    printf("%-*s %-20s %-20s", width, "Radio", "Model", "Programmed");
+    for (i=0; (name = radio_table_name(i, &mask)); i++) {
+        if (radio_table_selected(mask))
+            printf(" %s", name);
+    }
+    printf("     Time Result\n");
+
+    memset(count, 0, sizeof(count));
+    for (n=0; n<nports; n++) {
+        audit_result_t *r = &result[n];
+
+        if (! r->done) {
+            r->status = AUDIT_ERROR;
+            strcpy(r->message, "Worker crashed");
+        }
+        count[r->status]++;
+        printf("%-*s %-20s %-20s", width, port[n] ? port[n] : "-",
+            r->name[0] ? r->name : "-", r->timestamp[0] ? r->timestamp : "-");
+        for (i=0; (name = radio_table_name(i, &mask)); i++) {
+            if (! radio_table_selected(mask))
+                continue;
+            printf(" %-*s", (int)strlen(name),
+                ! (r->compared & mask) ? "-" :
+                (r->differ & mask) ? "DIFF" : "ok");
+        }
+        printf(" %4.1f sec %s", r->usec / 1000000.0, RESULT_NAME[r->status]);
+        if (r->status == AUDIT_FAIL) {
+            image_name(n, filename, sizeof(filename));
+            printf(", saved %s", filename);
+        } else if (r->status == AUDIT_ERROR) {
+            printf(": %s", r->message);
+        }
+        printf("\n");
+    }
+    printf("Audit: %d radios, %d passed, %d failed, %d errors, %.3f sec.\n",
+        nports, count[AUDIT_PASS], count[AUDIT_FAIL], count[AUDIT_ERROR],
+        (stats_usec() - start) / 1000000.0);
+    pool_free(result, nports * sizeof(audit_result_t));
+    return count[AUDIT_FAIL] + count[AUDIT_ERROR];
+#endif
+}
@@ -0,0 +1,334 @@
+/*
+ * Batch processing of jobs by a pool of worker processes.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if !defined(__WIN32__) && !defined(WIN32)
+#   include <sys/wait.h>
+#endif
+#include "radio.h"
+#include "util.h"
+
+//
+// Manifest is a text file, one job per line:
+//      apply IMAGE CONF OUTPUT     apply script to image, save to OUTPUT
+//      validate CONF               check the script for any radio
+//      print IMAGE OUTPUT          print configuration of image to OUTPUT
+// Empty lines and lines starting with # are ignored.
+//
+// Jobs which use the same image are grouped into tasks: a worker
+// reads the image once, and runs every job of the task in a child
+// process, which gets the image by copy-on-write. Radio routines
+// exit on error, so every job is isolated in its own process.
+//
+enum {
+    JOB_APPLY,
+    JOB_VALIDATE,
+    JOB_PRINT,
+};
+
+typedef struct {
+    int         kind;           // Kind of job: JOB_*
+    int         line;           // Line number in manifest
+    char        *image;         // Input image, or NULL
+    char        *conf;          // Configuration script, or NULL
+    char        *output;        // Output file, or NULL
+    int         task;           // Index of task
+} job_t;
+
+typedef struct {
+    int         done;           // Result is ready
+    int         status;         // Exit status: 0 on success
+    unsigned long long usec;    // Time of job
+    char        message[200];   // Last line of error output
+} job_result_t;
+
+typedef struct {
+    char        *image;         // Image shared by all jobs, or NULL
+    int         *jobs;          // Indices of jobs
+    int         njobs;
+} task_t;
+
+static const char *KIND_NAME[] = { "apply", "validate", "print" };
+
+static job_t *job;
+static int njobs;
+static task_t *task;
+static int ntasks;
+static job_result_t *result;    // Shared with workers
+static int loading_task = -1;   // Worker is reading image of the task
+static FILE *task_log;          // Error output of the worker
+
+//
+// Parse manifest file.
+//
+static void read_manifest(const char *filename)
+{
+    char line[1024], *word[5];
+    int lineno = 0, nalloc = 0, n;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (! f) {
+        perror(filename);
+        exit(-1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        n = 0;
+        word[0] = strtok(line, " \t\r\n");
+        while (word[n] && n < 4)
+            word[++n] = strtok(0, " \t\r\n");
+        if (n == 0 || word[0][0] == '#')
+            continue;
+
+        if (njobs >= nalloc) {
+            nalloc = nalloc ? nalloc * 2 : 64;
+            job = realloc(job, nalloc * sizeof(job_t));
+            if (! job) {
+                fprintf(stderr, "%s: Out of memory.\n", filename);
+                exit(-1);
+            }
+        }
+        job_t *j = &job[njobs];
+        memset(j, 0, sizeof(*j));
+        j->line = lineno;
+        if (strcmp(word[0], "apply") == 0 && n == 4) {
+            j->kind = JOB_APPLY;
+            j->image = strdup(word[1]);
+            j->conf = strdup(word[2]);
+            j->output = strdup(word[3]);
+        } else if (strcmp(word[0], "validate") == 0 && n == 2) {
+            j->kind = JOB_VALIDATE;
+            j->conf = strdup(word[1]);
+        } else if (strcmp(word[0], "print") == 0 && n == 3) {
+            j->kind = JOB_PRINT;
+            j->image = strdup(word[1]);
+            j->output = strdup(word[2]);
+        } else {
+            fprintf(stderr, "%s:%d: Bad job '%s'.\n", filename, lineno, word[0]);
+            fprintf(stderr, "Jobs are: apply IMAGE CONF OUTPUT, validate CONF, print IMAGE OUTPUT\n");
+            exit(-1);
+        }
+        njobs++;
+    }
+    fclose(f);
+}
+
+//
+// Group jobs into tasks by image, at most chunk jobs per task.
+//
+static void make_tasks(int chunk)
+{
+    int i, t;
+
+    task = calloc(njobs ? njobs : 1, sizeof(task_t));
+    if (! task) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    for (i=0; i<njobs; i++) {
+        // Find a task with the same image, which is not full.
+        for (t=ntasks-1; t>=0; t--) {
+            if (task[t].njobs >= chunk)
+                continue;
+            if (task[t].image ? (job[i].image && strcmp(task[t].image, job[i].image) == 0)
+                              : ! job[i].image)
+                break;
+        }
+        if (t < 0) {
+            t = ntasks++;
+            task[t].image = job[i].image;
+            task[t].jobs = calloc(chunk, sizeof(int));
+            if (! task[t].jobs) {
+                fprintf(stderr, "Out of memory.\n");
+                exit(-1);
+            }
+        }
+        task[t].jobs[task[t].njobs++] = i;
+        job[i].task = t;
+    }
+}
+
+#if !defined(__WIN32__) && !defined(WIN32)
+//
+// Run the job in the worker process.
+// Radio memory is already loaded from the image.
+//
+static void run_job(job_t *j)
+{
+    FILE *out;
+
+    switch (j->kind) {
+    case JOB_APPLY:
+        radio_parse_config(j->conf);
+        radio_verify_config();
+        radio_save_image(j->output);
+        break;
+    case JOB_VALIDATE:
+        radio_validate_config(j->conf);
+        break;
+    case JOB_PRINT:
+        out = fopen(j->output, "w");
+        if (! out) {
+            perror(j->output);
+            exit(-1);
+        }
+        radio_print_config(out, 1);
+        fclose(out);
+        break;
+    }
+}
+
+//
+// When the image of the task cannot be read,
+// the worker exits: fail all jobs of the task.
+//
+static void task_atexit()
+{
+    static char message[200];
+    int i;
+
+    if (loading_task < 0)
+        return;
+
+    task_t *t = &task[loading_task];
+    pool_last_line(task_log, message, sizeof(message));
+    for (i=0; i<t->njobs; i++) {
+        job_result_t *r = &result[t->jobs[i]];
+
+        r->status = -1;
+        strcpy(r->message, message);
+        r->done = 1;
+    }
+}
+
+//
+// Worker: read the image, and run jobs of the task one by one.
+//
+static void run_task(int t, FILE *log)
+{
+    int i, status;
+
+    task_log = log;
+    if (task[t].image) {
+        loading_task = t;
+        atexit(task_atexit);
+        radio_read_image(task[t].image);
+        loading_task = -1;
+    }
+
+    for (i=0; i<task[t].njobs; i++) {
+        int n = task[t].jobs[i];
+        job_result_t *r = &result[n];
+        unsigned long long start = stats_usec();
+        pid_t pid;
+
+        // Start the log anew.
+        if (ftruncate(fileno(task_log), 0) < 0)
+            perror("ftruncate");
+        rewind(task_log);
+        fflush(stdout);
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            _exit(-1);
+        }
+        if (pid == 0) {
+            run_job(&job[n]);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, &status, 0);
+        r->usec = stats_usec() - start;
+        r->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        if (r->status != 0)
+            pool_last_line(task_log, r->message, sizeof(r->message));
+        r->done = 1;
+    }
+}
+#endif
+
+//
+// Run all jobs from the manifest file by given number of workers.
+// Print result of every job, and the summary.
+// Return number of failed jobs.
+//
+int batch_run(const char *filename, int nworkers)
+{
+#if defined(__WIN32__) || defined(WIN32)
+    fprintf(stderr, "Batch mode is not supported on Windows.\n");
+    exit(-1);
+#else
+    unsigned long long start = stats_usec();
+    int i, nfailed;
+
+    if (nworkers <= 0)
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers <= 0)
+        nworkers = 1;
+
+    read_manifest(filename);
+    make_tasks((njobs + nworkers - 1) / nworkers);
+    fprintf(stderr, "Run %d jobs as %d tasks by %d workers.\n", njobs, ntasks, nworkers);
+
+    result = pool_alloc(njobs * sizeof(job_result_t));
+    pool_run(ntasks, nworkers, run_task, 0);
+
+    // Print results.
+    nfailed = 0;
+    for (i=0; i<njobs; i++) {
+        job_t *j = &job[i];
+        job_result_t *r = &result[i];
+
+        if (! r->done) {
+            r->status = -1;
+            strcpy(r->message, "Worker crashed");
+        }
+        if (r->status != 0)
+            nfailed++;
+        printf("%s:%d: %-4s %7.3f sec  %s", filename, j->line,
+            r->status ? "FAIL" : "ok", r->usec / 1000000.0, KIND_NAME[j->kind]);
+        if (j->image)
+            printf(" %s", j->image);
+        if (j->conf)
+            printf(" %s", j->conf);
+        if (j->output)
+            printf(" %s", j->output);
+        if (r->status)
+            printf(": %s", r->message);
+        printf("\n");
+    }
+    printf("Batch: %d jobs, %d ok, %d failed, %d workers, %.3f sec.\n",
+        njobs, njobs - nfailed, nfailed, nworkers,
+        (stats_usec() - start) / 1000000.0);
+    pool_free(result, njobs * sizeof(job_result_t));
+    return nfailed;
+#endif
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Measure throughput of Anytone serial protocol against the emulator:
+# codeplug upload, codeplug download and callsign database write.
+#
+# Usage: anytone-bench.sh [byte-usec [command-usec [ncallsigns]]]
+#
+# Default latency approximates a real D868UV: 115200 baud
+# and about one millisecond per command.
+#
+BYTE_USEC=${1:-87}
+COMMAND_USEC=${2:-1000}
+NCALLSIGNS=${3:-2000}
+
+BENCH=`cd \`dirname $0\`; pwd`
+DMRCONFIG=${DMRCONFIG:-$BENCH/../dmrconfig}
+CONF=$BENCH/../examples/d868uv-rmham-2018-10-20.conf
+TMP=`mktemp -d`
+
+$BENCH/anytone-emu -m D868UVE -b $BYTE_USEC -c $COMMAND_USEC \
+    -l $TMP/pty > /dev/null 2> $TMP/emu.log &
+EMU=$!
+trap 'kill $EMU; rm -rf $TMP' 0
+
+while [ ! -e $TMP/pty ]; do
+    sleep 0.1
+done
+cd $TMP
+
+#
+# Run dmrconfig with statistics enabled.
+#
+run()
+{
+    name=$1
+    shift
+    if ! $DMRCONFIG --port=$TMP/pty --stats=$name.json "$@" > $name.log 2>&1; then
+        echo "dmrconfig $@: failed"
+        tail -5 $name.log
+        exit 1
+    fi
+}
+
+#
+# Print throughput: phase time from dmrconfig statistics,
+# payload size from emulator session summary.
+#
+report()
+{
+    title=$1 json=$2 phase=$3 session=$4 field=$5
+    sec=`sed -n "s/^ *\"$phase\": \([0-9.]*\).*/\1/p" $json`
+    bytes=`sed -n "${session}s/^Session: .*/&/p" emu.log | awk -v f=$field '{ print $f }'`
+    awk -v t="$title" -v s=$sec -v b=$bytes 'BEGIN {
+        printf "%-20s %9d bytes %8.3f sec %8.1f kbytes/sec\n", t, b, s, b / s / 1024 }'
+}
+
+awk -v n=$NCALLSIGNS 'BEGIN {
+    print "Radio ID,Callsign,Name,City,State,Country,Remarks"
+    for (i = 0; i < n; i++)
+        printf "%d,K%05d,Name%d,City,State,Country,\n", 3100000 + i, i, i
+}' > calls.csv
+
+run upload -c $CONF
+run download -r
+run callsign -u calls.csv
+sleep 0.5
+
+echo "Latency: $BYTE_USEC usec per byte, $COMMAND_USEC usec per command."
+report "Codeplug upload"   upload.json   upload   1 8
+report "Codeplug download" download.json download 2 4
+report "Callsign database" callsign.json upload   3 8
@@ -0,0 +1,431 @@
+/*
+ * Emulator of Anytone D868UV/D878UV/D878UV2 and BTECH DMR-6x2 radios.
+ * Serves the serial programming protocol on a pseudo-terminal,
+ * for testing and benchmarking without hardware.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <getopt.h>
+
+//
+// Size of memory image: sum of all fragments.
+//
+#define MEMSZ           1606528
+
+//
+// Callsign database sizes.
+//
+#define ADDR_CALLDB_SIZE    0x044c0000
+
+typedef struct {
+    unsigned address;
+    unsigned length;
+    unsigned offset;
+} fragment_t;
+
+static fragment_t region_map[] = {
+#include "anytone_ht-map.h"
+};
+
+//
+// Sparse 32-bit address space, allocated by 64-kbyte pages.
+// Unwritten memory reads as 0xff.
+//
+#define PAGESZ          0x10000
+
+static uint8_t *page_tab[0x10000];
+
+static int master = -1;             // Master side of pseudo-terminal
+static const char *model = "D878UV";
+static unsigned byte_usec;          // Latency per byte transferred
+static unsigned command_usec;       // Latency per command
+static unsigned drop_every;         // Lose every N-th write, like worn flash
+static unsigned long ndropped;      // Writes lost
+static int verbose;
+
+//
+// Counters of the session.
+//
+static unsigned long nreads, nwrites, bytes_read, bytes_written;
+
+static uint8_t *get_page(unsigned addr)
+{
+    uint8_t **p = &page_tab[addr / PAGESZ];
+
+    if (! *p) {
+        *p = malloc(PAGESZ);
+        if (! *p) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        memset(*p, 0xff, PAGESZ);
+    }
+    return *p;
+}
+
+static void mem_read(unsigned addr, uint8_t *data, unsigned nbytes)
+{
+    while (nbytes > 0) {
+        unsigned n = PAGESZ - addr % PAGESZ;
+
+        if (n > nbytes)
+            n = nbytes;
+        if (page_tab[addr / PAGESZ])
+            memcpy(data, page_tab[addr / PAGESZ] + addr % PAGESZ, n);
+        else
+            memset(data, 0xff, n);
+        addr += n;
+        data += n;
+        nbytes -= n;
+    }
+}
+
+static void mem_write(unsigned addr, const uint8_t *data, unsigned nbytes)
+{
+    while (nbytes > 0) {
+        unsigned n = PAGESZ - addr % PAGESZ;
+
+        if (n > nbytes)
+            n = nbytes;
+        memcpy(get_page(addr) + addr % PAGESZ, data, n);
+        addr += n;
+        data += n;
+        nbytes -= n;
+    }
+}
+
+//
+// Load codeplug image into the address space.
+// Get radio model from the image header.
+//
+static void load_image(const char *filename)
+{
+    static char ident[8];
+    uint8_t *buf = malloc(MEMSZ);
+    unsigned offset = 0;
+    fragment_t *f;
+    FILE *img;
+
+    img = fopen(filename, "rb");
+    if (! img) {
+        perror(filename);
+        exit(-1);
+    }
+    if (! buf || fread(buf, 1, MEMSZ, img) != MEMSZ) {
+        fprintf(stderr, "%s: Cannot read %u bytes of image\n", filename, MEMSZ);
+        exit(-1);
+    }
+    fclose(img);
+
+    for (f=region_map; f->length; f++) {
+        mem_write(f->address, buf + offset, f->length);
+        offset += f->length;
+    }
+    memcpy(ident, buf, 7);
+    model = ident;
+    free(buf);
+}
+
+//
+// Initialize empty radio: put model name into the header,
+// and clear bitmaps of valid channels, zones and scanlists.
+//
+static void init_blank()
+{
+    uint8_t zero[0x1000];
+    fragment_t *f;
+
+    memset(zero, 0, sizeof(zero));
+    for (f=region_map; f->length; f++) {
+        if (f->offset != 0)
+            mem_write(f->address, zero, f->length);
+    }
+    mem_write(region_map[0].address, zero, 16);
+    mem_write(region_map[0].address, (const uint8_t*) model, strlen(model));
+}
+
+//
+// Save the address space into codeplug image.
+//
+static void save_image(const char *filename)
+{
+    uint8_t *buf = malloc(MEMSZ);
+    unsigned offset = 0;
+    fragment_t *f;
+    FILE *img;
+
+    for (f=region_map; f->length; f++) {
+        mem_read(f->address, buf + offset, f->length);
+        offset += f->length;
+    }
+    img = fopen(filename, "wb");
+    if (! img) {
+        perror(filename);
+        exit(-1);
+    }
+    fwrite(buf, 1, MEMSZ, img);
+    fclose(img);
+    free(buf);
+}
+
+//
+// Read exactly nbytes from the terminal.
+//
+static void get_bytes(uint8_t *data, unsigned nbytes)
+{
+    while (nbytes > 0) {
+        int n = read(master, data, nbytes);
+
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("read");
+            exit(-1);
+        }
+        data += n;
+        nbytes -= n;
+    }
+}
+
+//
+// Send reply, after a delay which simulates the radio latency.
+//
+static void reply(const uint8_t *data, unsigned nbytes, unsigned request_len)
+{
+    unsigned usec = command_usec + byte_usec * (request_len + nbytes);
+
+    if (usec > 0)
+        usleep(usec);
+    if (write(master, data, nbytes) != (int) nbytes) {
+        perror("write");
+        exit(-1);
+    }
+}
+
+//
+// Print a summary of the session.
+//
+static void print_summary()
+{
+    uint32_t sz[4];
+
+    fprintf(stderr, "Session: %lu reads, %lu bytes; %lu writes, %lu bytes.\n",
+        nreads, bytes_read, nwrites, bytes_written);
+    if (ndropped > 0)
+        fprintf(stderr, "Lost %lu writes.\n", ndropped);
+
+    mem_read(ADDR_CALLDB_SIZE, (uint8_t*) sz, sizeof(sz));
+    if (sz[0] != 0xffffffff)
+        fprintf(stderr, "Callsign database: %u entries.\n", sz[0]);
+
+    nreads = nwrites = bytes_read = bytes_written = ndropped = 0;
+}
+
+//
+// Process commands of programming protocol.
+// Return on END command.
+//
+static void serve()
+{
+    uint8_t cmd[8 + 255], buf[8 + 255];
+    unsigned addr, nbytes, i;
+    uint8_t sum;
+
+    for (;;) {
+        get_bytes(cmd, 1);
+        switch (cmd[0]) {
+        case 'P':
+            // Enter programming mode: PROGRAM -> QX ACK
+            get_bytes(cmd + 1, 6);
+            if (memcmp(cmd, "PROGRAM", 7) != 0)
+                break;
+            reply((const uint8_t*) "QX\6", 3, 7);
+            continue;
+
+        case 2:
+            // Identify: I model 0 version 0 0 ACK
+            memset(buf, 0, 16);
+            buf[0] = 'I';
+            strncpy((char*) buf + 1, model, 7);
+            memcpy(buf + 9, "V100", 4);
+            buf[15] = 6;
+            reply(buf, 16, 1);
+            continue;
+
+        case 'R':
+            // Read: R aa aa aa aa nn -> W aa aa aa aa nn data... sum ACK
+            get_bytes(cmd + 1, 5);
+            addr = cmd[1] << 24 | cmd[2] << 16 | cmd[3] << 8 | cmd[4];
+            nbytes = cmd[5];
+            memcpy(buf, cmd, 6);
+            buf[0] = 'W';
+            mem_read(addr, buf + 6, nbytes);
+            sum = 0;
+            for (i=1; i<6+nbytes; i++)
+                sum += buf[i];
+            buf[6 + nbytes] = sum;
+            buf[7 + nbytes] = 6;
+            if (verbose)
+                fprintf(stderr, "Read %08x [%u]\n", addr, nbytes);
+            reply(buf, 8 + nbytes, 6);
+            nreads++;
+            bytes_read += nbytes;
+            continue;
+
+        case 'W':
+            // Write: W aa aa aa aa nn data... sum ACK -> ACK
+            get_bytes(cmd + 1, 5);
+            addr = cmd[1] << 24 | cmd[2] << 16 | cmd[3] << 8 | cmd[4];
+            nbytes = cmd[5];
+            get_bytes(cmd + 6, nbytes + 2);
+            sum = 0;
+            for (i=1; i<6+nbytes; i++)
+                sum += cmd[i];
+            if (sum != cmd[6 + nbytes] || cmd[7 + nbytes] != 6) {
+                fprintf(stderr, "Bad checksum at %08x\n", addr);
+                reply((const uint8_t*) "\25", 1, 8 + nbytes);
+                continue;
+            }
+            if (verbose)
+                fprintf(stderr, "Write %08x [%u]\n", addr, nbytes);
+            if (drop_every && (nwrites + 1) % drop_every == 0) {
+                // Acknowledge, but don't store.
+                ndropped++;
+            } else
+                mem_write(addr, cmd + 6, nbytes);
+            reply((const uint8_t*) "\6", 1, 8 + nbytes);
+            nwrites++;
+            bytes_written += nbytes;
+            continue;
+
+        case 'E':
+            // Leave programming mode: END -> ACK
+            get_bytes(cmd + 1, 2);
+            if (memcmp(cmd, "END", 3) != 0)
+                break;
+            reply((const uint8_t*) "\6", 1, 3);
+            return;
+        }
+        if (verbose)
+            fprintf(stderr, "Unknown command byte %02x\n", cmd[0]);
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "Emulator of Anytone radio on a pseudo-terminal.\n");
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "    anytone-emu [options]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -m model     Radio identifier: D868UVE, D878UV, D878UV2 or D6X2UV.\n");
+    fprintf(stderr, "    -i file.img  Load memory contents from codeplug image.\n");
+    fprintf(stderr, "    -o file.img  Save memory contents to codeplug image after every session.\n");
+    fprintf(stderr, "    -b usec      Latency per byte transferred.\n");
+    fprintf(stderr, "    -c usec      Latency per command.\n");
+    fprintf(stderr, "    -l path      Create a symlink to the pseudo-terminal.\n");
+    fprintf(stderr, "    -f count     Lose every N-th write, acknowledging it.\n");
+    fprintf(stderr, "    -1           Exit after first session.\n");
+    fprintf(stderr, "    -v           Print all commands.\n");
+    exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *output = 0, *link = 0;
+    int once = 0, loaded = 0, slave;
+    struct termios mode;
+    char *name;
+
+    for (;;) {
+        switch (getopt(argc, argv, "m:i:o:b:c:l:f:1v")) {
+        case 'm': model = optarg; continue;
+        case 'i': load_image(optarg); loaded = 1; continue;
+        case 'o': output = optarg; continue;
+        case 'b': byte_usec = strtoul(optarg, 0, 0); continue;
+        case 'c': command_usec = strtoul(optarg, 0, 0); continue;
+        case 'l': link = optarg; continue;
+        case 'f': drop_every = strtoul(optarg, 0, 0); continue;
+        case '1': once = 1; continue;
+        case 'v': verbose = 1; continue;
+        default:
+            usage();
+        case EOF:
+            break;
+        }
+        break;
+    }
+    if (optind != argc)
+        usage();
+    if (! loaded)
+        init_blank();
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        exit(-1);
+    }
+    name = ptsname(master);
+
+    // Keep the slave side open, so that the master does not get EIO
+    // when the client closes the port between sessions.
+    slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        perror(name);
+        exit(-1);
+    }
+    tcgetattr(slave, &mode);
+    cfmakeraw(&mode);
+    tcsetattr(slave, TCSANOW, &mode);
+
+    if (link) {
+        unlink(link);
+        if (symlink(name, link) < 0) {
+            perror(link);
+            exit(-1);
+        }
+    }
+    printf("%s\n", name);
+    fflush(stdout);
+
+    do {
+        serve();
+        print_summary();
+        if (output)
+            save_image(output);
+    } while (! once);
+
+    if (link)
+        unlink(link);
+    return 0;
+}
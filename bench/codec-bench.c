@@ -0,0 +1,241 @@
+/*
+ * Microbenchmark of keyword lookup in configuration scripts.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Check the BCD and tone codec for exact round trips over the whole
+// range of values, and compare the speed of converting a database
+// of DMR IDs by a chain of divisions, as the drivers used to do,
+// and by table-driven batch conversion.
+//
+// Usage: codec-bench [-n count]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "util.h"
+
+static int nerrors;
+
+static unsigned long long now_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fail(const char *what, unsigned value, unsigned got, unsigned expect)
+{
+    if (nerrors++ < 10)
+        fprintf(stderr, "%s(%u): got 0x%x, expected 0x%x\n", what, value, got, expect);
+}
+
+//
+// Reference conversion: one digit at a time.
+//
+static unsigned division_bcd32(unsigned id)
+{
+    return ((id / 10     % 10) << 4)  |  (id            % 10)       |
+           ((id / 1000   % 10) << 12) | ((id / 100)     % 10) << 8  |
+           ((id / 100000 % 10) << 20) | ((id / 10000)   % 10) << 16 |
+           ((id / 10000000)    << 28) | ((id / 1000000) % 10) << 24;
+}
+
+//
+// All 8-digit numbers.
+//
+static void check_bcd32()
+{
+    unsigned value, bcd;
+    unsigned char buf[4];
+
+    for (value=0; value<=99999999; value++) {
+        bcd = bin_to_bcd32(value);
+        if (bcd != division_bcd32(value))
+            fail("bin_to_bcd32", value, bcd, division_bcd32(value));
+        if (bcd32_to_bin(bcd) != value)
+            fail("bcd32_to_bin", bcd, bcd32_to_bin(bcd), value);
+
+        if (value % 7 == 0) {
+            bcd_put(buf, 4, value);
+            if (bcd_get(buf, 4) != value ||
+                buf[0] != (bcd >> 24) || buf[3] != (bcd & 0xff))
+                fail("bcd_put", value, bcd_get(buf, 4), value);
+        }
+    }
+}
+
+//
+// All 16-bit words: valid BCD decodes and encodes back,
+// every number 0..9999 encodes to the same bytes.
+//
+static void check_bcd16()
+{
+    unsigned word, value;
+    unsigned char buf[2];
+
+    for (value=0; value<=9999; value++) {
+        bcd_put(buf, 2, value);
+        word = buf[0] << 8 | buf[1];
+        if (word != division_bcd32(value))
+            fail("bcd_put", value, word, division_bcd32(value));
+        if (bcd_get(buf, 2) != value)
+            fail("bcd_get", word, bcd_get(buf, 2), value);
+    }
+}
+
+//
+// Print a tone into a string.
+//
+static char *tone_string(unsigned data)
+{
+    static char buf[32];
+    FILE *out = fmemopen(buf, sizeof(buf), "w");
+
+    print_tone(out, data);
+    fclose(out);
+
+    // Drop trailing space.
+    int len = strlen(buf);
+    while (len > 0 && buf[len-1] == ' ')
+        buf[--len] = 0;
+    return buf;
+}
+
+//
+// All standard CTCSS tones and DCS codes: parse, encode and print back.
+//
+static void check_tones()
+{
+    char str[32];
+    int i, code, ntones = 0, ndcs = 0;
+
+    for (i=0; i<NCTCSS; i++) {
+        unsigned dhz = ctcss_tone(i);
+
+        sprintf(str, "%u.%u", dhz / 10, dhz % 10);
+        if (parse_ctcss(str) != dhz)
+            fail("parse_ctcss", dhz, parse_ctcss(str), dhz);
+        if (ctcss_index(dhz) != i)
+            fail("ctcss_index", dhz, ctcss_index(dhz), i);
+        if (ctcss_index(dhz + 1) >= 0)
+            fail("ctcss_index", dhz + 1, ctcss_index(dhz + 1), -1);
+
+        code = encode_tone(str);
+        if (i == 0) {
+            // 62.5 is not accepted by MD-380 family.
+            if (code >= 0)
+                fail("encode_tone", dhz, code, -1);
+            continue;
+        }
+        if (code < 0 || strcmp(tone_string(code), str) != 0)
+            fail("encode_tone", dhz, code, 0);
+        ntones++;
+    }
+
+    for (i=0; i<=777; i++) {
+        sprintf(str, "D%03dN", i);
+        code = encode_tone(str);
+        if (code < 0)
+            continue;
+        if (strcmp(tone_string(code), str) != 0)
+            fail("encode_tone", i, code, 0);
+
+        sprintf(str, "D%03dI", i);
+        code = encode_tone(str);
+        if (code < 0 || strcmp(tone_string(code), str) != 0)
+            fail("encode_tone", i, code, 0);
+        ndcs++;
+    }
+    printf("Tones: %d CTCSS, %d DCS codes round trip.\n", ntones, ndcs);
+}
+
+int main(int argc, char **argv)
+{
+    int count = 200000, i, k;
+    unsigned *id, *bcd;
+    unsigned long long t0, division_nsec, batch_nsec;
+    volatile unsigned sink = 0;
+
+    while ((k = getopt(argc, argv, "n:")) != -1) {
+        switch (k) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc || count < 1) {
+usage:  fprintf(stderr, "Usage: codec-bench [-n count]\n");
+        exit(-1);
+    }
+
+    check_bcd16();
+    check_bcd32();
+    check_tones();
+    if (nerrors > 0) {
+        fprintf(stderr, "%d errors.\n", nerrors);
+        exit(-1);
+    }
+    printf("BCD: all 8-digit values round trip.\n");
+
+    //
+    // Random 7-digit IDs, like in a callsign database.
+    //
+    id = malloc(count * sizeof(unsigned));
+    bcd = malloc(count * sizeof(unsigned));
+    if (!id || !bcd) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    srand(1);
+    for (i=0; i<count; i++)
+        id[i] = 1000000 + rand() % 9000000;
+
+    t0 = now_nsec();
+    for (k=0; k<10; k++)
+        for (i=0; i<count; i++)
+            sink += bcd[i] = division_bcd32(id[i]);
+    division_nsec = now_nsec() - t0;
+
+    t0 = now_nsec();
+    for (k=0; k<10; k++) {
+        bin_to_bcd32_array(bcd, id, count);
+        sink += bcd[k];
+    }
+    batch_nsec = now_nsec() - t0;
+
+    printf("IDs: %d, division %.1f ns, batch %.1f ns, speedup %.2fx\n",
+        count, (double)division_nsec / count / 10,
+        (double)batch_nsec / count / 10,
+        batch_nsec ? (double)division_nsec / batch_nsec : 0.0);
+    return 0;
+}
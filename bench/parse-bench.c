@@ -0,0 +1,236 @@
+/*
+ * Microbenchmark of keyword lookup in configuration scripts.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Collect keywords from configuration scripts given as arguments
+// (table headers, parameter names and words of table rows),
+// and resolve them repeatedly in two ways: by a linear scan
+// with strcasecmp(), as the drivers used to do, and through
+// the perfect hash tables of keyword_lookup().
+//
+// Usage: parse-bench [-n count] file.conf...
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "util.h"
+
+//
+// Stubs for dependencies of util.o.
+//
+int trace_flag;
+void stats_retry() {}
+
+//
+// Vocabularies of all drivers together.
+//
+static const char *PARAMETER_NAME[] = {
+    "Radio", "Name", "ID", "Last Programmed Date", "CPS Software Version",
+    "Intro Line 1", "Intro Line 2", "Working Mode",
+};
+static const char *HEADER_NAME[] = {
+    "Digital", "Analog", "Zone", "Scanlist", "Contact", "Grouplist", "Message",
+};
+static const char *ENUM_NAME[] = {
+    "High", "Low", "Mid", "Turbo",                  // power
+    "Always", "Free", "Color", "NColor", "Tone",    // admit criteria
+    "Normal", "Tight",                              // squelch
+    "12.5", "20", "25",                             // bandwidth
+    "Group", "Private", "All",                      // call type
+    "No", "Yes", "Online",                          // call alert
+};
+
+#define NELEM(a) (sizeof(a) / sizeof(a[0]))
+
+typedef struct {
+    const char *title;
+    const char **names;
+    int nnames;
+    keyword_t *words;
+    keyword_table_t table;
+    char **input;                       // Words to resolve
+    int ninput, maxinput;
+} vocabulary_t;
+
+static vocabulary_t vocab[3] = {
+    { "headers",    HEADER_NAME,    NELEM(HEADER_NAME) },
+    { "parameters", PARAMETER_NAME, NELEM(PARAMETER_NAME) },
+    { "row words",  ENUM_NAME,      NELEM(ENUM_NAME) },
+};
+
+static unsigned long long now_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_input(vocabulary_t *v, const char *str, int len)
+{
+    if (v->ninput >= v->maxinput) {
+        v->maxinput = v->maxinput ? v->maxinput * 2 : 256;
+        v->input = realloc(v->input, v->maxinput * sizeof(char*));
+        if (!v->input) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+    }
+    v->input[v->ninput++] = strndup(str, len);
+}
+
+//
+// Split the script into lines, the same way as radio_parse_config() does.
+//
+static void read_script(const char *filename)
+{
+    FILE *conf = fopen(filename, "r");
+    char line[1024], *p, *v;
+    int len;
+
+    if (!conf) {
+        perror(filename);
+        exit(-1);
+    }
+    while (fgets(line, sizeof(line), conf)) {
+        if (line[0] == '#')
+            continue;
+        len = strlen(line);
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' ||
+                           line[len-1] == ' '  || line[len-1] == '\t'))
+            line[--len] = 0;
+        if (len == 0)
+            continue;
+
+        if (line[0] != ' ') {
+            v = strchr(line, ':');
+            if (v) {
+                // Parameter name.
+                add_input(&vocab[1], line, v - line);
+            } else {
+                // Header: first word.
+                for (len=0; (line[len] >= 'A' && line[len] <= 'Z') ||
+                            (line[len] >= 'a' && line[len] <= 'z'); len++)
+                    continue;
+                add_input(&vocab[0], line, len);
+            }
+            continue;
+        }
+
+        // Table row: every word.
+        for (p = line; *p; p += len) {
+            while (*p == ' ' || *p == '\t')
+                p++;
+            len = strcspn(p, " \t");
+            if (len > 0)
+                add_input(&vocab[2], p, len);
+        }
+    }
+    fclose(conf);
+}
+
+int main(int argc, char **argv)
+{
+    int count = 1000, i, k, n, hits;
+    unsigned long long t0, linear_nsec, hash_nsec;
+    volatile int sink = 0;
+
+    while ((k = getopt(argc, argv, "n:")) != -1) {
+        switch (k) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 1 || count < 1) {
+usage:  fprintf(stderr, "Usage: parse-bench [-n count] file.conf...\n");
+        exit(-1);
+    }
+
+    for (i=0; i<argc; i++)
+        read_script(argv[i]);
+
+    printf("Corpus: %d files, %d headers, %d parameters, %d row words, %d passes.\n",
+        argc, vocab[0].ninput, vocab[1].ninput, vocab[2].ninput, count);
+    printf("%-12s %8s %8s %12s %12s %8s\n",
+        "", "lookups", "hits", "strcasecmp", "hash", "speedup");
+
+    for (k=0; k<3; k++) {
+        vocabulary_t *v = &vocab[k];
+
+        // Build keyword list with values equal to the index.
+        v->words = calloc(v->nnames + 1, sizeof(keyword_t));
+        for (i=0; i<v->nnames; i++) {
+            v->words[i].name = v->names[i];
+            v->words[i].value = i;
+        }
+        v->table.words = v->words;
+
+        // Check that both methods agree, and count hits.
+        hits = 0;
+        for (i=0; i<v->ninput; i++) {
+            int a = string_in_table(v->input[i], v->names, v->nnames);
+            int b = keyword_lookup(&v->table, v->input[i]);
+
+            if (a != b) {
+                fprintf(stderr, "Mismatch on '%s': %d != %d\n", v->input[i], a, b);
+                exit(-1);
+            }
+            if (a >= 0)
+                hits++;
+        }
+
+        t0 = now_nsec();
+        for (n=0; n<count; n++)
+            for (i=0; i<v->ninput; i++)
+                sink += string_in_table(v->input[i], v->names, v->nnames);
+        linear_nsec = now_nsec() - t0;
+
+        t0 = now_nsec();
+        for (n=0; n<count; n++)
+            for (i=0; i<v->ninput; i++)
+                sink += keyword_lookup(&v->table, v->input[i]);
+        hash_nsec = now_nsec() - t0;
+
+        n = v->ninput * count;
+        if (n == 0)
+            continue;
+        printf("%-12s %8d %8d %9.1f ns %9.1f ns %7.2fx\n",
+            v->title, v->ninput, hits,
+            (double)linear_nsec / n, (double)hash_nsec / n,
+            hash_nsec ? (double)linear_nsec / hash_nsec : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# Measure download and upload speed of USB radios against the emulator,
+# in blocks per second, for every driver.
+#
+# Usage: usb-bench.sh [transfer-usec [erase-msec]]
+#
+TRANSFER_USEC=${1:-0}
+ERASE_MSEC=${2:-150}
+
+BENCH=`cd \`dirname $0\`; pwd`
+DMRCONFIG=${DMRCONFIG:-$BENCH/dmrconfig-emu}
+EXAMPLES=$BENCH/../examples
+TMP=`mktemp -d`
+trap 'rm -rf $TMP' 0
+cd $TMP
+
+export USB_EMU_TRANSFER_USEC=$TRANSFER_USEC
+export USB_EMU_ERASE_MSEC=$ERASE_MSEC
+
+#
+# Run dmrconfig with statistics enabled.
+#
+run()
+{
+    log=$1
+    shift
+    if ! $DMRCONFIG --stats=$log.json "$@" > $log.log 2>&1; then
+        echo "dmrconfig $@: failed"
+        tail -5 $log.log
+        exit 1
+    fi
+}
+
+#
+# Print speed: phase time from dmrconfig statistics,
+# number of blocks from emulator session summary.
+#
+report()
+{
+    title=$1 log=$2 phase=$3 field=$4 blocksz=$5
+    sec=`sed -n "s/^ *\"$phase\": \([0-9.]*\).*/\1/p" $log.json`
+    bytes=`grep '^Session:' $log.log | awk -v f=$field '{ print $f }'`
+    awk -v t="$title" -v s=$sec -v b=$bytes -v bs=$blocksz 'BEGIN {
+        printf "%-20s %6d blocks %8.3f sec %10.1f blocks/sec\n", t, b / bs, s, b / bs / s }'
+}
+
+echo "Latency: $TRANSFER_USEC usec per transfer, $ERASE_MSEC msec per erase."
+for radio in md380:md380-baynet-full-codeplug-rev1:1024 \
+             uv380:uv380-south-bay-area:1024 \
+             gd77:gd77-south-bay-area:128 \
+             rd5r:rd5r-bayern-codeplug-v3:128 \
+             dm1801:dm1801-south-bay-area:128
+do
+    IFS=: read name conf blocksz <<END
+$radio
+END
+    export USB_EMU_RADIO=$name
+    export USB_EMU_IMAGE=$TMP/$name.img
+
+    run $name-upload -c $EXAMPLES/$conf.conf
+    run $name-download -r
+    report "$name download" $name-download download 4 $blocksz
+    report "$name upload" $name-upload upload 8 $blocksz
+done
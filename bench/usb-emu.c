@@ -0,0 +1,634 @@
+/*
+ * Emulator of USB radios: TYT MD-380/MD-UV380 family with DFU protocol,
+ * and Radioddity GD-77, Baofeng RD-5R, DM-1801 with HID protocol.
+ * Replaces libusb: link it instead of the library, or preload
+ * the shared object, for testing and benchmarking without hardware.
+ *
+ * Configured by environment variables:
+ *
+ *  USB_EMU_RADIO           Radio to emulate: md380, md390, uv380, uv390,
+ *                          md2017, md9600, rt84, gd77, rd5r or dm1801.
+ *                          When not set, no device is present.
+ *  USB_EMU_IMAGE           Codeplug image file. It is loaded when the
+ *                          device is opened, and saved after a write session.
+ *  USB_EMU_TRANSFER_USEC   Latency per control transfer, default 0.
+ *  USB_EMU_ERASE_MSEC      Time of 64-kbyte sector erase, default 150.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <libusb.h>
+
+enum {
+    DEV_DFU,                        // STM32 DFU bootloader, 0483:df11
+    DEV_HID,                        // HID programming interface, 15a2:0073
+};
+
+typedef struct {
+    const char *name;               // Value of USB_EMU_RADIO
+    int         type;               // DEV_DFU or DEV_HID
+    const char *ident;              // Identifier reported to the host
+    unsigned    image_size;         // Size of codeplug image
+} radio_t;
+
+static const radio_t radio_tab[] = {
+    { "md380",  DEV_DFU, "DR780",       0x40000 },
+    { "md390",  DEV_DFU, "MD390",       0x40000 },
+    { "uv380",  DEV_DFU, "MD-UV380",    0xd0000 },
+    { "uv390",  DEV_DFU, "MD-UV390",    0xd0000 },
+    { "md2017", DEV_DFU, "2017",        0xd0000 },
+    { "md9600", DEV_DFU, "MD9600",      0xd0000 },
+    { "rt84",   DEV_DFU, "DM-1701",     0xd0000 },
+    { "gd77",   DEV_HID, "MD-760P",     0x20000 },
+    { "rd5r",   DEV_HID, "BF-5R",       0x20000 },
+    { "dm1801", DEV_HID, "1801",        0x20000 },
+    { 0 },
+};
+
+struct libusb_context {
+    int dummy;
+};
+
+struct libusb_device_handle {
+    const radio_t *radio;
+};
+
+static struct libusb_context context;
+static struct libusb_device_handle handle;
+static const char *image_filename;
+static unsigned transfer_usec;      // Latency per control transfer
+static unsigned erase_msec = 150;   // Latency of sector erase
+
+//
+// Sparse 32-bit address space, allocated by 64-kbyte pages.
+// Unwritten memory reads as 0xff.
+//
+#define PAGESZ          0x10000
+
+static uint8_t *page_tab[0x10000];
+
+//
+// Counters of the session.
+//
+static unsigned long nreads, nwrites, nerases, bytes_read, bytes_written;
+
+static uint8_t *get_page(unsigned addr)
+{
+    uint8_t **p = &page_tab[addr / PAGESZ];
+
+    if (! *p) {
+        *p = malloc(PAGESZ);
+        if (! *p) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        memset(*p, 0xff, PAGESZ);
+    }
+    return *p;
+}
+
+static void mem_read(unsigned addr, uint8_t *data, unsigned nbytes)
+{
+    while (nbytes > 0) {
+        unsigned n = PAGESZ - addr % PAGESZ;
+
+        if (n > nbytes)
+            n = nbytes;
+        if (page_tab[addr / PAGESZ])
+            memcpy(data, page_tab[addr / PAGESZ] + addr % PAGESZ, n);
+        else
+            memset(data, 0xff, n);
+        addr += n;
+        data += n;
+        nbytes -= n;
+    }
+}
+
+//
+// Write to memory. Flash of DFU radios can only clear bits:
+// the sector must be erased before it is written.
+//
+static void mem_write(unsigned addr, const uint8_t *data, unsigned nbytes, int flash)
+{
+    while (nbytes > 0) {
+        unsigned n = PAGESZ - addr % PAGESZ;
+        uint8_t *p;
+        unsigned i;
+
+        if (n > nbytes)
+            n = nbytes;
+        p = get_page(addr) + addr % PAGESZ;
+        if (flash) {
+            for (i=0; i<n; i++)
+                p[i] &= data[i];
+        } else {
+            memcpy(p, data, n);
+        }
+        addr += n;
+        data += n;
+        nbytes -= n;
+    }
+}
+
+static void mem_erase(unsigned addr)
+{
+    memset(get_page(addr), 0xff, PAGESZ);
+}
+
+//
+// Image of DFU radios is contiguous, but the device has a gap:
+// blocks starting from 256 are mapped to address 0x110000.
+//
+static unsigned image_to_device(unsigned offset)
+{
+    if (handle.radio->type == DEV_DFU && offset >= 0x40000)
+        return offset + 0xd0000;
+    return offset;
+}
+
+static void load_image()
+{
+    unsigned size = handle.radio->image_size;
+    uint8_t *buf;
+    FILE *img;
+    unsigned n;
+
+    if (! image_filename)
+        return;
+    img = fopen(image_filename, "rb");
+    if (! img) {
+        // No image yet: start with blank device.
+        return;
+    }
+    buf = malloc(size);
+    n = fread(buf, 1, size, img);
+    fclose(img);
+    if (n != size) {
+        fprintf(stderr, "%s: Image must be %u bytes\n", image_filename, size);
+        exit(-1);
+    }
+    for (n=0; n<size; n+=0x10000) {
+        mem_write(image_to_device(n), buf + n, 0x10000, 0);
+    }
+    free(buf);
+}
+
+static void save_image()
+{
+    unsigned size = handle.radio->image_size;
+    uint8_t *buf;
+    FILE *img;
+    unsigned n;
+
+    if (! image_filename)
+        return;
+    buf = malloc(size);
+    for (n=0; n<size; n+=0x10000) {
+        mem_read(image_to_device(n), buf + n, 0x10000);
+    }
+    img = fopen(image_filename, "wb");
+    if (! img) {
+        perror(image_filename);
+        exit(-1);
+    }
+    fwrite(buf, 1, size, img);
+    fclose(img);
+    free(buf);
+}
+
+//
+// DFU device: state machine and programming commands of TYT bootloader.
+//
+enum {
+    REQUEST_DETACH      = 0,
+    REQUEST_DNLOAD      = 1,
+    REQUEST_UPLOAD      = 2,
+    REQUEST_GETSTATUS   = 3,
+    REQUEST_CLRSTATUS   = 4,
+    REQUEST_GETSTATE    = 5,
+    REQUEST_ABORT       = 6,
+};
+
+enum {
+    appIDLE                 = 0,
+    dfuIDLE                 = 2,
+    dfuDNLOAD_SYNC          = 3,
+    dfuDNLOAD_IDLE          = 5,
+    dfuUPLOAD_IDLE          = 9,
+    dfuERROR                = 10,
+};
+
+enum {
+    STATUS_OK               = 0x00,
+    STATUS_errTARGET        = 0x01,
+    STATUS_errSTALLEDPKT    = 0x0f,
+};
+
+static int dfu_state = appIDLE;
+static int dfu_status = STATUS_OK;
+static unsigned dfu_address;        // Base address set by 0x21 command
+static int dfu_command;             // Last command, pending until GETSTATUS
+static unsigned dfu_arg;            // Argument of pending command
+static int programming_mode;        // Set by 0x91 0x01 command
+
+static int dfu_error(int status)
+{
+    dfu_state = dfuERROR;
+    dfu_status = status;
+    return LIBUSB_ERROR_PIPE;
+}
+
+//
+// Execute a command, when the host asks for status.
+// Erase takes time, as in the real flash.
+//
+static void dfu_execute()
+{
+    switch (dfu_command) {
+    case 0x21:
+        dfu_address = dfu_arg;
+        break;
+    case 0x41:
+        if (! programming_mode) {
+            dfu_error(STATUS_errTARGET);
+            return;
+        }
+        mem_erase(dfu_arg);
+        nerases++;
+        if (erase_msec > 0)
+            usleep(erase_msec * 1000);
+        break;
+    }
+    dfu_command = 0;
+}
+
+static int dfu_dnload(unsigned value, unsigned char *data, unsigned length)
+{
+    // Unlike the DFU spec, TYT bootloader accepts commands
+    // right after upload.
+    if (dfu_state != dfuIDLE && dfu_state != dfuDNLOAD_IDLE &&
+        dfu_state != dfuUPLOAD_IDLE)
+        return dfu_error(STATUS_errSTALLEDPKT);
+
+    if (value == 0) {
+        // Command.
+        if (length == 2 && data[0] == 0x91) {
+            if (data[1] == 0x01)
+                programming_mode = 1;
+            else if (data[1] == 0x05)
+                programming_mode = 0;
+        } else if (length == 5 && (data[0] == 0x21 || data[0] == 0x41)) {
+            dfu_command = data[0];
+            dfu_arg = data[1] | data[2] << 8 | data[3] << 16 | data[4] << 24;
+        }
+        // Command 0xa2 selects identifier for UPLOAD, nothing to do.
+        dfu_state = dfuDNLOAD_SYNC;
+        return length;
+    }
+
+    // Block of data.
+    if (value < 2 || ! programming_mode)
+        return dfu_error(STATUS_errTARGET);
+    mem_write(dfu_address + (value - 2) * length, data, length, 1);
+    nwrites++;
+    bytes_written += length;
+    dfu_state = dfuDNLOAD_SYNC;
+    return length;
+}
+
+static int dfu_upload(unsigned value, unsigned char *data, unsigned length)
+{
+    if (dfu_state != dfuIDLE && dfu_state != dfuUPLOAD_IDLE)
+        return dfu_error(STATUS_errSTALLEDPKT);
+
+    if (value == 0) {
+        // Device identifier.
+        memset(data, 0, length);
+        strncpy((char*)data, handle.radio->ident, length);
+    } else if (value >= 2) {
+        mem_read(dfu_address + (value - 2) * length, data, length);
+        nreads++;
+        bytes_read += length;
+    } else {
+        return dfu_error(STATUS_errTARGET);
+    }
+    dfu_state = dfuUPLOAD_IDLE;
+    return length;
+}
+
+static int dfu_request(int request, unsigned value, unsigned char *data, unsigned length)
+{
+    switch (request) {
+    case REQUEST_DETACH:
+        if (dfu_state == appIDLE)
+            dfu_state = dfuIDLE;
+        return 0;
+
+    case REQUEST_DNLOAD:
+        return dfu_dnload(value, data, length);
+
+    case REQUEST_UPLOAD:
+        return dfu_upload(value, data, length);
+
+    case REQUEST_GETSTATUS:
+        if (length < 6)
+            return LIBUSB_ERROR_OVERFLOW;
+        if (dfu_state == dfuDNLOAD_SYNC) {
+            dfu_state = dfuDNLOAD_IDLE;
+            dfu_execute();
+        }
+        data[0] = dfu_status;
+        data[1] = data[2] = data[3] = 0;
+        data[4] = dfu_state;
+        data[5] = 0;
+        return 6;
+
+    case REQUEST_CLRSTATUS:
+        if (dfu_state == dfuERROR) {
+            dfu_state = dfuIDLE;
+            dfu_status = STATUS_OK;
+        }
+        return 0;
+
+    case REQUEST_GETSTATE:
+        if (length < 1)
+            return LIBUSB_ERROR_OVERFLOW;
+        data[0] = dfu_state;
+        return 1;
+
+    case REQUEST_ABORT:
+        if (dfu_state != dfuERROR && dfu_state != appIDLE)
+            dfu_state = dfuIDLE;
+        return 0;
+    }
+    return LIBUSB_ERROR_PIPE;
+}
+
+//
+// HID device: packets of 42 bytes.
+// Request: 01 00 len-lo len-hi data...
+// Reply:   03 00 len 00 data...
+//
+#define HID_PACKETSZ    42
+
+static unsigned hid_bank;                       // Selected by CWB command
+static unsigned char hid_reply[HID_PACKETSZ];   // Reply to last request
+static int hid_reply_ready;                     // Reply waits for interrupt transfer
+static struct libusb_transfer *hid_transfer;    // Submitted interrupt transfer
+
+static void hid_set_reply(const unsigned char *data, unsigned nbytes)
+{
+    memset(hid_reply, 0, sizeof(hid_reply));
+    hid_reply[0] = 3;
+    hid_reply[2] = nbytes;
+    memcpy(hid_reply + 4, data, nbytes);
+    hid_reply_ready = 1;
+}
+
+static void hid_ack()
+{
+    hid_set_reply((const unsigned char*)"A", 1);
+}
+
+static int hid_request(unsigned char *data, unsigned length)
+{
+    unsigned char *cmd = data + 4;
+    unsigned nbytes = data[2] | data[3] << 8;
+    unsigned char buf[36];
+
+    if (length != HID_PACKETSZ || data[0] != 1 || nbytes > HID_PACKETSZ - 4)
+        return LIBUSB_ERROR_PIPE;
+
+    if (nbytes == 7 && memcmp(cmd, "\2PROGRA", 7) == 0) {
+        hid_ack();
+
+    } else if (nbytes == 2 && memcmp(cmd, "M\2", 2) == 0) {
+        // Identifier, padded by 0xff, then firmware version.
+        memset(buf, 0xff, 8);
+        memcpy(buf, handle.radio->ident, strlen(handle.radio->ident));
+        memcpy(buf + 8, "V210\0\4\200\4", 8);
+        hid_set_reply(buf, 16);
+
+    } else if (nbytes == 1 && cmd[0] == 'A') {
+        hid_ack();
+
+    } else if (nbytes == 8 && memcmp(cmd, "CWB\4\0", 5) == 0) {
+        hid_bank = cmd[5] << 16;
+        hid_ack();
+
+    } else if (nbytes == 4 && cmd[0] == 'R') {
+        unsigned addr = hid_bank + (cmd[1] << 8 | cmd[2]);
+
+        buf[0] = 'W';
+        memcpy(buf + 1, cmd + 1, 3);
+        mem_read(addr, buf + 4, cmd[3]);
+        nreads++;
+        bytes_read += cmd[3];
+        hid_set_reply(buf, 4 + cmd[3]);
+
+    } else if (nbytes >= 4 && cmd[0] == 'W' && nbytes == 4u + cmd[3]) {
+        unsigned addr = hid_bank + (cmd[1] << 8 | cmd[2]);
+
+        mem_write(addr, cmd + 4, cmd[3], 0);
+        nwrites++;
+        bytes_written += cmd[3];
+        hid_ack();
+
+    } else if (nbytes == 4 && (memcmp(cmd, "ENDR", 4) == 0 ||
+                               memcmp(cmd, "ENDW", 4) == 0)) {
+        hid_ack();
+
+    } else {
+        // Unknown command: no reply, the host gets timeout.
+        fprintf(stderr, "usb-emu: Unknown HID command, %u bytes\n", nbytes);
+    }
+    return length;
+}
+
+//
+// Print a summary of the session.
+//
+static void print_summary()
+{
+    fprintf(stderr, "Session: %lu reads, %lu bytes; %lu writes, %lu bytes; %lu erases.\n",
+        nreads, bytes_read, nwrites, bytes_written, nerases);
+    nreads = nwrites = nerases = bytes_read = bytes_written = 0;
+}
+
+//
+// Replacement of libusb API, as much as dmrconfig needs.
+//
+int libusb_init(libusb_context **ctx)
+{
+    const char *value;
+
+    *ctx = &context;
+    image_filename = getenv("USB_EMU_IMAGE");
+    value = getenv("USB_EMU_TRANSFER_USEC");
+    if (value)
+        transfer_usec = strtoul(value, 0, 0);
+    value = getenv("USB_EMU_ERASE_MSEC");
+    if (value)
+        erase_msec = strtoul(value, 0, 0);
+    return 0;
+}
+
+void libusb_exit(libusb_context *ctx)
+{
+}
+
+const char *libusb_strerror(int errcode)
+{
+    switch (errcode) {
+    case LIBUSB_SUCCESS:            return "Success";
+    case LIBUSB_ERROR_IO:           return "Input/Output Error";
+    case LIBUSB_ERROR_INVALID_PARAM: return "Invalid parameter";
+    case LIBUSB_ERROR_NO_DEVICE:    return "No such device";
+    case LIBUSB_ERROR_TIMEOUT:      return "Operation timed out";
+    case LIBUSB_ERROR_OVERFLOW:     return "Overflow";
+    case LIBUSB_ERROR_PIPE:         return "Pipe error";
+    }
+    return "Other error";
+}
+
+libusb_device_handle *libusb_open_device_with_vid_pid(libusb_context *ctx,
+    uint16_t vid, uint16_t pid)
+{
+    const char *name = getenv("USB_EMU_RADIO");
+    const radio_t *r;
+
+    if (! name)
+        return 0;
+    for (r=radio_tab; r->name; r++) {
+        if (strcasecmp(name, r->name) == 0)
+            break;
+    }
+    if (! r->name) {
+        fprintf(stderr, "usb-emu: Unknown radio '%s'\n", name);
+        exit(-1);
+    }
+    if (r->type == DEV_DFU && ! (vid == 0x0483 && pid == 0xdf11))
+        return 0;
+    if (r->type == DEV_HID && ! (vid == 0x15a2 && pid == 0x0073))
+        return 0;
+
+    handle.radio = r;
+    load_image();
+    return &handle;
+}
+
+void libusb_close(libusb_device_handle *dev)
+{
+    if (nwrites > 0)
+        save_image();
+    print_summary();
+}
+
+int libusb_kernel_driver_active(libusb_device_handle *dev, int interface)
+{
+    return 0;
+}
+
+int libusb_detach_kernel_driver(libusb_device_handle *dev, int interface)
+{
+    return 0;
+}
+
+int libusb_claim_interface(libusb_device_handle *dev, int interface)
+{
+    return 0;
+}
+
+int libusb_release_interface(libusb_device_handle *dev, int interface)
+{
+    return 0;
+}
+
+int libusb_control_transfer(libusb_device_handle *dev, uint8_t request_type,
+    uint8_t request, uint16_t value, uint16_t index,
+    unsigned char *data, uint16_t length, unsigned int timeout)
+{
+    if (transfer_usec > 0)
+        usleep(transfer_usec);
+    if (dev->radio->type == DEV_HID)
+        return hid_request(data, length);
+    return dfu_request(request, value, data, length);
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets)
+{
+    return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+    free(transfer);
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+    hid_transfer = transfer;
+    return 0;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+    if (hid_transfer == transfer) {
+        hid_transfer = 0;
+        transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        transfer->callback(transfer);
+    }
+    return 0;
+}
+
+//
+// Complete the interrupt transfer: with reply when ready,
+// otherwise with timeout.
+//
+int libusb_handle_events(libusb_context *ctx)
+{
+    struct libusb_transfer *t = hid_transfer;
+
+    if (! t)
+        return 0;
+    hid_transfer = 0;
+    if (hid_reply_ready) {
+        memcpy(t->buffer, hid_reply, sizeof(hid_reply));
+        t->actual_length = sizeof(hid_reply);
+        t->status = LIBUSB_TRANSFER_COMPLETED;
+        hid_reply_ready = 0;
+    } else {
+        usleep(t->timeout * 1000);
+        t->actual_length = 0;
+        t->status = LIBUSB_TRANSFER_TIMED_OUT;
+    }
+    t->callback(t);
+    return 0;
+}
@@ -0,0 +1,435 @@
+/*
+ * Codec of binary coded decimals, frequencies and squelch tones.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "util.h"
+
+//
+// Byte-pair tables: a byte of two BCD digits from binary 0...99,
+// and back. Bytes with invalid digits decode as 10*hi + lo,
+// the same as digit by digit.
+//
+#define BCD_ROW(h) \
+    0x##h##0, 0x##h##1, 0x##h##2, 0x##h##3, 0x##h##4, \
+    0x##h##5, 0x##h##6, 0x##h##7, 0x##h##8, 0x##h##9
+
+#define BIN_ROW(h) \
+    h*10+0,  h*10+1,  h*10+2,  h*10+3,  h*10+4,  h*10+5,  h*10+6,  h*10+7, \
+    h*10+8,  h*10+9,  h*10+10, h*10+11, h*10+12, h*10+13, h*10+14, h*10+15
+
+static const unsigned char BCD_BYTE[100] = {
+    BCD_ROW(0), BCD_ROW(1), BCD_ROW(2), BCD_ROW(3), BCD_ROW(4),
+    BCD_ROW(5), BCD_ROW(6), BCD_ROW(7), BCD_ROW(8), BCD_ROW(9),
+};
+
+static const unsigned char BCD_VALUE[256] = {
+    BIN_ROW(0),  BIN_ROW(1),  BIN_ROW(2),  BIN_ROW(3),
+    BIN_ROW(4),  BIN_ROW(5),  BIN_ROW(6),  BIN_ROW(7),
+    BIN_ROW(8),  BIN_ROW(9),  BIN_ROW(10), BIN_ROW(11),
+    BIN_ROW(12), BIN_ROW(13), BIN_ROW(14), BIN_ROW(15),
+};
+
+//
+// CTCSS tones, Hz*10, in ascending order.
+// Tone 62.5 is supported only by Anytone radios.
+//
+static const int CTCSS_TONES[NCTCSS] = {
+     625,  670,  693,  719,  744,  770,  797,  825,  854,  885,
+     915,  948,  974, 1000, 1035, 1072, 1109, 1148, 1188, 1230,
+    1273, 1318, 1365, 1413, 1462, 1514, 1567, 1598, 1622, 1655,
+    1679, 1713, 1738, 1773, 1799, 1835, 1862, 1899, 1928, 1966,
+    1995, 2035, 2065, 2107, 2181, 2257, 2291, 2336, 2418, 2503,
+    2541,
+};
+
+//
+// DCS codes, in ascending order.
+//
+#define NDCS    (1+104)
+
+static const int DCS_CODES[NDCS] = {
+     17, // For RD-5R
+     23,  25,  26,  31,  32,  36,  43,  47,  51,  53,
+     54,  65,  71,  72,  73,  74, 114, 115, 116, 122,
+    125, 131, 132, 134, 143, 145, 152, 155, 156, 162,
+    165, 172, 174, 205, 212, 223, 225, 226, 243, 244,
+    245, 246, 251, 252, 255, 261, 263, 265, 266, 271,
+    274, 306, 311, 315, 325, 331, 332, 343, 346, 351,
+    356, 364, 365, 371, 411, 412, 413, 423, 431, 432,
+    445, 446, 452, 454, 455, 462, 464, 465, 466, 503,
+    506, 516, 523, 526, 532, 546, 565, 606, 612, 624,
+    627, 631, 632, 654, 662, 664, 703, 712, 723, 731,
+    732, 734, 743, 754,
+};
+
+//
+// Decode a big endian BCD number of nbytes (two digits per byte).
+//
+unsigned bcd_get(const unsigned char *bcd, int nbytes)
+{
+    unsigned value = 0;
+
+    while (nbytes-- > 0)
+        value = value*100 + BCD_VALUE[*bcd++];
+    return value;
+}
+
+//
+// Encode a number as big endian BCD of nbytes.
+// Upper digits which don't fit are dropped.
+//
+void bcd_put(unsigned char *bcd, int nbytes, unsigned value)
+{
+    while (nbytes-- > 0) {
+        bcd[nbytes] = BCD_BYTE[value % 100];
+        value /= 100;
+    }
+}
+
+//
+// Convert a number to 8 BCD digits in a 32-bit word, and back.
+//
+unsigned bin_to_bcd32(unsigned value)
+{
+    unsigned lo = value % 10000;
+    unsigned hi = value / 10000 % 10000;
+
+    return BCD_BYTE[hi / 100] << 24 | BCD_BYTE[hi % 100] << 16 |
+           BCD_BYTE[lo / 100] << 8  | BCD_BYTE[lo % 100];
+}
+
+unsigned bcd32_to_bin(unsigned bcd)
+{
+    return (BCD_VALUE[bcd >> 24] * 100 + BCD_VALUE[(bcd >> 16) & 0xff]) * 10000 +
+            BCD_VALUE[(bcd >> 8) & 0xff] * 100 + BCD_VALUE[bcd & 0xff];
+}
+
+//
+// Convert arrays of numbers, for example all IDs
+// of the callsign database.
+//
+void bin_to_bcd32_array(unsigned *bcd, const unsigned *value, int count)
+{
+    int i;
+
+    for (i=0; i<count; i++)
+        bcd[i] = bin_to_bcd32(value[i]);
+}
+
+void bcd32_to_bin_array(unsigned *value, const unsigned *bcd, int count)
+{
+    int i;
+
+    for (i=0; i<count; i++)
+        value[i] = bcd32_to_bin(bcd[i]);
+}
+
+//
+// Find a value in ascending table.
+// Return index, or -1 when not found.
+//
+static int find_code(const int *tab, int n, int value)
+{
+    int lo = 0, hi = n - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+
+        if (tab[mid] == value)
+            return mid;
+        if (tab[mid] < value)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+//
+// Find CTCSS tone (Hz*10) in standard table.
+// Return index, or -1 when not found.
+//
+int ctcss_index(unsigned dhz)
+{
+    return find_code(CTCSS_TONES, NCTCSS, dhz);
+}
+
+//
+// Get CTCSS tone (Hz*10) by index in standard table.
+//
+unsigned ctcss_tone(int index)
+{
+    return CTCSS_TONES[index];
+}
+
+//
+// Parse CTCSS frequency nnn.n in Hz, into Hz*10.
+// Second decimal is rounded.
+// Return -1 on syntax error.
+//
+int parse_ctcss(const char *str)
+{
+    int dhz = 0;
+
+    if (*str < '0' || *str > '9')
+        return -1;
+    for (; *str >= '0' && *str <= '9'; str++) {
+        dhz = dhz*10 + *str - '0';
+        if (dhz > 100000)
+            return -1;
+    }
+    dhz *= 10;
+    if (*str == '.') {
+        str++;
+        if (*str >= '0' && *str <= '9')
+            dhz += *str++ - '0';
+        if (*str >= '5' && *str <= '9')
+            dhz++;
+        while (*str >= '0' && *str <= '9')
+            str++;
+    }
+    if (*str != 0)
+        return -1;
+    return dhz;
+}
+
+//
+// Convert tone string to BCD format.
+// Four possible formats:
+// nnn.n - CTCSS frequency
+// DnnnN - DCS normal
+// DnnnI - DCS inverted
+// '-'   - Disabled
+//
+int encode_tone(char *str)
+{
+    int val, tag;
+
+    if (*str == '-') {
+        // Disabled
+        return 0xffff;
+
+    } else if (*str == 'D' || *str == 'd') {
+        //
+        // DCS tone
+        //
+        char *e;
+        val = strtoul(++str, &e, 10);
+
+        // Must be a valid code from DCS table.
+        if (find_code(DCS_CODES, NDCS, val) < 0)
+            return -1;
+
+        if (*e == 'N' || *e == 'n') {
+            tag = 2;
+        } else if (*e == 'I' || *e == 'i') {
+            tag = 3;
+        } else {
+            return -1;
+        }
+    } else if (*str >= '0' && *str <= '9') {
+        //
+        // CTCSS tone
+        //
+        val = parse_ctcss(str);
+
+        // Must be a valid tone from CTCSS table, except 62.5.
+        if (val < 0 || ctcss_index(val) <= 0)
+            return -1;
+        tag = 0;
+    } else {
+        return -1;
+    }
+
+    return (BCD_BYTE[val / 100] << 8) | BCD_BYTE[val % 100] | (tag << 14);
+}
+
+//
+// Print CTSS or DCS tone.
+//
+void print_tone(FILE *out, unsigned data)
+{
+    if (data == 0xffff) {
+        fprintf(out, "-    ");
+        return;
+    }
+
+    unsigned tag = data >> 14;
+    unsigned a = (data >> 12) & 3;
+    unsigned b = (data >> 8) & 15;
+    unsigned c = (data >> 4) & 15;
+    unsigned d = data & 15;
+
+    switch (tag) {
+    default:
+        // CTCSS
+        if (a == 0)
+            fprintf(out, "%d%d.%d ", b, c, d);
+        else
+            fprintf(out, "%d%d%d.%d", a, b, c, d);
+        break;
+    case 2:
+        // DCS-N
+        fprintf(out, "D%d%d%dN", b, c, d);
+        break;
+    case 3:
+        // DCS-I
+        fprintf(out, "D%d%d%dI", b, c, d);
+        break;
+    }
+}
+
+//
+// Print frequency (BCD value).
+//
+void print_freq(FILE *out, unsigned data)
+{
+    fprintf(out, "%d%d%d.%d%d%d", (data >> 28) & 15, (data >> 24) & 15,
+        (data >> 20) & 15, (data >> 16) & 15,
+        (data >> 12) & 15, (data >> 8) & 15);
+
+    if ((data & 0xff) == 0) {
+        fputs("  ", out);
+    } else {
+        fprintf(out, "%d", (data >> 4) & 15);
+        if ((data & 0x0f) == 0) {
+            fputs(" ", out);
+        } else {
+            fprintf(out, "%d", data & 15);
+        }
+    }
+}
+
+//
+// Parse frequency in MHz, with optional sign, into Hertz.
+// Decimal digits are converted exactly, without floating point:
+// digits beyond 1 Hz are rounded. Return 0 on syntax error.
+//
+int parse_freq(const char *str, freq_t *hz)
+{
+    int neg = 0, ndigits = 0, scale = 100000;
+    freq_t mhz = 0, frac = 0;
+
+    if (*str == '+' || *str == '-')
+        neg = (*str++ == '-');
+
+    for (; *str >= '0' && *str <= '9'; str++, ndigits++) {
+        mhz = mhz*10 + *str - '0';
+        if (mhz > FREQ_MAX_MHZ)
+            return 0;
+    }
+    if (*str == '.') {
+        for (str++; *str >= '0' && *str <= '9'; str++, ndigits++) {
+            if (scale > 0)
+                frac += (*str - '0') * scale;
+            else if (scale == 0 && *str >= '5')
+                frac++;
+            scale = (scale > 0) ? scale / 10 : -1;
+        }
+    }
+    if (ndigits == 0 || *str != 0)
+        return 0;
+
+    *hz = neg ? -(mhz*1000000 + frac) : (mhz*1000000 + frac);
+    return 1;
+}
+
+//
+// Convert frequency in Hertz to a binary coded decimal
+// format (8 digits, in units of 10 Hz), and back.
+// Format abcdefgh is most significant digits first;
+// format ghefcdab has the bytes in reverse order.
+//
+static unsigned swap_bytes(unsigned x)
+{
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+unsigned hz_to_abcdefgh(freq_t hz)
+{
+    return bin_to_bcd32(hz / 10);
+}
+
+unsigned hz_to_ghefcdab(freq_t hz)
+{
+    return swap_bytes(bin_to_bcd32(hz / 10));
+}
+
+freq_t abcdefgh_to_hz(unsigned bcd)
+{
+    return bcd32_to_bin(bcd) * 10;
+}
+
+freq_t ghefcdab_to_hz(unsigned bcd)
+{
+    return bcd32_to_bin(swap_bytes(bcd)) * 10;
+}
+
+//
+// Print frequency as MHz, without trailing zeros,
+// left aligned in 8 columns.
+//
+void print_mhz(FILE *out, freq_t hz)
+{
+    char buf[16];
+    unsigned frac = hz % 1000000;
+    int len = sprintf(buf, "%u", (unsigned) hz / 1000000);
+
+    if (frac != 0) {
+        buf[len++] = '.';
+        do {
+            buf[len++] = '0' + frac / 100000;
+            frac = frac % 100000 * 10;
+        } while (frac != 0);
+        buf[len] = 0;
+    }
+    fprintf(out, "%-8s", buf);
+}
+
+//
+// Print the transmit offset or frequency.
+//
+void print_offset(FILE *out, unsigned rx_bcd, unsigned tx_bcd)
+{
+    freq_t rx_hz = abcdefgh_to_hz(rx_bcd);
+    freq_t tx_hz = abcdefgh_to_hz(tx_bcd);
+    freq_t delta = tx_hz - rx_hz;
+
+    if (delta == 0) {
+        fprintf(out, "+0       ");
+    } else if (delta > 0 && delta/50000 <= 255) {
+        fprintf(out, "+");
+        print_mhz(out, delta);
+    } else if (delta < 0 && -delta/50000 <= 255) {
+        fprintf(out, "-");
+        print_mhz(out, -delta);
+    } else {
+        fprintf(out, " ");
+        print_mhz(out, tx_hz);
+    }
+}
@@ -0,0 +1,399 @@
+/*
+ * Codeplug parsed from configuration script, independent of radio model.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "radio.h"
+#include "util.h"
+
+//
+// Configuration script is parsed once into a codeplug, which does not
+// depend on radio model: parameters and tables in the order of the script,
+// with rows of every table stored by columns. Then it is compiled
+// into memory image of any radio by radio_compile(), which passes
+// the rows to the parse routines of the driver.
+//
+// Kind of table is recognized by the first word of the header.
+// Headers which are not known here are kept with kind 0,
+// and left for the radio to decide.
+//
+static const keyword_t HEADER_WORDS[] = {
+    { "Digital",    TABLE_CHANNELS },
+    { "Analog",     TABLE_CHANNELS },
+    { "Zone",       TABLE_ZONES },
+    { "Scanlist",   TABLE_SCANLISTS },
+    { "Contact",    TABLE_CONTACTS },
+    { "Grouplist",  TABLE_GROUPLISTS },
+    { "Message",    TABLE_MESSAGES },
+    { 0 },
+};
+static keyword_table_t header_table = { HEADER_WORDS };
+
+static void *xrealloc(void *ptr, unsigned nbytes)
+{
+    ptr = realloc(ptr, nbytes);
+    if (! ptr) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    return ptr;
+}
+
+//
+// Append a parameter or a table.
+//
+static codeplug_section_t *add_section(codeplug_t *cp, unsigned line)
+{
+    codeplug_section_t *sec;
+
+    if (cp->nsections >= cp->maxsections) {
+        cp->maxsections = cp->maxsections ? cp->maxsections * 2 : 32;
+        cp->section = xrealloc(cp->section, cp->maxsections * sizeof(codeplug_section_t));
+    }
+    sec = &cp->section[cp->nsections++];
+    memset(sec, 0, sizeof(*sec));
+    sec->line = line;
+    return sec;
+}
+
+//
+// Append a row to the table: k-th token goes to k-th column.
+//
+static void add_row(codeplug_section_t *sec, token_t *tok, int ntok)
+{
+    int k;
+
+    if (sec->nrows >= sec->maxrows) {
+        sec->maxrows = sec->maxrows ? sec->maxrows * 2 : 64;
+        sec->width = xrealloc(sec->width, sec->maxrows * sizeof(int));
+        for (k=0; k<sec->ncols; k++)
+            sec->column[k] = xrealloc(sec->column[k], sec->maxrows * sizeof(token_t));
+    }
+    if (ntok > sec->ncols) {
+        // Wider row: add columns. Shorter rows never look at them.
+        sec->column = xrealloc(sec->column, ntok * sizeof(token_t*));
+        for (k=sec->ncols; k<ntok; k++)
+            sec->column[k] = xrealloc(0, sec->maxrows * sizeof(token_t));
+        sec->ncols = ntok;
+    }
+    for (k=0; k<ntok; k++)
+        sec->column[k][sec->nrows] = tok[k];
+    sec->width[sec->nrows++] = ntok;
+}
+
+//
+// Read the configuration script into a codeplug.
+// Text is split into words in place, in the mapped file.
+//
+codeplug_t *codeplug_parse(const char *filename)
+{
+    unsigned nbytes, mapsize;
+    char *data = file_map(filename, &nbytes, &mapsize);
+    codeplug_t *cp = codeplug_parse_text(filename, data, nbytes);
+
+    cp->mapped = 1;
+    cp->mapsize = mapsize;
+    return cp;
+}
+
+//
+// Parse the text of configuration script, terminated by zero.
+// Text is split into words in place, and must stay
+// until the codeplug is released.
+//
+codeplug_t *codeplug_parse_text(const char *filename, char *data, unsigned nbytes)
+{
+    codeplug_t *cp;
+    codeplug_section_t *table = 0;
+    char *next, *line, *p, *v;
+    unsigned lineno = 0;
+    token_t *tok = 0;
+    int ntok, maxtok = 0;
+
+    cp = xrealloc(0, sizeof(codeplug_t));
+    memset(cp, 0, sizeof(*cp));
+    cp->filename = filename;
+    cp->data = data;
+    cp->nbytes = nbytes;
+
+    for (next = cp->data; next < cp->data + cp->nbytes; ) {
+        // Find end of line, and terminate it in place.
+        line = next;
+        v = memchr(line, '\n', cp->data + cp->nbytes - line);
+        if (! v)
+            v = cp->data + cp->nbytes;
+        *v = 0;
+        next = v + 1;
+        lineno++;
+
+        // Strip comments.
+        if (*line == '#')
+            continue;
+
+        // Strip trailing spaces and newline.
+        v--;
+        while (v >= line && (*v=='\n' || *v=='\r' || *v==' ' || *v=='\t'))
+            *v-- = 0;
+
+        // Ignore comments and empty lines.
+        p = line;
+        if (*p == 0)
+            continue;
+
+        if (*p != ' ') {
+            // Table finished.
+            table = 0;
+
+            // Find the value.
+            v = strchr(p, ':');
+            if (! v) {
+                // Table header.
+                table = add_section(cp, lineno);
+                table->header = p;
+                table->kind = keyword_prefix(&header_table, p);
+                if ((int)table->kind < 0)
+                    table->kind = 0;
+                continue;
+            }
+
+            // Parameter.
+            *v++ = 0;
+
+            // Skip spaces.
+            while (*v == ' ' || *v == '\t')
+                v++;
+
+            codeplug_section_t *param = add_section(cp, lineno);
+            param->name = p;
+            param->value = v;
+
+        } else {
+            // Table row: split into tokens in place.
+            for (ntok = 0; ; ntok++) {
+                while (*p == ' ' || *p == '\t')
+                    p++;
+                if (*p == 0)
+                    break;
+                if (ntok >= maxtok) {
+                    maxtok = maxtok ? maxtok * 2 : 32;
+                    tok = xrealloc(tok, maxtok * sizeof(token_t));
+                }
+                tok[ntok].str = p;
+                tok[ntok].line = lineno;
+                tok[ntok].col = p - line + 1;
+                while (*p != 0 && *p != ' ' && *p != '\t')
+                    p++;
+                tok[ntok].len = p - tok[ntok].str;
+                tok[ntok].sep = *p;
+                if (*p)
+                    *p++ = 0;
+            }
+
+            // Ignore comments and empty lines.
+            if (ntok == 0 || tok[0].str[0] == '#')
+                continue;
+            if (! table) {
+                fprintf(stderr, "%s:%u:%u: Invalid line: '%s'\n", filename,
+                    lineno, tok[0].col, token_rest(tok, ntok, 0));
+                exit(-1);
+            }
+            add_row(table, tok, ntok);
+        }
+    }
+    free(tok);
+    return cp;
+}
+
+//
+// Release the codeplug, and unmap the script when mapped.
+//
+void codeplug_free(codeplug_t *cp)
+{
+    int i, k;
+
+    for (i=0; i<cp->nsections; i++) {
+        codeplug_section_t *sec = &cp->section[i];
+
+        for (k=0; k<sec->ncols; k++)
+            free(sec->column[k]);
+        free(sec->column);
+        free(sec->width);
+    }
+    free(cp->section);
+    if (cp->mapped)
+        file_unmap(cp->data, cp->mapsize);
+    free(cp);
+}
+
+//
+// Count rows of all tables.
+//
+int codeplug_count_rows(const codeplug_t *cp)
+{
+    int i, n = 0;
+
+    for (i=0; i<cp->nsections; i++)
+        n += cp->section[i].nrows;
+    return n;
+}
+
+//
+// Result of compilation for one target.
+//
+typedef struct {
+    int         done;           // Result is ready
+    int         status;         // Exit status: 0 on success
+    int         nrejected;      // Rows which the radio did not accept
+    char        message[200];   // Last line of error output
+} target_result_t;
+
+#if !defined(__WIN32__) && !defined(WIN32)
+static codeplug_t *compile_cp;          // Script to compile
+static char **compile_image;            // Image of every target
+static char **compile_output;           // Result file of every target
+static char **compile_log;              // Error output of every target
+static target_result_t *compile_result; // Shared with workers
+
+//
+// Worker: compile the codeplug for one image, and save the result.
+// Output is discarded, errors go to the log of the target.
+//
+static void compile_target(int i, FILE *log)
+{
+    target_result_t *r = &compile_result[i];
+
+    radio_read_image(compile_image[i]);
+    r->nrejected = radio_compile(compile_cp, 0);
+    radio_verify_config();
+    radio_save_image(compile_output[i]);
+    r->done = 1;
+}
+
+//
+// Worker finished: keep the status, and the text of the log.
+//
+static void compile_done(int i, int status, FILE *log)
+{
+    long size;
+
+    compile_result[i].status = status;
+
+    fflush(log);
+    fseek(log, 0, SEEK_END);
+    size = ftell(log);
+    rewind(log);
+    compile_log[i] = xrealloc(0, size + 1);
+    size = fread(compile_log[i], 1, size, log);
+    compile_log[i][size] = 0;
+}
+#endif
+
+//
+// Compile one configuration script for several codeplug images,
+// by given number of workers in parallel. Results are saved
+// to files 'device-1.img', 'device-2.img' and so on.
+// Print the log of every target, and the summary.
+// Return number of failed targets.
+//
+int codeplug_compile_all(const char *filename, char **images, int nimages, int nworkers)
+{
+#if defined(__WIN32__) || defined(WIN32)
+    fprintf(stderr, "Compiling for several radios is not supported on Windows.\n");
+    exit(-1);
+#else
+    unsigned long long start = stats_usec();
+    target_result_t *result;
+    char **output, *text, *eol, line[256];
+    int i, nfailed, nrows;
+
+    if (nworkers <= 0)
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers <= 0)
+        nworkers = 1;
+
+    stats_begin(STATS_PARSE);
+    compile_cp = codeplug_parse(filename);
+    stats_end(STATS_PARSE);
+    nrows = codeplug_count_rows(compile_cp);
+    fprintf(stderr, "Compile %d rows for %d radios by %d workers.\n",
+        nrows, nimages, nworkers);
+
+    result = pool_alloc(nimages * sizeof(target_result_t));
+    output = xrealloc(0, nimages * sizeof(char*));
+    for (i=0; i<nimages; i++) {
+        output[i] = xrealloc(0, 32);
+        sprintf(output[i], "device-%d.img", i+1);
+    }
+    compile_image = images;
+    compile_output = output;
+    compile_log = xrealloc(0, nimages * sizeof(char*));
+    compile_result = result;
+    pool_run(nimages, nworkers, compile_target, compile_done);
+
+    // Print logs, prefixed by name of the image.
+    for (i=0; i<nimages; i++) {
+        for (text = compile_log[i]; *text; text = eol) {
+            eol = strchr(text, '\n');
+            eol = eol ? eol + 1 : text + strlen(text);
+            fprintf(stderr, "%s: %.*s", images[i], (int)(eol - text), text);
+            snprintf(line, sizeof(line), "%.*s", (int)(eol - text), text);
+
+            char *p = trim_spaces(line, sizeof(line) - 1);
+            if (*p)
+                snprintf(result[i].message, sizeof(result[i].message), "%s", p);
+        }
+        free(compile_log[i]);
+    }
+
+    // Print results.
+    nfailed = 0;
+    for (i=0; i<nimages; i++) {
+        target_result_t *r = &result[i];
+
+        if (! r->done && r->status == 0)
+            r->status = -1;
+        if (r->status != 0) {
+            nfailed++;
+            printf("%-4s %s: %s\n", "FAIL", images[i], r->message);
+        } else {
+            printf("%-4s %s -> %s, %d of %d rows accepted\n", "ok", images[i],
+                output[i], nrows - r->nrejected, nrows);
+        }
+        free(output[i]);
+    }
+    printf("Compile: %d radios, %d ok, %d failed, %.3f sec.\n",
+        nimages, nimages - nfailed, nfailed,
+        (stats_usec() - start) / 1000000.0);
+    pool_free(result, nimages * sizeof(target_result_t));
+    free(compile_log);
+    free(output);
+    codeplug_free(compile_cp);
+    return nfailed;
+#endif
+}
@@ -72,39 +72,54 @@ typedef struct {
 static libusb_context *ctx = NULL;
 static libusb_device_handle *dev;
 static status_t status;
+static int replay_session;          // Serve transfers from recorded session
 
-static int detach(int timeout)
+//
+// Perform a control transfer on the device.
+// Account it in the transfer statistics and in the trace.
+//
+static int control(int type, int request, int value, unsigned char *data, int length)
 {
-    if (trace_flag) {
-        printf("--- Send DETACH\n");
+    unsigned long long start = stats_usec();
+    int to_host = (type == REQUEST_TYPE_TO_HOST);
+
+    trace_record(STATS_DFU, TRACE_SEND, request, value, length,
+        data, to_host ? 0 : length);
+
+    int error;
+    if (replay_session) {
+        error = replay_transfer(STATS_DFU, request, value, length,
+            data, to_host ? 0 : length, data, to_host ? length : 0);
+    } else {
+        error = libusb_control_transfer(dev, type, request, value, 0, data, length, 0);
+    }
+    if (error < 0) {
+        trace_record(STATS_DFU, TRACE_ERROR, request, error, 0, 0, 0);
+        if (error == LIBUSB_ERROR_TIMEOUT)
+            stats_timeout(STATS_DFU);
+        return error;
     }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_DETACH, timeout, 0, NULL, 0, 0);
+    if (to_host)
+        trace_record(STATS_DFU, TRACE_RECV, request, value, length, data, error);
+    stats_transaction(STATS_DFU, length, start);
+    return error;
+}
+
+static int detach(int timeout)
+{
+    int error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_DETACH, timeout, NULL, 0);
     return error;
 }
 
 static int get_status()
 {
-    if (trace_flag) {
-        printf("--- Send GETSTATUS [6]\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_HOST,
-        REQUEST_GETSTATUS, 0, 0, (unsigned char*)&status, 6, 0);
-    if (trace_flag && error >= 0) {
-        printf("--- Recv ");
-        print_hex((unsigned char*)&status, 6);
-        printf("\n");
-    }
+    int error = control(REQUEST_TYPE_TO_HOST, REQUEST_GETSTATUS, 0, (unsigned char*)&status, 6);
     return error;
 }
 
 static int clear_status()
 {
-    if (trace_flag) {
-        printf("--- Send CLRSTATUS\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_CLRSTATUS, 0, 0, NULL, 0, 0);
+    int error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_CLRSTATUS, 0, NULL, 0);
     return error;
 }
 
@@ -112,27 +127,14 @@ static int get_state(int *pstate)
 {
     unsigned char state;
 
-    if (trace_flag) {
-        printf("--- Send GETSTATE [1]\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_HOST,
-        REQUEST_GETSTATE, 0, 0, &state, 1, 0);
+    int error = control(REQUEST_TYPE_TO_HOST, REQUEST_GETSTATE, 0, &state, 1);
     *pstate = state;
-    if (trace_flag && error >= 0) {
-        printf("--- Recv ");
-        print_hex(&state, 1);
-        printf("\n");
-    }
     return error;
 }
 
 static int dfu_abort()
 {
-    if (trace_flag) {
-        printf("--- Send ABORT\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_ABORT, 0, 0, NULL, 0, 0);
+    int error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_ABORT, 0, NULL, 0);
     return error;
 }
 
@@ -179,17 +181,55 @@ static void wait_dfu_idle()
     }
 }
 
+//
+// Resynchronize the protocol state after a failed transfer:
+// clear error status or abort pending request, until dfuIDLE.
+// Give up after about 10 seconds.
+// Return negative on error.
+//
+static int resync()
+{
+    int state, error, count;
+
+    for (count=0; count<100; count++) {
+        error = get_state(&state);
+        if (error < 0) {
+            clear_status();
+            usleep(100000);
+            continue;
+        }
+
+        switch (state) {
+        case dfuIDLE:
+            return 0;
+
+        case appIDLE:
+            detach(1000);
+            break;
+
+        case dfuERROR:
+            clear_status();
+            break;
+
+        case appDETACH:
+        case dfuDNBUSY:
+        case dfuMANIFEST_WAIT_RESET:
+            usleep(100000);
+            break;
+
+        default:
+            dfu_abort();
+            break;
+        }
+    }
+    return -1;
+}
+
 static void md380_command(uint8_t a, uint8_t b)
 {
     unsigned char cmd[2] = { a, b };
 
-    if (trace_flag) {
-        printf("--- Send DNLOAD [2] ");
-        print_hex(cmd, 2);
-        printf("\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_DNLOAD, 0, 0, cmd, 2, 0);
+    int error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_DNLOAD, 0, cmd, 2);
     if (error < 0) {
         fprintf(stderr, "%s: cannot send command: %d: %s\n",
             __func__, error, libusb_strerror(error));
@@ -209,13 +249,7 @@ static void set_address(uint32_t address)
         (uint8_t)(address >> 24),
     };
 
-    if (trace_flag) {
-        printf("--- Send DNLOAD [5] ");
-        print_hex(cmd, 5);
-        printf("\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_DNLOAD, 0, 0, cmd, 5, 0);
+    int error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_DNLOAD, 0, cmd, 5);
     if (error < 0) {
         fprintf(stderr, "%s: cannot send command: %d: %s\n",
             __func__, error, libusb_strerror(error));
@@ -227,6 +261,7 @@ static void set_address(uint32_t address)
 
 static void erase_block(uint32_t address, int progress_flag)
 {
+    unsigned long long start = stats_usec();
     unsigned char cmd[5] = { 0x41,
         (uint8_t)address,
         (uint8_t)(address >> 8),
@@ -234,13 +269,7 @@ static void erase_block(uint32_t address, int progress_flag)
         (uint8_t)(address >> 24),
     };
 
-    if (trace_flag) {
-        printf("--- Send DNLOAD [5] ");
-        print_hex(cmd, 5);
-        printf("\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_DNLOAD, 0, 0, cmd, 5, 0);
+    int error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_DNLOAD, 0, cmd, 5);
     if (error < 0) {
         fprintf(stderr, "%s: cannot send command: %d: %s\n",
             __func__, error, libusb_strerror(error));
@@ -248,6 +277,7 @@ static void erase_block(uint32_t address, int progress_flag)
     }
     get_status();
     wait_dfu_idle();
+    stats_erase(STATS_DFU, start);
 
     if (progress_flag) {
         fprintf(stderr, "#");
@@ -261,27 +291,44 @@ static const char *identify()
 
     md380_command(0xa2, 0x01);
 
-    if (trace_flag) {
-        printf("--- Send UPLOAD [64]\n");
-    }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_HOST,
-        REQUEST_UPLOAD, 0, 0, data, 64, 0);
+    int error = control(REQUEST_TYPE_TO_HOST, REQUEST_UPLOAD, 0, data, 64);
     if (error < 0) {
         fprintf(stderr, "%s: cannot read data: %d: %s\n",
             __func__, error, libusb_strerror(error));
         exit(-1);
     }
-    if (trace_flag) {
-        printf("--- Recv ");
-        print_hex(data, 64);
-        printf("\n");
-    }
     get_status();
     return (const char*) data;
 }
 
+//
+// Enter programming mode and get device identifier.
+//
+static const char *start_session()
+{
+    // Enter Programming Mode.
+    wait_dfu_idle();
+    md380_command(0x91, 0x01);
+
+    // Get device identifier in a static buffer.
+    const char *ident = identify();
+
+    // Zero address.
+    set_address(0x00000000);
+
+    return ident;
+}
+
 const char *dfu_init(unsigned vid, unsigned pid)
 {
+    if (replay_flag) {
+        // Use recorded session instead of the device.
+        if (replay_transport() != STATS_DFU)
+            return 0;
+        replay_session = 1;
+        return start_session();
+    }
+
     int error = libusb_init(&ctx);
     if (error < 0) {
         fprintf(stderr, "libusb init failed: %d: %s\n",
@@ -312,22 +359,12 @@ const char *dfu_init(unsigned vid, unsigned pid)
         ctx = 0;
         exit(-1);
     }
-
-    // Enter Programming Mode.
-    wait_dfu_idle();
-    md380_command(0x91, 0x01);
-
-    // Get device identifier in a static buffer.
-    const char *ident = identify();
-
-    // Zero address.
-    set_address(0x00000000);
-
-    return ident;
+    return start_session();
 }
 
 void dfu_close()
 {
+    replay_session = 0;
     if (ctx) {
         libusb_release_interface(dev, 0);
         libusb_close(dev);
@@ -338,6 +375,11 @@ void dfu_close()
 
 void dfu_erase(unsigned start, unsigned finish)
 {
+    if (dry_run) {
+        estimate_dfu_erase(start, finish);
+        return;
+    }
+
     // Enter Programming Mode.
     get_status();
     wait_dfu_idle();
@@ -380,66 +422,103 @@ void dfu_erase(unsigned start, unsigned finish)
     set_address(0x00000000);
 }
 
+//
+// Erase only sectors of configuration memory, which hold
+// given range of the image. Image above 256 kbytes is stored
+// in extended configuration memory at 0x110000.
+//
+void dfu_erase_image(unsigned start, unsigned finish)
+{
+    unsigned addr;
+
+    if (dry_run) {
+        estimate_dfu_erase_image(start, finish);
+        return;
+    }
+
+    // Enter Programming Mode.
+    get_status();
+    wait_dfu_idle();
+    md380_command(0x91, 0x01);
+    usleep(100000);
+
+    for (addr=start & ~0xffff; addr<finish; addr+=0x00010000) {
+        erase_block(addr < 256*1024 ? addr : addr + 0xd0000, 1);
+    }
+
+    // Zero address.
+    set_address(0x00000000);
+}
+
 void dfu_read_block(int bno, uint8_t *data, int nbytes)
 {
-    if (bno >= 256 && bno < 2048)
-        bno += 832;
+    int attempt = 0, error, synced;
 
-    if (trace_flag) {
-        printf("--- Send UPLOAD [%d]\n", nbytes);
+    if (dry_run) {
+        estimate_dfu_block(0, nbytes);
+        return;
     }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_HOST,
-        REQUEST_UPLOAD, bno+2, 0, data, nbytes, 0);
+
+    if (bno >= 256 && bno < 2048)
+        bno += 832;
+again:
+    error = control(REQUEST_TYPE_TO_HOST, REQUEST_UPLOAD, bno+2, data, nbytes);
     if (error < 0) {
-        fprintf(stderr, "%s: cannot read block %d, nbytes = %d: %d: %s\n",
-            __func__, bno, nbytes, error, libusb_strerror(error));
+        synced = resync();
+        if (synced >= 0 && retry_backoff(__func__, &attempt)) {
+            set_address(0x00000000);
+            goto again;
+        }
+        fprintf(stderr, "%s: cannot read block %d, nbytes = %d: %d: %s%s\n",
+            __func__, bno, nbytes, error, libusb_strerror(error),
+            synced < 0 ? ", radio not ready" : "");
         exit(-1);
     }
-    if (trace_flag > 1) {
-        printf("--- Recv ");
-        print_hex(data, nbytes);
-        printf("\n");
-    }
     get_status();
 }
 
 void dfu_write_block(int bno, uint8_t *data, int nbytes)
 {
+    int attempt = 0, error, synced;
+
+    if (dry_run) {
+        estimate_dfu_block(1, nbytes);
+        return;
+    }
+
     if (bno >= 256 && bno < 2048)
         bno += 832;
-
-    if (trace_flag) {
-        printf("--- Send DNLOAD [%d] ", nbytes);
-        if (trace_flag > 1)
-            print_hex(data, nbytes);
-        printf("\n");
+again:
+    error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_DNLOAD, bno+2, data, nbytes);
+    if (error >= 0)
+        get_status();
+    synced = resync();
+    if (error >= 0 && synced >= 0)
+        return;
+    if (synced >= 0 && retry_backoff(__func__, &attempt)) {
+        set_address(0x00000000);
+        goto again;
     }
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_DNLOAD, bno+2, 0, data, nbytes, 0);
-    if (error < 0) {
-        fprintf(stderr, "%s: cannot write block %d, nbytes = %d: %d: %s\n",
-            __func__, bno, nbytes, error, libusb_strerror(error));
-        exit(-1);
+    if (error >= 0) {
+        // Block was sent, but the radio did not return to idle state.
+        fprintf(stderr, "%s: cannot write block %d, nbytes = %d: radio not ready\n",
+            __func__, bno, nbytes);
+    } else {
+        fprintf(stderr, "%s: cannot write block %d, nbytes = %d: %d: %s%s\n",
+            __func__, bno, nbytes, error, libusb_strerror(error),
+            synced < 0 ? ", radio not ready" : "");
     }
-
-    get_status();
-    wait_dfu_idle();
+    exit(-1);
 }
 
 void dfu_reboot()
 {
     unsigned char cmd[2] = { 0x91, 0x05 };
 
-    if (! ctx)
+    if (! ctx && ! replay_session)
         return;
-    if (trace_flag) {
-        printf("--- Send DNLOAD [2] ");
-        print_hex(cmd, 2);
-        printf("\n");
-    }
     wait_dfu_idle();
-    int error = libusb_control_transfer(dev, REQUEST_TYPE_TO_DEVICE,
-        REQUEST_DNLOAD, 0, 0, cmd, 2, 0);
+    int error = control(REQUEST_TYPE_TO_DEVICE, REQUEST_DNLOAD, 0, cmd, 2);
     if (error < 0) {
         fprintf(stderr, "%s: cannot send command: %d: %s\n",
             __func__, error, libusb_strerror(error));
@@ -88,6 +88,7 @@ static status_t status;
 
 static int dev_request(int request, int value)
 {
+    unsigned long long start = stats_usec();
     CNTRPIPE_RQ rq;
     DWORD nbytes = 0;
 
@@ -98,15 +99,19 @@ static int dev_request(int request, int value)
     rq.Index     = 0;
     rq.Length    = 0;
 
+    trace_record(STATS_DFU, TRACE_SEND, request, value, 0, 0, 0);
     if (!DeviceIoControl(dev, PU_VENDOR_REQUEST, &rq, sizeof(rq),
                          NULL, 0, &nbytes, NULL)) {
+        trace_record(STATS_DFU, TRACE_ERROR, request, GetLastError(), 0, 0, 0);
         return -1;
     }
+    stats_transaction(STATS_DFU, 0, start);
     return 0;
 }
 
 static int dev_write(int request, int value, int length, PBYTE data)
 {
+    unsigned long long start = stats_usec();
     int rqlen = sizeof(CNTRPIPE_RQ) + length;
     PCNTRPIPE_RQ rq = alloca(rqlen);
     DWORD nbytes = 0;
@@ -120,15 +125,19 @@ static int dev_write(int request, int value, int length, PBYTE data)
 
     memcpy(rq + 1, data, length);
 
+    trace_record(STATS_DFU, TRACE_SEND, request, value, length, data, length);
     if (!DeviceIoControl(dev, PU_VENDOR_REQUEST, rq, rqlen,
                          NULL, 0, &nbytes, NULL)) {
+        trace_record(STATS_DFU, TRACE_ERROR, request, GetLastError(), 0, 0, 0);
         return -1;
     }
+    stats_transaction(STATS_DFU, length, start);
     return 0;
 }
 
 static int dev_read(int request, int value, int length, PBYTE buffer)
 {
+    unsigned long long start = stats_usec();
     CNTRPIPE_RQ rq;
     DWORD nbytes = 0;
 
@@ -139,44 +148,35 @@ static int dev_read(int request, int value, int length, PBYTE buffer)
     rq.Index     = 0;
     rq.Length    = length;
 
+    trace_record(STATS_DFU, TRACE_SEND, request, value, length, 0, 0);
     if (!DeviceIoControl(dev, PU_VENDOR_REQUEST, &rq, sizeof(rq),
                          buffer, length, &nbytes, NULL)) {
+        trace_record(STATS_DFU, TRACE_ERROR, request, GetLastError(), 0, 0, 0);
         return -1;
     }
     if (nbytes != length) {
+        trace_record(STATS_DFU, TRACE_ERROR, request, -1, 0, 0, 0);
         return -1;
     }
+    trace_record(STATS_DFU, TRACE_RECV, request, value, length, buffer, length);
+    stats_transaction(STATS_DFU, length, start);
     return 0;
 }
 
 static int detach(int timeout)
 {
-    if (trace_flag) {
-        printf("--- Send DETACH\n");
-    }
     int error = dev_request(REQUEST_DETACH, timeout);
     return error;
 }
 
 static int get_status()
 {
-    if (trace_flag) {
-        printf("--- Send GETSTATUS [6]\n");
-    }
     int error = dev_read(REQUEST_GETSTATUS, 0, 6, (unsigned char*)&status);
-    if (trace_flag && error >= 0) {
-        printf("--- Recv ");
-        print_hex((unsigned char*)&status, 6);
-        printf("\n");
-    }
     return error;
 }
 
 static int clear_status()
 {
-    if (trace_flag) {
-        printf("--- Send CLRSTATUS\n");
-    }
     int error = dev_request(REQUEST_CLRSTATUS, 0);
     return error;
 }
@@ -185,24 +185,13 @@ static int get_state(int *pstate)
 {
     unsigned char state;
 
-    if (trace_flag) {
-        printf("--- Send GETSTATE [1]\n");
-    }
     int error = dev_read(REQUEST_GETSTATE, 0, 1, &state);
     *pstate = state;
-    if (trace_flag && error >= 0) {
-        printf("--- Recv ");
-        print_hex(&state, 1);
-        printf("\n");
-    }
     return error;
 }
 
 static int dfu_abort()
 {
-    if (trace_flag) {
-        printf("--- Send ABORT\n");
-    }
     int error = dev_request(REQUEST_ABORT, 0);
     return error;
 }
@@ -249,15 +238,54 @@ static void wait_dfu_idle()
     }
 }
 
+//
+// Resynchronize the protocol state after a failed transfer:
+// clear error status or abort pending request, until dfuIDLE.
+// Give up after about 10 seconds.
+// Return negative on error.
+//
+static int resync()
+{
+    int state, error, count;
+
+    for (count=0; count<100; count++) {
+        error = get_state(&state);
+        if (error < 0) {
+            clear_status();
+            usleep(100000);
+            continue;
+        }
+
+        switch (state) {
+        case dfuIDLE:
+            return 0;
+
+        case appIDLE:
+            detach(5000);
+            break;
+
+        case dfuERROR:
+            clear_status();
+            break;
+
+        case appDETACH:
+        case dfuDNBUSY:
+        case dfuMANIFEST_WAIT_RESET:
+            usleep(100000);
+            break;
+
+        default:
+            dfu_abort();
+            break;
+        }
+    }
+    return -1;
+}
+
 static void md380_command(uint8_t a, uint8_t b)
 {
     unsigned char cmd[2] = { a, b };
 
-    if (trace_flag) {
-        printf("--- Send DNLOAD [2] ");
-        print_hex(cmd, 2);
-        printf("\n");
-    }
     int error = dev_write(REQUEST_DNLOAD, 0, 2, cmd);
     if (error < 0) {
         fprintf(stderr, "%s: cannot send command\n", __func__);
@@ -277,11 +305,6 @@ static void set_address(uint32_t address)
         (uint8_t)(address >> 24),
     };
 
-    if (trace_flag) {
-        printf("--- Send DNLOAD [5] ");
-        print_hex(cmd, 5);
-        printf("\n");
-    }
     int error = dev_write(REQUEST_DNLOAD, 0, 5, cmd);
     if (error < 0) {
         fprintf(stderr, "%s: cannot send command\n", __func__);
@@ -293,6 +316,7 @@ static void set_address(uint32_t address)
 
 static void erase_block(uint32_t address, int progress_flag)
 {
+    unsigned long long start = stats_usec();
     unsigned char cmd[5] = { 0x41,
         (uint8_t)address,
         (uint8_t)(address >> 8),
@@ -300,11 +324,6 @@ static void erase_block(uint32_t address, int progress_flag)
         (uint8_t)(address >> 24),
     };
 
-    if (trace_flag) {
-        printf("--- Send DNLOAD [5] ");
-        print_hex(cmd, 5);
-        printf("\n");
-    }
     int error = dev_write(REQUEST_DNLOAD, 0, 5, cmd);
     if (error < 0) {
         fprintf(stderr, "%s: cannot send command\n", __func__);
@@ -312,6 +331,7 @@ static void erase_block(uint32_t address, int progress_flag)
     }
     get_status();
     wait_dfu_idle();
+    stats_erase(STATS_DFU, start);
 
     if (progress_flag) {
         fprintf(stderr, "#");
@@ -325,19 +345,11 @@ static const char *identify()
 
     md380_command(0xa2, 0x01);
 
-    if (trace_flag) {
-        printf("--- Send UPLOAD [64]\n");
-    }
     int error = dev_read(REQUEST_UPLOAD, 0, 64, data);
     if (error < 0) {
         fprintf(stderr, "%s: cannot read data\n", __func__);
         exit(-1);
     }
-    if (trace_flag) {
-        printf("--- Recv ");
-        print_hex(data, 64);
-        printf("\n");
-    }
     get_status();
     return (const char*) data;
 }
@@ -440,6 +452,11 @@ void dfu_close()
 
 void dfu_erase(unsigned start, unsigned finish)
 {
+    if (dry_run) {
+        estimate_dfu_erase(start, finish);
+        return;
+    }
+
     // Enter Programming Mode.
     get_status();
     wait_dfu_idle();
@@ -482,48 +499,84 @@ void dfu_erase(unsigned start, unsigned finish)
     set_address(0x00000000);
 }
 
+//
+// Erase only sectors of configuration memory, which hold
+// given range of the image. Image above 256 kbytes is stored
+// in extended configuration memory at 0x110000.
+//
+void dfu_erase_image(unsigned start, unsigned finish)
+{
+    unsigned addr;
+
+    if (dry_run) {
+        estimate_dfu_erase_image(start, finish);
+        return;
+    }
+
+    // Enter Programming Mode.
+    get_status();
+    wait_dfu_idle();
+    md380_command(0x91, 0x01);
+    usleep(100000);
+
+    for (addr=start & ~0xffff; addr<finish; addr+=0x00010000) {
+        erase_block(addr < 256*1024 ? addr : addr + 0xd0000, 1);
+    }
+
+    // Zero address.
+    set_address(0x00000000);
+}
+
 void dfu_read_block(int bno, uint8_t *data, int nbytes)
 {
-    if (bno >= 256 && bno < 2048)
-        bno += 832;
+    int attempt = 0, error;
 
-    if (trace_flag) {
-        printf("--- Send UPLOAD [%d]\n", nbytes);
+    if (dry_run) {
+        estimate_dfu_block(0, nbytes);
+        return;
     }
-    int error = dev_read(REQUEST_UPLOAD, bno+2, nbytes, data);
+
+    if (bno >= 256 && bno < 2048)
+        bno += 832;
+again:
+    error = dev_read(REQUEST_UPLOAD, bno+2, nbytes, data);
     if (error < 0) {
+        if (resync() >= 0 && retry_backoff(__func__, &attempt)) {
+            set_address(0x00000000);
+            goto again;
+        }
         fprintf(stderr, "%s: cannot read block %d, nbytes = %d\n",
             __func__, bno, nbytes);
         exit(-1);
     }
-    if (trace_flag > 1) {
-        printf("--- Recv ");
-        print_hex(data, nbytes);
-        printf("\n");
-    }
     get_status();
 }
 
 void dfu_write_block(int bno, uint8_t *data, int nbytes)
 {
+    int attempt = 0, error;
+
+    if (dry_run) {
+        estimate_dfu_block(1, nbytes);
+        return;
+    }
+
     if (bno >= 256 && bno < 2048)
         bno += 832;
-
-    if (trace_flag) {
-        printf("--- Send DNLOAD [%d] ", nbytes);
-        if (trace_flag > 1)
-            print_hex(data, nbytes);
-        printf("\n");
+again:
+    error = dev_write(REQUEST_DNLOAD, bno+2, nbytes, data);
+    if (error >= 0) {
+        get_status();
+        if (resync() >= 0)
+            return;
     }
-    int error = dev_write(REQUEST_DNLOAD, bno+2, nbytes, data);
-    if (error < 0) {
-        fprintf(stderr, "%s: cannot write block %d, nbytes = %d\n",
-            __func__, bno, nbytes);
-        exit(-1);
+    if (resync() >= 0 && retry_backoff(__func__, &attempt)) {
+        set_address(0x00000000);
+        goto again;
     }
-
-    get_status();
-    wait_dfu_idle();
+    fprintf(stderr, "%s: cannot write block %d, nbytes = %d\n",
+        __func__, bno, nbytes);
+    exit(-1);
 }
 
 void dfu_reboot()
@@ -532,11 +585,6 @@ void dfu_reboot()
 
     if (!dev)
         return;
-    if (trace_flag) {
-        printf("--- Send DNLOAD [2] ");
-        print_hex(cmd, 2);
-        printf("\n");
-    }
     wait_dfu_idle();
     int error = dev_write(REQUEST_DNLOAD, 0, 2, cmd);
     if (error < 0) {
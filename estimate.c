@@ -0,0 +1,391 @@
+/*
+ * Dry run: estimate the cost of transfers without the radio.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "util.h"
+
+int dry_run;
+
+static const char *TRANSPORT_NAME[STATS_NTRANSPORTS] = {
+    "serial", "hid", "dfu",
+};
+
+//
+// Dry run: counters of transactions which would be issued,
+// and latencies for estimating the time.
+//
+typedef struct {
+    unsigned long   transactions;       // Regular transactions
+    unsigned long   bytes;              // Bytes sent and received
+    unsigned long   erases;             // Flash erase commands
+    unsigned long   erase_transactions; // Transactions of erase commands
+    unsigned long   erase_bytes;        // Bytes of erase commands
+    unsigned long   bank_switches;      // Memory bank selections
+    double          fixed_usec;         // Latency per transaction
+    double          byte_usec;          // Latency per byte
+    double          erase_usec;         // Time of erase command
+} estimate_t;
+
+//
+// Defaults: serial port at 115200 baud, full-speed USB
+// with 1-msec polling of interrupt endpoint, and typical
+// erase time of 64-kbyte flash sector.
+//
+static estimate_t estimate[STATS_NTRANSPORTS] = {
+    [STATS_SERIAL] = { .fixed_usec = 1000, .byte_usec = 87 },
+    [STATS_HID]    = { .fixed_usec = 1000, .byte_usec = 1 },
+    [STATS_DFU]    = { .fixed_usec = 1000, .byte_usec = 1, .erase_usec = 500000 },
+};
+static unsigned long long estimate_delay_usec;
+static const char *calibration_filename;
+
+//
+// Skip a JSON string, starting at the opening quote.
+// Return pointer past the closing quote.
+//
+static const char *json_skip_string(const char *p, const char *end)
+{
+    for (p++; p < end && *p != '"'; p++) {
+        if (*p == '\\' && p+1 < end)
+            p++;
+    }
+    return (p < end) ? p+1 : end;
+}
+
+//
+// Find a field of JSON object, which contents are at [p, end).
+// Fields of nested objects are not searched.
+// Return pointer to the value, or 0 when not found.
+//
+static const char *json_field(const char *p, const char *end, const char *name)
+{
+    int len = strlen(name);
+    int depth = 0;
+
+    while (p < end && depth >= 0) {
+        if (*p == '"') {
+            const char *str = p + 1;
+
+            p = json_skip_string(p, end);
+            if (depth == 0 && p - str - 1 == len && strncmp(str, name, len) == 0) {
+                while (p < end && isspace((unsigned char)*p))
+                    p++;
+                if (p < end && *p == ':') {
+                    for (p++; p < end && isspace((unsigned char)*p); p++)
+                        continue;
+                    return p;
+                }
+            }
+            continue;
+        }
+        if (*p == '{' || *p == '[')
+            depth++;
+        else if (*p == '}' || *p == ']')
+            depth--;
+        p++;
+    }
+    return 0;
+}
+
+//
+// Find a nested JSON object by name.
+// On input, [*p, *end) are contents of the outer object.
+// On success, they are set to contents of the nested object.
+// Return 0 when not found.
+//
+static int json_object(const char **p, const char **end, const char *name)
+{
+    const char *v = json_field(*p, *end, name);
+    const char *q;
+    int depth = 0;
+
+    if (! v || *v != '{')
+        return 0;
+    for (q = v; q < *end; ) {
+        if (*q == '"') {
+            q = json_skip_string(q, *end);
+            continue;
+        }
+        if (*q == '{') {
+            depth++;
+        } else if (*q == '}' && --depth == 0) {
+            *p = v + 1;
+            *end = q;
+            return 1;
+        }
+        q++;
+    }
+    return 0;
+}
+
+//
+// Get a numeric field of JSON object, which contents are at [p, end).
+// Return 0 when not found.
+//
+static int json_number(const char *p, const char *end, const char *name, double *value)
+{
+    const char *v = json_field(p, end, name);
+    char *e;
+
+    if (! v)
+        return 0;
+    *value = strtod(v, &e);
+    return e != v;
+}
+
+//
+// Calibration file has no required field: reject it.
+//
+static void missing_field(const char *filename, const char *object, const char *name)
+{
+    fprintf(stderr, "%s: No field \"%s\" in %s.\n", filename, name, object);
+    exit(-1);
+}
+
+//
+// Load latencies from a report of --stats option.
+// Only transports with transactions are used.
+//
+void estimate_calibrate(const char *filename)
+{
+    static char text[64*1024];
+    const char *start, *end;
+    FILE *f;
+    int tr;
+
+    f = fopen(filename, "r");
+    if (! f) {
+        perror(filename);
+        exit(-1);
+    }
+    end = text + fread(text, 1, sizeof(text) - 1, f);
+    fclose(f);
+
+    start = memchr(text, '{', end - text);
+    if (! start) {
+        fprintf(stderr, "%s: Not a report of --stats option.\n", filename);
+        exit(-1);
+    }
+    start++;
+    if (! json_object(&start, &end, "transports"))
+        missing_field(filename, "report", "transports");
+
+    for (tr=0; tr<STATS_NTRANSPORTS; tr++) {
+        estimate_t *e = &estimate[tr];
+        const char *name = TRANSPORT_NAME[tr];
+        const char *p = start, *pend = end;
+        const char *lat, *lat_end;
+        double n, fixed, byte, erase;
+
+        if (! json_object(&p, &pend, name))
+            missing_field(filename, "transports", name);
+        if (! json_number(p, pend, "transactions", &n))
+            missing_field(filename, name, "transactions");
+        if (! json_number(p, pend, "erase_mean_usec", &erase))
+            missing_field(filename, name, "erase_mean_usec");
+
+        lat = p;
+        lat_end = pend;
+        if (! json_object(&lat, &lat_end, "latency"))
+            missing_field(filename, name, "latency");
+        if (! json_number(lat, lat_end, "fixed_usec", &fixed))
+            missing_field(filename, name, "fixed_usec");
+        if (! json_number(lat, lat_end, "per_byte_usec", &byte))
+            missing_field(filename, name, "per_byte_usec");
+
+        if (n == 0)
+            continue;
+        e->fixed_usec = fixed;
+        e->byte_usec = byte;
+        if (erase > 0)
+            e->erase_usec = erase;
+    }
+    calibration_filename = filename;
+}
+
+static void add_transactions(int tr, unsigned count, unsigned nbytes)
+{
+    estimate[tr].transactions += count;
+    estimate[tr].bytes += nbytes;
+}
+
+static void add_erase(int tr, unsigned count, unsigned nbytes)
+{
+    estimate[tr].erases++;
+    estimate[tr].erase_transactions += count;
+    estimate[tr].erase_bytes += nbytes;
+}
+
+//
+// DFU command: DNLOAD, GETSTATUS, then GETSTATE, ABORT
+// and GETSTATE until the device is idle.
+//
+static void dfu_command(int nbytes)
+{
+    add_transactions(STATS_DFU, 5, nbytes + 6 + 2);
+}
+
+//
+// Count transactions of dfu_erase().
+//
+void estimate_dfu_erase(unsigned start, unsigned finish)
+{
+    unsigned addr;
+
+    // Enter Programming Mode, with two delays of 100 msec.
+    add_transactions(STATS_DFU, 2, 6 + 1);
+    dfu_command(2);
+    estimate_delay_usec += 200000;
+
+    if (start == 0) {
+        // Configuration memory, then extended configuration memory.
+        for (addr=0; addr<0x40000; addr+=0x10000)
+            add_erase(STATS_DFU, 5, 5 + 6 + 2);
+        if (finish > 256*1024) {
+            for (addr=0x110000; addr<0x1e0000; addr+=0x10000)
+                add_erase(STATS_DFU, 5, 5 + 6 + 2);
+        }
+    } else {
+        // Callsign database.
+        for (addr=start; addr<finish; addr+=0x10000)
+            add_erase(STATS_DFU, 5, 5 + 6 + 2);
+    }
+
+    // Zero address.
+    dfu_command(5);
+}
+
+//
+// Count transactions of dfu_erase_image().
+//
+void estimate_dfu_erase_image(unsigned start, unsigned finish)
+{
+    unsigned addr;
+
+    // Enter Programming Mode, with two delays of 100 msec.
+    add_transactions(STATS_DFU, 2, 6 + 1);
+    dfu_command(2);
+    estimate_delay_usec += 200000;
+
+    for (addr=start & ~0xffff; addr<finish; addr+=0x10000)
+        add_erase(STATS_DFU, 5, 5 + 6 + 2);
+
+    // Zero address.
+    dfu_command(5);
+}
+
+//
+// Count transactions of dfu_read_block() and dfu_write_block().
+// Read is UPLOAD and GETSTATUS; write is a command with data.
+//
+void estimate_dfu_block(int write_flag, int nbytes)
+{
+    if (write_flag)
+        dfu_command(nbytes);
+    else
+        add_transactions(STATS_DFU, 2, nbytes + 6);
+}
+
+//
+// Count transactions of hid_read_block() and hid_write_block().
+// Memory bank is selected by CWB command when changed.
+// Data go by 32 bytes, with 4-byte header in every packet.
+//
+void estimate_hid_block(int write_flag, unsigned addr, int nbytes)
+{
+    static unsigned bank = 0;
+    unsigned n = nbytes / 32;
+
+    if (bank != (addr & 0x10000)) {
+        bank = addr & 0x10000;
+        add_transactions(STATS_HID, 1, 4 + 8 + 1);
+        estimate[STATS_HID].bank_switches++;
+    }
+    if (write_flag)
+        add_transactions(STATS_HID, n, n * (4 + 4+32 + 1));
+    else
+        add_transactions(STATS_HID, n, n * (4 + 4 + 4+32));
+}
+
+//
+// Count ENDR or ENDW command.
+//
+void estimate_hid_finish()
+{
+    add_transactions(STATS_HID, 1, 4 + 4 + 1);
+}
+
+//
+// Count transactions of serial_read_region() and serial_write_region().
+//
+void estimate_serial_region(int write_flag, int nbytes)
+{
+    unsigned n;
+
+    if (write_flag) {
+        n = (nbytes + SERIAL_WRITE_SIZE - 1) / SERIAL_WRITE_SIZE;
+        add_transactions(STATS_SERIAL, n, n * (8 + SERIAL_WRITE_SIZE + 1));
+    } else {
+        n = (nbytes + SERIAL_READ_SIZE - 1) / SERIAL_READ_SIZE;
+        add_transactions(STATS_SERIAL, n, n * (6 + 8 + SERIAL_READ_SIZE));
+    }
+}
+
+//
+// Print the counts and estimated time.
+//
+void estimate_print(FILE *out, const char *radio_name)
+{
+    double total_usec = estimate_delay_usec;
+    int tr;
+
+    fprintf(out, "Dry run for %s: no data transferred.\n", radio_name);
+    fprintf(out, "Transport  Transactions      Bytes  Erases  Banks  Time, sec\n");
+    for (tr=0; tr<STATS_NTRANSPORTS; tr++) {
+        estimate_t *e = &estimate[tr];
+        double usec;
+
+        if (e->transactions + e->erase_transactions == 0)
+            continue;
+        usec = e->transactions * e->fixed_usec + e->bytes * e->byte_usec +
+               e->erases * e->erase_usec;
+        total_usec += usec;
+        fprintf(out, "%-9s %13lu %10lu %7lu %6lu %10.1f\n",
+            TRANSPORT_NAME[tr], e->transactions + e->erase_transactions,
+            e->bytes + e->erase_bytes, e->erases, e->bank_switches,
+            usec / 1000000);
+    }
+    if (estimate_delay_usec > 0)
+        fprintf(out, "Protocol delays: %.1f sec\n", estimate_delay_usec / 1000000.0);
+    fprintf(out, "Estimated time: %.1f seconds, excluding connect and disconnect.\n",
+        total_usec / 1000000);
+    fprintf(out, "Latencies %s%s.\n", calibration_filename ? "measured in " : "are default",
+        calibration_filename ? calibration_filename : "");
+}
@@ -180,14 +180,7 @@ typedef struct {
 
     // Bytes 16-19
     uint8_t id[4];                      // BCD coded 8 digits
-#define GET_ID(x) (((x)[0] >> 4) * 10000000 +\
-                   ((x)[0] & 15) * 1000000 +\
-                   ((x)[1] >> 4) * 100000 +\
-                   ((x)[1] & 15) * 10000 +\
-                   ((x)[2] >> 4) * 1000 +\
-                   ((x)[2] & 15) * 100 +\
-                   ((x)[3] >> 4) * 10 +\
-                   ((x)[3] & 15))
+#define GET_ID(x) bcd_get(x, 4)
 #define CONTACT_ID(ct) GET_ID((ct)->id)
 
     // Byte 20
@@ -342,8 +335,101 @@ static void gd77_print_version(radio_device_t *radio, FILE *out)
     }
 }
 
+//
+// Vocabulary of configuration script.
+//
+enum {
+    PARAM_RADIO, PARAM_NAME, PARAM_ID, PARAM_DATE, PARAM_VERSION, PARAM_INTRO1, PARAM_INTRO2,
+};
+
+static const keyword_t PARAMETER_WORDS[] = {
+    { "Radio",                 PARAM_RADIO },
+    { "Name",                  PARAM_NAME },
+    { "ID",                    PARAM_ID },
+    { "Last Programmed Date",  PARAM_DATE },
+    { "CPS Software Version",  PARAM_VERSION },
+    { "Intro Line 1",          PARAM_INTRO1 },
+    { "Intro Line 2",          PARAM_INTRO2 },
+    { 0 },
+};
+static keyword_table_t parameter_table = { PARAMETER_WORDS };
+
+static const keyword_t HEADER_WORDS[] = {
+    { "Digital",    'D' },
+    { "Analog",     'A' },
+    { "Zone",       'Z' },
+    { "Scanlist",   'S' },
+    { "Contact",    'C' },
+    { "Grouplist",  'G' },
+    { "Message",    'M' },
+    { 0 },
+};
+static keyword_table_t header_table = { HEADER_WORDS };
+
+static const keyword_t POWER_WORDS[] = {
+    { "High",  POWER_HIGH },
+    { "Low",   POWER_LOW },
+    { 0 },
+};
+static keyword_table_t power_table = { POWER_WORDS };
+
+static const keyword_t DIGITAL_ADMIT_WORDS[] = {
+    { "Always",  ADMIT_ALWAYS },
+    { "Free",    ADMIT_CH_FREE },
+    { "Color",   ADMIT_COLOR },
+    { 0 },
+};
+static keyword_table_t digital_admit_table = { DIGITAL_ADMIT_WORDS };
+
+static const keyword_t ANALOG_ADMIT_WORDS[] = {
+    { "Always",  ADMIT_ALWAYS },
+    { "Free",    ADMIT_CH_FREE },
+    { 0 },
+};
+static keyword_table_t analog_admit_table = { ANALOG_ADMIT_WORDS };
+
+static const keyword_t SQUELCH_WORDS[] = {
+    { "Normal",  SQ_NORMAL },
+    { "Tight",   SQ_TIGHT },
+    { 0 },
+};
+static keyword_table_t squelch_table = { SQUELCH_WORDS };
+
+static const keyword_t WIDTH_WORDS[] = {
+    { "12.5",  BW_12_5_KHZ },
+    { "25",    BW_25_KHZ },
+    { 0 },
+};
+static keyword_table_t width_table = { WIDTH_WORDS };
+
+static const keyword_t CALL_TYPE_WORDS[] = {
+    { "Group",    CALL_GROUP },
+    { "Private",  CALL_PRIVATE },
+    { "All",      CALL_ALL },
+    { 0 },
+};
+static keyword_table_t call_type_table = { CALL_TYPE_WORDS };
+
+//
+// Map of tables in memory image.
+//
+static const table_range_t gd77_tables[] = {
+    { TABLE_VERSION,    OFFSET_TIMESTMP,    8 },
+    { TABLE_SETTINGS,   OFFSET_SETTINGS,    sizeof(general_settings_t) },
+    { TABLE_MESSAGES,   OFFSET_MSGTAB,      sizeof(msgtab_t) },
+    { TABLE_SCANLISTS,  OFFSET_SCANTAB,     sizeof(scantab_t) },
+    { TABLE_CHANNELS,   OFFSET_BANK_0,      sizeof(bank_t) },
+    { TABLE_SETTINGS,   OFFSET_INTRO,       sizeof(intro_text_t) },
+    { TABLE_ZONES,      OFFSET_ZONETAB,     sizeof(zonetab_t) },
+    { TABLE_CHANNELS,   OFFSET_BANK_1,      7 * sizeof(bank_t) },
+    { TABLE_CONTACTS,   OFFSET_CONTACTS,    NCONTACTS * 24 },
+    { TABLE_GROUPLISTS, OFFSET_GROUPTAB,    sizeof(grouptab_t) },
+    { 0 },
+};
+
 //
 // Read memory image from the device.
+// Blocks of tables which are not selected are skipped.
 //
 static void download(radio_device_t *radio)
 {
@@ -355,6 +441,8 @@ static void download(radio_device_t *radio)
             // Skip range 0x7c00...0x8000.
             continue;
         }
+        if (! radio_range_selected(bno*128, 128))
+            continue;
         hid_read_block(bno, &radio_mem[bno*128], 128);
 
         ++radio_progress;
@@ -384,6 +472,7 @@ static void gd77_download(radio_device_t *radio)
 
 //
 // Write memory image to the device.
+// Blocks of tables which are not selected are skipped.
 //
 static void gd77_upload(radio_device_t *radio, int cont_flag)
 {
@@ -395,7 +484,10 @@ static void gd77_upload(radio_device_t *radio, int cont_flag)
             // Skip range 0x7c00...0x8000.
             continue;
         }
+        if (! radio_range_selected(bno*128, 128))
+            continue;
         hid_write_block(bno, &radio_mem[bno*128], 128);
+        radio_mark_written(bno*128, 128);
 
         ++radio_progress;
         if (radio_progress % 32 == 0) {
@@ -564,10 +656,7 @@ static void setup_contact(int index, const char *name, int type, int id, int rxt
 {
     contact_t *ct = GET_CONTACT(index);
 
-    ct->id[0] = ((id / 10000000) << 4) | ((id / 1000000) % 10);
-    ct->id[1] = ((id / 100000 % 10) << 4) | ((id / 10000) % 10);
-    ct->id[2] = ((id / 1000 % 10) << 4) | ((id / 100) % 10);
-    ct->id[3] = ((id / 10 % 10) << 4) | (id % 10);
+    bcd_put(ct->id, 4, id);
 
     ct->type         = type;
     ct->receive_tone = rxtone;
@@ -652,8 +741,10 @@ static void setup_message(int index, const char *text)
 //
 // Check that the radio does support this frequency.
 //
-static int is_valid_frequency(int mhz)
+static int is_valid_frequency(freq_t hz)
 {
+    int mhz = hz / 1000000;
+
     if (mhz >= 136 && mhz <= 174)
         return 1;
     if (mhz >= 400 && mhz <= 480)
@@ -688,7 +779,7 @@ static channel_t *get_channel(int i)
 //
 // Set the parameters for a given memory channel.
 //
-static void setup_channel(int i, int mode, char *name, double rx_mhz, double tx_mhz,
+static void setup_channel(int i, int mode, char *name, freq_t rx_hz, freq_t tx_hz,
     int power, int scanlist, int squelch, int tot, int rxonly,
     int admit, int colorcode, int timeslot, int grouplist, int contact,
     int rxtone, int txtone, int width)
@@ -710,8 +801,8 @@ static void setup_channel(int i, int mode, char *name, double rx_mhz, double tx_
     ch->tot                 = tot;
     ch->scan_list_index     = scanlist;
     ch->group_list_index    = grouplist;
-    ch->rx_frequency        = mhz_to_abcdefgh(rx_mhz);
-    ch->tx_frequency        = mhz_to_abcdefgh(tx_mhz);
+    ch->rx_frequency        = hz_to_abcdefgh(rx_hz);
+    ch->tx_frequency        = hz_to_abcdefgh(tx_hz);
     ch->ctcss_dcs_receive   = rxtone;
     ch->ctcss_dcs_transmit  = txtone;
 
@@ -1177,18 +1268,20 @@ static void gd77_print_config(radio_device_t *radio, FILE *out, int verbose)
 {
     int i;
 
-    fprintf(out, "Radio: %s\n", radio->name);
-    if (verbose)
-        gd77_print_version(radio, out);
+    if (radio_table_selected(TABLE_VERSION)) {
+        fprintf(out, "Radio: %s\n", radio->name);
+        if (verbose)
+            gd77_print_version(radio, out);
+    }
 
     //
     // Channels.
     //
-    if (have_channels(MODE_DIGITAL)) {
+    if (radio_table_selected(TABLE_CHANNELS) && have_channels(MODE_DIGITAL)) {
         fprintf(out, "\n");
         print_digital_channels(out, verbose);
     }
-    if (have_channels(MODE_ANALOG)) {
+    if (radio_table_selected(TABLE_CHANNELS) && have_channels(MODE_ANALOG)) {
         fprintf(out, "\n");
         print_analog_channels(out, verbose);
     }
@@ -1196,7 +1289,7 @@ static void gd77_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Zones.
     //
-    if (have_zones()) {
+    if (radio_table_selected(TABLE_ZONES) && have_zones()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of channel zones.\n");
@@ -1228,7 +1321,7 @@ static void gd77_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Scan lists.
     //
-    if (have_scanlists()) {
+    if (radio_table_selected(TABLE_SCANLISTS) && have_scanlists()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of scan lists.\n");
@@ -1291,7 +1384,7 @@ static void gd77_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Contacts.
     //
-    if (have_contacts()) {
+    if (radio_table_selected(TABLE_CONTACTS) && have_contacts()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of contacts.\n");
@@ -1321,7 +1414,7 @@ static void gd77_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Group lists.
     //
-    if (have_grouplists()) {
+    if (radio_table_selected(TABLE_GROUPLISTS) && have_grouplists()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of group lists.\n");
@@ -1354,7 +1447,7 @@ static void gd77_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Text messages.
     //
-    if (have_messages()) {
+    if (radio_table_selected(TABLE_MESSAGES) && have_messages()) {
         msgtab_t *mt = GET_MSGTAB();
 
         fprintf(out, "\n");
@@ -1377,8 +1470,10 @@ static void gd77_print_config(radio_device_t *radio, FILE *out, int verbose)
     }
 
     // General settings.
-    print_id(out, verbose);
-    print_intro(out, verbose);
+    if (radio_table_selected(TABLE_SETTINGS)) {
+        print_id(out, verbose);
+        print_intro(out, verbose);
+    }
 }
 
 //
@@ -1468,7 +1563,9 @@ static void erase_contacts()
 //
 static void gd77_parse_parameter(radio_device_t *radio, char *param, char *value)
 {
-    if (strcasecmp("Radio", param) == 0) {
+    int kw = keyword_lookup(&parameter_table, param);
+
+    if (kw == PARAM_RADIO) {
         if (!radio_is_compatible(value)) {
             fprintf(stderr, "Incompatible model: %s\n", value);
             exit(-1);
@@ -1477,34 +1574,35 @@ static void gd77_parse_parameter(radio_device_t *radio, char *param, char *value
     }
 
     general_settings_t *gs = GET_SETTINGS();
-    if (strcasecmp ("Name", param) == 0) {
+    if (kw == PARAM_NAME) {
         ascii_decode(gs->radio_name, value, 8, 0xff);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("ID", param) == 0) {
+    if (kw == PARAM_ID) {
         uint32_t id = strtoul(value, 0, 0);
-        gs->radio_id[0] = ((id / 10000000) << 4) | ((id / 1000000) % 10);
-        gs->radio_id[1] = ((id / 100000 % 10) << 4) | ((id / 10000) % 10);
-        gs->radio_id[2] = ((id / 1000 % 10) << 4) | ((id / 100) % 10);
-        gs->radio_id[3] = ((id / 10 % 10) << 4) | (id % 10);
+        bcd_put(gs->radio_id, 4, id);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("Last Programmed Date", param) == 0) {
+    if (kw == PARAM_DATE) {
         // Ignore.
         return;
     }
-    if (strcasecmp ("CPS Software Version", param) == 0) {
+    if (kw == PARAM_VERSION) {
         // Ignore.
         return;
     }
 
     intro_text_t *it = GET_INTRO();
-    if (strcasecmp ("Intro Line 1", param) == 0) {
+    if (kw == PARAM_INTRO1) {
         ascii_decode(it->intro_line1, value, 16, 0xff);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("Intro Line 2", param) == 0) {
+    if (kw == PARAM_INTRO2) {
         ascii_decode(it->intro_line2, value, 16, 0xff);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
     fprintf(stderr, "Unknown parameter: %s = %s\n", param, value);
@@ -1516,22 +1614,31 @@ static void gd77_parse_parameter(radio_device_t *radio, char *param, char *value
 // Start_flag is 1 for the first table row.
 // Return 0 on failure.
 //
-static int parse_digital_channel(radio_device_t *radio, int first_row, char *line)
+static int parse_digital_channel(radio_device_t *radio, int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], rxfreq_str[256], offset_str[256];
-    char power_str[256], scanlist_str[256];
-    char tot_str[256], rxonly_str[256], admit_str[256], colorcode_str[256];
-    char slot_str[256], grouplist_str[256], contact_str[256];
+    char *num_str, *name_str, *rxfreq_str, *offset_str;
+    char *power_str, *scanlist_str;
+    char *tot_str, *rxonly_str, *admit_str, *colorcode_str;
+    char *slot_str, *grouplist_str, *contact_str;
     int num, power, scanlist, tot, rxonly, admit;
     int colorcode, timeslot, grouplist, contact;
-    double rx_mhz, tx_mhz;
+    freq_t rx_hz, tx_hz;
 
-    if (sscanf(line, "%s %s %s %s %s %s %s %s %s %s %s %s %s",
-        num_str, name_str, rxfreq_str, offset_str,
-        power_str, scanlist_str,
-        tot_str, rxonly_str, admit_str, colorcode_str,
-        slot_str, grouplist_str, contact_str) != 13)
+    if (ntok < 13)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    rxfreq_str = tok[2].str;
+    offset_str = tok[3].str;
+    power_str = tok[4].str;
+    scanlist_str = tok[5].str;
+    tot_str = tok[6].str;
+    rxonly_str = tok[7].str;
+    admit_str = tok[8].str;
+    colorcode_str = tok[9].str;
+    slot_str = tok[10].str;
+    grouplist_str = tok[11].str;
+    contact_str = tok[12].str;
 
     num = atoi(num_str);
     if (num < 1 || num > NCHAN) {
@@ -1539,25 +1646,22 @@ static int parse_digital_channel(radio_device_t *radio, int first_row, char *lin
         return 0;
     }
 
-    if (sscanf(rxfreq_str, "%lf", &rx_mhz) != 1 ||
-        !is_valid_frequency(rx_mhz)) {
+    if (!parse_freq(rxfreq_str, &rx_hz) ||
+        !is_valid_frequency(rx_hz)) {
         fprintf(stderr, "Bad receive frequency.\n");
         return 0;
     }
-    if (sscanf(offset_str, "%lf", &tx_mhz) != 1) {
+    if (!parse_freq(offset_str, &tx_hz)) {
 badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
     if (offset_str[0] == '-' || offset_str[0] == '+')
-        tx_mhz += rx_mhz;
-    if (! is_valid_frequency(tx_mhz))
+        tx_hz += rx_hz;
+    if (! is_valid_frequency(tx_hz))
         goto badtx;
 
-    if (strcasecmp("High", power_str) == 0) {
-        power = POWER_HIGH;
-    } else if (strcasecmp("Low", power_str) == 0) {
-        power = POWER_LOW;
-    } else {
+    power = keyword_lookup(&power_table, power_str);
+    if (power < 0) {
         fprintf(stderr, "Bad power level.\n");
         return 0;
     }
@@ -1588,13 +1692,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (*admit_str == '-' || strcasecmp("Always", admit_str) == 0) {
+    if (*admit_str == '-') {
         admit = ADMIT_ALWAYS;
-    } else if (strcasecmp("Free", admit_str) == 0) {
-        admit = ADMIT_CH_FREE;
-    } else if (strcasecmp("Color", admit_str) == 0) {
-        admit = ADMIT_COLOR;
-    } else {
+    } else if ((admit = keyword_lookup(&digital_admit_table, admit_str)) < 0) {
         fprintf(stderr, "Bad admit criteria.\n");
         return 0;
     }
@@ -1636,9 +1736,10 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         erase_channels();
         erase_zones();
         erase_scanlists();
+        radio_touched |= TABLE_CHANNELS | TABLE_ZONES | TABLE_SCANLISTS;
     }
 
-    setup_channel(num-1, MODE_DIGITAL, name_str, rx_mhz, tx_mhz,
+    setup_channel(num-1, MODE_DIGITAL, name_str, rx_hz, tx_hz,
         power, scanlist, 5, tot, rxonly, admit,
         colorcode, timeslot, grouplist, contact, 0xffff, 0xffff, BW_12_5_KHZ);
 
@@ -1651,22 +1752,31 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
 // Start_flag is 1 for the first table row.
 // Return 0 on failure.
 //
-static int parse_analog_channel(radio_device_t *radio, int first_row, char *line)
+static int parse_analog_channel(radio_device_t *radio, int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], rxfreq_str[256], offset_str[256];
-    char power_str[256], scanlist_str[256], squelch_str[256];
-    char tot_str[256], rxonly_str[256], admit_str[256];
-    char rxtone_str[256], txtone_str[256], width_str[256];
+    char *num_str, *name_str, *rxfreq_str, *offset_str;
+    char *power_str, *scanlist_str, *squelch_str;
+    char *tot_str, *rxonly_str, *admit_str;
+    char *rxtone_str, *txtone_str, *width_str;
     int num, power, scanlist, squelch, tot, rxonly, admit;
     int rxtone, txtone, width;
-    double rx_mhz, tx_mhz;
+    freq_t rx_hz, tx_hz;
 
-    if (sscanf(line, "%s %s %s %s %s %s %s %s %s %s %s %s %s",
-        num_str, name_str, rxfreq_str, offset_str,
-        power_str, scanlist_str,
-        tot_str, rxonly_str, admit_str, squelch_str,
-        rxtone_str, txtone_str, width_str) != 13)
+    if (ntok < 13)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    rxfreq_str = tok[2].str;
+    offset_str = tok[3].str;
+    power_str = tok[4].str;
+    scanlist_str = tok[5].str;
+    tot_str = tok[6].str;
+    rxonly_str = tok[7].str;
+    admit_str = tok[8].str;
+    squelch_str = tok[9].str;
+    rxtone_str = tok[10].str;
+    txtone_str = tok[11].str;
+    width_str = tok[12].str;
 
     num = atoi(num_str);
     if (num < 1 || num > NCHAN) {
@@ -1674,25 +1784,22 @@ static int parse_analog_channel(radio_device_t *radio, int first_row, char *line
         return 0;
     }
 
-    if (sscanf(rxfreq_str, "%lf", &rx_mhz) != 1 ||
-        !is_valid_frequency(rx_mhz)) {
+    if (!parse_freq(rxfreq_str, &rx_hz) ||
+        !is_valid_frequency(rx_hz)) {
         fprintf(stderr, "Bad receive frequency.\n");
         return 0;
     }
-    if (sscanf(offset_str, "%lf", &tx_mhz) != 1) {
+    if (!parse_freq(offset_str, &tx_hz)) {
 badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
     if (offset_str[0] == '-' || offset_str[0] == '+')
-        tx_mhz += rx_mhz;
-    if (! is_valid_frequency(tx_mhz))
+        tx_hz += rx_hz;
+    if (! is_valid_frequency(tx_hz))
         goto badtx;
 
-    if (strcasecmp("High", power_str) == 0) {
-        power = POWER_HIGH;
-    } else if (strcasecmp("Low", power_str) == 0) {
-        power = POWER_LOW;
-    } else {
+    power = keyword_lookup(&power_table, power_str);
+    if (power < 0) {
         fprintf(stderr, "Bad power level.\n");
         return 0;
     }
@@ -1707,12 +1814,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         }
     }
 
-    if (strcasecmp ("Normal", squelch_str) == 0) {
-        squelch = SQ_NORMAL;
-    } else if (strcasecmp ("Tight", squelch_str) == 0) {
-        squelch = SQ_TIGHT;
-    } else {
-        fprintf (stderr, "Bad squelch level.\n");
+    squelch = keyword_lookup(&squelch_table, squelch_str);
+    if (squelch < 0) {
+        fprintf(stderr, "Bad squelch level.\n");
         return 0;
     }
 
@@ -1732,11 +1836,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (*admit_str == '-' || strcasecmp("Always", admit_str) == 0) {
+    if (*admit_str == '-') {
         admit = ADMIT_ALWAYS;
-    } else if (strcasecmp("Free", admit_str) == 0) {
-        admit = ADMIT_CH_FREE;
-    } else {
+    } else if ((admit = keyword_lookup(&analog_admit_table, admit_str)) < 0) {
         fprintf(stderr, "Bad admit criteria.\n");
         return 0;
     }
@@ -1752,12 +1854,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (strcasecmp ("12.5", width_str) == 0) {
-        width = BW_12_5_KHZ;
-    } else if (strcasecmp ("25", width_str) == 0) {
-        width = BW_25_KHZ;
-    } else {
-        fprintf (stderr, "Bad width.\n");
+    width = keyword_lookup(&width_table, width_str);
+    if (width < 0) {
+        fprintf(stderr, "Bad width.\n");
         return 0;
     }
 
@@ -1766,9 +1865,10 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         erase_channels();
         erase_zones();
         erase_scanlists();
+        radio_touched |= TABLE_CHANNELS | TABLE_ZONES | TABLE_SCANLISTS;
     }
 
-    setup_channel(num-1, MODE_ANALOG, name_str, rx_mhz, tx_mhz,
+    setup_channel(num-1, MODE_ANALOG, name_str, rx_hz, tx_hz,
         power, scanlist, squelch, tot, rxonly, admit,
         0, 1, 0, 0, rxtone, txtone, width);
 
@@ -1780,13 +1880,16 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
 // Parse one line of Zones table.
 // Return 0 on failure.
 //
-static int parse_zones(int first_row, char *line)
+static int parse_zones(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], chan_str[256];
+    char *num_str, *name_str, *chan_str;
     int znum;
 
-    if (sscanf(line, "%s %s %s", num_str, name_str, chan_str) != 3)
+    if (ntok < 3)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    chan_str = tok[2].str;
 
     znum = strtoul(num_str, 0, 10);
     if (znum < 1 || znum > NZONES) {
@@ -1797,6 +1900,7 @@ static int parse_zones(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Zones table.
         erase_zones();
+        radio_touched |= TABLE_ZONES;
     }
 
     setup_zone(znum-1, name_str);
@@ -1856,15 +1960,20 @@ static int parse_zones(int first_row, char *line)
 // Parse one line of Scanlist table.
 // Return 0 on failure.
 //
-static int parse_scanlist(int first_row, char *line)
+static int parse_scanlist(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], prio1_str[256], prio2_str[256];
-    char tx_str[256], chan_str[256];
+    char *num_str, *name_str, *prio1_str, *prio2_str;
+    char *tx_str, *chan_str;
     int snum, prio1, prio2, txchan;
 
-    if (sscanf(line, "%s %s %s %s %s %s",
-        num_str, name_str, prio1_str, prio2_str, tx_str, chan_str) != 6)
+    if (ntok < 6)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    prio1_str = tok[2].str;
+    prio2_str = tok[3].str;
+    tx_str = tok[4].str;
+    chan_str = tok[5].str;
 
     snum = atoi(num_str);
     if (snum < 1 || snum > NSCANL) {
@@ -1875,6 +1984,7 @@ static int parse_scanlist(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Scanlists table.
         erase_scanlists();
+        radio_touched |= TABLE_SCANLISTS;
     }
 
     if (*prio1_str == '-') {
@@ -1978,14 +2088,18 @@ static int parse_scanlist(int first_row, char *line)
 // Parse one line of Contacts table.
 // Return 0 on failure.
 //
-static int parse_contact(int first_row, char *line)
+static int parse_contact(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], type_str[256], id_str[256], rxtone_str[256];
+    char *num_str, *name_str, *type_str, *id_str, *rxtone_str;
     int cnum, type, id, rxtone;
 
-    if (sscanf(line, "%s %s %s %s %s",
-        num_str, name_str, type_str, id_str, rxtone_str) != 5)
+    if (ntok < 5)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    type_str = tok[2].str;
+    id_str = tok[3].str;
+    rxtone_str = tok[4].str;
 
     cnum = atoi(num_str);
     if (cnum < 1 || cnum > NCONTACTS) {
@@ -1996,15 +2110,11 @@ static int parse_contact(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Contacts table.
         erase_contacts();
+        radio_touched |= TABLE_CONTACTS;
     }
 
-    if (strcasecmp("Group", type_str) == 0) {
-        type = CALL_GROUP;
-    } else if (strcasecmp("Private", type_str) == 0) {
-        type = CALL_PRIVATE;
-    } else if (strcasecmp("All", type_str) == 0) {
-        type = CALL_ALL;
-    } else {
+    type = keyword_lookup(&call_type_table, type_str);
+    if (type < 0) {
         fprintf(stderr, "Bad call type.\n");
         return 0;
     }
@@ -2032,13 +2142,16 @@ static int parse_contact(int first_row, char *line)
 // Parse one line of Grouplist table.
 // Return 0 on failure.
 //
-static int parse_grouplist(int first_row, char *line)
+static int parse_grouplist(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], list_str[256];
+    char *num_str, *name_str, *list_str;
     int glnum;
 
-    if (sscanf(line, "%s %s %s", num_str, name_str, list_str) != 3)
+    if (ntok < 3)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    list_str = tok[2].str;
 
     glnum = strtoul(num_str, 0, 10);
     if (glnum < 1 || glnum > NGLISTS) {
@@ -2049,6 +2162,7 @@ static int parse_grouplist(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Grouplists table.
         memset(&radio_mem[OFFSET_GROUPTAB], 0, sizeof(grouptab_t));
+        radio_touched |= TABLE_GROUPLISTS;
     }
 
     setup_grouplist(glnum-1, name_str);
@@ -2108,9 +2222,9 @@ static int parse_grouplist(int first_row, char *line)
 // Parse one line of Messages table.
 // Return 0 on failure.
 //
-static int parse_messages(int first_row, char *line)
+static int parse_messages(int first_row, token_t *tok, int ntok)
 {
-    char *text;
+    char *text, *line = token_rest(tok, ntok, 0);
     int mnum;
 
     mnum = strtoul(line, &text, 10);
@@ -2122,6 +2236,7 @@ static int parse_messages(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Messages table.
         memset(GET_MSGTAB(), 0, sizeof(msgtab_t));
+        radio_touched |= TABLE_MESSAGES;
     }
 
     setup_message(mnum-1, text);
@@ -2134,37 +2249,27 @@ static int parse_messages(int first_row, char *line)
 //
 static int gd77_parse_header(radio_device_t *radio, char *line)
 {
-    if (strncasecmp(line, "Digital", 7) == 0)
-        return 'D';
-    if (strncasecmp(line, "Analog", 6) == 0)
-        return 'A';
-    if (strncasecmp(line, "Zone", 4) == 0)
-        return 'Z';
-    if (strncasecmp(line, "Scanlist", 8) == 0)
-        return 'S';
-    if (strncasecmp(line, "Contact", 7) == 0)
-        return 'C';
-    if (strncasecmp(line, "Grouplist", 9) == 0)
-        return 'G';
-    if (strncasecmp(line, "Message", 7) == 0)
-        return 'M';
-    return 0;
+    int table_id = keyword_prefix(&header_table, line);
+
+    if (table_id < 0)
+        return 0;
+    return table_id;
 }
 
 //
 // Parse one line of table data.
 // Return 0 on failure.
 //
-static int gd77_parse_row(radio_device_t *radio, int table_id, int first_row, char *line)
+static int gd77_parse_row(radio_device_t *radio, int table_id, int first_row, token_t *tok, int ntok)
 {
     switch (table_id) {
-    case 'D': return parse_digital_channel(radio, first_row, line);
-    case 'A': return parse_analog_channel(radio, first_row, line);
-    case 'Z': return parse_zones(first_row, line);
-    case 'S': return parse_scanlist(first_row, line);
-    case 'C': return parse_contact(first_row, line);
-    case 'G': return parse_grouplist(first_row, line);
-    case 'M': return parse_messages(first_row, line);
+    case 'D': return parse_digital_channel(radio, first_row, tok, ntok);
+    case 'A': return parse_analog_channel(radio, first_row, tok, ntok);
+    case 'Z': return parse_zones(first_row, tok, ntok);
+    case 'S': return parse_scanlist(first_row, tok, ntok);
+    case 'C': return parse_contact(first_row, tok, ntok);
+    case 'G': return parse_grouplist(first_row, tok, ntok);
+    case 'M': return parse_messages(first_row, tok, ntok);
     }
     return 0;
 }
@@ -2334,5 +2439,8 @@ radio_device_t radio_gd77 = {
     gd77_parse_header,
     gd77_parse_row,
     gd77_update_timestamp,
-    //TODO: gd77_write_csv,
+    0,                          //TODO: gd77_write_csv,
+    0,                          // print_plan
+    gd77_tables,
+    MEMSZ,
 };
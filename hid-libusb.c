@@ -37,6 +37,7 @@ static libusb_device_handle *dev;           // libusb device
 static struct libusb_transfer *transfer;    // async transfer descriptor
 static unsigned char receive_buf[42];       // receive buffer
 static volatile int nbytes_received = 0;    // receive result
+static int replay_session;                  // serve from recorded session
 
 #define HID_INTERFACE   0                   // interface index
 #define TIMEOUT_MSEC    500                 // receive timeout
@@ -126,6 +127,8 @@ again:
         if (trace_flag > 0) {
             fprintf(stderr, "No response from HID device!\n");
         }
+        trace_record(STATS_HID, TRACE_ERROR, 0, 0, 0, 0, 0);
+        stats_timeout(STATS_HID);
         goto again;
     }
     return nbytes_received;
@@ -134,13 +137,14 @@ again:
 //
 // Send a request to the device.
 // Store the reply into the rdata[] array.
-// Terminate in case of errors.
+// Return -1 in case of errors.
 //
-void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength)
+int hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength)
 {
+    unsigned long long start = stats_usec();
     unsigned char buf[42];
+    unsigned addr = 0;
     unsigned char reply[42];
-    unsigned k;
     int reply_len;
 
     memset(buf, 0, sizeof(buf));
@@ -152,43 +156,36 @@ void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rd
         memcpy(buf+4, data, nbytes);
     nbytes += 4;
 
-    if (trace_flag > 0) {
-        fprintf(stderr, "---Send");
-        for (k=0; k<nbytes; ++k) {
-            if (k != 0 && (k & 15) == 0)
-                fprintf(stderr, "\n       ");
-            fprintf(stderr, " %02x", buf[k]);
-        }
-        fprintf(stderr, "\n");
-    }
-    reply_len = write_read(buf, sizeof(buf), reply, sizeof(reply));
+    // Read and write commands: get address for the trace.
+    if ((data[0] == 'R' || data[0] == 'W') && nbytes >= 8)
+        addr = data[1] << 8 | data[2];
+    trace_record(STATS_HID, TRACE_SEND, 0, addr, nbytes, buf, nbytes);
+    if (replay_session)
+        reply_len = replay_transfer(STATS_HID, 0, addr, nbytes, buf, nbytes, reply, sizeof(reply));
+    else
+        reply_len = write_read(buf, sizeof(buf), reply, sizeof(reply));
     if (reply_len < 0) {
-        exit(-1);
+        trace_record(STATS_HID, TRACE_ERROR, 0, reply_len, 0, 0, 0);
+        return -1;
     }
     if (reply_len != sizeof(reply)) {
         fprintf(stderr, "Short read: %d bytes instead of %d!\n",
             reply_len, (int)sizeof(reply));
-        exit(-1);
-    }
-    if (trace_flag > 0) {
-        fprintf(stderr, "---Recv");
-        for (k=0; k<reply_len; ++k) {
-            if (k != 0 && (k & 15) == 0)
-                fprintf(stderr, "\n       ");
-            fprintf(stderr, " %02x", reply[k]);
-        }
-        fprintf(stderr, "\n");
+        return -1;
     }
+    trace_record(STATS_HID, TRACE_RECV, 0, addr, reply_len, reply, reply_len);
     if (reply[0] != 3 || reply[1] != 0 || reply[3] != 0) {
         fprintf(stderr, "incorrect reply\n");
-        exit(-1);
+        return -1;
     }
     if (reply[2] != rlength) {
         fprintf(stderr, "incorrect reply length %d, expected %d\n",
             reply[2], rlength);
-        exit(-1);
+        return -1;
     }
     memcpy(rdata, reply+4, rlength);
+    stats_transaction(STATS_HID, nbytes + rlength, start);
+    return 0;
 }
 
 //
@@ -197,6 +194,14 @@ void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rd
 //
 int hid_init(int vid, int pid)
 {
+    if (replay_flag) {
+        // Use recorded session instead of the device.
+        if (replay_transport() != STATS_HID)
+            return -1;
+        replay_session = 1;
+        return 0;
+    }
+
     int error = libusb_init(&ctx);
     if (error < 0) {
         fprintf(stderr, "libusb init failed: %d: %s\n",
@@ -232,6 +237,7 @@ int hid_init(int vid, int pid)
 
 void hid_close()
 {
+    replay_session = 0;
     if (!ctx)
         return;
 
@@ -40,11 +40,13 @@ static volatile int nbytes_received = 0;    // receive result
 //
 // Send a request to the device.
 // Store the reply into the rdata[] array.
-// Terminate in case of errors.
+// Return -1 in case of errors.
 //
-void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength)
+int hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength)
 {
+    unsigned long long start = stats_usec();
     unsigned char buf[42];
+    unsigned addr = 0;
     unsigned k;
     IOReturn result;
 
@@ -57,15 +59,10 @@ void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rd
         memcpy(buf+4, data, nbytes);
     nbytes += 4;
 
-    if (trace_flag > 0) {
-        fprintf(stderr, "---Send");
-        for (k=0; k<nbytes; ++k) {
-            if (k != 0 && (k & 15) == 0)
-                fprintf(stderr, "\n       ");
-            fprintf(stderr, " %02x", buf[k]);
-        }
-        fprintf(stderr, "\n");
-    }
+    // Read and write commands: get address for the trace.
+    if ((data[0] == 'R' || data[0] == 'W') && nbytes >= 8)
+        addr = data[1] << 8 | data[2];
+    trace_record(STATS_HID, TRACE_SEND, 0, addr, nbytes, buf, nbytes);
     nbytes_received = 0;
     memset(receive_buf, 0, sizeof(receive_buf));
 again:
@@ -73,7 +70,8 @@ again:
     result = IOHIDDeviceSetReport(dev, kIOHIDReportTypeOutput, 0, buf, sizeof(buf));
     if (result != kIOReturnSuccess) {
         fprintf(stderr, "HID output error: %d!\n", result);
-        exit(-1);
+        trace_record(STATS_HID, TRACE_ERROR, 0, result, 0, 0, 0);
+        return -1;
     }
 
     // Run main application loop until reply received.
@@ -85,6 +83,8 @@ again:
             if (trace_flag > 0) {
                 fprintf(stderr, "No response from HID device!\n");
             }
+            trace_record(STATS_HID, TRACE_ERROR, 0, 0, 0, 0, 0);
+            stats_timeout(STATS_HID);
             goto again;
         }
     }
@@ -92,27 +92,21 @@ again:
     if (nbytes_received != sizeof(receive_buf)) {
         fprintf(stderr, "Short read: %d bytes instead of %d!\n",
             nbytes_received, (int)sizeof(receive_buf));
-        exit(-1);
-    }
-    if (trace_flag > 0) {
-        fprintf(stderr, "---Recv");
-        for (k=0; k<nbytes_received; ++k) {
-            if (k != 0 && (k & 15) == 0)
-                fprintf(stderr, "\n       ");
-            fprintf(stderr, " %02x", receive_buf[k]);
-        }
-        fprintf(stderr, "\n");
+        return -1;
     }
+    trace_record(STATS_HID, TRACE_RECV, 0, addr, nbytes_received, receive_buf, nbytes_received);
     if (receive_buf[0] != 3 || receive_buf[1] != 0 || receive_buf[3] != 0) {
         fprintf(stderr, "incorrect reply\n");
-        exit(-1);
+        return -1;
     }
     if (receive_buf[2] != rlength) {
         fprintf(stderr, "incorrect reply length %d, expected %d\n",
             receive_buf[2], rlength);
-        exit(-1);
+        return -1;
     }
     memcpy(rdata, receive_buf+4, rlength);
+    stats_transaction(STATS_HID, nbytes + rlength, start);
+    return 0;
 }
 
 //
@@ -41,12 +41,13 @@ static unsigned char receive_buf[42];       // receive buffer
 //
 // Send a request to the device.
 // Store the reply into the rdata[] array.
-// Terminate in case of errors.
+// Return -1 in case of errors.
 //
-void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength)
+int hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength)
 {
+    unsigned long long start = stats_usec();
     unsigned char buf[42];
-    unsigned k;
+    unsigned addr = 0;
     DWORD nbytes_received;
 
     memset(buf, 0, sizeof(buf));
@@ -58,54 +59,45 @@ void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rd
         memcpy(buf+4, data, nbytes);
     nbytes += 4;
 
-    if (trace_flag > 0) {
-        fprintf(stderr, "---Send");
-        for (k=0; k<nbytes; ++k) {
-            if (k != 0 && (k & 15) == 0)
-                fprintf(stderr, "\n       ");
-            fprintf(stderr, " %02x", buf[k]);
-        }
-        fprintf(stderr, "\n");
-    }
+    // Read and write commands: get address for the trace.
+    if ((data[0] == 'R' || data[0] == 'W') && nbytes >= 8)
+        addr = data[1] << 8 | data[2];
+    trace_record(STATS_HID, TRACE_SEND, 0, addr, nbytes, buf, nbytes);
     nbytes_received = 0;
     memset(receive_buf, 0, sizeof(receive_buf));
 
     // Write to HID device.
     if (!WriteFile(dev, buf, sizeof(buf), NULL, NULL)) {
         fprintf(stderr, "Error %#lx sending to HID device!\n", GetLastError());
-        exit(-1);
+        trace_record(STATS_HID, TRACE_ERROR, 0, GetLastError(), 0, 0, 0);
+        return -1;
     }
 
     // Receive reply.
     if (!ReadFile(dev, receive_buf, sizeof(receive_buf), &nbytes_received, NULL)) {
         fprintf(stderr, "Error %#lx receiving from HID device!\n", GetLastError());
-        exit(-1);
+        trace_record(STATS_HID, TRACE_ERROR, 0, GetLastError(), 0, 0, 0);
+        return -1;
     }
 
     if (nbytes_received != sizeof(receive_buf)) {
         fprintf(stderr, "Short read: %u bytes instead of %u!\n",
             (unsigned)nbytes_received, (unsigned)sizeof(receive_buf));
-        exit(-1);
-    }
-    if (trace_flag > 0) {
-        fprintf(stderr, "---Recv");
-        for (k=0; k<nbytes_received; ++k) {
-            if (k != 0 && (k & 15) == 0)
-                fprintf(stderr, "\n       ");
-            fprintf(stderr, " %02x", receive_buf[k]);
-        }
-        fprintf(stderr, "\n");
+        return -1;
     }
+    trace_record(STATS_HID, TRACE_RECV, 0, addr, nbytes_received, receive_buf, nbytes_received);
     if (receive_buf[0] != 3 || receive_buf[1] != 0 || receive_buf[3] != 0) {
         fprintf(stderr, "incorrect reply\n");
-        exit(-1);
+        return -1;
     }
     if (receive_buf[2] != rlength) {
         fprintf(stderr, "incorrect reply length %d, expected %d\n",
             receive_buf[2], rlength);
-        exit(-1);
+        return -1;
     }
     memcpy(rdata, receive_buf+4, rlength);
+    stats_transaction(STATS_HID, nbytes + rlength, start);
+    return 0;
 }
 
 //
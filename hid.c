@@ -41,7 +41,7 @@ static const unsigned char CMD_ENDW[]  = "ENDW";
 static const unsigned char CMD_CWB0[]  = "CWB\4\0\0\0\0";
 static const unsigned char CMD_CWB1[]  = "CWB\4\0\1\0\0";
 
-static unsigned offset = 0;                 // CWD offset
+static unsigned offset = 0;                 // CWB offset, or ~0 when unknown
 
 //
 // Query and return the device identification string.
@@ -51,16 +51,19 @@ const char *hid_identify()
     static unsigned char reply[38];
     unsigned char ack;
 
-    hid_send_recv(CMD_PRG, 7, &ack, 1);
+    if (hid_send_recv(CMD_PRG, 7, &ack, 1) < 0)
+        return 0;
     if (ack != CMD_ACK[0]) {
         fprintf(stderr, "%s: Wrong PRD acknowledge %#x, expected %#x\n",
             __func__, ack, CMD_ACK[0]);
         return 0;
     }
 
-    hid_send_recv(CMD_PRG2, 2, reply, 16);
+    if (hid_send_recv(CMD_PRG2, 2, reply, 16) < 0)
+        return 0;
 
-    hid_send_recv(CMD_ACK, 1, &ack, 1);
+    if (hid_send_recv(CMD_ACK, 1, &ack, 1) < 0)
+        return 0;
     if (ack != CMD_ACK[0]) {
         fprintf(stderr, "%s: Wrong PRG2 acknowledge %#x, expected %#x\n",
             __func__, ack, CMD_ACK[0]);
@@ -78,63 +81,69 @@ const char *hid_identify()
     return (char*)reply;
 }
 
-void hid_read_block(int bno, unsigned char *data, int nbytes)
+//
+// Send a command and check the acknowledge.
+// Return -1 on error.
+//
+static int send_ack(const char *func, const unsigned char *cmd, unsigned nbytes)
 {
-    unsigned addr = bno * nbytes;
-    unsigned char ack, cmd[4], reply[32+4];
-    int n;
+    unsigned char ack;
 
-    if (addr < 0x10000 && offset != 0) {
-        offset = 0;
-        hid_send_recv(CMD_CWB0, 8, &ack, 1);
-        if (ack != CMD_ACK[0]) {
-            fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
-                __func__, ack, CMD_ACK[0]);
-            exit(-1);
-        }
-    } else if (addr >= 0x10000 && offset == 0) {
-        offset = 0x00010000;
-        hid_send_recv(CMD_CWB1, 8, &ack, 1);
-        if (ack != CMD_ACK[0]) {
-            fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
-                __func__, ack, CMD_ACK[0]);
-            exit(-1);
-        }
+    if (hid_send_recv(cmd, nbytes, &ack, 1) < 0)
+        return -1;
+    if (ack != CMD_ACK[0]) {
+        fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
+            func, ack, CMD_ACK[0]);
+        return -1;
     }
+    return 0;
+}
+
+//
+// Select memory bank for a given address.
+// Return -1 on error.
+//
+static int select_bank(unsigned addr)
+{
+    unsigned bank = (addr < 0x10000) ? 0 : 0x00010000;
+
+    if (offset == bank)
+        return 0;
+
+    offset = ~0;
+    if (send_ack(__func__, bank ? CMD_CWB1 : CMD_CWB0, 8) < 0)
+        return -1;
+    offset = bank;
+    return 0;
+}
+
+static int read_block(unsigned addr, unsigned char *data, int nbytes)
+{
+    unsigned char cmd[4], reply[32+4];
+    int n;
+
+    if (select_bank(addr) < 0)
+        return -1;
 
     for (n=0; n<nbytes; n+=32) {
         cmd[0] = CMD_READ[0];
         cmd[1] = (addr + n) >> 8;
         cmd[2] = addr + n;
         cmd[3] = 32;
-        hid_send_recv(cmd, 4, reply, sizeof(reply));
+        if (hid_send_recv(cmd, 4, reply, sizeof(reply)) < 0)
+            return -1;
         memcpy(data + n, reply + 4, 32);
     }
+    return 0;
 }
 
-void hid_write_block(int bno, unsigned char *data, int nbytes)
+static int write_block(unsigned addr, unsigned char *data, int nbytes)
 {
-    unsigned addr = bno * nbytes;
-    unsigned char ack, cmd[4+32];
+    unsigned char cmd[4+32];
     int n;
 
-    if (addr < 0x10000 && offset != 0) {
-        offset = 0;
-        hid_send_recv(CMD_CWB0, 8, &ack, 1);
-        if (ack != CMD_ACK[0]) {
-            fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
-                __func__, ack, CMD_ACK[0]);
-            exit(-1);
-        }
-    } else if (addr >= 0x10000 && offset == 0) {
-        offset = 0x00010000;
-        hid_send_recv(CMD_CWB1, 8, &ack, 1);
-        if (ack != CMD_ACK[0]) {
-            fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
-                __func__, ack, CMD_ACK[0]);
-            exit(-1);
-        }
-    }
+    if (select_bank(addr) < 0)
+        return -1;
 
     for (n=0; n<nbytes; n+=32) {
         cmd[0] = CMD_WRITE[0];
@@ -142,33 +151,75 @@ void hid_write_block(int bno, unsigned char *data, int nbytes)
         cmd[2] = addr + n;
         cmd[3] = 32;
         memcpy(cmd + 4, data + n, 32);
-        hid_send_recv(cmd, 4+32, &ack, 1);
-        if (ack != CMD_ACK[0]) {
-            fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
-                __func__, ack, CMD_ACK[0]);
+        if (send_ack(__func__, cmd, 4+32) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+//
+// Read block of data, retry on error.
+// Bank is re-selected on every retry.
+//
+void hid_read_block(int bno, unsigned char *data, int nbytes)
+{
+    unsigned addr = bno * nbytes;
+    int attempt = 0;
+
+    if (dry_run) {
+        estimate_hid_block(0, addr, nbytes);
+        return;
+    }
+
+    while (read_block(addr, data, nbytes) < 0) {
+        offset = ~0;
+        if (! retry_backoff(__func__, &attempt)) {
+            fprintf(stderr, "%s: cannot read block %d\n", __func__, bno);
             exit(-1);
         }
     }
 }
 
-void hid_read_finish()
+//
+// Write block of data, retry on error.
+// Bank is re-selected on every retry.
+//
+void hid_write_block(int bno, unsigned char *data, int nbytes)
 {
-    unsigned char ack;
+    unsigned addr = bno * nbytes;
+    int attempt = 0;
 
-    hid_send_recv(CMD_ENDR, 4, &ack, 1);
-    if (ack != CMD_ACK[0]) {
-        fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
-            __func__, ack, CMD_ACK[0]);
+    if (dry_run) {
+        estimate_hid_block(1, addr, nbytes);
+        return;
+    }
+
+    while (write_block(addr, data, nbytes) < 0) {
+        offset = ~0;
+        if (! retry_backoff(__func__, &attempt)) {
+            fprintf(stderr, "%s: cannot write block %d\n", __func__, bno);
+            exit(-1);
+        }
     }
 }
 
-void hid_write_finish()
+void hid_read_finish()
 {
-    unsigned char ack;
+    if (dry_run) {
+        estimate_hid_finish();
+        return;
+    }
+    send_ack(__func__, CMD_ENDR, 4);
+}
 
-    hid_send_recv(CMD_ENDW, 4, &ack, 1);
-    if (ack != CMD_ACK[0]) {
-        fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
-            __func__, ack, CMD_ACK[0]);
+void hid_write_finish()
+{
+    if (dry_run) {
+        estimate_hid_finish();
+        return;
     }
+    send_ack(__func__, CMD_ENDW, 4);
+
+    // Bank is selected anew by the next session.
+    offset = ~0;
 }
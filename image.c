@@ -0,0 +1,661 @@
+/*
+ * Sparse codeplug image, and editing of raw image in place.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__WIN32__) || defined(WIN32)
+#   define O_BINARY_FLAG O_BINARY
+#else
+#   include <sys/mman.h>
+#   define O_BINARY_FLAG 0
+#endif
+#include "util.h"
+
+//
+// Layout of sparse image file:
+//      header          image_header_t, HEADER_SIZE bytes
+//      run index       nruns * image_run_t, RUN_SIZE bytes each
+//      data pages      contents of DATA runs, in order of index
+//
+// The raw image is split into pages. Consecutive pages of the same
+// kind form a run: erased pages (all 0xff) and zero pages are
+// coded by the run entry alone, other pages are stored as is.
+// In the file, fields are stored byte by byte in little endian order,
+// at offsets given by put_header() and put_run().
+//
+#define IMAGE_MAGIC     "DMRIMG\r\n"
+#define PAGE_SIZE       256
+#define HEADER_SIZE     128
+#define RUN_SIZE        16
+
+enum {
+    RUN_ERASED,                 // Filled with 0xff
+    RUN_ZERO,                   // Filled with 0x00
+    RUN_DATA,                   // Stored in the file
+};
+
+typedef struct {
+    char        magic[8];       // IMAGE_MAGIC
+    unsigned    header_size;    // Size of this header, bytes
+    unsigned    image_size;     // Size of raw image, bytes
+    unsigned    page_size;      // Size of page, bytes
+    unsigned    nruns;          // Number of entries in run index
+    unsigned long long timestamp; // Time of creation, seconds since 1970
+    char        model[32];      // Name of radio, zero terminated
+    char        firmware[16];   // Firmware version, when known
+    unsigned char sha256[32];   // Digest of raw image
+} image_header_t;
+
+typedef struct {
+    unsigned    first;          // Index of first page
+    unsigned    npages;         // Number of pages
+    unsigned    kind;           // Kind of pages: RUN_*
+    unsigned    offset;         // Offset of data in file, for RUN_DATA
+} image_run_t;
+
+int image_sparse_flag;          // Save images in sparse format
+
+static void put32(unsigned char *buf, unsigned value)
+{
+    buf[0] = value;
+    buf[1] = value >> 8;
+    buf[2] = value >> 16;
+    buf[3] = value >> 24;
+}
+
+static unsigned get32(const unsigned char *buf)
+{
+    return buf[0] | buf[1] << 8 | buf[2] << 16 | (unsigned)buf[3] << 24;
+}
+
+//
+// Encode the header for the file.
+//
+static void put_header(unsigned char *buf, const image_header_t *hdr)
+{
+    memset(buf, 0, HEADER_SIZE);
+    memcpy(buf, hdr->magic, 8);
+    put32(buf + 8,  hdr->header_size);
+    put32(buf + 12, hdr->image_size);
+    put32(buf + 16, hdr->page_size);
+    put32(buf + 20, hdr->nruns);
+    put32(buf + 24, hdr->timestamp);
+    put32(buf + 28, hdr->timestamp >> 32);
+    memcpy(buf + 32, hdr->model, 32);
+    memcpy(buf + 64, hdr->firmware, 16);
+    memcpy(buf + 80, hdr->sha256, 32);
+
+    // Bytes 112...127 are reserved.
+}
+
+//
+// Decode the header from the file.
+//
+static void get_header(image_header_t *hdr, const unsigned char *buf)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, buf, 8);
+    hdr->header_size = get32(buf + 8);
+    hdr->image_size  = get32(buf + 12);
+    hdr->page_size   = get32(buf + 16);
+    hdr->nruns       = get32(buf + 20);
+    hdr->timestamp   = get32(buf + 24) | (unsigned long long) get32(buf + 28) << 32;
+    memcpy(hdr->model, buf + 32, 32);
+    memcpy(hdr->firmware, buf + 64, 16);
+    memcpy(hdr->sha256, buf + 80, 32);
+}
+
+static void put_run(unsigned char *buf, const image_run_t *run)
+{
+    put32(buf,      run->first);
+    put32(buf + 4,  run->npages);
+    put32(buf + 8,  run->kind);
+    put32(buf + 12, run->offset);
+}
+
+static void get_run(image_run_t *run, const unsigned char *buf)
+{
+    run->first  = get32(buf);
+    run->npages = get32(buf + 4);
+    run->kind   = get32(buf + 8);
+    run->offset = get32(buf + 12);
+}
+
+//
+// Get kind of the page.
+//
+static int page_kind(const unsigned char *data, unsigned nbytes)
+{
+    unsigned i;
+
+    if (data[0] != 0xff && data[0] != 0)
+        return RUN_DATA;
+    for (i=1; i<nbytes; i++) {
+        if (data[i] != data[0])
+            return RUN_DATA;
+    }
+    return data[0] ? RUN_ERASED : RUN_ZERO;
+}
+
+//
+// Map file contents into memory for reading.
+// On Windows, read it into allocated buffer.
+//
+static unsigned char *map_file(const char *filename, unsigned *nbytes)
+{
+    struct stat st;
+    unsigned char *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_BINARY_FLAG);
+    if (fd < 0) {
+        perror(filename);
+        exit(-1);
+    }
+    if (fstat(fd, &st) < 0) {
+        perror(filename);
+        exit(-1);
+    }
+    *nbytes = st.st_size;
+#if defined(__WIN32__) || defined(WIN32)
+    data = malloc(*nbytes ? *nbytes : 1);
+    if (! data) {
+        fprintf(stderr, "%s: Out of memory.\n", filename);
+        exit(-1);
+    }
+    if (read(fd, data, *nbytes) != (int)*nbytes) {
+        fprintf(stderr, "%s: Cannot read file.\n", filename);
+        exit(-1);
+    }
+#else
+    data = mmap(0, *nbytes ? *nbytes : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror(filename);
+        exit(-1);
+    }
+#endif
+    close(fd);
+    return data;
+}
+
+static void unmap_file(unsigned char *data, unsigned nbytes)
+{
+#if defined(__WIN32__) || defined(WIN32)
+    free(data);
+#else
+    munmap(data, nbytes ? nbytes : 1);
+#endif
+}
+
+//
+// Check whether the file is a sparse image.
+//
+int image_is_sparse(const char *filename)
+{
+    char magic[8];
+    FILE *img;
+    int match;
+
+    img = fopen(filename, "rb");
+    if (! img)
+        return 0;
+    match = (fread(magic, 1, 8, img) == 8 &&
+             memcmp(magic, IMAGE_MAGIC, 8) == 0);
+    fclose(img);
+    return match;
+}
+
+//
+// Read sparse image into memory buffer of given size.
+// Return name of the radio, and size of the image.
+// Firmware version is restored to serial_firmware[].
+//
+const char *image_read_sparse(const char *filename, unsigned char *mem, unsigned maxsize, unsigned *size)
+{
+    static char model[32];
+    unsigned char *data, digest[32];
+    unsigned nbytes, npages, i, next;
+    image_header_t header, *hdr = &header;
+    image_run_t entry, *run = &entry;
+
+    data = map_file(filename, &nbytes);
+    if (nbytes < HEADER_SIZE || memcmp(data, IMAGE_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: Not a sparse image.\n", filename);
+        exit(-1);
+    }
+    get_header(hdr, data);
+    if (hdr->header_size < HEADER_SIZE || hdr->header_size > nbytes ||
+        hdr->page_size == 0 || hdr->image_size > maxsize) {
+        fprintf(stderr, "%s: Bad header of sparse image.\n", filename);
+        exit(-1);
+    }
+    if (hdr->nruns > (nbytes - hdr->header_size) / RUN_SIZE) {
+        fprintf(stderr, "%s: Truncated run index.\n", filename);
+        exit(-1);
+    }
+    npages = (hdr->image_size + hdr->page_size - 1) / hdr->page_size;
+
+    // Runs must cover all pages in order.
+    next = 0;
+    for (i=0; i<hdr->nruns; i++) {
+        unsigned addr, len;
+
+        get_run(run, data + hdr->header_size + i*RUN_SIZE);
+        addr = run->first * hdr->page_size;
+        len = run->npages * hdr->page_size;
+        if (run->first != next || run->npages == 0 || run->npages > npages - next) {
+            fprintf(stderr, "%s: Bad run #%u in sparse image.\n", filename, i);
+            exit(-1);
+        }
+        next += run->npages;
+        if (addr + len > hdr->image_size)
+            len = hdr->image_size - addr;
+
+        switch (run->kind) {
+        case RUN_ERASED:
+            memset(mem + addr, 0xff, len);
+            break;
+        case RUN_ZERO:
+            memset(mem + addr, 0, len);
+            break;
+        case RUN_DATA:
+            if (run->offset > nbytes || len > nbytes - run->offset) {
+                fprintf(stderr, "%s: Truncated data of run #%u.\n", filename, i);
+                exit(-1);
+            }
+            memcpy(mem + addr, data + run->offset, len);
+            break;
+        default:
+            fprintf(stderr, "%s: Unknown kind %u of run #%u.\n", filename, run->kind, i);
+            exit(-1);
+        }
+    }
+    if (next != npages) {
+        fprintf(stderr, "%s: Run index does not cover the image.\n", filename);
+        exit(-1);
+    }
+
+    sha256(mem, hdr->image_size, digest);
+    if (memcmp(digest, hdr->sha256, 32) != 0) {
+        fprintf(stderr, "%s: Checksum mismatch.\n", filename);
+        exit(-1);
+    }
+
+    memcpy(model, hdr->model, sizeof(model) - 1);
+    model[sizeof(model) - 1] = 0;
+    memcpy(serial_firmware, hdr->firmware, sizeof(serial_firmware) - 1);
+    serial_firmware[sizeof(serial_firmware) - 1] = 0;
+    *size = hdr->image_size;
+    unmap_file(data, nbytes);
+    return model;
+}
+
+//
+// Save memory contents as sparse image.
+//
+void image_save_sparse(const char *filename, const unsigned char *mem, unsigned size, const char *model)
+{
+    unsigned npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned nruns, ndata, nbytes, offset, i;
+    image_header_t hdr;
+    image_run_t *runs, *run;
+    unsigned char *data;
+
+    runs = calloc(npages ? npages : 1, sizeof(*runs));
+    if (! runs) {
+        fprintf(stderr, "%s: Out of memory.\n", filename);
+        exit(-1);
+    }
+
+    // Split the image into runs of pages of the same kind.
+    nruns = 0;
+    ndata = 0;
+    for (i=0; i<npages; i++) {
+        unsigned len = (i == npages-1) ? size - i*PAGE_SIZE : PAGE_SIZE;
+        int kind = page_kind(mem + i*PAGE_SIZE, len);
+
+        if (nruns > 0 && runs[nruns-1].kind == kind) {
+            runs[nruns-1].npages++;
+        } else {
+            run = &runs[nruns++];
+            run->first = i;
+            run->npages = 1;
+            run->kind = kind;
+        }
+        if (kind == RUN_DATA)
+            ndata += len;
+    }
+    offset = HEADER_SIZE + nruns * RUN_SIZE;
+    nbytes = offset + ndata;
+
+#if defined(__WIN32__) || defined(WIN32)
+    data = calloc(1, nbytes);
+    if (! data) {
+        fprintf(stderr, "%s: Out of memory.\n", filename);
+        exit(-1);
+    }
+#else
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0664);
+    if (fd < 0) {
+        perror(filename);
+        exit(-1);
+    }
+    if (ftruncate(fd, nbytes) < 0) {
+        perror(filename);
+        exit(-1);
+    }
+    data = mmap(0, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        perror(filename);
+        exit(-1);
+    }
+#endif
+
+    // Fill header.
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, IMAGE_MAGIC, 8);
+    hdr.header_size = HEADER_SIZE;
+    hdr.image_size = size;
+    hdr.page_size = PAGE_SIZE;
+    hdr.nruns = nruns;
+    hdr.timestamp = time(0);
+    strncpy(hdr.model, model, sizeof(hdr.model) - 1);
+    strncpy(hdr.firmware, serial_firmware, sizeof(hdr.firmware) - 1);
+    sha256(mem, size, hdr.sha256);
+    put_header(data, &hdr);
+
+    // Fill run index and data pages.
+    for (i=0; i<nruns; i++) {
+        run = &runs[i];
+        run->offset = 0;
+        if (run->kind == RUN_DATA) {
+            unsigned addr = run->first * PAGE_SIZE;
+            unsigned len = run->npages * PAGE_SIZE;
+
+            if (addr + len > size)
+                len = size - addr;
+            run->offset = offset;
+            memcpy(data + offset, mem + addr, len);
+            offset += len;
+        }
+        put_run(data + HEADER_SIZE + i*RUN_SIZE, run);
+    }
+    free(runs);
+
+#if defined(__WIN32__) || defined(WIN32)
+    FILE *img = fopen(filename, "wb");
+    if (! img) {
+        perror(filename);
+        exit(-1);
+    }
+    if (fwrite(data, 1, nbytes, img) != nbytes) {
+        fprintf(stderr, "%s: Cannot write file.\n", filename);
+        exit(-1);
+    }
+    fclose(img);
+    free(data);
+#else
+    if (munmap(data, nbytes) < 0) {
+        perror(filename);
+        exit(-1);
+    }
+    close(fd);
+#endif
+}
+
+//
+// Image file, mapped for editing in place.
+//
+static unsigned char *map_data;         // Mapped contents
+static unsigned map_size;               // Size of mapping, bytes
+static unsigned map_page;               // Size of memory page
+static char *map_filename;              // Name of image file
+static int map_atomic;                  // Replace file on commit
+static int map_fd = -1;
+
+//
+// Map image file into memory, for editing in place.
+// The mapping is private: the file is not changed until
+// image_commit(), so errors in the script leave it intact.
+// On commit, pages which differ from the file are written back.
+// In atomic mode, the file is replaced by a new copy
+// under temporary name.
+//
+unsigned char *image_map(const char *filename, unsigned size, int atomic)
+{
+    map_filename = strdup(filename);
+    map_atomic = atomic;
+    map_size = size;
+#if defined(__WIN32__) || defined(WIN32)
+    // No mmap: read the file, and write it back on commit.
+    unsigned nbytes;
+
+    map_data = map_file(filename, &nbytes);
+    map_page = size;
+#else
+    map_page = sysconf(_SC_PAGESIZE);
+    map_fd = open(filename, atomic ? O_RDONLY : O_RDWR);
+    if (map_fd < 0) {
+        perror(filename);
+        exit(-1);
+    }
+
+    // Changes stay private until commit.
+    map_data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, map_fd, 0);
+    if (map_data == MAP_FAILED) {
+        perror(filename);
+        exit(-1);
+    }
+#endif
+    return map_data;
+}
+
+#if !defined(__WIN32__) && !defined(WIN32)
+//
+// Compare pages marked as dirty with the file,
+// and clear the marks of pages which are not changed.
+//
+static void compare_pages(unsigned char *dirty, unsigned npages, unsigned *ndirty)
+{
+    unsigned char *buf = malloc(map_page);
+    unsigned page;
+
+    if (! buf) {
+        fprintf(stderr, "%s: Out of memory.\n", map_filename);
+        exit(-1);
+    }
+    for (page=0; page<npages; page++) {
+        unsigned len = map_size - page*map_page;
+
+        if (! dirty[page])
+            continue;
+        if (len > map_page)
+            len = map_page;
+        if (pread(map_fd, buf, len, page*map_page) == (ssize_t)len &&
+            memcmp(buf, map_data + page*map_page, len) == 0) {
+            dirty[page] = 0;
+            --*ndirty;
+        }
+    }
+    free(buf);
+}
+#endif
+
+#ifdef __linux__
+//
+// Find pages of the private mapping which were written to.
+// The kernel copies a page on the first write to it: in /proc/self/pagemap,
+// such page is present or swapped, and is not a file page any more.
+// Return 0 when pagemap is not available.
+//
+static int find_copied_pages(unsigned char *dirty, unsigned npages, unsigned *ndirty)
+{
+    uint64_t entry[512];
+    off_t offset = (uintptr_t) map_data / map_page * sizeof(entry[0]);
+    unsigned page, n, k;
+    int fd;
+
+    fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0)
+        return 0;
+    for (page=0; page<npages; page+=n) {
+        n = npages - page;
+        if (n > sizeof(entry) / sizeof(entry[0]))
+            n = sizeof(entry) / sizeof(entry[0]);
+        if (pread(fd, entry, n * sizeof(entry[0]), offset + page * sizeof(entry[0])) !=
+            (ssize_t) (n * sizeof(entry[0]))) {
+            close(fd);
+            return 0;
+        }
+        for (k=0; k<n; k++) {
+            int present = (entry[k] >> 63) & 1;
+            int swapped = (entry[k] >> 62) & 1;
+            int file    = (entry[k] >> 61) & 1;
+
+            if ((present || swapped) && ! file) {
+                dirty[page + k] = 1;
+                ++*ndirty;
+            }
+        }
+    }
+    close(fd);
+    return 1;
+}
+#endif
+
+//
+// Write changes of the mapped image back to the file.
+//
+void image_commit()
+{
+    unsigned npages = (map_size + map_page - 1) / map_page;
+    unsigned page, ndirty = 0;
+    unsigned char *dirty = calloc(npages, 1);
+
+    if (! dirty) {
+        fprintf(stderr, "%s: Out of memory.\n", map_filename);
+        exit(-1);
+    }
+#if defined(__WIN32__) || defined(WIN32)
+    // Whole file is one page.
+    dirty[0] = 1;
+    ndirty = 1;
+#else
+    // Only pages which were written to can differ from the file.
+    // Without pagemap, check all of them.
+#ifdef __linux__
+    if (! find_copied_pages(dirty, npages, &ndirty))
+#endif
+    {
+        memset(dirty, 1, npages);
+        ndirty = npages;
+    }
+    compare_pages(dirty, npages, &ndirty);
+#endif
+    fprintf(stderr, "Update %u of %u pages in file '%s'%s.\n",
+        ndirty, npages, map_filename, map_atomic && ndirty ? " atomically" : "");
+
+    if (ndirty > 0 && map_atomic) {
+        // Write new copy and replace the file.
+        char *tmp = malloc(strlen(map_filename) + 5);
+        FILE *img;
+
+        if (! tmp) {
+            fprintf(stderr, "%s: Out of memory.\n", map_filename);
+            exit(-1);
+        }
+        sprintf(tmp, "%s.tmp", map_filename);
+        img = fopen(tmp, "wb");
+        if (! img) {
+            perror(tmp);
+            exit(-1);
+        }
+        if (fwrite(map_data, 1, map_size, img) != map_size || fflush(img) != 0) {
+            fprintf(stderr, "%s: Cannot write file.\n", tmp);
+            exit(-1);
+        }
+#if !defined(__WIN32__) && !defined(WIN32)
+        fsync(fileno(img));
+#else
+        // Windows cannot rename over existing file.
+        remove(map_filename);
+#endif
+        fclose(img);
+        if (rename(tmp, map_filename) < 0) {
+            perror(map_filename);
+            exit(-1);
+        }
+        free(tmp);
+    }
+#if defined(__WIN32__) || defined(WIN32)
+    else if (ndirty > 0) {
+        FILE *img = fopen(map_filename, "r+b");
+
+        if (! img || fwrite(map_data, 1, map_size, img) != map_size) {
+            fprintf(stderr, "%s: Cannot write file.\n", map_filename);
+            exit(-1);
+        }
+        fclose(img);
+    }
+    free(map_data);
+#else
+    else if (ndirty > 0) {
+        // Write only modified pages, merging adjacent ones.
+        for (page=0; page<npages; page++) {
+            unsigned first = page, len;
+
+            if (! dirty[page])
+                continue;
+            while (page+1 < npages && dirty[page+1])
+                page++;
+            len = (page + 1 - first) * map_page;
+            if (first*map_page + len > map_size)
+                len = map_size - first*map_page;
+            if (pwrite(map_fd, map_data + first*map_page, len, first*map_page) != (ssize_t)len) {
+                perror(map_filename);
+                exit(-1);
+            }
+        }
+        if (fsync(map_fd) < 0) {
+            perror(map_filename);
+            exit(-1);
+        }
+    }
+    munmap(map_data, map_size);
+    close(map_fd);
+    map_fd = -1;
+#endif
+    map_data = 0;
+    free(dirty);
+    free(map_filename);
+}
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include "radio.h"
 #include "util.h"
 
@@ -39,6 +40,70 @@ extern int optind;
 
 int trace_flag = 0;
 
+//
+// Long options.
+//
+enum {
+    OPT_STATS = 256,
+    OPT_SAVE_TRACE,
+    OPT_DECODE_TRACE,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_REPLAY_LATENCY,
+    OPT_PORT,
+    OPT_PLAN,
+    OPT_DRY_RUN,
+    OPT_TABLES,
+    OPT_PARTIAL,
+    OPT_STREAM,
+    OPT_SPARSE,
+    OPT_CONVERT,
+    OPT_STORE,
+    OPT_SNAPSHOTS,
+    OPT_RESTORE,
+    OPT_DIFF,
+    OPT_IN_PLACE,
+    OPT_ATOMIC,
+    OPT_BATCH,
+    OPT_JOBS,
+    OPT_QUERY,
+    OPT_FINGERPRINT,
+    OPT_AUDIT,
+    OPT_WATCH,
+    OPT_READ_BACK,
+};
+
+static const struct option long_options[] = {
+    { "stats",          optional_argument,  0,  OPT_STATS },
+    { "save-trace",     required_argument,  0,  OPT_SAVE_TRACE },
+    { "decode-trace",   required_argument,  0,  OPT_DECODE_TRACE },
+    { "record",         required_argument,  0,  OPT_RECORD },
+    { "replay",         required_argument,  0,  OPT_REPLAY },
+    { "replay-latency", required_argument,  0,  OPT_REPLAY_LATENCY },
+    { "port",           required_argument,  0,  OPT_PORT },
+    { "plan",           no_argument,        0,  OPT_PLAN },
+    { "dry-run",        optional_argument,  0,  OPT_DRY_RUN },
+    { "tables",         required_argument,  0,  OPT_TABLES },
+    { "partial",        no_argument,        0,  OPT_PARTIAL },
+    { "stream",         no_argument,        0,  OPT_STREAM },
+    { "sparse",         no_argument,        0,  OPT_SPARSE },
+    { "convert",        no_argument,        0,  OPT_CONVERT },
+    { "store",          required_argument,  0,  OPT_STORE },
+    { "snapshots",      no_argument,        0,  OPT_SNAPSHOTS },
+    { "restore",        required_argument,  0,  OPT_RESTORE },
+    { "diff",           no_argument,        0,  OPT_DIFF },
+    { "in-place",       no_argument,        0,  OPT_IN_PLACE },
+    { "atomic",         no_argument,        0,  OPT_ATOMIC },
+    { "batch",          required_argument,  0,  OPT_BATCH },
+    { "jobs",           required_argument,  0,  OPT_JOBS },
+    { "query",          required_argument,  0,  OPT_QUERY },
+    { "fingerprint",    no_argument,        0,  OPT_FINGERPRINT },
+    { "audit",          no_argument,        0,  OPT_AUDIT },
+    { "watch",          no_argument,        0,  OPT_WATCH },
+    { "read-back",      no_argument,        0,  OPT_READ_BACK },
+    { 0,                0,                  0,  0 },
+};
+
 void usage()
 {
     fprintf(stderr, "DMR Config, Version %s, %s\n", version, copyright);
@@ -46,6 +111,12 @@ void usage()
     fprintf(stderr, "    dmrconfig -r [-t]\n");
     fprintf(stderr, "                         Read codeplug from the radio to a file 'device.img'.\n");
     fprintf(stderr, "                         Save configuration to a text file 'device.conf'.\n");
+    fprintf(stderr, "    dmrconfig -r --tables=LIST\n");
+    fprintf(stderr, "                         Read only given tables from the radio,\n");
+    fprintf(stderr, "                         and save them to a text file 'device.conf'.\n");
+    fprintf(stderr, "    dmrconfig -r --stream\n");
+    fprintf(stderr, "                         Print every table as soon as it is read,\n");
+    fprintf(stderr, "                         then save 'device.img' and 'device.conf'.\n");
     fprintf(stderr, "    dmrconfig -w [-t] file.img\n");
     fprintf(stderr, "                         Write codeplug to the radio.\n");
     fprintf(stderr, "    dmrconfig -v [-t] file.conf\n");
@@ -54,13 +125,60 @@ void usage()
     fprintf(stderr, "                         Read (validate) a configuration file.\n");
     fprintf(stderr, "    dmrconfig -c [-t] file.conf\n");
     fprintf(stderr, "                         Apply configuration script to the radio.\n");
+    fprintf(stderr, "    dmrconfig -c --partial file.conf\n");
+    fprintf(stderr, "                         Write to the radio only tables modified\n");
+    fprintf(stderr, "                         by the configuration script.\n");
+    fprintf(stderr, "    dmrconfig -c --watch file.conf\n");
+    fprintf(stderr, "                         Stay connected, and apply configuration script\n");
+    fprintf(stderr, "                         to the radio every time it changes, writing\n");
+    fprintf(stderr, "                         only what differs. Stop by Ctrl-C.\n");
     fprintf(stderr, "    dmrconfig -c file.img file.conf\n");
     fprintf(stderr, "                         Apply configuration script to the codeplug image.\n");
     fprintf(stderr, "                         Store modified copy to a file 'device.img'.\n");
+    fprintf(stderr, "    dmrconfig -c [--jobs=N] file1.img file2.img... file.conf\n");
+    fprintf(stderr, "                         Compile configuration script for several codeplug\n");
+    fprintf(stderr, "                         images in parallel, skipping what does not fit.\n");
+    fprintf(stderr, "                         Store results to files 'device-1.img', 'device-2.img'...\n");
+    fprintf(stderr, "    dmrconfig -c --in-place [--atomic] file.img file.conf\n");
+    fprintf(stderr, "                         Apply configuration script to the codeplug image,\n");
+    fprintf(stderr, "                         modifying the image file in place.\n");
     fprintf(stderr, "    dmrconfig file.img\n");
     fprintf(stderr, "                         Display configuration from the codeplug image.\n");
     fprintf(stderr, "    dmrconfig -u [-t] file.csv\n");
     fprintf(stderr, "                         Update contacts database from CSV file.\n");
+    fprintf(stderr, "    dmrconfig --dry-run[=stats.json] -w file.img\n");
+    fprintf(stderr, "    dmrconfig --dry-run[=stats.json] -c file.img file.conf\n");
+    fprintf(stderr, "    dmrconfig --dry-run[=stats.json] -u file.img file.csv\n");
+    fprintf(stderr, "                         Estimate transfers and time of operation,\n");
+    fprintf(stderr, "                         for a radio with contents of file.img.\n");
+    fprintf(stderr, "    dmrconfig --plan file.img [file.conf]\n");
+    fprintf(stderr, "                         Print the plan of memory transfers for the codeplug,\n");
+    fprintf(stderr, "                         optionally modified by configuration script.\n");
+    fprintf(stderr, "    dmrconfig --convert [--sparse] input.img output.img\n");
+    fprintf(stderr, "                         Convert codeplug image to raw or sparse format.\n");
+    fprintf(stderr, "    dmrconfig --store=DIR --snapshots\n");
+    fprintf(stderr, "                         List snapshots in the store.\n");
+    fprintf(stderr, "    dmrconfig --store=DIR --restore=SNAPSHOT file.img\n");
+    fprintf(stderr, "                         Save snapshot from the store to image file.\n");
+    fprintf(stderr, "    dmrconfig --store=DIR --diff SNAPSHOT1 SNAPSHOT2\n");
+    fprintf(stderr, "                         Compare two snapshots table by table.\n");
+    fprintf(stderr, "    dmrconfig --batch=FILE [--jobs=N]\n");
+    fprintf(stderr, "                         Run jobs from manifest file in parallel:\n");
+    fprintf(stderr, "                         apply IMAGE CONF OUTPUT, validate CONF,\n");
+    fprintf(stderr, "                         print IMAGE OUTPUT.\n");
+    fprintf(stderr, "    dmrconfig --query=QUERY file.img...\n");
+    fprintf(stderr, "                         Find channels by frequency or contact ID, and zones\n");
+    fprintf(stderr, "                         and scan lists by channel, in codeplug images:\n");
+    fprintf(stderr, "                         freq=MHZ, id=NUM, channel=NUM, separated by comma.\n");
+    fprintf(stderr, "    dmrconfig --fingerprint [--tables=LIST] [file.img...]\n");
+    fprintf(stderr, "                         Print fingerprints of tables of codeplug images,\n");
+    fprintf(stderr, "                         or of the radio, reading only the tables.\n");
+    fprintf(stderr, "    dmrconfig --audit [--port=DEV,...] [--jobs=N] golden.img...\n");
+    fprintf(stderr, "                         Compare fingerprints of tables of all attached radios\n");
+    fprintf(stderr, "                         with golden images of the same models. Save radios\n");
+    fprintf(stderr, "                         which differ to files 'audit-PORT.img'.\n");
+    fprintf(stderr, "    dmrconfig --decode-trace file.trace\n");
+    fprintf(stderr, "                         Print binary trace of USB protocol.\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "    -r           Read codeplug from the radio.\n");
     fprintf(stderr, "    -w           Write codeplug to the radio.\n");
@@ -70,18 +188,74 @@ void usage()
     fprintf(stderr, "    -u           Update contacts database.\n");
     fprintf(stderr, "    -l           List all supported radios.\n");
     fprintf(stderr, "    -t           Trace USB protocol.\n");
+    fprintf(stderr, "    --stats[=FILE]\n");
+    fprintf(stderr, "                 Print transfer statistics and timing in JSON format\n");
+    fprintf(stderr, "                 to stderr, or to a file.\n");
+    fprintf(stderr, "    --save-trace=FILE\n");
+    fprintf(stderr, "                 Save binary trace of USB protocol to a file.\n");
+    fprintf(stderr, "                 On failure, trace is saved to 'dmrconfig.trace'.\n");
+    fprintf(stderr, "    --dry-run[=FILE]\n");
+    fprintf(stderr, "                 Count transfers instead of talking to the radio,\n");
+    fprintf(stderr, "                 and estimate the time using latencies from\n");
+    fprintf(stderr, "                 a --stats report.\n");
+    fprintf(stderr, "    --tables=LIST\n");
+    fprintf(stderr, "                 Comma separated list of tables to read, fingerprint\n");
+    fprintf(stderr, "                 or audit:\n");
+    fprintf(stderr, "                 channels, zones, scanlists, contacts, grouplists,\n");
+    fprintf(stderr, "                 messages, settings.\n");
+    fprintf(stderr, "    --partial\n");
+    fprintf(stderr, "                 With -c, write only tables which are present\n");
+    fprintf(stderr, "                 in the configuration script.\n");
+    fprintf(stderr, "    --stream\n");
+    fprintf(stderr, "                 With -r, read identity and settings first, and print\n");
+    fprintf(stderr, "                 every table to stdout as soon as it is read.\n");
+    fprintf(stderr, "    --read-back\n");
+    fprintf(stderr, "                 With -w or -c, read back the memory just written\n");
+    fprintf(stderr, "                 to the radio, and write again what differs.\n");
+    fprintf(stderr, "    --in-place\n");
+    fprintf(stderr, "                 With -c, map the image file into memory and write back\n");
+    fprintf(stderr, "                 only modified pages, instead of saving 'device.img'.\n");
+    fprintf(stderr, "    --atomic\n");
+    fprintf(stderr, "                 With --in-place, write new copy of the image file\n");
+    fprintf(stderr, "                 and rename it over the original.\n");
+    fprintf(stderr, "    --sparse\n");
+    fprintf(stderr, "                 Save codeplug images in sparse format, with erased\n");
+    fprintf(stderr, "                 pages omitted. Both formats are accepted on input.\n");
+    fprintf(stderr, "    --store=DIR\n");
+    fprintf(stderr, "                 Keep every saved codeplug image as a snapshot\n");
+    fprintf(stderr, "                 in the store, deduplicated by pages.\n");
+    fprintf(stderr, "    --jobs=N\n");
+    fprintf(stderr, "                 Number of worker processes for --batch and -c,\n");
+    fprintf(stderr, "                 by default one per processor. With --audit,\n");
+    fprintf(stderr, "                 number of radios read at once, by default all.\n");
+    fprintf(stderr, "    --port=DEVICE\n");
+    fprintf(stderr, "                 Use given serial port for Anytone radios.\n");
+    fprintf(stderr, "                 With --audit, comma separated list of ports.\n");
+    fprintf(stderr, "    --record=FILE\n");
+    fprintf(stderr, "                 Record all transactions of the session to a file.\n");
+    fprintf(stderr, "    --replay=FILE\n");
+    fprintf(stderr, "                 Replay a recorded session instead of the radio.\n");
+    fprintf(stderr, "    --replay-latency=USEC\n");
+    fprintf(stderr, "                 Delay every replayed transaction by given time,\n");
+    fprintf(stderr, "                 or 'real' to reproduce the recorded timing.\n");
     exit(-1);
 }
 
 int main(int argc, char **argv)
 {
     int read_flag = 0, write_flag = 0, config_flag = 0, csv_flag = 0;
-    int list_flag = 0, verify_flag = 0, validate_flag = 0;
+    int list_flag = 0, verify_flag = 0, validate_flag = 0, plan_flag = 0;
+    int partial_flag = 0, stream_flag = 0, convert_flag = 0;
+    int snapshots_flag = 0, diff_flag = 0, in_place_flag = 0, atomic_flag = 0;
+    int fingerprint_flag = 0, audit_flag = 0, watch_flag = 0;
+    const char *restore_id = 0, *batch_filename = 0, *query = 0;
+    int nworkers = 0;
+    const char *replay_filename = 0, *replay_latency = 0;
 
     copyright = "Copyright (C) 2018 Serge Vakulenko KK6ABQ";
     trace_flag = 0;
     for (;;) {
-        switch (getopt(argc, argv, "tcwrulvz")) {
+        switch (getopt_long(argc, argv, "tcwrulvz", long_options, 0)) {
         case 't': ++trace_flag;  continue;
         case 'r': ++read_flag;   continue;
         case 'w': ++write_flag;  continue;
@@ -90,6 +264,37 @@ int main(int argc, char **argv)
         case 'l': ++list_flag;   continue;
 	case 'v': ++verify_flag; continue;
         case 'z': ++validate_flag; continue;
+        case OPT_STATS: stats_enable(optarg); continue;
+        case OPT_SAVE_TRACE: trace_save_on_exit(optarg); continue;
+        case OPT_DECODE_TRACE: trace_decode(optarg); exit(0);
+        case OPT_RECORD: trace_record_session(optarg); continue;
+        case OPT_REPLAY: replay_filename = optarg; continue;
+        case OPT_REPLAY_LATENCY: replay_latency = optarg; continue;
+        case OPT_PORT: serial_port = optarg; continue;
+        case OPT_PLAN: ++plan_flag; continue;
+        case OPT_DRY_RUN:
+            dry_run = 1;
+            if (optarg)
+                estimate_calibrate(optarg);
+            continue;
+        case OPT_TABLES: radio_select_tables(optarg); continue;
+        case OPT_PARTIAL: ++partial_flag; continue;
+        case OPT_STREAM: ++stream_flag; continue;
+        case OPT_SPARSE: ++image_sparse_flag; continue;
+        case OPT_CONVERT: ++convert_flag; continue;
+        case OPT_STORE: store_dir = optarg; continue;
+        case OPT_SNAPSHOTS: ++snapshots_flag; continue;
+        case OPT_RESTORE: restore_id = optarg; continue;
+        case OPT_DIFF: ++diff_flag; continue;
+        case OPT_IN_PLACE: ++in_place_flag; continue;
+        case OPT_ATOMIC: ++atomic_flag; continue;
+        case OPT_BATCH: batch_filename = optarg; continue;
+        case OPT_JOBS: nworkers = strtol(optarg, 0, 10); continue;
+        case OPT_QUERY: query = optarg; continue;
+        case OPT_FINGERPRINT: ++fingerprint_flag; continue;
+        case OPT_AUDIT: ++audit_flag; continue;
+        case OPT_WATCH: ++watch_flag; continue;
+        case OPT_READ_BACK: ++radio_read_back; continue;
         default:
             usage();
         case EOF:
@@ -99,12 +304,52 @@ int main(int argc, char **argv)
     }
     argc -= optind;
     argv += optind;
+    if (replay_filename)
+        replay_open(replay_filename, replay_latency);
     if (list_flag) {
         radio_list();
         exit(0);
     }
-    if (read_flag + write_flag + config_flag + csv_flag + verify_flag + validate_flag > 1) {
-        fprintf(stderr, "Only one of -r, -w, -c, -v, -z or -u options is allowed.\n");
+    if (read_flag + write_flag + config_flag + csv_flag + verify_flag + validate_flag + plan_flag +
+        convert_flag + snapshots_flag + diff_flag + (restore_id != 0) + (batch_filename != 0) +
+        (query != 0) + fingerprint_flag + audit_flag > 1) {
+        fprintf(stderr, "Only one of -r, -w, -c, -v, -z, -u, --plan, --convert, --snapshots, --restore, --diff, --batch, --query, --fingerprint or --audit options is allowed.\n");
+        usage();
+    }
+    if ((snapshots_flag || diff_flag || restore_id) && ! store_dir) {
+        fprintf(stderr, "Options --snapshots, --restore and --diff need --store.\n");
+        usage();
+    }
+    if (dry_run && ! (write_flag || config_flag || csv_flag)) {
+        fprintf(stderr, "Dry run is supported only with -w, -c or -u options.\n");
+        usage();
+    }
+    if (stream_flag && ! read_flag) {
+        fprintf(stderr, "Option --stream is supported only with -r option.\n");
+        usage();
+    }
+    if (radio_tables && ! (read_flag || fingerprint_flag || audit_flag)) {
+        fprintf(stderr, "Option --tables is supported only with -r, --fingerprint or --audit options.\n");
+        usage();
+    }
+    if (in_place_flag && ! (config_flag && argc == 2 && ! dry_run)) {
+        fprintf(stderr, "Option --in-place is supported only with -c file.img file.conf.\n");
+        usage();
+    }
+    if (atomic_flag && ! in_place_flag) {
+        fprintf(stderr, "Option --atomic is supported only with --in-place option.\n");
+        usage();
+    }
+    if (radio_read_back && ! (write_flag || (config_flag && argc == 1))) {
+        fprintf(stderr, "Option --read-back is supported only with -w or -c options.\n");
+        usage();
+    }
+    if (watch_flag && ! (config_flag && argc == 1 && ! dry_run && ! partial_flag)) {
+        fprintf(stderr, "Option --watch is supported only with -c file.conf.\n");
+        usage();
+    }
+    if (partial_flag && ! (config_flag || plan_flag)) {
+        fprintf(stderr, "Option --partial is supported only with -c or --plan options.\n");
         usage();
     }
     setvbuf(stdout, 0, _IOLBF, 0);
@@ -115,17 +360,40 @@ int main(int argc, char **argv)
         if (argc != 1)
             usage();
 
-        radio_connect();
+        if (! dry_run)
+            radio_connect();
         radio_read_image(argv[0]);
         radio_print_version(stdout);
         radio_upload(0);
         radio_disconnect();
 
     } else if (config_flag) {
-        if (argc != 1 && argc != 2)
+        if (argc < 1 || (argc > 2 && dry_run))
             usage();
 
-        if (argc == 2) {
+        if (argc > 2) {
+            // Compile the script for every image.
+            if (codeplug_compile_all(argv[argc-1], argv, argc-1, nworkers) > 0)
+                exit(-1);
+
+        } else if (in_place_flag) {
+            // Edit image file through memory mapping.
+            radio_map_image(argv[0], atomic_flag);
+            radio_print_version(stdout);
+            radio_parse_config(argv[1]);
+            radio_verify_config();
+            image_commit();
+
+        } else if (watch_flag) {
+            // Stay connected, and apply the script on every change.
+            radio_connect();
+            radio_download();
+            radio_print_version(stdout);
+            radio_save_image("backup.img");
+            watch_run(argv[0]);
+            radio_disconnect();
+
+        } else if (argc == 2 && ! dry_run) {
             // Apply text config to image file.
             radio_read_image(argv[0]);
             radio_print_version(stdout);
@@ -134,13 +402,25 @@ int main(int argc, char **argv)
             radio_save_image("device.img");
 
         } else {
+            if (dry_run) {
+                // Image file stands for contents of the radio.
+                if (argc != 2)
+                    usage();
+                radio_read_image(argv[0]);
+            }
+
             // Update device from text config file.
             radio_connect();
             radio_download();
             radio_print_version(stdout);
-            radio_save_image("backup.img");
-            radio_parse_config(argv[0]);
+            if (! dry_run)
+                radio_save_image("backup.img");
+            radio_parse_config(argv[argc-1]);
             radio_verify_config();
+            if (partial_flag) {
+                // Write only tables modified by the script.
+                radio_tables = radio_touched | TABLE_VERSION;
+            }
             radio_upload(1);
             radio_disconnect();
         }
@@ -161,10 +441,19 @@ int main(int argc, char **argv)
 
         // Dump device to image file.
         radio_connect();
-        radio_download();
-        radio_print_version(stdout);
+        if (stream_flag) {
+            radio_download_stream(stdout);
+        } else {
+            radio_download();
+            radio_print_version(stdout);
+        }
         radio_disconnect();
-        radio_save_image("device.img");
+        if (radio_tables) {
+            // Partial image is not usable for upload.
+            fprintf(stderr, "Partial read: image is not saved.\n");
+        } else {
+            radio_save_image("device.img");
+        }
 
         // Print configuration to file.
         const char *filename = "device.conf";
@@ -179,13 +468,94 @@ int main(int argc, char **argv)
 
     } else if (csv_flag) {
         // Update contacts database on the device.
-        if (argc != 1)
+        if (argc != 1 + dry_run)
             usage();
 
+        if (dry_run) {
+            // Image file gives the radio model.
+            radio_read_image(argv[0]);
+        }
         radio_connect();
-        radio_write_csv(argv[0]);
+        radio_write_csv(argv[argc-1]);
         radio_disconnect();
 
+    } else if (plan_flag) {
+        if (argc != 1 && argc != 2)
+            usage();
+
+        // Print transfer plan for the image file.
+        radio_read_image(argv[0]);
+        if (argc == 2) {
+            radio_parse_config(argv[1]);
+            radio_verify_config();
+            if (partial_flag)
+                radio_tables = radio_touched | TABLE_VERSION;
+        }
+        radio_print_plan(stdout);
+
+    } else if (convert_flag) {
+        if (argc != 2)
+            usage();
+
+        // Rewrite image file in another format.
+        radio_read_image(argv[0]);
+        radio_save_image(argv[1]);
+
+    } else if (snapshots_flag) {
+        if (argc != 0)
+            usage();
+        store_list(stdout);
+
+    } else if (restore_id) {
+        if (argc != 1)
+            usage();
+
+        // Extract snapshot to image file.
+        radio_load_snapshot(restore_id);
+        store_dir = 0;
+        radio_save_image(argv[0]);
+
+    } else if (diff_flag) {
+        if (argc != 2)
+            usage();
+        radio_diff_snapshots(argv[0], argv[1], stdout);
+
+    } else if (batch_filename) {
+        if (argc != 0)
+            usage();
+        if (batch_run(batch_filename, nworkers) > 0)
+            exit(-1);
+
+    } else if (fingerprint_flag) {
+        if (argc == 0) {
+            // Read only the tables from the radio.
+            radio_connect();
+            radio_download_tables();
+            radio_disconnect();
+            radio_print_fingerprints(stdout, "device");
+        } else {
+            int i;
+
+            for (i=0; i<argc; i++) {
+                radio_read_image(argv[i]);
+                radio_print_fingerprints(stdout, argv[i]);
+            }
+        }
+
+    } else if (audit_flag) {
+        if (argc < 1)
+            usage();
+        if (audit_run(argv, argc, nworkers) > 0)
+            exit(-1);
+
+    } else if (query) {
+        if (argc < 1)
+            usage();
+
+        // Exit status is non-zero when nothing found, like grep.
+        if (query_run(query, argv, argc) == 0)
+            exit(1);
+
     } else if (validate_flag) {
       radio_validate_config(argv[0]);
     } else {
@@ -196,5 +566,9 @@ int main(int argc, char **argv)
         radio_read_image(argv[0]);
         radio_print_config(stdout, !isatty(1));
     }
+    if (dry_run)
+        radio_print_estimate(stdout);
+    replay_finish();
+    trace_success();
     return 0;
 }
@@ -359,14 +359,109 @@ static void md380_print_version(radio_device_t *radio, FILE *out)
     }
 }
 
+//
+// Vocabulary of configuration script.
+//
+enum {
+    PARAM_RADIO, PARAM_NAME, PARAM_ID, PARAM_DATE, PARAM_VERSION, PARAM_INTRO1, PARAM_INTRO2,
+};
+
+static const keyword_t PARAMETER_WORDS[] = {
+    { "Radio",                 PARAM_RADIO },
+    { "Name",                  PARAM_NAME },
+    { "ID",                    PARAM_ID },
+    { "Last Programmed Date",  PARAM_DATE },
+    { "CPS Software Version",  PARAM_VERSION },
+    { "Intro Line 1",          PARAM_INTRO1 },
+    { "Intro Line 2",          PARAM_INTRO2 },
+    { 0 },
+};
+static keyword_table_t parameter_table = { PARAMETER_WORDS };
+
+static const keyword_t HEADER_WORDS[] = {
+    { "Digital",    'D' },
+    { "Analog",     'A' },
+    { "Zone",       'Z' },
+    { "Scanlist",   'S' },
+    { "Contact",    'C' },
+    { "Grouplist",  'G' },
+    { "Message",    'M' },
+    { 0 },
+};
+static keyword_table_t header_table = { HEADER_WORDS };
+
+static const keyword_t POWER_WORDS[] = {
+    { "High",  POWER_HIGH },
+    { "Low",   POWER_LOW },
+    { 0 },
+};
+static keyword_table_t power_table = { POWER_WORDS };
+
+static const keyword_t DIGITAL_ADMIT_WORDS[] = {
+    { "Always",  ADMIT_ALWAYS },
+    { "Free",    ADMIT_CH_FREE },
+    { "Color",   ADMIT_COLOR },
+    { 0 },
+};
+static keyword_table_t digital_admit_table = { DIGITAL_ADMIT_WORDS };
+
+static const keyword_t ANALOG_ADMIT_WORDS[] = {
+    { "Always",  ADMIT_ALWAYS },
+    { "Free",    ADMIT_CH_FREE },
+    { "Tone",    ADMIT_TONE },
+    { 0 },
+};
+static keyword_table_t analog_admit_table = { ANALOG_ADMIT_WORDS };
+
+static const keyword_t SQUELCH_WORDS[] = {
+    { "Normal",  SQ_NORMAL },
+    { "Tight",   SQ_TIGHT },
+    { 0 },
+};
+static keyword_table_t squelch_table = { SQUELCH_WORDS };
+
+static const keyword_t WIDTH_WORDS[] = {
+    { "12.5",  BW_12_5_KHZ },
+    { "20",    BW_20_KHZ },
+    { "25",    BW_25_KHZ },
+    { 0 },
+};
+static keyword_table_t width_table = { WIDTH_WORDS };
+
+static const keyword_t CALL_TYPE_WORDS[] = {
+    { "Group",    CALL_GROUP },
+    { "Private",  CALL_PRIVATE },
+    { "All",      CALL_ALL },
+    { 0 },
+};
+static keyword_table_t call_type_table = { CALL_TYPE_WORDS };
+
+//
+// Map of tables in memory image.
+//
+static const table_range_t md380_tables[] = {
+    { TABLE_VERSION,    OFFSET_TIMESTMP - 1,    OFFSET_SETTINGS - OFFSET_TIMESTMP + 1 },
+    { TABLE_SETTINGS,   OFFSET_SETTINGS,        OFFSET_MSG - OFFSET_SETTINGS },
+    { TABLE_MESSAGES,   OFFSET_MSG,             NMESSAGES * 288 },
+    { TABLE_CONTACTS,   OFFSET_CONTACTS,        NCONTACTS * 36 },
+    { TABLE_GROUPLISTS, OFFSET_GLISTS,          NGLISTS * 96 },
+    { TABLE_ZONES,      OFFSET_ZONES,           NZONES * 64 },
+    { TABLE_SCANLISTS,  OFFSET_SCANL,           NSCANL * 104 },
+    { TABLE_CHANNELS,   OFFSET_CHANNELS,        NCHAN * 64 },
+    { 0 },
+};
+
 //
 // Read memory image from the device.
+// Blocks of tables which are not selected are skipped.
 //
 static void md380_download(radio_device_t *radio)
 {
     int bno;
 
     for (bno=0; bno<MEMSZ/1024; bno++) {
+        if (! radio_range_selected(bno*1024, 1024))
+            continue;
         dfu_read_block(bno, &radio_mem[bno*1024], 1024);
 
         ++radio_progress;
@@ -379,20 +474,35 @@ static void md380_download(radio_device_t *radio)
 
 //
 // Write memory image to the device.
+// With selected tables, or when contents of the radio is known,
+// only 64-kbyte sectors which need update are erased and written.
 //
 static void md380_upload(radio_device_t *radio, int cont_flag)
 {
-    int bno;
+    int bno, start, finish;
 
-    dfu_erase(0, MEMSZ);
+    for (start=0; start<MEMSZ; start=finish) {
+        // Find a run of sectors to update.
+        finish = start + 0x10000;
+        if (! radio_range_selected(start, 0x10000))
+            continue;
+        while (finish < MEMSZ && radio_range_selected(finish, 0x10000))
+            finish += 0x10000;
 
-    for (bno=0; bno<MEMSZ/1024; bno++) {
-        dfu_write_block(bno, &radio_mem[bno*1024], 1024);
+        if (radio_upload_partial())
+            dfu_erase_image(start, finish);
+        else
+            dfu_erase(0, MEMSZ);
 
-        ++radio_progress;
-        if (radio_progress % 32 == 0) {
-            fprintf(stderr, "#");
-            fflush(stderr);
+        for (bno=start/1024; bno<finish/1024; bno++) {
+            dfu_write_block(bno, &radio_mem[bno*1024], 1024);
+            radio_mark_written(bno*1024, 1024);
+
+            ++radio_progress;
+            if (radio_progress % 32 == 0) {
+                fprintf(stderr, "#");
+                fflush(stderr);
+            }
         }
     }
 }
@@ -561,8 +671,10 @@ static void setup_message(int index, const char *text)
 //
 // Check that the radio does support this frequency.
 //
-static int is_valid_frequency(int mhz)
+static int is_valid_frequency(freq_t hz)
 {
+    int mhz = hz / 1000000;
+
     if (mhz >= 136 && mhz <= 174)
         return 1;
     if (mhz >= 400 && mhz <= 480)
@@ -573,7 +685,7 @@ static int is_valid_frequency(int mhz)
 //
 // Set the parameters for a given memory channel.
 //
-static void setup_channel(int i, int mode, char *name, double rx_mhz, double tx_mhz,
+static void setup_channel(int i, int mode, char *name, freq_t rx_hz, freq_t tx_hz,
     int power, int scanlist, int squelch, int tot, int rxonly,
     int admit, int colorcode, int timeslot, int grouplist, int contact,
     int rxtone, int txtone, int width)
@@ -592,8 +704,8 @@ static void setup_channel(int i, int mode, char *name, double rx_mhz, double tx_
     ch->tot                 = tot;
     ch->scan_list_index     = scanlist;
     ch->group_list_index    = grouplist;
-    ch->rx_frequency        = mhz_to_abcdefgh(rx_mhz);
-    ch->tx_frequency        = mhz_to_abcdefgh(tx_mhz);
+    ch->rx_frequency        = hz_to_abcdefgh(rx_hz);
+    ch->tx_frequency        = hz_to_abcdefgh(tx_hz);
     ch->ctcss_dcs_receive   = rxtone;
     ch->ctcss_dcs_transmit  = txtone;
 
@@ -1062,18 +1174,20 @@ static void md380_print_config(radio_device_t *radio, FILE *out, int verbose)
 {
     int i;
 
-    fprintf(out, "Radio: %s\n", radio->name);
-    if (verbose)
-        md380_print_version(radio, out);
+    if (radio_table_selected(TABLE_VERSION)) {
+        fprintf(out, "Radio: %s\n", radio->name);
+        if (verbose)
+            md380_print_version(radio, out);
+    }
 
     //
     // Channels.
     //
-    if (have_channels(MODE_DIGITAL)) {
+    if (radio_table_selected(TABLE_CHANNELS) && have_channels(MODE_DIGITAL)) {
         fprintf(out, "\n");
         print_digital_channels(out, verbose);
     }
-    if (have_channels(MODE_ANALOG)) {
+    if (radio_table_selected(TABLE_CHANNELS) && have_channels(MODE_ANALOG)) {
         fprintf(out, "\n");
         print_analog_channels(out, verbose);
     }
@@ -1081,7 +1195,7 @@ static void md380_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Zones.
     //
-    if (have_zones()) {
+    if (radio_table_selected(TABLE_ZONES) && have_zones()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of channel zones.\n");
@@ -1114,7 +1228,7 @@ static void md380_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Scan lists.
     //
-    if (have_scanlists()) {
+    if (radio_table_selected(TABLE_SCANLISTS) && have_scanlists()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of scan lists.\n");
@@ -1178,7 +1292,7 @@ static void md380_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Contacts.
     //
-    if (have_contacts()) {
+    if (radio_table_selected(TABLE_CONTACTS) && have_contacts()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of contacts.\n");
@@ -1208,7 +1322,7 @@ static void md380_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Group lists.
     //
-    if (have_grouplists()) {
+    if (radio_table_selected(TABLE_GROUPLISTS) && have_grouplists()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of group lists.\n");
@@ -1241,7 +1355,7 @@ static void md380_print_config(radio_device_t *radio, FILE *out, int verbose)
     //
     // Text messages.
     //
-    if (have_messages()) {
+    if (radio_table_selected(TABLE_MESSAGES) && have_messages()) {
         fprintf(out, "\n");
         if (verbose) {
             fprintf(out, "# Table of text messages.\n");
@@ -1265,8 +1379,10 @@ static void md380_print_config(radio_device_t *radio, FILE *out, int verbose)
     }
 
     // General settings.
-    print_id(out, verbose);
-    print_intro(out, verbose);
+    if (radio_table_selected(TABLE_SETTINGS)) {
+        print_id(out, verbose);
+        print_intro(out, verbose);
+    }
 }
 
 //
@@ -1365,40 +1481,45 @@ static void erase_contacts()
 //
 static void md380_parse_parameter(radio_device_t *radio, char *param, char *value)
 {
+    int kw = keyword_lookup(&parameter_table, param);
     general_settings_t *gs = GET_SETTINGS();
 
-    if (strcasecmp("Radio", param) == 0) {
+    if (kw == PARAM_RADIO) {
         if (!radio_is_compatible(value)) {
             fprintf(stderr, "Incompatible model: %s\n", value);
             exit(-1);
         }
         return;
     }
-    if (strcasecmp ("Name", param) == 0) {
+    if (kw == PARAM_NAME) {
         utf8_decode(gs->radio_name, value, 16);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("ID", param) == 0) {
+    if (kw == PARAM_ID) {
         uint32_t id = strtoul(value, 0, 0);
         gs->radio_id[0] = id;
         gs->radio_id[1] = id >> 8;
         gs->radio_id[2] = id >> 16;
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("Last Programmed Date", param) == 0) {
+    if (kw == PARAM_DATE) {
         // Ignore.
         return;
     }
-    if (strcasecmp ("CPS Software Version", param) == 0) {
+    if (kw == PARAM_VERSION) {
         // Ignore.
         return;
     }
-    if (strcasecmp ("Intro Line 1", param) == 0) {
+    if (kw == PARAM_INTRO1) {
         utf8_decode(gs->intro_line1, value, 10);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
-    if (strcasecmp ("Intro Line 2", param) == 0) {
+    if (kw == PARAM_INTRO2) {
         utf8_decode(gs->intro_line2, value, 10);
+        radio_touched |= TABLE_SETTINGS;
         return;
     }
     fprintf(stderr, "Unknown parameter: %s = %s\n", param, value);
@@ -1410,22 +1531,31 @@ static void md380_parse_parameter(radio_device_t *radio, char *param, char *valu
 // Start_flag is 1 for the first table row.
 // Return 0 on failure.
 //
-static int parse_digital_channel(radio_device_t *radio, int first_row, char *line)
+static int parse_digital_channel(radio_device_t *radio, int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], rxfreq_str[256], offset_str[256];
-    char power_str[256], scanlist_str[256];
-    char tot_str[256], rxonly_str[256], admit_str[256], colorcode_str[256];
-    char slot_str[256], grouplist_str[256], contact_str[256];
+    char *num_str, *name_str, *rxfreq_str, *offset_str;
+    char *power_str, *scanlist_str;
+    char *tot_str, *rxonly_str, *admit_str, *colorcode_str;
+    char *slot_str, *grouplist_str, *contact_str;
     int num, power, scanlist, tot, rxonly, admit;
     int colorcode, timeslot, grouplist, contact;
-    double rx_mhz, tx_mhz;
+    freq_t rx_hz, tx_hz;
 
-    if (sscanf(line, "%s %s %s %s %s %s %s %s %s %s %s %s %s",
-        num_str, name_str, rxfreq_str, offset_str,
-        power_str, scanlist_str,
-        tot_str, rxonly_str, admit_str, colorcode_str,
-        slot_str, grouplist_str, contact_str) != 13)
+    if (ntok < 13)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    rxfreq_str = tok[2].str;
+    offset_str = tok[3].str;
+    power_str = tok[4].str;
+    scanlist_str = tok[5].str;
+    tot_str = tok[6].str;
+    rxonly_str = tok[7].str;
+    admit_str = tok[8].str;
+    colorcode_str = tok[9].str;
+    slot_str = tok[10].str;
+    grouplist_str = tok[11].str;
+    contact_str = tok[12].str;
 
     num = atoi(num_str);
     if (num < 1 || num > NCHAN) {
@@ -1433,25 +1563,22 @@ static int parse_digital_channel(radio_device_t *radio, int first_row, char *lin
         return 0;
     }
 
-    if (sscanf(rxfreq_str, "%lf", &rx_mhz) != 1 ||
-        !is_valid_frequency(rx_mhz)) {
+    if (!parse_freq(rxfreq_str, &rx_hz) ||
+        !is_valid_frequency(rx_hz)) {
         fprintf(stderr, "Bad receive frequency.\n");
         return 0;
     }
-    if (sscanf(offset_str, "%lf", &tx_mhz) != 1) {
+    if (!parse_freq(offset_str, &tx_hz)) {
 badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
     if (offset_str[0] == '-' || offset_str[0] == '+')
-        tx_mhz += rx_mhz;
-    if (! is_valid_frequency(tx_mhz))
+        tx_hz += rx_hz;
+    if (! is_valid_frequency(tx_hz))
         goto badtx;
 
-    if (strcasecmp("High", power_str) == 0) {
-        power = POWER_HIGH;
-    } else if (strcasecmp("Low", power_str) == 0) {
-        power = POWER_LOW;
-    } else {
+    power = keyword_lookup(&power_table, power_str);
+    if (power < 0) {
         fprintf(stderr, "Bad power level.\n");
         return 0;
     }
@@ -1482,13 +1609,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (*admit_str == '-' || strcasecmp("Always", admit_str) == 0) {
+    if (*admit_str == '-') {
         admit = ADMIT_ALWAYS;
-    } else if (strcasecmp("Free", admit_str) == 0) {
-        admit = ADMIT_CH_FREE;
-    } else if (strcasecmp("Color", admit_str) == 0) {
-        admit = ADMIT_COLOR;
-    } else {
+    } else if ((admit = keyword_lookup(&digital_admit_table, admit_str)) < 0) {
         fprintf(stderr, "Bad admit criteria.\n");
         return 0;
     }
@@ -1530,9 +1653,10 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         erase_channels();
         erase_zones();
         erase_scanlists();
+        radio_touched |= TABLE_CHANNELS | TABLE_ZONES | TABLE_SCANLISTS;
     }
 
-    setup_channel(num-1, MODE_DIGITAL, name_str, rx_mhz, tx_mhz,
+    setup_channel(num-1, MODE_DIGITAL, name_str, rx_hz, tx_hz,
         power, scanlist, SQ_NORMAL, tot, rxonly, admit,
         colorcode, timeslot, grouplist, contact, 0xffff, 0xffff, BW_12_5_KHZ);
 
@@ -1545,22 +1669,31 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
 // Start_flag is 1 for the first table row.
 // Return 0 on failure.
 //
-static int parse_analog_channel(radio_device_t *radio, int first_row, char *line)
+static int parse_analog_channel(radio_device_t *radio, int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], rxfreq_str[256], offset_str[256];
-    char power_str[256], scanlist_str[256], squelch_str[256];
-    char tot_str[256], rxonly_str[256], admit_str[256];
-    char rxtone_str[256], txtone_str[256], width_str[256];
+    char *num_str, *name_str, *rxfreq_str, *offset_str;
+    char *power_str, *scanlist_str, *squelch_str;
+    char *tot_str, *rxonly_str, *admit_str;
+    char *rxtone_str, *txtone_str, *width_str;
     int num, power, scanlist, squelch, tot, rxonly, admit;
     int rxtone, txtone, width;
-    double rx_mhz, tx_mhz;
+    freq_t rx_hz, tx_hz;
 
-    if (sscanf(line, "%s %s %s %s %s %s %s %s %s %s %s %s %s",
-        num_str, name_str, rxfreq_str, offset_str,
-        power_str, scanlist_str,
-        tot_str, rxonly_str, admit_str, squelch_str,
-        rxtone_str, txtone_str, width_str) != 13)
+    if (ntok < 13)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    rxfreq_str = tok[2].str;
+    offset_str = tok[3].str;
+    power_str = tok[4].str;
+    scanlist_str = tok[5].str;
+    tot_str = tok[6].str;
+    rxonly_str = tok[7].str;
+    admit_str = tok[8].str;
+    squelch_str = tok[9].str;
+    rxtone_str = tok[10].str;
+    txtone_str = tok[11].str;
+    width_str = tok[12].str;
 
     num = atoi(num_str);
     if (num < 1 || num > NCHAN) {
@@ -1568,25 +1701,22 @@ static int parse_analog_channel(radio_device_t *radio, int first_row, char *line
         return 0;
     }
 
-    if (sscanf(rxfreq_str, "%lf", &rx_mhz) != 1 ||
-        !is_valid_frequency(rx_mhz)) {
+    if (!parse_freq(rxfreq_str, &rx_hz) ||
+        !is_valid_frequency(rx_hz)) {
         fprintf(stderr, "Bad receive frequency.\n");
         return 0;
     }
-    if (sscanf(offset_str, "%lf", &tx_mhz) != 1) {
+    if (!parse_freq(offset_str, &tx_hz)) {
 badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
     if (offset_str[0] == '-' || offset_str[0] == '+')
-        tx_mhz += rx_mhz;
-    if (! is_valid_frequency(tx_mhz))
+        tx_hz += rx_hz;
+    if (! is_valid_frequency(tx_hz))
         goto badtx;
 
-    if (strcasecmp("High", power_str) == 0) {
-        power = POWER_HIGH;
-    } else if (strcasecmp("Low", power_str) == 0) {
-        power = POWER_LOW;
-    } else {
+    power = keyword_lookup(&power_table, power_str);
+    if (power < 0) {
         fprintf(stderr, "Bad power level.\n");
         return 0;
     }
@@ -1601,12 +1731,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         }
     }
 
-    if (strcasecmp ("Normal", squelch_str) == 0) {
-        squelch = SQ_NORMAL;
-    } else if (strcasecmp ("Tight", squelch_str) == 0) {
-        squelch = SQ_TIGHT;
-    } else {
-        fprintf (stderr, "Bad squelch level.\n");
+    squelch = keyword_lookup(&squelch_table, squelch_str);
+    if (squelch < 0) {
+        fprintf(stderr, "Bad squelch level.\n");
         return 0;
     }
 
@@ -1626,13 +1753,9 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (*admit_str == '-' || strcasecmp("Always", admit_str) == 0) {
+    if (*admit_str == '-') {
         admit = ADMIT_ALWAYS;
-    } else if (strcasecmp("Free", admit_str) == 0) {
-        admit = ADMIT_CH_FREE;
-    } else if (strcasecmp("Tone", admit_str) == 0) {
-        admit = ADMIT_TONE;
-    } else {
+    } else if ((admit = keyword_lookup(&analog_admit_table, admit_str)) < 0) {
         fprintf(stderr, "Bad admit criteria.\n");
         return 0;
     }
@@ -1648,23 +1771,19 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
         return 0;
     }
 
-    if (strcasecmp ("12.5", width_str) == 0) {
-        width = BW_12_5_KHZ;
-    } else if (strcasecmp ("20", width_str) == 0) {
-        width = BW_20_KHZ;
-    } else if (strcasecmp ("25", width_str) == 0) {
-        width = BW_25_KHZ;
-    } else {
-        fprintf (stderr, "Bad width.\n");
+    width = keyword_lookup(&width_table, width_str);
+    if (width < 0) {
+        fprintf(stderr, "Bad width.\n");
         return 0;
     }
 
     if (first_row && radio->channel_count == 0) {
         // On first entry, erase all channels, zones and scanlists.
         erase_channels();
+        radio_touched |= TABLE_CHANNELS;
     }
 
-    setup_channel(num-1, MODE_ANALOG, name_str, rx_mhz, tx_mhz,
+    setup_channel(num-1, MODE_ANALOG, name_str, rx_hz, tx_hz,
         power, scanlist, squelch, tot, rxonly, admit,
         1, 1, 0, 0, rxtone, txtone, width);
 
@@ -1676,13 +1795,16 @@ badtx:  fprintf(stderr, "Bad transmit frequency.\n");
 // Parse one line of Zones table.
 // Return 0 on failure.
 //
-static int parse_zones(int first_row, char *line)
+static int parse_zones(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], chan_str[256];
+    char *num_str, *name_str, *chan_str;
     int znum;
 
-    if (sscanf(line, "%s %s %s", num_str, name_str, chan_str) != 3)
+    if (ntok < 3)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    chan_str = tok[2].str;
 
     znum = strtoul(num_str, 0, 10);
     if (znum < 1 || znum > NZONES) {
@@ -1693,6 +1815,7 @@ static int parse_zones(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Zones table.
         erase_zones();
+        radio_touched |= TABLE_ZONES;
     }
 
     setup_zone(znum-1, name_str);
@@ -1752,15 +1875,20 @@ static int parse_zones(int first_row, char *line)
 // Parse one line of Scanlist table.
 // Return 0 on failure.
 //
-static int parse_scanlist(int first_row, char *line)
+static int parse_scanlist(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], prio1_str[256], prio2_str[256];
-    char tx_str[256], chan_str[256];
+    char *num_str, *name_str, *prio1_str, *prio2_str;
+    char *tx_str, *chan_str;
     int snum, prio1, prio2, txchan;
 
-    if (sscanf(line, "%s %s %s %s %s %s",
-        num_str, name_str, prio1_str, prio2_str, tx_str, chan_str) != 6)
+    if (ntok < 6)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    prio1_str = tok[2].str;
+    prio2_str = tok[3].str;
+    tx_str = tok[4].str;
+    chan_str = tok[5].str;
 
     snum = atoi(num_str);
     if (snum < 1 || snum > NSCANL) {
@@ -1771,6 +1899,7 @@ static int parse_scanlist(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Scanlists table.
         erase_scanlists();
+        radio_touched |= TABLE_SCANLISTS;
     }
 
     if (*prio1_str == '-') {
@@ -1866,14 +1995,18 @@ static int parse_scanlist(int first_row, char *line)
 // Parse one line of Contacts table.
 // Return 0 on failure.
 //
-static int parse_contact(int first_row, char *line)
+static int parse_contact(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], type_str[256], id_str[256], rxtone_str[256];
+    char *num_str, *name_str, *type_str, *id_str, *rxtone_str;
     int cnum, type, id, rxtone;
 
-    if (sscanf(line, "%s %s %s %s %s",
-        num_str, name_str, type_str, id_str, rxtone_str) != 5)
+    if (ntok < 5)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    type_str = tok[2].str;
+    id_str = tok[3].str;
+    rxtone_str = tok[4].str;
 
     cnum = atoi(num_str);
     if (cnum < 1 || cnum > NCONTACTS) {
@@ -1884,15 +2017,11 @@ static int parse_contact(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Contacts table.
         erase_contacts();
+        radio_touched |= TABLE_CONTACTS;
     }
 
-    if (strcasecmp("Group", type_str) == 0) {
-        type = CALL_GROUP;
-    } else if (strcasecmp("Private", type_str) == 0) {
-        type = CALL_PRIVATE;
-    } else if (strcasecmp("All", type_str) == 0) {
-        type = CALL_ALL;
-    } else {
+    type = keyword_lookup(&call_type_table, type_str);
+    if (type < 0) {
         fprintf(stderr, "Bad call type.\n");
         return 0;
     }
@@ -1920,13 +2049,16 @@ static int parse_contact(int first_row, char *line)
 // Parse one line of Grouplist table.
 // Return 0 on failure.
 //
-static int parse_grouplist(int first_row, char *line)
+static int parse_grouplist(int first_row, token_t *tok, int ntok)
 {
-    char num_str[256], name_str[256], list_str[256];
+    char *num_str, *name_str, *list_str;
     int glnum;
 
-    if (sscanf(line, "%s %s %s", num_str, name_str, list_str) != 3)
+    if (ntok < 3)
         return 0;
+    num_str = tok[0].str;
+    name_str = tok[1].str;
+    list_str = tok[2].str;
 
     glnum = strtoul(num_str, 0, 10);
     if (glnum < 1 || glnum > NGLISTS) {
@@ -1937,6 +2069,7 @@ static int parse_grouplist(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Grouplists table.
         memset(&radio_mem[OFFSET_GLISTS], 0, NGLISTS*96);
+        radio_touched |= TABLE_GROUPLISTS;
     }
 
     setup_grouplist(glnum-1, name_str);
@@ -1996,9 +2129,9 @@ static int parse_grouplist(int first_row, char *line)
 // Parse one line of Messages table.
 // Return 0 on failure.
 //
-static int parse_messages(int first_row, char *line)
+static int parse_messages(int first_row, token_t *tok, int ntok)
 {
-    char *text;
+    char *text, *line = token_rest(tok, ntok, 0);
     int mnum;
 
     mnum = strtoul(line, &text, 10);
@@ -2010,6 +2143,7 @@ static int parse_messages(int first_row, char *line)
     if (first_row) {
         // On first entry, erase the Messages table.
         memset(&radio_mem[OFFSET_MSG], 0, NMESSAGES*288);
+        radio_touched |= TABLE_MESSAGES;
     }
 
     setup_message(mnum-1, text);
@@ -2022,37 +2156,27 @@ static int parse_messages(int first_row, char *line)
 //
 static int md380_parse_header(radio_device_t *radio, char *line)
 {
-    if (strncasecmp(line, "Digital", 7) == 0)
-        return 'D';
-    if (strncasecmp(line, "Analog", 6) == 0)
-        return 'A';
-    if (strncasecmp(line, "Zone", 4) == 0)
-        return 'Z';
-    if (strncasecmp(line, "Scanlist", 8) == 0)
-        return 'S';
-    if (strncasecmp(line, "Contact", 7) == 0)
-        return 'C';
-    if (strncasecmp(line, "Grouplist", 9) == 0)
-        return 'G';
-    if (strncasecmp(line, "Message", 7) == 0)
-        return 'M';
-    return 0;
+    int table_id = keyword_prefix(&header_table, line);
+
+    if (table_id < 0)
+        return 0;
+    return table_id;
 }
 
 //
 // Parse one line of table data.
 // Return 0 on failure.
 //
-static int md380_parse_row(radio_device_t *radio, int table_id, int first_row, char *line)
+static int md380_parse_row(radio_device_t *radio, int table_id, int first_row, token_t *tok, int ntok)
 {
     switch (table_id) {
-    case 'D': return parse_digital_channel(radio, first_row, line);
-    case 'A': return parse_analog_channel(radio, first_row, line);
-    case 'Z': return parse_zones(first_row, line);
-    case 'S': return parse_scanlist(first_row, line);
-    case 'C': return parse_contact(first_row, line);
-    case 'G': return parse_grouplist(first_row, line);
-    case 'M': return parse_messages(first_row, line);
+    case 'D': return parse_digital_channel(radio, first_row, tok, ntok);
+    case 'A': return parse_analog_channel(radio, first_row, tok, ntok);
+    case 'Z': return parse_zones(first_row, tok, ntok);
+    case 'S': return parse_scanlist(first_row, tok, ntok);
+    case 'C': return parse_contact(first_row, tok, ntok);
+    case 'G': return parse_grouplist(first_row, tok, ntok);
+    case 'M': return parse_messages(first_row, tok, ntok);
     }
     return 0;
 }
@@ -2245,7 +2369,10 @@ radio_device_t radio_md380 = {
     md380_parse_header,
     md380_parse_row,
     md380_update_timestamp,
-    //TODO: md380_write_csv,
+    0,                          //TODO: md380_write_csv,
+    0,                          // print_plan
+    md380_tables,
+    MEMSZ,
 };
 
 //
@@ -2265,7 +2392,10 @@ radio_device_t radio_md390 = {
     md380_parse_header,
     md380_parse_row,
     md380_update_timestamp,
-    //TODO: md380_write_csv,
+    0,                          //TODO: md380_write_csv,
+    0,                          // print_plan
+    md380_tables,
+    MEMSZ,
 };
 
 //
@@ -2285,6 +2415,10 @@ radio_device_t radio_d900 = {
     md380_parse_header,
     md380_parse_row,
     md380_update_timestamp,
+    0,                          // write_csv
+    0,                          // print_plan
+    md380_tables,
+    MEMSZ,
 };
 
 //
@@ -2304,6 +2438,10 @@ radio_device_t radio_dp880 = {
     md380_parse_header,
     md380_parse_row,
     md380_update_timestamp,
+    0,                          // write_csv
+    0,                          // print_plan
+    md380_tables,
+    MEMSZ,
 };
 
 //
@@ -2323,4 +2461,8 @@ radio_device_t radio_rt27d = {
     md380_parse_header,
     md380_parse_row,
     md380_update_timestamp,
+    0,                          // write_csv
+    0,                          // print_plan
+    md380_tables,
+    MEMSZ,
 };
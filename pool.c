@@ -0,0 +1,168 @@
+/*
+ * Pool of worker processes.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if !defined(__WIN32__) && !defined(WIN32)
+#   include <sys/mman.h>
+#   include <sys/wait.h>
+#endif
+#include "util.h"
+
+#if !defined(__WIN32__) && !defined(WIN32)
+//
+// Radio routines exit on error, so every task runs in its own
+// worker process. Results are passed back to the parent through
+// memory shared with the workers.
+//
+void *pool_alloc(unsigned nbytes)
+{
+    void *data;
+
+    data = mmap(0, nbytes ? nbytes : 1, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        exit(-1);
+    }
+    return data;
+}
+
+void pool_free(void *data, unsigned nbytes)
+{
+    munmap(data, nbytes ? nbytes : 1);
+}
+
+//
+// Get the last non-empty line of the log file.
+//
+void pool_last_line(FILE *log, char *buf, int maxlen)
+{
+    char line[256];
+
+    buf[0] = 0;
+    fflush(log);
+    rewind(log);
+    while (fgets(line, sizeof(line), log)) {
+        char *p = trim_spaces(line, sizeof(line) - 1);
+
+        if (*p)
+            snprintf(buf, maxlen, "%s", p);
+    }
+}
+
+//
+// Worker process: discard normal output, keep errors in the log,
+// and run the task.
+//
+static void run_worker(int index, FILE *log, void (*worker)(int, FILE*))
+{
+    int null_fd;
+
+    // Statistics and trace are reported by the parent.
+    stats_disable();
+    trace_disable();
+
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0)
+        dup2(null_fd, 1);
+    dup2(fileno(log), 2);
+    setvbuf(stderr, 0, _IONBF, 0);
+
+    worker(index, log);
+    fflush(stdout);
+    _exit(0);
+}
+
+//
+// Run tasks 0...ntasks-1 by given number of worker processes.
+// Every task gets a temporary log file for its error output.
+// When the worker exits, done() is called in the parent with
+// exit status of the worker, or -1 when it crashed, and the log.
+//
+void pool_run(int ntasks, int nworkers, void (*worker)(int, FILE*),
+    void (*done)(int, int, FILE*))
+{
+    pid_t *pid;
+    FILE **log;
+    int i, next, running;
+
+    pid = calloc(ntasks ? ntasks : 1, sizeof(pid_t));
+    log = calloc(ntasks ? ntasks : 1, sizeof(FILE*));
+    if (! pid || ! log) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+
+    // Start tasks while there are free workers.
+    fflush(stdout);
+    fflush(stderr);
+    next = 0;
+    running = 0;
+    while (next < ntasks || running > 0) {
+        int status;
+        pid_t p;
+
+        while (running < nworkers && next < ntasks) {
+            log[next] = tmpfile();
+            if (! log[next]) {
+                perror("tmpfile");
+                exit(-1);
+            }
+            p = fork();
+            if (p < 0) {
+                perror("fork");
+                exit(-1);
+            }
+            if (p == 0)
+                run_worker(next, log[next], worker);
+            pid[next++] = p;
+            running++;
+        }
+        p = wait(&status);
+        if (p < 0) {
+            perror("wait");
+            exit(-1);
+        }
+        for (i=0; i<ntasks; i++) {
+            if (pid[i] == p) {
+                pid[i] = 0;
+                running--;
+                if (done)
+                    done(i, WIFEXITED(status) ? WEXITSTATUS(status) : -1, log[i]);
+                fclose(log[i]);
+                break;
+            }
+        }
+    }
+    free(pid);
+    free(log);
+}
+#endif
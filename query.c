@@ -0,0 +1,595 @@
+/*
+ * Query of codeplug images through in-memory indexes.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "radio.h"
+#include "util.h"
+
+//
+// Query is a comma separated list of terms:
+//      freq=MHZ        channels with given receive or transmit frequency,
+//                      and zones and scan lists which contain them
+//      id=NUM          contacts with given DMR ID, grouplists which
+//                      contain them, and channels which use them
+//      channel=NUM     zones and scan lists which contain the channel
+//
+// Every image is decoded lazily: only tables needed for the query
+// are printed by the driver, and parsed back into a codeplug.
+// Relations between tables are kept as indexes: arrays of
+// (key, value) pairs sorted by key, for binary search.
+//
+enum {
+    TERM_FREQ,
+    TERM_ID,
+    TERM_CHANNEL,
+};
+
+static const keyword_t TERM_WORDS[] = {
+    { "freq",       TERM_FREQ },
+    { "id",         TERM_ID },
+    { "channel",    TERM_CHANNEL },
+    { 0 },
+};
+static keyword_table_t term_table = { TERM_WORDS };
+
+//
+// Tables needed for every kind of term.
+//
+static const unsigned TERM_TABLES[] = {
+    TABLE_CHANNELS | TABLE_ZONES | TABLE_SCANLISTS,
+    TABLE_CONTACTS | TABLE_GROUPLISTS | TABLE_CHANNELS,
+    TABLE_CHANNELS | TABLE_ZONES | TABLE_SCANLISTS,
+};
+
+typedef struct {
+    int         kind;           // Kind of term: TERM_*
+    int         value;          // Frequency in Hz, ID or channel number
+} term_t;
+
+typedef struct {
+    int         key;
+    int         value;
+} pair_t;
+
+typedef struct {
+    pair_t      *entry;
+    int         count;
+    int         max;
+} index_t;
+
+//
+// Names of table rows: name[num] for row number num.
+//
+typedef struct {
+    char        **name;
+    int         max;
+} names_t;
+
+//
+// Decoded tables of current image.
+//
+static unsigned loaded;                 // Tables decoded so far
+static codeplug_t *part[8];             // Text of decoded tables
+static char *part_text[8];
+static int nparts;
+
+static index_t chan_by_freq;            // Frequency -> channels
+static index_t chan_by_contact;         // Transmit contact -> channels
+static index_t chan_by_grouplist;       // Receive grouplist -> channels
+static index_t contact_by_id;           // DMR ID -> contacts
+static index_t grouplist_by_contact;    // Contact -> grouplists
+static index_t zone_by_chan;            // Channel -> zones
+static index_t scanlist_by_chan;        // Channel -> scan lists
+
+static names_t chan_name, contact_name, grouplist_name;
+static names_t chan_receive, chan_transmit;
+
+static void *xrealloc(void *ptr, unsigned nbytes)
+{
+    ptr = realloc(ptr, nbytes);
+    if (! ptr) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    return ptr;
+}
+
+static void index_add(index_t *ix, int key, int value)
+{
+    if (ix->count >= ix->max) {
+        ix->max = ix->max ? ix->max * 2 : 256;
+        ix->entry = xrealloc(ix->entry, ix->max * sizeof(pair_t));
+    }
+    ix->entry[ix->count].key = key;
+    ix->entry[ix->count].value = value;
+    ix->count++;
+}
+
+static int compare_pair(const void *pa, const void *pb)
+{
+    const pair_t *a = pa, *b = pb;
+
+    if (a->key != b->key)
+        return (a->key < b->key) ? -1 : 1;
+    if (a->value != b->value)
+        return (a->value < b->value) ? -1 : 1;
+    return 0;
+}
+
+static void index_sort(index_t *ix)
+{
+    qsort(ix->entry, ix->count, sizeof(pair_t), compare_pair);
+}
+
+//
+// Find the first entry with given key.
+// Return its position, or -1 when not found.
+//
+static int index_find(const index_t *ix, int key)
+{
+    int lo = 0, hi = ix->count;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (ix->entry[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < ix->count && ix->entry[lo].key == key)
+        return lo;
+    return -1;
+}
+
+static void names_set(names_t *n, int num, char *name)
+{
+    if (num >= n->max) {
+        int old = n->max;
+
+        n->max = num + 256;
+        n->name = xrealloc(n->name, n->max * sizeof(char*));
+        memset(n->name + old, 0, (n->max - old) * sizeof(char*));
+    }
+    n->name[num] = name;
+}
+
+static const char *names_get(const names_t *n, int num)
+{
+    if (num < 0 || num >= n->max || ! n->name[num])
+        return "?";
+    return n->name[num];
+}
+
+static void names_clear(names_t *n)
+{
+    if (n->max)
+        memset(n->name, 0, n->max * sizeof(char*));
+}
+
+//
+// Forget all tables of previous image.
+//
+static void reset_tables()
+{
+    int i;
+
+    for (i=0; i<nparts; i++) {
+        codeplug_free(part[i]);
+        free(part_text[i]);
+    }
+    nparts = 0;
+    loaded = 0;
+    chan_by_freq.count = 0;
+    chan_by_contact.count = 0;
+    chan_by_grouplist.count = 0;
+    contact_by_id.count = 0;
+    grouplist_by_contact.count = 0;
+    zone_by_chan.count = 0;
+    scanlist_by_chan.count = 0;
+    names_clear(&chan_name);
+    names_clear(&chan_receive);
+    names_clear(&chan_transmit);
+    names_clear(&contact_name);
+    names_clear(&grouplist_name);
+}
+
+//
+// Find the column by name of the header word.
+// Return -1 when the table has no such column.
+//
+static int find_column(const codeplug_section_t *sec, const char *name)
+{
+    const char *p = sec->header;
+    int len = strlen(name), col;
+
+    for (col=0; *p; col++) {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == 0)
+            break;
+        int n = strcspn(p, " \t");
+        if (n == len && strncasecmp(p, name, len) == 0)
+            return col;
+        p += n;
+    }
+    return -1;
+}
+
+//
+// Get the word of the row, or NULL when the row is shorter.
+//
+static char *cell(const codeplug_section_t *sec, int col, int row)
+{
+    if (col < 0 || col >= sec->width[row])
+        return 0;
+    return sec->column[col][row].str;
+}
+
+//
+// Add members of list "1-8,10" to the index, with given value.
+//
+static void index_list(index_t *ix, const char *list, int value)
+{
+    const char *p = list;
+
+    if (! list || *p == '-')
+        return;
+    while (*p >= '0' && *p <= '9') {
+        int first = strtoul(p, (char**)&p, 10), last = first, k;
+
+        if (*p == '-')
+            last = strtoul(p+1, (char**)&p, 10);
+        for (k=first; k<=last; k++)
+            index_add(ix, k, value);
+        if (*p != ',')
+            break;
+        p++;
+    }
+}
+
+//
+// Channels: names, frequencies, contacts and grouplists.
+//
+static void index_channels(const codeplug_section_t *sec)
+{
+    int num_col = 0, name_col = find_column(sec, "Name");
+    int rx_col = find_column(sec, "Receive");
+    int tx_col = find_column(sec, "Transmit");
+    int contact_col = find_column(sec, "TxContact");
+    int gl_col = find_column(sec, "RxGL");
+    int i;
+
+    for (i=0; i<sec->nrows; i++) {
+        int num = atoi(cell(sec, num_col, i));
+        char *rx_str = cell(sec, rx_col, i);
+        char *tx_str = cell(sec, tx_col, i);
+        char *str;
+        freq_t rx_hz = 0, tx_hz = 0;
+
+        if (num <= 0)
+            continue;
+        names_set(&chan_name, num, cell(sec, name_col, i));
+        names_set(&chan_receive, num, rx_str);
+        names_set(&chan_transmit, num, tx_str);
+        if (rx_str && parse_freq(rx_str, &rx_hz)) {
+            index_add(&chan_by_freq, rx_hz, num);
+            if (tx_str && parse_freq(tx_str, &tx_hz)) {
+                if (*tx_str == '+' || *tx_str == '-')
+                    tx_hz += rx_hz;
+                if (tx_hz != rx_hz)
+                    index_add(&chan_by_freq, tx_hz, num);
+            }
+        }
+
+        str = cell(sec, contact_col, i);
+        if (str && *str != '-')
+            index_add(&chan_by_contact, atoi(str), num);
+        str = cell(sec, gl_col, i);
+        if (str && *str != '-')
+            index_add(&chan_by_grouplist, atoi(str), num);
+    }
+}
+
+//
+// Contacts: names and DMR IDs.
+//
+static void index_contacts(const codeplug_section_t *sec)
+{
+    int name_col = find_column(sec, "Name");
+    int id_col = find_column(sec, "ID");
+    int i;
+
+    for (i=0; i<sec->nrows; i++) {
+        int num = atoi(cell(sec, 0, i));
+        char *id_str = cell(sec, id_col, i);
+
+        if (num <= 0)
+            continue;
+        names_set(&contact_name, num, cell(sec, name_col, i));
+        if (id_str)
+            index_add(&contact_by_id, atoi(id_str), num);
+    }
+}
+
+//
+// Zones, scan lists and grouplists: lists of members.
+//
+static void index_members(const codeplug_section_t *sec, index_t *ix, names_t *names,
+    const char *list_name)
+{
+    int name_col = find_column(sec, "Name");
+    int list_col = find_column(sec, list_name);
+    int i;
+
+    for (i=0; i<sec->nrows; i++) {
+        int num = atoi(cell(sec, 0, i));
+
+        if (num <= 0)
+            continue;
+        if (names)
+            names_set(names, num, cell(sec, name_col, i));
+        index_list(ix, cell(sec, list_col, i), num);
+    }
+}
+
+//
+// Decode tables of the current image, which are not decoded yet,
+// and build indexes for them.
+//
+static void load_tables(const char *filename, unsigned mask)
+{
+    codeplug_t *cp;
+    unsigned nbytes;
+    char *text;
+    int i;
+
+    mask &= ~loaded;
+    if (! mask)
+        return;
+    loaded |= mask;
+
+    text = radio_print_tables(mask, &nbytes);
+    cp = codeplug_parse_text(filename, text, nbytes);
+    part[nparts] = cp;
+    part_text[nparts] = text;
+    nparts++;
+
+    for (i=0; i<cp->nsections; i++) {
+        const codeplug_section_t *sec = &cp->section[i];
+
+        switch (sec->kind) {
+        case TABLE_CHANNELS:
+            index_channels(sec);
+            break;
+        case TABLE_CONTACTS:
+            index_contacts(sec);
+            break;
+        case TABLE_ZONES:
+            index_members(sec, &zone_by_chan, 0, "Channels");
+            break;
+        case TABLE_SCANLISTS:
+            index_members(sec, &scanlist_by_chan, 0, "Channels");
+            break;
+        case TABLE_GROUPLISTS:
+            index_members(sec, &grouplist_by_contact, &grouplist_name, "Contacts");
+            break;
+        }
+    }
+    if (mask & TABLE_CHANNELS) {
+        index_sort(&chan_by_freq);
+        index_sort(&chan_by_contact);
+        index_sort(&chan_by_grouplist);
+    }
+    if (mask & TABLE_CONTACTS)
+        index_sort(&contact_by_id);
+    if (mask & TABLE_GROUPLISTS)
+        index_sort(&grouplist_by_contact);
+    if (mask & TABLE_ZONES)
+        index_sort(&zone_by_chan);
+    if (mask & TABLE_SCANLISTS)
+        index_sort(&scanlist_by_chan);
+}
+
+//
+// Print values of the index for given key, as a list.
+// Return number of printed values.
+//
+static int print_values(FILE *out, const char *title, const index_t *ix, int key)
+{
+    int i = index_find(ix, key), n = 0;
+
+    if (i < 0)
+        return 0;
+    for (; i < ix->count && ix->entry[i].key == key; i++) {
+        // Skip duplicates.
+        if (n > 0 && ix->entry[i].value == ix->entry[i-1].value)
+            continue;
+        fprintf(out, "%s%d", n ? "," : title, ix->entry[i].value);
+        n++;
+    }
+    return n;
+}
+
+//
+// Print the channel with zones and scan lists which contain it.
+//
+static void print_channel(FILE *out, const char *filename, int num)
+{
+    fprintf(out, "%s: channel %d %s %s %s", filename, num, names_get(&chan_name, num),
+        names_get(&chan_receive, num), names_get(&chan_transmit, num));
+    print_values(out, " zones ", &zone_by_chan, num);
+    print_values(out, " scanlists ", &scanlist_by_chan, num);
+    fprintf(out, "\n");
+}
+
+//
+// Print the contact, with grouplists which contain it,
+// and channels which use it for transmit or receive.
+//
+static void print_contact(FILE *out, const char *filename, int num, int id)
+{
+    int i, k;
+
+    fprintf(out, "%s: contact %d %s id %d", filename, num,
+        names_get(&contact_name, num), id);
+    print_values(out, " grouplists ", &grouplist_by_contact, num);
+    print_values(out, " tx-channels ", &chan_by_contact, num);
+
+    // Channels which receive through any of the grouplists.
+    index_t rx = {0};
+    i = index_find(&grouplist_by_contact, num);
+    for (; i >= 0 && i < grouplist_by_contact.count &&
+           grouplist_by_contact.entry[i].key == num; i++) {
+        int gl = grouplist_by_contact.entry[i].value;
+
+        k = index_find(&chan_by_grouplist, gl);
+        for (; k >= 0 && k < chan_by_grouplist.count &&
+               chan_by_grouplist.entry[k].key == gl; k++)
+            index_add(&rx, 0, chan_by_grouplist.entry[k].value);
+    }
+    index_sort(&rx);
+    print_values(out, " rx-channels ", &rx, 0);
+    free(rx.entry);
+    fprintf(out, "\n");
+}
+
+//
+// Answer all terms of the query for the current image.
+// Return number of hits.
+//
+static int run_terms(FILE *out, const char *filename, const term_t *term, int nterms)
+{
+    int t, i, prev, nhits = 0;
+
+    for (t=0; t<nterms; t++) {
+        load_tables(filename, TERM_TABLES[term[t].kind]);
+
+        switch (term[t].kind) {
+        case TERM_FREQ:
+            prev = -1;
+            i = index_find(&chan_by_freq, term[t].value);
+            for (; i >= 0 && i < chan_by_freq.count &&
+                   chan_by_freq.entry[i].key == term[t].value; i++) {
+                // Skip duplicates.
+                if (chan_by_freq.entry[i].value == prev)
+                    continue;
+                prev = chan_by_freq.entry[i].value;
+                print_channel(out, filename, prev);
+                nhits++;
+            }
+            break;
+        case TERM_ID:
+            i = index_find(&contact_by_id, term[t].value);
+            for (; i >= 0 && i < contact_by_id.count &&
+                   contact_by_id.entry[i].key == term[t].value; i++) {
+                print_contact(out, filename, contact_by_id.entry[i].value, term[t].value);
+                nhits++;
+            }
+            break;
+        case TERM_CHANNEL:
+            if (term[t].value < chan_name.max && chan_name.name[term[t].value]) {
+                print_channel(out, filename, term[t].value);
+                nhits++;
+            }
+            break;
+        }
+    }
+    return nhits;
+}
+
+//
+// Parse the query into terms.
+// Return number of terms.
+//
+static int parse_query(const char *query, term_t *term, int maxterms)
+{
+    const char *p = query;
+    char buf[32];
+    int n = 0;
+
+    while (*p) {
+        int len = strcspn(p, ",");
+        const char *eq = memchr(p, '=', len);
+        int kind;
+
+        if (! eq || n >= maxterms || len - (eq - p) > (int)sizeof(buf))
+            goto bad;
+        kind = keyword_match(&term_table, p, eq - p);
+        if (kind < 0)
+            goto bad;
+        memcpy(buf, eq + 1, len - (eq - p) - 1);
+        buf[len - (eq - p) - 1] = 0;
+
+        term[n].kind = kind;
+        if (kind == TERM_FREQ) {
+            freq_t hz;
+
+            if (! parse_freq(buf, &hz) || hz <= 0)
+                goto bad;
+            term[n].value = hz;
+        } else {
+            char *e;
+
+            term[n].value = strtoul(buf, &e, 10);
+            if (*e || e == buf)
+                goto bad;
+        }
+        n++;
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    if (n == 0) {
+bad:    fprintf(stderr, "Bad query: '%s'\n", query);
+        fprintf(stderr, "Terms are: freq=MHZ, id=NUM, channel=NUM\n");
+        exit(-1);
+    }
+    return n;
+}
+
+//
+// Run the query over all images, one by one.
+// Print matches, one per line, prefixed by the file name.
+// Return number of matches.
+//
+int query_run(const char *query, char **images, int nimages)
+{
+    term_t term[32];
+    int nterms, i, nhits = 0;
+
+    nterms = parse_query(query, term, 32);
+    for (i=0; i<nimages; i++) {
+        radio_read_image(images[i]);
+        nhits += run_terms(stdout, images[i], term, nterms);
+        reset_tables();
+    }
+    return nhits;
+}
@@ -32,6 +32,10 @@
 #include <fcntl.h>
 #include <time.h>
 #include <sys/stat.h>
+#if !defined(__WIN32__) && !defined(WIN32)
+#   include <sys/mman.h>
+#   include <sys/wait.h>
+#endif
 #include "radio.h"
 #include "util.h"
 
@@ -59,8 +63,25 @@ static struct {
     { 0, 0 }
 };
 
-unsigned char radio_mem [1024*1024*2];  // Radio memory contents, up to 2 Mbytes
+static unsigned char radio_buf [1024*1024*2]; // Radio memory contents, up to 2 Mbytes
+unsigned char *radio_mem = radio_buf;   // Radio memory, or mapped image file
 int radio_progress;                     // Read/write progress counter
+unsigned radio_tables;                  // Selected tables, zero when all
+unsigned radio_touched;                 // Tables modified by the script
+unsigned char *radio_synced;            // Contents of the radio, when known
+int radio_read_back;                    // Read back and check written data
+
+//
+// Maps of memory by pieces of READBACK_CHUNK bytes, for read-back check:
+// pieces written by the last upload, and pieces to read back or rewrite.
+//
+#define READBACK_CHUNK  64
+#define NCHUNKS         (sizeof(radio_buf) / READBACK_CHUNK)
+
+static unsigned char *written_map;      // Pieces written, when tracked
+static unsigned char *readback_map;     // Pieces to transfer again
+
+static unsigned tables_done;            // Tables already read, when streaming
 
 static radio_device_t *device;          // Device-dependent interface
 
@@ -69,13 +90,20 @@ static radio_device_t *device;          // Device-dependent interface
 //
 void radio_disconnect()
 {
+    if (dry_run)
+        return;
     fprintf(stderr, "Close device.\n");
+    stats_begin(STATS_DISCONNECT);
 
     // Restore the normal radio mode.
     dfu_reboot();
     dfu_close();
     hid_close();
     serial_close();
+    stats_end(STATS_DISCONNECT);
+
+    if (retry_count > 0)
+        fprintf(stderr, "Recovered from %d transient i/o errors.\n", retry_count);
 }
 
 //
@@ -94,9 +122,23 @@ void radio_connect()
     const char *ident;
     int i;
 
-    // Try TYT MD family.
-    ident = dfu_init(0x0483, 0xdf11);
-    if (! ident) {
+    if (dry_run) {
+        // Radio is represented by the image file.
+        if (! device) {
+            fprintf(stderr, "Dry run needs an image file.\n");
+            exit(-1);
+        }
+        return;
+    }
+    stats_begin(STATS_CONNECT);
+
+    // Serial port given by user means Anytone family.
+    ident = 0;
+    if (! serial_port) {
+        // Try TYT MD family.
+        ident = dfu_init(0x0483, 0xdf11);
+    }
+    if (! ident && ! serial_port) {
         // Try RD-5R, DM-1801 and GD-77.
         if (hid_init(0x15a2, 0x0073) >= 0)
             ident = hid_identify();
@@ -112,6 +154,8 @@ void radio_connect()
         exit(-1);
     }
 
+    // Forget the device of a previously read image.
+    device = 0;
     for (i=0; radio_tab[i].ident; i++) {
         if (strcasecmp(ident, radio_tab[i].ident) == 0) {
             device = radio_tab[i].device;
@@ -123,6 +167,24 @@ void radio_connect()
         exit(-1);
     }
     fprintf(stderr, "Connect to %s.\n", device->name);
+    stats_radio(device->name);
+    stats_end(STATS_CONNECT);
+}
+
+//
+// Name of the connected radio, or of the image.
+//
+const char *radio_name()
+{
+    return device->name;
+}
+
+//
+// Return true when the device can read separate tables.
+//
+int radio_has_tables()
+{
+    return device->tables != 0;
 }
 
 //
@@ -138,23 +200,392 @@ void radio_list()
     }
 }
 
+//
+// Names of tables for partial transfers.
+//
+static struct {
+    const char *name;
+    unsigned mask;
+} table_names[] = {
+    { "channels",   TABLE_CHANNELS },
+    { "zones",      TABLE_ZONES },
+    { "scanlists",  TABLE_SCANLISTS },
+    { "contacts",   TABLE_CONTACTS },
+    { "grouplists", TABLE_GROUPLISTS },
+    { "messages",   TABLE_MESSAGES },
+    { "settings",   TABLE_SETTINGS },
+    { 0, 0 }
+};
+
+//
+// Get name and mask of the table by index.
+// Return 0 past the last table.
+//
+const char *radio_table_name(int i, unsigned *mask)
+{
+    if (i < 0 || i >= (int)(sizeof(table_names) / sizeof(table_names[0])) - 1)
+        return 0;
+    *mask = table_names[i].mask;
+    return table_names[i].name;
+}
+
+//
+// Select tables for partial transfer, by a comma separated list of names.
+//
+void radio_select_tables(const char *list)
+{
+    const char *p = list;
+    int i, len;
+
+    while (*p) {
+        len = strcspn(p, ",");
+        for (i=0; table_names[i].name; i++) {
+            if (strlen(table_names[i].name) == len &&
+                strncasecmp(p, table_names[i].name, len) == 0)
+                break;
+        }
+        if (! table_names[i].name) {
+            fprintf(stderr, "Unknown table '%.*s'.\n", len, p);
+            fprintf(stderr, "Tables are:");
+            for (i=0; table_names[i].name; i++)
+                fprintf(stderr, " %s", table_names[i].name);
+            fprintf(stderr, "\n");
+            exit(-1);
+        }
+        radio_tables |= table_names[i].mask;
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+
+    // Header of the image is always needed.
+    radio_tables |= TABLE_VERSION;
+}
+
+//
+// While the config is printed into memory for fingerprints,
+// drivers ask for every table before printing it: remember
+// where the text of each table starts.
+//
+#define MAX_MARKS 32
+
+static FILE *mark_out;          // Stream of the config, or 0
+static int nmarks;
+static struct {
+    unsigned mask;              // Table printed from this position
+    long pos;                   // Offset in the text
+} mark[MAX_MARKS];
+
+//
+// Check whether the table is selected for transfer.
+//
+int radio_table_selected(unsigned mask)
+{
+    if (mark_out && nmarks < MAX_MARKS) {
+        mark[nmarks].mask = mask;
+        mark[nmarks].pos = ftell(mark_out);
+        nmarks++;
+    }
+    return radio_tables == 0 || (radio_tables & mask);
+}
+
+//
+// Check whether the range of radio memory belongs to any of given tables.
+//
+static int range_in_tables(unsigned mask, unsigned offset, unsigned nbytes)
+{
+    const table_range_t *t;
+
+    for (t=device->tables; t->mask; t++) {
+        if (! (t->mask & mask))
+            continue;
+        if (offset < t->offset + t->length && t->offset < offset + nbytes)
+            return 1;
+    }
+    return 0;
+}
+
+//
+// Check whether any piece of the range is marked in the map.
+//
+static int range_marked(const unsigned char *map, unsigned offset, unsigned nbytes)
+{
+    unsigned i;
+
+    for (i = offset / READBACK_CHUNK; i < (offset + nbytes + READBACK_CHUNK - 1) / READBACK_CHUNK; i++) {
+        if (map[i])
+            return 1;
+    }
+    return 0;
+}
+
+//
+// Check whether the range of radio memory belongs to selected tables.
+// Without a map of tables, the whole memory is transferred.
+// When streaming, tables which were read already are excluded.
+// When contents of the radio is known, unchanged ranges are excluded.
+// On read-back, only the pieces marked for it are selected.
+//
+int radio_range_selected(unsigned offset, unsigned nbytes)
+{
+    if (readback_map) {
+        // Read back or rewrite only given pieces.
+        return range_marked(readback_map, offset, nbytes);
+    }
+    if (radio_synced && memcmp(&radio_mem[offset], &radio_synced[offset], nbytes) == 0) {
+        // Radio has the same contents.
+        return 0;
+    }
+    if (! device->tables)
+        return 1;
+    if (tables_done && range_in_tables(tables_done, offset, nbytes))
+        return 0;
+    if (radio_tables == 0)
+        return 1;
+    return range_in_tables(radio_tables | TABLE_VERSION, offset, nbytes);
+}
+
+//
+// Get size of the table in radio memory.
+//
+static unsigned table_size(unsigned mask)
+{
+    const table_range_t *t;
+    unsigned nbytes = 0;
+
+    for (t=device->tables; t->mask; t++) {
+        if (t->mask & mask)
+            nbytes += t->length;
+    }
+    return nbytes;
+}
+
 //
 // Read firmware image from the device.
 //
 void radio_download()
 {
+    if (radio_tables) {
+        if (! device->tables) {
+            fprintf(stderr, "%s does not support partial read.\n", device->name);
+            exit(-1);
+        }
+        // Tables not selected look like erased memory.
+        memset(radio_mem, 0xff, sizeof(radio_buf));
+    }
     radio_progress = 0;
     if (! trace_flag) {
         fprintf(stderr, "Read device: ");
         fflush(stderr);
     }
 
+    stats_begin(STATS_DOWNLOAD);
     device->download(device);
+    stats_end(STATS_DOWNLOAD);
 
     if (! trace_flag)
         fprintf(stderr, " done.\n");
 }
 
+//
+// Read firmware image from the device, and print every table
+// as soon as it's complete. Identity and settings are read first,
+// then other tables from the smallest to the largest, so that
+// tables complete as early as possible. Remaining memory is read last.
+//
+void radio_download_stream(FILE *out)
+{
+    unsigned order[16], mask, all, printed;
+    int n = 0, i, k;
+
+    if (! device->tables) {
+        // No map: read everything, then print.
+        radio_download();
+        radio_print_version(out);
+        radio_print_config(out, 0);
+        return;
+    }
+    all = radio_tables;
+    for (i=0; table_names[i].name; i++) {
+        mask = table_names[i].mask;
+        if (mask == TABLE_SETTINGS || (all && ! (all & mask)) || table_size(mask) == 0)
+            continue;
+
+        // Insert by size.
+        for (k=n; k>0 && table_size(order[k-1]) > table_size(mask); k--)
+            order[k] = order[k-1];
+        order[k] = mask;
+        n++;
+    }
+
+    // Tables not read yet look like erased memory.
+    memset(radio_mem, 0xff, sizeof(radio_buf));
+    radio_progress = 0;
+    if (! trace_flag) {
+        fprintf(stderr, "Read device: ");
+        fflush(stderr);
+    }
+    stats_begin(STATS_DOWNLOAD);
+
+    // Identity and settings.
+    radio_tables = TABLE_VERSION;
+    if (! all || (all & TABLE_SETTINGS))
+        radio_tables |= TABLE_SETTINGS;
+    device->download(device);
+    tables_done = radio_tables;
+    if (! device->is_compatible(device)) {
+        fprintf(stderr, "\nUnsupported firmware or model of %s.\n", device->name);
+        exit(-1);
+    }
+    device->print_version(device, out);
+    device->print_config(device, out, 0);
+    fflush(out);
+    printed = tables_done;
+
+    for (i=0; i<n; i++) {
+        radio_tables = order[i];
+        device->download(device);
+        tables_done |= radio_tables;
+
+        // Channels are printed with names of contacts,
+        // so they have to wait for contacts.
+        mask = tables_done & ~printed;
+        if ((mask & TABLE_CHANNELS) && ! (tables_done & TABLE_CONTACTS) &&
+            (! all || (all & TABLE_CONTACTS)))
+            mask &= ~TABLE_CHANNELS;
+        if (mask) {
+            radio_tables = mask;
+            device->print_config(device, out, 0);
+            fflush(out);
+            printed |= mask;
+        }
+    }
+
+    if (all) {
+        // Only selected tables.
+        radio_tables = all;
+    } else {
+        // The rest of memory.
+        radio_tables = 0;
+        device->download(device);
+    }
+    tables_done = 0;
+    stats_end(STATS_DOWNLOAD);
+
+    if (! trace_flag)
+        fprintf(stderr, " done.\n");
+}
+
+//
+// Mark the range of memory as written to the radio,
+// for the read-back check.
+//
+void radio_mark_written(unsigned offset, unsigned nbytes)
+{
+    unsigned i;
+
+    if (! written_map)
+        return;
+    for (i = offset / READBACK_CHUNK; i < (offset + nbytes + READBACK_CHUNK - 1) / READBACK_CHUNK; i++)
+        written_map[i] = 1;
+}
+
+//
+// Return true when the upload has to write only part of memory:
+// selected tables, differences, or pieces to rewrite.
+//
+int radio_upload_partial()
+{
+    return radio_tables || radio_synced || readback_map;
+}
+
+//
+// Read back the pieces of memory just written, and compare
+// with the image. Write again the pieces which differ.
+// Exit when the radio keeps wrong data after a few attempts.
+//
+static void check_written(int cont_flag)
+{
+    static unsigned char *expect;
+    unsigned i, nbad, nchecked;
+    int attempt;
+
+    if (! expect) {
+        expect = malloc(sizeof(radio_buf));
+        if (! expect) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+    }
+    memcpy(expect, radio_mem, sizeof(radio_buf));
+
+    for (attempt=1; ; attempt++) {
+        // Read back only the pieces written.
+        readback_map = written_map;
+        written_map = 0;
+        nchecked = 0;
+        for (i=0; i<NCHUNKS; i++)
+            nchecked += readback_map[i];
+        if (nchecked == 0)
+            break;
+
+        radio_progress = 0;
+        if (! trace_flag) {
+            fprintf(stderr, "Read back: ");
+            fflush(stderr);
+        }
+        stats_begin(STATS_READBACK);
+        device->download(device);
+        stats_end(STATS_READBACK);
+        if (! trace_flag)
+            fprintf(stderr, " done.\n");
+
+        // Keep marks only on pieces which differ.
+        nbad = 0;
+        for (i=0; i<NCHUNKS; i++) {
+            if (! readback_map[i])
+                continue;
+            if (memcmp(&radio_mem[i*READBACK_CHUNK], &expect[i*READBACK_CHUNK], READBACK_CHUNK) == 0) {
+                readback_map[i] = 0;
+            } else {
+                if (nbad == 0)
+                    fprintf(stderr, "Read back: data differ at offset 0x%x.\n", i*READBACK_CHUNK);
+                nbad++;
+            }
+        }
+        memcpy(radio_mem, expect, sizeof(radio_buf));
+        if (nbad == 0)
+            break;
+        if (attempt >= READBACK_TRIES) {
+            fprintf(stderr, "Read back: %u bytes still differ after %d writes.\n",
+                nbad * READBACK_CHUNK, attempt);
+            exit(-1);
+        }
+        fprintf(stderr, "Read back: %u of %u bytes differ, write again.\n",
+            nbad * READBACK_CHUNK, nchecked * READBACK_CHUNK);
+
+        // Rewrite bad pieces, and track what is written.
+        written_map = calloc(NCHUNKS, 1);
+        if (! written_map) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+        radio_progress = 0;
+        if (! trace_flag) {
+            fprintf(stderr, "Write device: ");
+            fflush(stderr);
+        }
+        stats_begin(STATS_UPLOAD);
+        device->upload(device, cont_flag);
+        stats_end(STATS_UPLOAD);
+        if (! trace_flag)
+            fprintf(stderr, " done.\n");
+        free(readback_map);
+    }
+    free(readback_map);
+    readback_map = 0;
+}
+
 //
 // Write firmware image to the device.
 //
@@ -170,29 +601,119 @@ void radio_upload(int cont_flag)
         fprintf(stderr, "Write device: ");
         fflush(stderr);
     }
+    if (radio_read_back && ! dry_run) {
+        // Track pieces written.
+        written_map = calloc(NCHUNKS, 1);
+        if (! written_map) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+    }
+    stats_begin(STATS_UPLOAD);
     device->upload(device, cont_flag);
+    stats_end(STATS_UPLOAD);
 
     if (! trace_flag)
         fprintf(stderr, " done.\n");
+
+    if (written_map)
+        check_written(cont_flag);
+
+    if (radio_synced) {
+        // Radio has now the same contents.
+        memcpy(radio_synced, radio_mem, sizeof(radio_buf));
+    }
 }
 
 //
-// Read firmware image from the binary file.
+// Remember current contents of the radio.
+// Further uploads write only the pieces which differ.
 //
-void radio_read_image(const char *filename)
+void radio_track_changes()
 {
-    FILE *img;
-    struct stat st;
-    char ident[8];
+    if (! radio_synced) {
+        radio_synced = malloc(sizeof(radio_buf));
+        if (! radio_synced) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+    }
+    memcpy(radio_synced, radio_mem, sizeof(radio_buf));
+}
 
-    fprintf(stderr, "Read codeplug from file '%s'.\n", filename);
-    img = fopen(filename, "rb");
-    if (! img) {
-        perror(filename);
+//
+// Check whether the table has to be written: it is selected,
+// and differs from contents of the radio, when known.
+//
+int radio_table_modified(unsigned mask)
+{
+    const table_range_t *t;
+
+    if (! radio_table_selected(mask))
+        return 0;
+    if (readback_map && device->tables) {
+        // Rewrite only tables with bad pieces.
+        for (t=device->tables; t->mask; t++) {
+            if ((t->mask & mask) && range_marked(readback_map, t->offset, t->length))
+                return 1;
+        }
+        return 0;
+    }
+    if (! radio_synced || ! device->tables)
+        return 1;
+    for (t=device->tables; t->mask; t++) {
+        if ((t->mask & mask) &&
+            memcmp(&radio_mem[t->offset], &radio_synced[t->offset], t->length) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+//
+// Set the device by radio name, as stored in image header
+// or snapshot manifest. Check size of the image.
+//
+static void set_device_by_name(const char *filename, const char *name, unsigned size)
+{
+    int i;
+
+    for (i=0; radio_tab[i].ident; i++) {
+        if (strcmp(radio_tab[i].device->name, name) == 0)
+            break;
+    }
+    if (! radio_tab[i].ident) {
+        fprintf(stderr, "%s: Unknown radio '%s'.\n", filename, name);
+        exit(-1);
+    }
+    device = radio_tab[i].device;
+    if (size != device->memsz) {
+        fprintf(stderr, "%s: Wrong image size %u bytes for %s.\n",
+            filename, size, device->name);
         exit(-1);
     }
+    stats_radio(device->name);
+}
+
+//
+// Read sparse image: radio is given by name in the header.
+//
+static void read_sparse_image(const char *filename)
+{
+    const char *name;
+    unsigned size;
+
+    name = image_read_sparse(filename, radio_mem, sizeof(radio_buf), &size);
+    set_device_by_name(filename, name, size);
+}
+
+//
+// Guess device type by file size and header of raw image.
+//
+static void guess_device(const char *filename, FILE *img)
+{
+    struct stat st;
+    char ident[8];
 
-    // Guess device type by file size.
     if (stat(filename, &st) < 0) {
         perror(filename);
         exit(-1);
@@ -252,9 +773,91 @@ void radio_read_image(const char *filename)
             filename, (int) st.st_size);
         exit(-1);
     }
+}
+
+//
+// Read firmware image from the binary file.
+//
+void radio_read_image(const char *filename)
+{
+    FILE *img;
 
+    fprintf(stderr, "Read codeplug from file '%s'.\n", filename);
+    if (image_is_sparse(filename)) {
+        read_sparse_image(filename);
+        return;
+    }
+    img = fopen(filename, "rb");
+    if (! img) {
+        perror(filename);
+        exit(-1);
+    }
+
+    guess_device(filename, img);
     device->read_image(device, img);
     fclose(img);
+    stats_radio(device->name);
+}
+
+//
+// Map raw image file into memory, and use it as radio memory.
+// Changes are written back to the file by image_commit().
+//
+void radio_map_image(const char *filename, int atomic)
+{
+    FILE *img;
+    struct stat st;
+
+    fprintf(stderr, "Map codeplug from file '%s'.\n", filename);
+    if (image_is_sparse(filename)) {
+        fprintf(stderr, "%s: In-place editing needs raw image.\n", filename);
+        exit(-1);
+    }
+    img = fopen(filename, "rb");
+    if (! img) {
+        perror(filename);
+        exit(-1);
+    }
+    guess_device(filename, img);
+    fclose(img);
+
+    if (stat(filename, &st) < 0) {
+        perror(filename);
+        exit(-1);
+    }
+    if (st.st_size != device->memsz) {
+        fprintf(stderr, "%s: In-place editing needs raw image of %u bytes.\n",
+            filename, device->memsz);
+        exit(-1);
+    }
+    radio_mem = image_map(filename, device->memsz, atomic);
+    stats_radio(device->name);
+}
+
+//
+// Get DMR ID of the radio from the settings.
+// Return zero when not set.
+//
+unsigned radio_id()
+{
+    unsigned nbytes, id = 0;
+    char *text, *p;
+
+    text = radio_print_tables(TABLE_SETTINGS, &nbytes);
+    for (p = text; p && *p; p = strchr(p, '\n')) {
+        if (*p == '\n')
+            p++;
+        if (strncmp(p, "ID:", 3) == 0) {
+            id = strtoul(p + 3, 0, 10);
+            break;
+        }
+    }
+    free(text);
+
+    // DMR ID has 24 bits; larger values mean erased memory.
+    if (id >= 0xffffff)
+        id = 0;
+    return id;
 }
 
 //
@@ -265,6 +868,14 @@ void radio_save_image(const char *filename)
     FILE *img;
 
     fprintf(stderr, "Write codeplug to file '%s'.\n", filename);
+    if (store_dir) {
+        // Keep history of images in the store.
+        store_save(radio_mem, device->memsz, device->name, radio_id());
+    }
+    if (image_sparse_flag) {
+        image_save_sparse(filename, radio_mem, device->memsz, device->name);
+        return;
+    }
     img = fopen(filename, "wb");
     if (! img) {
         perror(filename);
@@ -274,6 +885,91 @@ void radio_save_image(const char *filename)
     fclose(img);
 }
 
+//
+// Load snapshot from the store.
+//
+void radio_load_snapshot(const char *id)
+{
+    const char *name;
+    unsigned size;
+
+    fprintf(stderr, "Read codeplug from snapshot '%s'.\n", id);
+    name = store_load(id, radio_mem, sizeof(radio_buf), &size);
+    set_device_by_name(id, name, size);
+}
+
+//
+// Count bytes which differ in the given tables.
+//
+static unsigned diff_tables(const unsigned char *old, unsigned mask, unsigned *total)
+{
+    const table_range_t *t;
+    unsigned i, count = 0;
+
+    *total = 0;
+    for (t=device->tables; t->mask; t++) {
+        if (! (t->mask & mask))
+            continue;
+        for (i=t->offset; i<t->offset + t->length; i++) {
+            if (old[i] != radio_mem[i])
+                count++;
+        }
+        *total += t->length;
+    }
+    return count;
+}
+
+//
+// Compare two snapshots of the same radio, and print
+// the amount of changes in every table.
+//
+void radio_diff_snapshots(const char *id1, const char *id2, FILE *out)
+{
+    radio_device_t *dev1;
+    unsigned char *old;
+    unsigned nbytes, total, i, other;
+    int k;
+
+    radio_load_snapshot(id1);
+    dev1 = device;
+    old = malloc(device->memsz);
+    if (! old) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    memcpy(old, radio_mem, device->memsz);
+
+    radio_load_snapshot(id2);
+    if (device != dev1) {
+        fprintf(stderr, "Snapshots are from different radios: %s and %s.\n",
+            dev1->name, device->name);
+        exit(-1);
+    }
+    fprintf(out, "Radio: %s\n", device->name);
+    if (! device->tables) {
+        fprintf(stderr, "No map of tables for %s.\n", device->name);
+        exit(-1);
+    }
+
+    nbytes = diff_tables(old, TABLE_VERSION, &total);
+    fprintf(out, "%-12s %u of %u bytes changed\n", "header", nbytes, total);
+    for (k=0; table_names[k].name; k++) {
+        nbytes = diff_tables(old, table_names[k].mask, &total);
+        if (total > 0)
+            fprintf(out, "%-12s %u of %u bytes changed\n",
+                table_names[k].name, nbytes, total);
+    }
+
+    // Memory outside of any table.
+    other = 0;
+    for (i=0; i<device->memsz; i++) {
+        if (old[i] != radio_mem[i] && ! range_in_tables(~0, i, 1))
+            other++;
+    }
+    fprintf(out, "%-12s %u bytes changed\n", "other", other);
+    free(old);
+}
+
 
 //
 // Loop over all known radios and see if the config file can be parsed.
@@ -315,82 +1011,230 @@ void radio_validate_config(const char *filename) {
 //
 void radio_parse_config(const char *filename)
 {
-    FILE *conf;
-    char line [256], *p, *v;
-    int table_id = 0, table_dirty = 0;
+    codeplug_t *cp;
 
     fprintf(stderr, "Read configuration from file '%s'.\n", filename);
-    conf = fopen(filename, "r");
-    if (! conf) {
-        perror(filename);
-        exit(-1);
-    }
+
+    stats_begin(STATS_PARSE);
+    cp = codeplug_parse(filename);
+    radio_compile(cp, 1);
+    codeplug_free(cp);
+    stats_end(STATS_PARSE);
+}
+
+//
+// Apply the codeplug to the radio memory, table by table,
+// through the parse routines of the device.
+// When strict, exit on the first line which the radio does not accept.
+// Otherwise report such lines, skip them and continue:
+// the same script can be compiled for radios of different capacity.
+// Return number of rejected rows.
+//
+int radio_compile(codeplug_t *cp, int strict)
+{
+    token_t *tok = 0;
+    int maxtok = 0, nrejected = 0;
+    int i, k, s, ntok, table_id, table_dirty;
 
     device->channel_count = 0;
-    while (fgets(line, sizeof(line), conf)) {
-        line[sizeof(line)-1] = 0;
-
-        // Strip comments.
-        v = strchr(line, '#');
-        if (v == line)
-            *v = 0;
-
-        // Strip trailing spaces and newline.
-        v = line + strlen(line) - 1;
-        while (v >= line && (*v=='\n' || *v=='\r' || *v==' ' || *v=='\t'))
-            *v-- = 0;
-
-        // Ignore comments and empty lines.
-        p = line;
-        if (*p == 0)
+    for (s=0; s<cp->nsections; s++) {
+        codeplug_section_t *sec = &cp->section[s];
+
+        if (sec->name) {
+            // Radio model is given by the image, when compiling
+            // the script for several radios.
+            if (! strict && strcasecmp(sec->name, "Radio") == 0)
+                continue;
+            device->parse_parameter(device, sec->name, sec->value);
             continue;
+        }
 
-        if (*p != ' ') {
-            // Table finished.
-            table_id = 0;
-
-            // Find the value.
-            v = strchr(p, ':');
-            if (! v) {
-                // Table header: get table type.
-                table_id = device->parse_header(device, p);
-                if (! table_id) {
-badline:            fprintf(stderr, "Invalid line: '%s'\n", line);
+        // Table header: get table type.
+        table_id = device->parse_header(device, sec->header);
+        if (! table_id) {
+            fprintf(stderr, "%s:%u: Invalid line: '%s'\n", cp->filename, sec->line, sec->header);
+            if (strict)
+                exit(-1);
+            nrejected += sec->nrows;
+            continue;
+        }
+        if (sec->ncols > maxtok) {
+            maxtok = sec->ncols;
+            tok = realloc(tok, maxtok * sizeof(token_t));
+            if (! tok) {
+                fprintf(stderr, "Out of memory.\n");
+                exit(-1);
+            }
+        }
+
+        table_dirty = 0;
+        for (i=0; i<sec->nrows; i++) {
+            // Gather words of the row from columns.
+            ntok = sec->width[i];
+            for (k=0; k<ntok; k++)
+                tok[k] = sec->column[k][i];
+
+            if (! device->parse_row(device, table_id, ! table_dirty, tok, ntok)) {
+                fprintf(stderr, "%s:%u:%u: Invalid line: '%s'\n", cp->filename,
+                    tok[0].line, tok[0].col, token_rest(tok, ntok, 0));
+                if (strict)
                     exit(-1);
-                }
-                table_dirty = 0;
-                continue;
+                nrejected++;
+            } else {
+                table_dirty = 1;
             }
 
-            // Parameter.
-            *v++ = 0;
+            // Put back terminators, which token_rest() could remove.
+            for (k=0; k<ntok; k++)
+                tok[k].str[tok[k].len] = 0;
+        }
+    }
+    free(tok);
+    device->update_timestamp(device);
+    if (! strict)
+        fprintf(stderr, "%s: %d rows rejected.\n", device->name, nrejected);
+    return nrejected;
+}
+
+//
+// Restore the text of the row starting from i-th token:
+// put back the separators, replaced by zeros.
+//
+char *token_rest(token_t *tok, int ntok, int i)
+{
+    int k;
+
+    for (k=i; k<ntok-1; k++)
+        tok[k].str[tok[k].len] = tok[k].sep;
+    return tok[i].str;
+}
+
+//
+// Hash the text of a table in canonical form: one line per entry,
+// words separated by one space.
+// Only valid entries are printed by the driver, so unused and erased
+// slots don't count. Comments and alignment of columns are ignored:
+// channels have names of contacts in comments, and those belong
+// to the contacts table.
+// Return the number of bytes hashed.
+//
+static unsigned hash_table_text(sha256_t *ctx, unsigned mask,
+    const char *p, const char *end)
+{
+    unsigned nbytes = 0;
 
-            // Skip spaces.
-            while (*v == ' ' || *v == '\t')
-                v++;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
 
-            device->parse_parameter(device, p, v);
+        if (! eol)
+            eol = end;
+        while (p < eol && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p < eol && *p != '#') {
+            for (;;) {
+                const char *word = p;
 
-        } else {
-            // Table row or comment.
-            // Skip spaces.
-            // Ignore comments and empty lines.
-            while (*p == ' ' || *p == '\t')
-                p++;
-            if (*p == '#' || *p == 0)
-                continue;
-            if (! table_id) {
-                goto badline;
-            }
+                while (p < eol && *p != ' ' && *p != '\t')
+                    p++;
+                sha256_update(ctx, word, p - word);
+                nbytes += p - word;
 
-            if (! device->parse_row(device, table_id, ! table_dirty, p)) {
-                goto badline;
+                while (p < eol && (*p == ' ' || *p == '\t'))
+                    p++;
+                if (p == eol || (mask == TABLE_CHANNELS && *p == '#'))
+                    break;
+                sha256_update(ctx, " ", 1);
+                nbytes++;
             }
-            table_dirty = 1;
+            sha256_update(ctx, "\n", 1);
+            nbytes++;
         }
+        p = (eol < end) ? eol + 1 : eol;
     }
-    fclose(conf);
-    device->update_timestamp(device);
+    return nbytes;
+}
+
+//
+// Finish the hash of the table, and get fingerprint
+// as first 64 bits of SHA-256, in 16 hex digits.
+// Empty table has fingerprint "-".
+//
+static void fingerprint_hex(sha256_t *ctx, unsigned nbytes, char *hex)
+{
+    unsigned char digest[32];
+    int i;
+
+    sha256_final(ctx, digest);
+    if (nbytes == 0) {
+        strcpy(hex, "-");
+        return;
+    }
+    for (i=0; i<8; i++)
+        sprintf(hex + 2*i, "%02x", digest[i]);
+}
+
+//
+// Print given tables as text into memory.
+// With marks enabled, note where every table starts.
+// Return the text terminated by zero, to be released by free().
+//
+static char *print_text(unsigned mask, int marks, unsigned *nbytes)
+{
+    unsigned saved = radio_tables;
+    char *text;
+    FILE *out;
+
+#if defined(__WIN32__) || defined(WIN32)
+    long size;
+
+    out = tmpfile();
+    if (! out) {
+        perror("tmpfile");
+        exit(-1);
+    }
+#else
+    size_t size;
+
+    out = open_memstream(&text, &size);
+    if (! out) {
+        perror("open_memstream");
+        exit(-1);
+    }
+#endif
+    radio_tables = mask;
+    if (marks) {
+        mark_out = out;
+        nmarks = 0;
+    }
+    device->print_config(device, out, marks);
+    mark_out = 0;
+    radio_tables = saved;
+#if defined(__WIN32__) || defined(WIN32)
+    size = ftell(out);
+    text = malloc(size + 1);
+    if (! text) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    rewind(out);
+    if (fread(text, 1, size, out) != (size_t)size) {
+        perror("fread");
+        exit(-1);
+    }
+    text[size] = 0;
+#endif
+    fclose(out);
+    *nbytes = size;
+    return text;
+}
+
+//
+// Print given tables as text into memory.
+// Return the text terminated by zero, to be released by free().
+//
+char *radio_print_tables(unsigned mask, unsigned *nbytes)
+{
+    return print_text(mask, 0, nbytes);
 }
 
 //
@@ -398,21 +1242,171 @@ badline:            fprintf(stderr, "Invalid line: '%s'\n", line);
 //
 void radio_print_config(FILE *out, int verbose)
 {
-    if (verbose) {
-        char buf [40];
-        time_t t;
-        struct tm *tmp;
+    char buf[40], hex[20], *text;
+    sha256_t ctx[sizeof(table_names) / sizeof(table_names[0])];
+    unsigned hashed[sizeof(table_names) / sizeof(table_names[0])];
+    unsigned nbytes;
+    time_t t;
+    struct tm *tmp;
+    int i, k;
 
-        t = time(NULL);
-        tmp = localtime(&t);
-        if (! tmp || ! strftime(buf, sizeof(buf), "%Y/%m/%d ", tmp))
-            buf[0] = 0;
-        fprintf(out, "#\n");
-        fprintf(out, "# Configuration generated %sby dmrconfig, version %s\n",
-            buf, version);
-        fprintf(out, "#\n");
+    if (! verbose) {
+        device->print_config(device, out, 0);
+        return;
+    }
+
+    t = time(NULL);
+    tmp = localtime(&t);
+    if (! tmp || ! strftime(buf, sizeof(buf), "%Y/%m/%d ", tmp))
+        buf[0] = 0;
+    fprintf(out, "#\n");
+    fprintf(out, "# Configuration generated %sby dmrconfig, version %s\n",
+        buf, version);
+    fprintf(out, "#\n");
+
+    // Print the config into memory once, and hash the text
+    // of every table from there.
+    text = print_text(radio_tables, 1, &nbytes);
+    for (i=0; table_names[i].name; i++) {
+        sha256_init(&ctx[i]);
+        hashed[i] = 0;
+    }
+    for (k=0; k<nmarks; k++) {
+        long end = (k+1 < nmarks) ? mark[k+1].pos : (long)nbytes;
+
+        for (i=0; table_names[i].name; i++) {
+            if (table_names[i].mask == mark[k].mask) {
+                hashed[i] += hash_table_text(&ctx[i], mark[k].mask,
+                    text + mark[k].pos, text + end);
+                break;
+            }
+        }
     }
-    device->print_config(device, out, verbose);
+
+    // Fingerprints of tables, for comparison of radios.
+    fprintf(out, "# Fingerprints of tables:\n");
+    for (i=0; table_names[i].name; i++) {
+        fingerprint_hex(&ctx[i], hashed[i], hex);
+        if (radio_table_selected(table_names[i].mask))
+            fprintf(out, "#   %-12s %s\n", table_names[i].name, hex);
+    }
+    fprintf(out, "#\n");
+    fwrite(text, 1, nbytes, out);
+    free(text);
+}
+
+//
+// Compute fingerprint of the table: first 64 bits of SHA-256
+// of its text in canonical form, as 16 hex digits.
+// Empty table has fingerprint "-".
+// Return 0 when the table is empty.
+//
+int radio_fingerprint(unsigned mask, char *hex)
+{
+    unsigned nbytes;
+    sha256_t ctx;
+    char *text;
+
+    text = radio_print_tables(mask, &nbytes);
+    sha256_init(&ctx);
+    nbytes = hash_table_text(&ctx, mask, text, text + nbytes);
+    free(text);
+    fingerprint_hex(&ctx, nbytes, hex);
+    return nbytes != 0;
+}
+
+//
+// Print fingerprints of selected tables, in one line.
+//
+void radio_print_fingerprints(FILE *out, const char *title)
+{
+    char hex[20];
+    int i;
+
+    fprintf(out, "%s:", title);
+    for (i=0; table_names[i].name; i++) {
+        if (! radio_table_selected(table_names[i].mask))
+            continue;
+        radio_fingerprint(table_names[i].mask, hex);
+        fprintf(out, " %s %s", table_names[i].name, hex);
+    }
+    fprintf(out, "\n");
+}
+
+//
+// Read only tables of the codeplug from the device:
+// selected tables, or all of them.
+// Radios without a map of tables are read whole.
+//
+void radio_download_tables()
+{
+    unsigned selected = radio_tables;
+    int i;
+
+    if (! device->tables) {
+        radio_tables = 0;
+    } else if (! radio_tables) {
+        for (i=0; table_names[i].name; i++)
+            radio_tables |= table_names[i].mask;
+        radio_tables |= TABLE_VERSION;
+    }
+    radio_download();
+    radio_tables = selected;
+}
+
+//
+// Apply configuration script and check the result, in a child process:
+// the script with errors leaves radio memory intact.
+// Return 0 on success, or -1 on errors.
+//
+int radio_try_config(const char *filename)
+{
+#if defined(__WIN32__) || defined(WIN32)
+    // No fork: errors are fatal.
+    radio_parse_config(filename);
+    radio_verify_config();
+    return 0;
+#else
+    static unsigned char *result;
+    int status;
+    pid_t pid;
+
+    if (! result) {
+        // Memory of the child is passed back through shared mapping.
+        result = mmap(0, sizeof(radio_buf), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (result == MAP_FAILED) {
+            perror("mmap");
+            exit(-1);
+        }
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(-1);
+    }
+    if (pid == 0) {
+        // Errors in the script are not failures of the session.
+        // Statistics and trace are reported by the parent.
+        stats_disable();
+        trace_disable();
+        radio_parse_config(filename);
+        radio_verify_config();
+        memcpy(result, radio_mem, sizeof(radio_buf));
+        fflush(stdout);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        perror("waitpid");
+        exit(-1);
+    }
+    if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    memcpy(radio_mem, result, sizeof(radio_buf));
+    return 0;
+#endif
 }
 
 //
@@ -420,10 +1414,12 @@ void radio_print_config(FILE *out, int verbose)
 //
 void radio_verify_config()
 {
+    stats_begin(STATS_VERIFY);
     if (!device->verify_config(device)) {
         // Message should be already printed.
         exit(-1);
     }
+    stats_end(STATS_VERIFY);
 }
 
 //
@@ -445,10 +1441,32 @@ void radio_write_csv(const char *filename)
     }
     fprintf(stderr, "Read file '%s'.\n", filename);
 
+    stats_begin(STATS_UPLOAD);
     device->write_csv(device, csv);
+    stats_end(STATS_UPLOAD);
     fclose(csv);
 }
 
+//
+// Print the plan of memory transfers.
+//
+void radio_print_plan(FILE *out)
+{
+    if (!device->print_plan) {
+        fprintf(stderr, "%s transfers the whole memory by blocks, no plan.\n", device->name);
+        return;
+    }
+    device->print_plan(device, out);
+}
+
+//
+// Print estimated cost of a dry run.
+//
+void radio_print_estimate(FILE *out)
+{
+    estimate_print(out, device->name);
+}
+
 //
 // Check for compatible radio model.
 //
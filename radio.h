@@ -37,16 +37,58 @@ void radio_connect(void);
 //
 void radio_disconnect(void);
 
+//
+// Name of the connected radio, or of the image.
+//
+const char *radio_name(void);
+
+//
+// Return true when the device can read separate tables.
+//
+int radio_has_tables(void);
+
+//
+// Get DMR ID of the radio from the settings, or zero when not set.
+//
+unsigned radio_id(void);
+
 //
 // Read firmware image from the device.
 //
 void radio_download(void);
 
+//
+// Read only tables of the codeplug from the device.
+//
+void radio_download_tables(void);
+
+//
+// Read firmware image from the device, and print tables as they arrive.
+//
+void radio_download_stream(FILE *out);
+
 //
 // Write firmware image to the device.
 //
 void radio_upload(int cont_flag);
 
+//
+// Remember current contents of the radio.
+// Further uploads write only the pieces which differ.
+//
+void radio_track_changes(void);
+
+//
+// Mark the range of memory as written to the radio,
+// for the read-back check.
+//
+void radio_mark_written(unsigned offset, unsigned nbytes);
+
+//
+// Return true when the upload has to write only part of memory.
+//
+int radio_upload_partial(void);
+
 //
 // Print a generic information about the device.
 //
@@ -57,6 +99,23 @@ void radio_print_version(FILE *out);
 //
 void radio_print_config(FILE *out, int verbose);
 
+//
+// Print given tables as text into memory.
+// Return the text terminated by zero, to be released by free().
+//
+char *radio_print_tables(unsigned mask, unsigned *nbytes);
+
+//
+// Compute fingerprint of the table, as 16 hex digits, or "-" when empty.
+// Return 0 when the table is empty.
+//
+int radio_fingerprint(unsigned mask, char *hex);
+
+//
+// Print fingerprints of selected tables, in one line.
+//
+void radio_print_fingerprints(FILE *out, const char *title);
+
 //
 // Read firmware image from the binary file.
 //
@@ -67,6 +126,21 @@ void radio_read_image(const char *filename);
 //
 void radio_save_image(const char *filename);
 
+//
+// Map raw image file as radio memory, for editing in place.
+//
+void radio_map_image(const char *filename, int atomic);
+
+//
+// Load codeplug from the snapshot store.
+//
+void radio_load_snapshot(const char *id);
+
+//
+// Compare two snapshots and print changes by table.
+//
+void radio_diff_snapshots(const char *id1, const char *id2, FILE *out);
+
 //
 // Read the configuration from text file, and modify the firmware.
 //
@@ -77,6 +151,12 @@ void radio_parse_config(const char *filename);
 //
 void radio_validate_config(const char *filename);
 
+//
+// Apply configuration script and check the result, in a child process.
+// Return 0 on success, or -1 when the script has errors.
+//
+int radio_try_config(const char *filename);
+
 //
 // Check the configuration.
 //
@@ -87,19 +167,152 @@ void radio_verify_config(void);
 //
 void radio_write_csv(const char *filename);
 
+//
+// Print the plan of memory transfers.
+//
+void radio_print_plan(FILE *out);
+
+//
+// Print estimated cost of a dry run.
+//
+void radio_print_estimate(FILE *out);
+
 //
 // List all supported radios.
 //
 void radio_list(void);
 
+//
+// Select tables for partial transfer, by a comma separated list of names.
+//
+void radio_select_tables(const char *list);
+
+//
+// Check whether the table is selected for transfer.
+//
+int radio_table_selected(unsigned mask);
+
+//
+// Check whether the table has to be written: it is selected,
+// and differs from contents of the radio, when known.
+//
+int radio_table_modified(unsigned mask);
+
+//
+// Get name and mask of the table by index.
+// Return 0 past the last table.
+//
+const char *radio_table_name(int i, unsigned *mask);
+
+//
+// Check whether the range of radio memory belongs to selected tables.
+//
+int radio_range_selected(unsigned offset, unsigned nbytes);
+
 //
 // Check for compatible radio model.
 //
 int radio_is_compatible(const char *ident);
 
+//
+// Tables of the codeplug, for partial transfers.
+// Version area is always transferred: it identifies the image.
+//
+enum {
+    TABLE_VERSION       = 0x0001,
+    TABLE_CHANNELS      = 0x0002,
+    TABLE_ZONES         = 0x0004,
+    TABLE_SCANLISTS     = 0x0008,
+    TABLE_CONTACTS      = 0x0010,
+    TABLE_GROUPLISTS    = 0x0020,
+    TABLE_MESSAGES      = 0x0040,
+    TABLE_SETTINGS      = 0x0080,
+};
+
+//
+// Range of radio memory, owned by one or more tables.
+//
+typedef struct {
+    unsigned mask;                      // Tables which use the range
+    unsigned offset;                    // Offset in radio_mem[]
+    unsigned length;                    // Size in bytes
+} table_range_t;
+
 //
 // Device-dependent interface to the radio.
 //
+//
+// Word of a table row in configuration script.
+// Text is terminated by zero, in place of the separator.
+//
+typedef struct {
+    char *str;                          // Text of the token
+    unsigned len;                       // Length in bytes
+    unsigned line;                      // Line number in the script, from 1
+    unsigned col;                       // Column, from 1
+    char sep;                           // Separator replaced by zero
+} token_t;
+
+//
+// Restore the text of the row starting from i-th token.
+//
+char *token_rest(token_t *tok, int ntok, int i);
+
+//
+// Configuration script, parsed independently of radio model.
+// Parameters and tables are kept in the order of the script.
+// Rows of a table are stored by columns: column[k][i] is
+// the k-th word of i-th row, valid when k < width[i].
+//
+typedef struct {
+    char        *name;                  // Parameter name, or NULL for a table
+    char        *value;                 // Value of the parameter
+    char        *header;                // Header line of the table
+    unsigned    line;                   // Line number in the script
+    unsigned    kind;                   // Kind of table: TABLE_CHANNELS etc, or 0
+    int         nrows;                  // Number of rows
+    int         maxrows;                // Allocated rows
+    int         ncols;                  // Number of columns
+    int         *width;                 // Number of words in every row
+    token_t     **column;               // Words of all rows, by columns
+} codeplug_section_t;
+
+typedef struct {
+    const char  *filename;              // Name of the script
+    char        *data;                  // Text of the script
+    unsigned    nbytes;                 // Size of the text
+    int         mapped;                 // Text is mapped from file
+    unsigned    mapsize;                // Size of mapping, or 0 when read
+    int         nsections;              // Number of parameters and tables
+    int         maxsections;            // Allocated sections
+    codeplug_section_t *section;        // Parameters and tables
+} codeplug_t;
+
+//
+// Read the configuration script into a codeplug, from file
+// or from text in memory, and release it.
+//
+codeplug_t *codeplug_parse(const char *filename);
+codeplug_t *codeplug_parse_text(const char *filename, char *data, unsigned nbytes);
+void codeplug_free(codeplug_t *cp);
+
+//
+// Count rows of all tables.
+//
+int codeplug_count_rows(const codeplug_t *cp);
+
+//
+// Compile one configuration script for several codeplug images
+// in parallel. Return number of failed targets.
+//
+int codeplug_compile_all(const char *filename, char **images, int nimages, int nworkers);
+
+//
+// Apply the codeplug to the radio memory.
+// Return number of rows which the radio did not accept.
+//
+int radio_compile(codeplug_t *cp, int strict);
+
 typedef struct _radio_device_t radio_device_t;
 struct _radio_device_t {
     const char *name;
@@ -113,9 +326,12 @@ struct _radio_device_t {
     int (*verify_config)(radio_device_t *radio);
     void (*parse_parameter)(radio_device_t *radio, char *param, char *value);
     int (*parse_header)(radio_device_t *radio, char *line);
-    int (*parse_row)(radio_device_t *radio, int table_id, int first_row, char *line);
+    int (*parse_row)(radio_device_t *radio, int table_id, int first_row, token_t *tok, int ntok);
     void (*update_timestamp)(radio_device_t *radio);
     void (*write_csv)(radio_device_t *radio, FILE *csv);
+    void (*print_plan)(radio_device_t *radio, FILE *out);
+    const table_range_t *tables;        // Map of tables, zero terminated
+    unsigned memsz;                     // Size of memory image in bytes
     int channel_count;
 };
 
@@ -140,7 +356,30 @@ extern radio_device_t radio_rt84;       // Baofeng DM-1701, Retevis RT84
 //
 // Radio: memory contents.
 //
-extern unsigned char radio_mem[];
+extern unsigned char *radio_mem;
+
+//
+// Selected tables for partial transfer, zero when all.
+//
+extern unsigned radio_tables;
+
+//
+// Tables modified by the configuration script.
+//
+extern unsigned radio_touched;
+
+//
+// Contents of the radio, when known: only differences are written.
+//
+extern unsigned char *radio_synced;
+
+//
+// Read back written data after upload, and write again what differs.
+// Give up after a few attempts.
+//
+extern int radio_read_back;
+
+#define READBACK_TRIES  3
 
 //
 // File descriptor of serial port with programming cable attached.
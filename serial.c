@@ -56,6 +56,9 @@
 #endif
 
 static char *dev_path;
+char *serial_port;              // Port name given by user
+char serial_firmware[16];       // Firmware version reported by radio
+static int replay_session;      // Serve from recorded session
 
 static const unsigned char CMD_PRG[]   = "PROGRAM";
 static const unsigned char CMD_PRG2[]  = "\2";
@@ -356,8 +359,9 @@ int serial_open(const char *devname, int baud_rate)
 
 //
 // Find a device path by vid/pid.
+// Skip given number of matching devices.
 //
-static char *find_path(int vid, int pid)
+static char *find_path(int vid, int pid, int skip)
 {
     char *result = 0;
 
@@ -414,6 +418,10 @@ static char *find_path(int vid, int pid)
             // Wrong ID.
             continue;
         }
+        if (skip-- > 0) {
+            // Not this one.
+            continue;
+        }
 
         // Print names of vendor and product.
         //const char *vendor  = udev_device_get_sysattr_value(parent, "manufacturer");
@@ -516,6 +524,10 @@ static char *find_path(int vid, int pid)
             // Wrong ID.
             continue;
         }
+        if (skip-- > 0) {
+            // Not this one.
+            continue;
+        }
 
         result = strdup(devname);
         break;
@@ -567,6 +579,10 @@ static char *find_path(int vid, int pid)
             //printf("Wrong vid/pid.\n");
             continue;
         }
+        if (skip-- > 0) {
+            // Not this one.
+            continue;
+        }
 
         // Figure out the COM port name.
         HKEY key = SetupDiOpenDevRegKey(devinfo, &did, DICS_FLAG_GLOBAL, 0, DIREG_DEV, KEY_READ);
@@ -591,13 +607,46 @@ static char *find_path(int vid, int pid)
     return result;
 }
 
+//
+// Find all attached devices with given vid/pid.
+// Return the number of devices, and a list of paths, to be released by free().
+//
+int serial_find_all(int vid, int pid, char ***paths)
+{
+    char **list = 0, *path;
+    int n;
+
+    for (n=0; (path = find_path(vid, pid, n)); n++) {
+        list = realloc(list, (n + 1) * sizeof(char*));
+        if (! list) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+        list[n] = strdup(path);
+    }
+    *paths = list;
+    return n;
+}
+
 //
 // Connect to the specified device.
 // Initiate the programming session.
 //
 int serial_init(int vid, int pid)
 {
-    dev_path = find_path(vid, pid);
+    if (replay_flag) {
+        // Use recorded session instead of the device.
+        if (replay_transport() != STATS_SERIAL)
+            return -1;
+        replay_session = 1;
+        dev_path = "replay";
+        return 0;
+    }
+
+    if (serial_port)
+        dev_path = serial_port;
+    else
+        dev_path = find_path(vid, pid, 0);
     if (!dev_path) {
         if (trace_flag) {
             fprintf(stderr, "Cannot find USB device %04x:%04x\n",
@@ -617,52 +666,85 @@ int serial_init(int vid, int pid)
 static int send_recv(const unsigned char *cmd, int cmdlen,
     unsigned char *response, int reply_len)
 {
+    unsigned long long start = stats_usec();
     unsigned char *p;
-    int len, i, got;
+    unsigned addr = 0;
+    int len, got;
+
+    // Read and write commands: get address for the trace.
+    if ((cmd[0] == CMD_READ[0] || cmd[0] == CMD_WRITE[0]) && cmdlen >= 6)
+        addr = cmd[1] << 24 | cmd[2] << 16 | cmd[3] << 8 | cmd[4];
 
     //
     // Send command.
     //
-    if (trace_flag > 0) {
-        fprintf(stderr, "----Send [%d] %02x", cmdlen, cmd[0]);
-        for (i=1; i<cmdlen; ++i)
-            fprintf(stderr, "-%02x", cmd[i]);
-        fprintf(stderr, "\n");
-    }
+    trace_record(STATS_SERIAL, TRACE_SEND, 0, addr, cmdlen, cmd, cmdlen);
+
+    if (replay_session) {
+        // Get response from the recorded session.
+        len = replay_transfer(STATS_SERIAL, 0, addr, cmdlen, cmd, cmdlen,
+            response, reply_len);
+        if (len < 0)
+            goto write_error;
+    } else {
+        if (serial_write(cmd, cmdlen) < 0) {
+write_error:
+            trace_record(STATS_SERIAL, TRACE_ERROR, 0, -1, 0, 0, 0);
+            fprintf(stderr, "%s: write error\n", dev_path);
+            exit(-1);
+        }
 
-    if (serial_write(cmd, cmdlen) < 0) {
-        fprintf(stderr, "%s: write error\n", dev_path);
-        exit(-1);
+        //
+        // Get response.
+        //
+        p = response;
+        len = 0;
+        while (len < reply_len) {
+            got = serial_read(p, reply_len - len, 1000);
+            if (! got)
+                break;
+
+            p += got;
+            len += got;
+        }
     }
-
-    //
-    // Get response.
-    //
-    p = response;
-    len = 0;
-    while (len < reply_len) {
-        got = serial_read(p, reply_len - len, 1000);
-        if (! got)
-            return 0;
-
-        p += got;
-        len += got;
+    if (len < reply_len) {
+        trace_record(STATS_SERIAL, TRACE_ERROR, 0, 0, 0, 0, 0);
+        stats_timeout(STATS_SERIAL);
+        return 0;
     }
 
-    if (trace_flag > 0) {
-        fprintf(stderr, "----Recv [%d] %02x", reply_len, response[0]);
-        for (i=1; i<reply_len; ++i)
-            fprintf(stderr, "-%02x", response[i]);
-        fprintf(stderr, "\n");
-    }
+    trace_record(STATS_SERIAL, TRACE_RECV, 0, addr, reply_len, response, reply_len);
+    stats_transaction(STATS_SERIAL, cmdlen + reply_len, start);
     return 1;
 }
 
+//
+// Discard pending input and output data.
+//
+static void serial_flush()
+{
+    if (replay_session)
+        return;
+#if defined(__WIN32__) || defined(WIN32)
+    PurgeComm(fd, PURGE_RXCLEAR | PURGE_TXCLEAR);
+#else
+    tcflush(fd, TCIOFLUSH);
+#endif
+}
+
 //
 // Close the serial port.
 //
 void serial_close()
 {
+    if (replay_session) {
+        unsigned char ack[1];
+
+        send_recv(CMD_END, 3, ack, 1);
+        replay_session = 0;
+        return;
+    }
 #if defined(__WIN32__) || defined(WIN32)
     if (fd != INVALID_HANDLE_VALUE) {
         unsigned char ack[1];
@@ -696,16 +778,12 @@ const char *serial_identify()
     unsigned char ack[3];
     int retry = 0;
 
-    if (serial_open(dev_path, 115200) < 0) {
+    if (! replay_session && serial_open(dev_path, 115200) < 0) {
         return 0;
     }
 
 again:
-#if defined(__WIN32__) || defined(WIN32)
-    //TODO: flush pending input and output buffers.
-#else
-    tcflush(fd, TCIOFLUSH);
-#endif
+    serial_flush();
     send_recv(CMD_PRG, 7, ack, 3);
     if (memcmp(ack, CMD_QX, 3) != 0) {
         if (++retry >= 10) {
@@ -733,14 +811,21 @@ again:
 
     // Terminate the string.
     reply[8] = 0;
+    memcpy(serial_firmware, &reply[9], 5);
+    serial_firmware[5] = 0;
     return (char*)&reply[1];
 }
 
 void serial_read_region(int addr, unsigned char *data, int nbytes)
 {
-    static const int DATASZ = 64;
+    static const int DATASZ = SERIAL_READ_SIZE;
     unsigned char cmd[6], reply[8 + DATASZ];
-    int n, i, retry = 0;
+    int n, i, attempt;
+
+    if (dry_run) {
+        estimate_serial_region(0, nbytes);
+        return;
+    }
 
     for (n=0; n<nbytes; n+=DATASZ) {
         // Read command: 52 aa aa aa aa 10
@@ -750,12 +835,17 @@ void serial_read_region(int addr, unsigned char *data, int nbytes)
         cmd[3] = (addr + n) >> 8;
         cmd[4] = addr + n;
         cmd[5] = DATASZ;
+        attempt = 0;
 again:
-        send_recv(cmd, 6, reply, sizeof(reply));
+        if (! send_recv(cmd, 6, reply, sizeof(reply))) {
+            fprintf(stderr, "%s: No reply at address %08x\n",
+                __func__, addr + n);
+            goto retry;
+        }
         if (reply[0] != CMD_WRITE[0] || reply[7+DATASZ] != CMD_ACK[0]) {
             fprintf(stderr, "%s: Wrong read reply %02x-...-%02x, expected %02x-...-%02x\n",
                 __func__, reply[0], reply[7+DATASZ], CMD_WRITE[0], CMD_ACK[0]);
-            exit(-1);
+            goto retry;
         }
 
         // Compute checksum.
@@ -765,21 +855,29 @@ again:
         if (reply[6+DATASZ] != sum) {
             fprintf(stderr, "%s: Wrong read checksum %02x, expected %02x\n",
                 __func__, sum, reply[6+DATASZ]);
-            if (retry++ < 3)
-                goto again;
-            exit(-1);
+            goto retry;
         }
 
         memcpy(data + n, reply + 6, DATASZ);
+        continue;
+retry:
+        serial_flush();
+        if (retry_backoff(__func__, &attempt))
+            goto again;
+        exit(-1);
     }
 }
 
 void serial_write_region(int addr, unsigned char *data, int nbytes)
 {
-    //static const int DATASZ = 64;
-    static const int DATASZ = 16;
+    static const int DATASZ = SERIAL_WRITE_SIZE;
     unsigned char ack, cmd[8 + DATASZ];
-    int n, i;
+    int n, i, attempt;
+
+    if (dry_run) {
+        estimate_serial_region(1, nbytes);
+        return;
+    }
 
     for (n=0; n<nbytes; n+=DATASZ) {
         // Write command: 57 aa aa aa aa 10 .. .. ss nn
@@ -798,12 +896,20 @@ void serial_write_region(int addr, unsigned char *data, int nbytes)
 
         cmd[6 + DATASZ] = sum;
         cmd[7 + DATASZ] = CMD_ACK[0];
-
-        send_recv(cmd, 8 + DATASZ, &ack, 1);
-        if (ack != CMD_ACK[0]) {
+        attempt = 0;
+again:
+        if (! send_recv(cmd, 8 + DATASZ, &ack, 1)) {
+            fprintf(stderr, "%s: No acknowledge at address %08x\n",
+                __func__, addr + n);
+        } else if (ack != CMD_ACK[0]) {
             fprintf(stderr, "%s: Wrong acknowledge %#x, expected %#x\n",
                 __func__, ack, CMD_ACK[0]);
-            exit(-1);
+        } else {
+            continue;
         }
+        serial_flush();
+        if (retry_backoff(__func__, &attempt))
+            goto again;
+        exit(-1);
     }
 }
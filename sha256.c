@@ -0,0 +1,156 @@
+/*
+ * SHA-256 message digest, as specified in FIPS 180-4.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+static const unsigned K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+//
+// Process one 64-byte block.
+//
+static void transform(unsigned state[8], const unsigned char *block)
+{
+    unsigned w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i=0; i<16; i++) {
+        w[i] = block[i*4] << 24 | block[i*4+1] << 16 |
+               block[i*4+2] << 8 | block[i*4+3];
+    }
+    for (; i<64; i++) {
+        unsigned s0 = ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+        unsigned s1 = ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (i=0; i<64; i++) {
+        t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+             ((e & f) ^ (~e & g)) + K[i] + w[i];
+        t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+             ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(sha256_t *ctx)
+{
+    static const unsigned H[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(ctx->state, H, sizeof(H));
+    ctx->nbytes = 0;
+}
+
+void sha256_update(sha256_t *ctx, const void *data, size_t nbytes)
+{
+    const unsigned char *p = data;
+    unsigned fill = ctx->nbytes % 64;
+
+    ctx->nbytes += nbytes;
+    if (fill > 0) {
+        unsigned n = 64 - fill;
+
+        if (nbytes < n) {
+            memcpy(ctx->buf + fill, p, nbytes);
+            return;
+        }
+        memcpy(ctx->buf + fill, p, n);
+        transform(ctx->state, ctx->buf);
+        p += n;
+        nbytes -= n;
+    }
+    for (; nbytes >= 64; p += 64, nbytes -= 64)
+        transform(ctx->state, p);
+    memcpy(ctx->buf, p, nbytes);
+}
+
+void sha256_final(sha256_t *ctx, unsigned char digest[32])
+{
+    unsigned long long nbits = ctx->nbytes * 8;
+    unsigned fill = ctx->nbytes % 64;
+    int i;
+
+    // Append one bit, pad with zeros and put the length in bits.
+    ctx->buf[fill++] = 0x80;
+    if (fill > 56) {
+        memset(ctx->buf + fill, 0, 64 - fill);
+        transform(ctx->state, ctx->buf);
+        fill = 0;
+    }
+    memset(ctx->buf + fill, 0, 56 - fill);
+    for (i=0; i<8; i++)
+        ctx->buf[56+i] = nbits >> (56 - i*8);
+    transform(ctx->state, ctx->buf);
+
+    for (i=0; i<8; i++) {
+        digest[i*4]   = ctx->state[i] >> 24;
+        digest[i*4+1] = ctx->state[i] >> 16;
+        digest[i*4+2] = ctx->state[i] >> 8;
+        digest[i*4+3] = ctx->state[i];
+    }
+}
+
+//
+// Compute digest of a memory buffer.
+//
+void sha256(const void *data, size_t nbytes, unsigned char digest[32])
+{
+    sha256_t ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, nbytes);
+    sha256_final(&ctx, digest);
+}
@@ -0,0 +1,342 @@
+/*
+ * Transfer statistics and phase timing.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__WIN32__) || defined(WIN32)
+#   include <windows.h>
+#else
+#   include <sys/time.h>
+#   include <sys/resource.h>
+#endif
+#include "util.h"
+
+//
+// Latency histogram: bucket k counts transactions
+// which took from 2^(k-1) to 2^k microseconds.
+//
+#define NBUCKETS    28
+
+typedef struct {
+    unsigned long       transactions;   // Number of request/reply exchanges
+    unsigned long       bytes;          // Bytes sent and received
+    unsigned long       retries;        // Transactions repeated after error
+    unsigned long       timeouts;       // Replies not received in time
+    unsigned long long  total_usec;     // Sum of latencies
+    unsigned long long  min_usec;       // Fastest transaction
+    unsigned long long  max_usec;       // Slowest transaction
+    unsigned long       histogram[NBUCKETS];
+    double              sum_x, sum_xx;  // Sums for linear fit of latency
+    double              sum_y, sum_xy;  // by transaction size
+    unsigned long       erases;         // Flash erase commands
+    unsigned long long  erase_usec;     // Time of erase commands
+} transport_stats_t;
+
+static const char *TRANSPORT_NAME[STATS_NTRANSPORTS] = {
+    "serial", "hid", "dfu",
+};
+
+static const char *LATENCY_NAME[STATS_NTRANSPORTS] = {
+    "send_recv", "hid_send_recv", "dfu_control",
+};
+
+static const char *PHASE_NAME[STATS_NPHASES] = {
+    "connect", "download", "parse", "verify", "upload", "readback", "disconnect",
+};
+
+static transport_stats_t transport[STATS_NTRANSPORTS];
+static unsigned long long phase_usec[STATS_NPHASES];
+static unsigned long long phase_start[STATS_NPHASES];
+static int last_transport = -1;
+static const char *radio_name;
+static char *stats_filename;
+static int stats_disabled;
+
+//
+// Get monotonic time in microseconds.
+//
+unsigned long long stats_usec()
+{
+#if defined(__WIN32__) || defined(WIN32)
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return now.QuadPart * 1000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+//
+// Mark start and finish of operation phase.
+// Time of repeated phases is accumulated.
+//
+void stats_begin(int phase)
+{
+    phase_start[phase] = stats_usec();
+}
+
+void stats_end(int phase)
+{
+    if (phase_start[phase]) {
+        phase_usec[phase] += stats_usec() - phase_start[phase];
+        phase_start[phase] = 0;
+    }
+}
+
+//
+// Account a completed transaction: bytes sent and received,
+// and the start time for computing latency.
+//
+void stats_transaction(int tr, unsigned nbytes, unsigned long long start_usec)
+{
+    transport_stats_t *s = &transport[tr];
+    unsigned long long usec = stats_usec() - start_usec;
+    int k;
+
+    last_transport = tr;
+    s->transactions++;
+    s->bytes += nbytes;
+    s->total_usec += usec;
+    if (s->transactions == 1 || usec < s->min_usec)
+        s->min_usec = usec;
+    if (usec > s->max_usec)
+        s->max_usec = usec;
+    s->sum_x += nbytes;
+    s->sum_xx += (double)nbytes * nbytes;
+    s->sum_y += usec;
+    s->sum_xy += (double)nbytes * usec;
+
+    for (k=0; k<NBUCKETS-1 && usec >= (1ULL << k); k++)
+        continue;
+    s->histogram[k]++;
+}
+
+//
+// Account a timeout on given transport.
+//
+void stats_timeout(int tr)
+{
+    last_transport = tr;
+    transport[tr].timeouts++;
+}
+
+//
+// Account a retry: it belongs to the transport
+// of the most recent (failed) transaction.
+//
+void stats_retry()
+{
+    if (last_transport >= 0)
+        transport[last_transport].retries++;
+}
+
+//
+// Account a flash erase command: it takes much longer
+// than a regular transaction, so it is timed separately.
+//
+void stats_erase(int tr, unsigned long long start_usec)
+{
+    transport[tr].erases++;
+    transport[tr].erase_usec += stats_usec() - start_usec;
+}
+
+//
+// Get average latency of transactions on given transport,
+// in microseconds. Return 0 when no data available.
+//
+unsigned stats_latency(int tr)
+{
+    transport_stats_t *s = &transport[tr];
+
+    if (s->transactions == 0)
+        return 0;
+    return s->total_usec / s->transactions;
+}
+
+//
+// Fit latency of transactions as a linear function of size:
+// fixed time per transaction plus time per byte.
+//
+static void fit_latency(transport_stats_t *s, double *fixed_usec, double *byte_usec)
+{
+    double n = s->transactions;
+    double denom = n * s->sum_xx - s->sum_x * s->sum_x;
+
+    *fixed_usec = 0;
+    *byte_usec = 0;
+    if (n == 0)
+        return;
+    if (n > 1 && denom > 0)
+        *byte_usec = (n * s->sum_xy - s->sum_x * s->sum_y) / denom;
+    if (*byte_usec < 0)
+        *byte_usec = 0;
+    *fixed_usec = (s->sum_y - *byte_usec * s->sum_x) / n;
+    if (*fixed_usec < 0) {
+        // All the time is proportional to size.
+        *fixed_usec = 0;
+        *byte_usec = s->sum_y / s->sum_x;
+    }
+}
+
+//
+// Set name of the radio for the report.
+//
+void stats_radio(const char *name)
+{
+    radio_name = name;
+}
+
+//
+// Get peak resident set size in kbytes.
+//
+static long peak_rss_kbytes()
+{
+#if defined(__WIN32__) || defined(WIN32)
+    return 0;
+#else
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        return 0;
+#ifdef __APPLE__
+    // Bytes on Mac OS.
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+//
+// Print statistics in JSON format.
+//
+void stats_print(FILE *out)
+{
+    int p, tr, k;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"version\": \"%s\",\n", version);
+    if (radio_name)
+        fprintf(out, "  \"radio\": \"%s\",\n", radio_name);
+
+    fprintf(out, "  \"phases\": {");
+    for (p=0; p<STATS_NPHASES; p++) {
+        stats_end(p);
+        fprintf(out, "%s\n    \"%s\": %.6f", p ? "," : "",
+            PHASE_NAME[p], phase_usec[p] / 1000000.0);
+    }
+    fprintf(out, "\n  },\n");
+
+    fprintf(out, "  \"transports\": {");
+    for (tr=0; tr<STATS_NTRANSPORTS; tr++) {
+        transport_stats_t *s = &transport[tr];
+        double fixed_usec, byte_usec;
+
+        fit_latency(s, &fixed_usec, &byte_usec);
+        fprintf(out, "%s\n    \"%s\": {\n", tr ? "," : "", TRANSPORT_NAME[tr]);
+        fprintf(out, "      \"transactions\": %lu,\n", s->transactions);
+        fprintf(out, "      \"bytes\": %lu,\n", s->bytes);
+        fprintf(out, "      \"retries\": %lu,\n", s->retries);
+        fprintf(out, "      \"timeouts\": %lu,\n", s->timeouts);
+        fprintf(out, "      \"erases\": %lu,\n", s->erases);
+        fprintf(out, "      \"erase_mean_usec\": %llu,\n",
+            s->erases ? s->erase_usec / s->erases : 0);
+        fprintf(out, "      \"latency\": {\n");
+        fprintf(out, "        \"function\": \"%s\",\n", LATENCY_NAME[tr]);
+        fprintf(out, "        \"min_usec\": %llu,\n", s->min_usec);
+        fprintf(out, "        \"mean_usec\": %u,\n", stats_latency(tr));
+        fprintf(out, "        \"max_usec\": %llu,\n", s->max_usec);
+        fprintf(out, "        \"fixed_usec\": %.1f,\n", fixed_usec);
+        fprintf(out, "        \"per_byte_usec\": %.3f,\n", byte_usec);
+
+        // Print only non-empty buckets, as upper bound: count.
+        fprintf(out, "        \"histogram_usec\": {");
+        int first = 1;
+        for (k=0; k<NBUCKETS; k++) {
+            if (s->histogram[k] == 0)
+                continue;
+            fprintf(out, "%s\"%llu\": %lu", first ? "" : ", ",
+                1ULL << k, s->histogram[k]);
+            first = 0;
+        }
+        fprintf(out, "}\n");
+        fprintf(out, "      }\n");
+        fprintf(out, "    }");
+    }
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"peak_rss_kbytes\": %ld\n", peak_rss_kbytes());
+    fprintf(out, "}\n");
+}
+
+//
+// Print the report at exit, to a file or to stderr.
+//
+static void stats_atexit()
+{
+    if (stats_disabled)
+        return;
+    if (stats_filename) {
+        FILE *out = fopen(stats_filename, "w");
+        if (! out) {
+            perror(stats_filename);
+            return;
+        }
+        stats_print(out);
+        fclose(out);
+    } else {
+        stats_print(stderr);
+    }
+}
+
+//
+// Enable the statistics report.
+// When filename is NULL, print to stderr.
+//
+void stats_enable(const char *filename)
+{
+    if (filename)
+        stats_filename = strdup(filename);
+    atexit(stats_atexit);
+}
+
+//
+// Don't print the report at exit.
+// Called in forked workers, to keep the report of the parent only.
+//
+void stats_disable()
+{
+    stats_disabled = 1;
+}
@@ -0,0 +1,388 @@
+/*
+ * Content-addressed store of codeplug snapshots.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "util.h"
+
+//
+// Layout of the store:
+//      DIR/pages/xx/yyyy...            page contents, named by SHA-256
+//      DIR/snapshots/RADIO/DATE        manifest of snapshot
+//
+// Every radio has its own history: RADIO is the model name
+// and the DMR ID of the radio, or only the model name,
+// when the ID is not set.
+//
+// Manifest is a text file: header lines, then one line per run
+// of identical pages: hash of the page and optional repeat count.
+// Unchanged pages are shared by all snapshots, so every new
+// snapshot costs a manifest plus the pages which differ.
+//
+#define PAGE_SIZE       4096
+
+char *store_dir;                // Directory of snapshot store
+
+//
+// Create directory, when not exists.
+//
+static void make_dir(const char *path)
+{
+#if defined(__WIN32__) || defined(WIN32)
+    if (mkdir(path) < 0 && errno != EEXIST) {
+#else
+    if (mkdir(path, 0775) < 0 && errno != EEXIST) {
+#endif
+        perror(path);
+        exit(-1);
+    }
+}
+
+static void hash_to_hex(const unsigned char digest[32], char hex[65])
+{
+    int i;
+
+    for (i=0; i<32; i++)
+        sprintf(hex + i*2, "%02x", digest[i]);
+}
+
+//
+// Get path of the page file by its hash.
+//
+static void page_path(char *path, unsigned maxlen, const char *hex)
+{
+    snprintf(path, maxlen, "%s/pages/%.2s/%s", store_dir, hex, hex+2);
+}
+
+//
+// Store page contents, unless already present.
+// Return 1 when a new page was written.
+//
+static int write_page(const unsigned char *data, unsigned nbytes, const char *hex)
+{
+    char path[1024], tmp[1024+8];
+    FILE *f;
+
+    page_path(path, sizeof(path), hex);
+    if (access(path, F_OK) == 0)
+        return 0;
+
+    snprintf(tmp, sizeof(tmp), "%s/pages/%.2s", store_dir, hex);
+    make_dir(tmp);
+
+    // Write under temporary name, to never leave a partial page.
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "wb");
+    if (! f) {
+        perror(tmp);
+        exit(-1);
+    }
+    if (fwrite(data, 1, nbytes, f) != nbytes || fclose(f) != 0) {
+        fprintf(stderr, "%s: Cannot write page.\n", tmp);
+        exit(-1);
+    }
+    if (rename(tmp, path) < 0) {
+        perror(path);
+        exit(-1);
+    }
+    return 1;
+}
+
+//
+// Read page contents and check the hash.
+//
+static void read_page(unsigned char *data, unsigned nbytes, const char *hex)
+{
+    char path[1024], got[65];
+    unsigned char digest[32];
+    FILE *f;
+
+    page_path(path, sizeof(path), hex);
+    f = fopen(path, "rb");
+    if (! f) {
+        perror(path);
+        exit(-1);
+    }
+    if (fread(data, 1, nbytes, f) != nbytes) {
+        fprintf(stderr, "%s: Cannot read page.\n", path);
+        exit(-1);
+    }
+    fclose(f);
+
+    sha256(data, nbytes, digest);
+    hash_to_hex(digest, got);
+    if (strcmp(got, hex) != 0) {
+        fprintf(stderr, "%s: Page is corrupted.\n", path);
+        exit(-1);
+    }
+}
+
+//
+// Save memory contents as a new snapshot of given radio.
+// Radio is identified by model name and DMR ID, when not zero.
+// Return name of the snapshot: RADIO/DATE.
+//
+const char *store_save(const unsigned char *mem, unsigned size, const char *model, unsigned radio_id)
+{
+    static char id[128];
+    char path[1024], tmp[1040], hex[65], prev[65], date[16], radio[64];
+    unsigned char digest[32];
+    unsigned addr, count, nnew = 0;
+    FILE *f;
+    int i;
+
+    // Name of the radio, suitable for directory name.
+    for (i=0; model[i] && i<(int)sizeof(radio)-1; i++) {
+        char c = model[i];
+        radio[i] = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                   (c >= 'A' && c <= 'Z') || c == '-' ? c : '_';
+    }
+    radio[i] = 0;
+    if (radio_id != 0)
+        snprintf(radio + i, sizeof(radio) - i, "-%u", radio_id);
+
+    make_dir(store_dir);
+    snprintf(path, sizeof(path), "%s/pages", store_dir);
+    make_dir(path);
+    snprintf(path, sizeof(path), "%s/snapshots", store_dir);
+    make_dir(path);
+    snprintf(path, sizeof(path), "%s/snapshots/%s", store_dir, radio);
+    make_dir(path);
+
+    // Find unused name for the snapshot.
+    get_timestamp(date);
+    for (i=1; ; i++) {
+        if (i == 1)
+            snprintf(id, sizeof(id), "%s/%.8s-%s", radio, date, date+8);
+        else
+            snprintf(id, sizeof(id), "%s/%.8s-%s.%d", radio, date, date+8, i);
+        snprintf(path, sizeof(path), "%s/snapshots/%s", store_dir, id);
+        if (access(path, F_OK) != 0)
+            break;
+    }
+
+    // Write manifest under temporary hidden name, and rename when complete.
+    snprintf(tmp, sizeof(tmp), "%s/snapshots/%s/.%s.tmp", store_dir, radio,
+        id + strlen(radio) + 1);
+    f = fopen(tmp, "w");
+    if (! f) {
+        perror(tmp);
+        exit(-1);
+    }
+    fprintf(f, "Radio: %s\n", model);
+    if (serial_firmware[0])
+        fprintf(f, "Firmware: %s\n", serial_firmware);
+    fprintf(f, "Date: %s\n", date);
+    fprintf(f, "Size: %u\n", size);
+    fprintf(f, "Page: %u\n", PAGE_SIZE);
+
+    // List pages, with repeated pages coded by count.
+    prev[0] = 0;
+    count = 0;
+    for (addr=0; addr<size; addr+=PAGE_SIZE) {
+        unsigned nbytes = (size - addr < PAGE_SIZE) ? size - addr : PAGE_SIZE;
+
+        sha256(mem + addr, nbytes, digest);
+        hash_to_hex(digest, hex);
+        nnew += write_page(mem + addr, nbytes, hex);
+
+        if (count > 0 && strcmp(hex, prev) == 0) {
+            count++;
+            continue;
+        }
+        if (count > 0)
+            fprintf(f, count > 1 ? "%s %u\n" : "%s\n", prev, count);
+        strcpy(prev, hex);
+        count = 1;
+    }
+    if (count > 0)
+        fprintf(f, count > 1 ? "%s %u\n" : "%s\n", prev, count);
+    if (fflush(f) != 0) {
+        perror(tmp);
+        exit(-1);
+    }
+#if !defined(__WIN32__) && !defined(WIN32)
+    fsync(fileno(f));
+#endif
+    if (fclose(f) != 0) {
+        perror(tmp);
+        exit(-1);
+    }
+    if (rename(tmp, path) < 0) {
+        perror(path);
+        exit(-1);
+    }
+    fprintf(stderr, "Store snapshot '%s': %u new pages of %u.\n",
+        id, nnew, (size + PAGE_SIZE - 1) / PAGE_SIZE);
+    return id;
+}
+
+//
+// Read snapshot into memory buffer of given size.
+// Return name of the radio, and size of the image.
+// Firmware version is restored to serial_firmware[].
+//
+const char *store_load(const char *id, unsigned char *mem, unsigned maxsize, unsigned *size)
+{
+    static char model[64];
+    char path[1024], line[256], hex[65];
+    unsigned addr = 0, page_size = 0, count, nbytes;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/snapshots/%s", store_dir, id);
+    f = fopen(path, "r");
+    if (! f) {
+        perror(path);
+        exit(-1);
+    }
+    model[0] = 0;
+    serial_firmware[0] = 0;
+    *size = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "Radio: ", 7) == 0) {
+            strncpy(model, trim_spaces(line + 7, sizeof(model) - 1), sizeof(model) - 1);
+            continue;
+        }
+        if (strncmp(line, "Firmware: ", 10) == 0) {
+            strncpy(serial_firmware, trim_spaces(line + 10, 15), 15);
+            continue;
+        }
+        if (strncmp(line, "Size: ", 6) == 0) {
+            *size = strtoul(line + 6, 0, 10);
+            continue;
+        }
+        if (strncmp(line, "Page: ", 6) == 0) {
+            page_size = strtoul(line + 6, 0, 10);
+            continue;
+        }
+        if (strncmp(line, "Date: ", 6) == 0)
+            continue;
+
+        // Hash of page and optional count.
+        count = 1;
+        if (sscanf(line, "%64s %u", hex, &count) < 1 || strlen(hex) != 64 ||
+            page_size == 0 || *size == 0 || *size > maxsize) {
+            fprintf(stderr, "%s: Bad manifest line: %s", path, line);
+            exit(-1);
+        }
+        for (; count > 0; count--) {
+            if (addr >= *size) {
+                fprintf(stderr, "%s: Too many pages.\n", path);
+                exit(-1);
+            }
+            nbytes = (*size - addr < page_size) ? *size - addr : page_size;
+            read_page(mem + addr, nbytes, hex);
+            addr += nbytes;
+        }
+    }
+    fclose(f);
+    if (! model[0] || *size == 0 || addr != *size) {
+        fprintf(stderr, "%s: Incomplete snapshot.\n", path);
+        exit(-1);
+    }
+    return model;
+}
+
+static int compare_names(const void *pa, const void *pb)
+{
+    return strcmp(*(char* const*)pa, *(char* const*)pb);
+}
+
+//
+// Get sorted list of directory entries, skipping hidden ones.
+// Return number of entries.
+//
+static int list_dir(const char *path, char ***names)
+{
+    DIR *dir = opendir(path);
+    struct dirent *ent;
+    int n = 0, nalloc = 0;
+
+    *names = 0;
+    if (! dir)
+        return 0;
+    while ((ent = readdir(dir)) != 0) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (n >= nalloc) {
+            nalloc = nalloc ? nalloc * 2 : 64;
+            *names = realloc(*names, nalloc * sizeof(char*));
+            if (! *names) {
+                fprintf(stderr, "%s: Out of memory.\n", path);
+                exit(-1);
+            }
+        }
+        (*names)[n++] = strdup(ent->d_name);
+    }
+    closedir(dir);
+    qsort(*names, n, sizeof(char*), compare_names);
+    return n;
+}
+
+//
+// Print list of snapshots: name, radio and firmware.
+//
+void store_list(FILE *out)
+{
+    char path[1024], line[256], **radios, **snaps;
+    int nradios, nsnaps, r, s;
+
+    snprintf(path, sizeof(path), "%s/snapshots", store_dir);
+    nradios = list_dir(path, &radios);
+    for (r=0; r<nradios; r++) {
+        snprintf(path, sizeof(path), "%s/snapshots/%s", store_dir, radios[r]);
+        nsnaps = list_dir(path, &snaps);
+        for (s=0; s<nsnaps; s++) {
+            char model[64] = "", firmware[16] = "";
+            FILE *f;
+
+            snprintf(path, sizeof(path), "%s/snapshots/%s/%s",
+                store_dir, radios[r], snaps[s]);
+            f = fopen(path, "r");
+            if (f) {
+                while (fgets(line, sizeof(line), f) && line[0] >= 'A' && line[0] <= 'Z') {
+                    if (strncmp(line, "Radio: ", 7) == 0)
+                        strncpy(model, trim_spaces(line + 7, 63), 63);
+                    else if (strncmp(line, "Firmware: ", 10) == 0)
+                        strncpy(firmware, trim_spaces(line + 10, 15), 15);
+                }
+                fclose(f);
+            }
+            fprintf(out, "%s/%s  %s%s%s\n", radios[r], snaps[s], model,
+                firmware[0] ? ", firmware " : "", firmware);
+            free(snaps[s]);
+        }
+        free(snaps);
+        free(radios[r]);
+    }
+    free(radios);
+}
@@ -0,0 +1,592 @@
+/*
+ * Flight recorder of transport transactions.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "util.h"
+
+//
+// Binary record of a transaction.
+// Payload of nbytes follows the header.
+// In the file, the header has fixed size, with fields in little-endian
+// order, so the trace can be replayed on another host.
+//
+typedef struct {
+    uint64_t usec;          // Time from the first record, in microseconds
+    uint8_t  transport;     // STATS_SERIAL, STATS_HID or STATS_DFU
+    uint8_t  type;          // TRACE_SEND, TRACE_RECV or TRACE_ERROR
+    uint8_t  request;       // DFU request code
+    uint8_t  reserved;
+    uint32_t addr;          // Memory address, DFU block number or error code
+    uint16_t length;        // Length of transfer
+    uint16_t nbytes;        // Size of payload
+} trace_rec_t;
+
+#define TRACE_HDRSZ 20          // Size of the header in the file
+#define TRACE_HDRSZ_V1 16       // Old format, with 32-bit time
+
+//
+// Ring buffer keeps the most recent records.
+// Size must be a power of two.
+//
+#define RING_SIZE   (1024*1024)
+
+static unsigned char ring[RING_SIZE];
+static unsigned ring_head;              // Total bytes written
+static unsigned ring_tail;              // Start of the oldest record
+static unsigned long long start_usec;   // Time of the first record
+static char *save_filename;             // Dump the trace to this file at exit
+static int session_ok;                  // Don't dump the trace at exit
+static FILE *record_file;               // Write all records to this file
+
+//
+// Replay of a recorded session.
+//
+int replay_flag;                        // Replay mode enabled
+static FILE *replay_file;               // Recorded session
+static char *replay_filename;
+static trace_rec_t replay_rec;          // Next record, read ahead
+static unsigned char replay_data[65536];// Payload of next record
+static int replay_eof;                  // No more records
+static unsigned replay_index;           // Number of the next record
+static int replay_latency;              // Delay per transaction in usec, or -1 for recorded
+static int replay_v1;                   // Old format of the file
+
+//
+// Time of the old format wraps after 71 minutes:
+// it has a different magic, and is accepted for reading.
+//
+static const char TRACE_MAGIC[8] = "DMRTRAC2";
+static const char TRACE_MAGIC_V1[8] = "DMRTRACE";
+static const char TRACE_FILENAME[] = "dmrconfig.trace";
+
+//
+// DFU requests.
+//
+enum {
+    DFU_DETACH,
+    DFU_DNLOAD,
+    DFU_UPLOAD,
+    DFU_GETSTATUS,
+    DFU_CLRSTATUS,
+    DFU_GETSTATE,
+    DFU_ABORT,
+};
+
+static const char *DFU_REQUEST_NAME[] = {
+    "DETACH", "DNLOAD", "UPLOAD", "GETSTATUS", "CLRSTATUS", "GETSTATE", "ABORT",
+};
+
+static void ring_put(unsigned pos, const void *data, unsigned nbytes)
+{
+    unsigned i = pos & (RING_SIZE-1);
+    unsigned n = RING_SIZE - i;
+
+    if (n > nbytes)
+        n = nbytes;
+    memcpy(&ring[i], data, n);
+    memcpy(&ring[0], n + (const unsigned char*)data, nbytes - n);
+}
+
+static void ring_get(unsigned pos, void *data, unsigned nbytes)
+{
+    unsigned i = pos & (RING_SIZE-1);
+    unsigned n = RING_SIZE - i;
+
+    if (n > nbytes)
+        n = nbytes;
+    memcpy(data, &ring[i], n);
+    memcpy(n + (unsigned char*)data, &ring[0], nbytes - n);
+}
+
+//
+// Print bytes separated by dashes.
+//
+static void print_dashed(FILE *out, const unsigned char *data, int len)
+{
+    int i;
+
+    if (len <= 0)
+        return;
+    fprintf(out, "%02x", data[0]);
+    for (i=1; i<len; i++)
+        fprintf(out, "-%02x", data[i]);
+}
+
+//
+// Print the record in human readable format.
+// With level 1, payload of DFU block transfers is omitted.
+//
+static void print_record(FILE *out, const trace_rec_t *rec,
+    const unsigned char *data, int level)
+{
+    const char *dir = (rec->type == TRACE_SEND) ? "Send" : "Recv";
+    int k;
+
+    if (rec->type == TRACE_ERROR) {
+        if (rec->addr == 0)
+            fprintf(out, "--- Timeout\n");
+        else
+            fprintf(out, "--- Error %d\n", (int) rec->addr);
+        return;
+    }
+
+    switch (rec->transport) {
+    case STATS_SERIAL:
+        fprintf(out, "----%s [%d] ", dir, rec->nbytes);
+        print_dashed(out, data, rec->nbytes);
+        fprintf(out, "\n");
+        break;
+
+    case STATS_HID:
+        fprintf(out, "---%s", dir);
+        for (k=0; k<rec->nbytes; ++k) {
+            if (k != 0 && (k & 15) == 0)
+                fprintf(out, "\n       ");
+            fprintf(out, " %02x", data[k]);
+        }
+        fprintf(out, "\n");
+        break;
+
+    case STATS_DFU: {
+        int block = (rec->request == DFU_UPLOAD || rec->request == DFU_DNLOAD) &&
+                    rec->addr >= 2;
+        int show = (level > 1 || ! block);
+        const char *name = (rec->request <= DFU_ABORT) ?
+                           DFU_REQUEST_NAME[rec->request] : "REQUEST";
+
+        if (rec->type == TRACE_RECV) {
+            if (show) {
+                fprintf(out, "--- Recv ");
+                print_dashed(out, data, rec->nbytes);
+                fprintf(out, "\n");
+            }
+        } else if (rec->length == 0) {
+            fprintf(out, "--- Send %s\n", name);
+        } else if (rec->nbytes == 0) {
+            fprintf(out, "--- Send %s [%d]\n", name, rec->length);
+        } else {
+            fprintf(out, "--- Send %s [%d] ", name, rec->length);
+            if (show)
+                print_dashed(out, data, rec->nbytes);
+            fprintf(out, "\n");
+        }
+        break;
+    }
+    }
+}
+
+//
+// Encode the header of the record for the file.
+//
+static void put_header(unsigned char *buf, const trace_rec_t *rec)
+{
+    int i;
+
+    for (i=0; i<8; i++)
+        buf[i] = rec->usec >> (8*i);
+    buf[8]  = rec->transport;
+    buf[9]  = rec->type;
+    buf[10] = rec->request;
+    buf[11] = 0;
+    buf[12] = rec->addr;
+    buf[13] = rec->addr >> 8;
+    buf[14] = rec->addr >> 16;
+    buf[15] = rec->addr >> 24;
+    buf[16] = rec->length;
+    buf[17] = rec->length >> 8;
+    buf[18] = rec->nbytes;
+    buf[19] = rec->nbytes >> 8;
+}
+
+//
+// Decode the header of the record from the file.
+// In the old format, time has only 4 bytes.
+//
+static void get_header(trace_rec_t *rec, const unsigned char *buf, int v1)
+{
+    int tsize = v1 ? 4 : 8;
+    int i;
+
+    rec->usec = 0;
+    for (i=0; i<tsize; i++)
+        rec->usec |= (uint64_t)buf[i] << (8*i);
+    buf += tsize;
+    rec->transport = buf[0];
+    rec->type      = buf[1];
+    rec->request   = buf[2];
+    rec->reserved  = 0;
+    rec->addr      = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+    rec->length    = buf[8] | buf[9] << 8;
+    rec->nbytes    = buf[10] | buf[11] << 8;
+}
+
+//
+// Write a record to the trace file.
+//
+static void write_record(FILE *out, const trace_rec_t *rec, const unsigned char *data)
+{
+    unsigned char hdr[TRACE_HDRSZ];
+
+    put_header(hdr, rec);
+    fwrite(hdr, 1, sizeof(hdr), out);
+    fwrite(data, 1, rec->nbytes, out);
+}
+
+//
+// Read a record from the trace file.
+// Return 0 on end of file.
+//
+static int read_record(FILE *in, const char *filename, int v1,
+    trace_rec_t *rec, unsigned char *data)
+{
+    unsigned char hdr[TRACE_HDRSZ];
+    unsigned hdrsz = v1 ? TRACE_HDRSZ_V1 : TRACE_HDRSZ;
+
+    if (fread(hdr, 1, hdrsz, in) != hdrsz)
+        return 0;
+    get_header(rec, hdr, v1);
+    if (fread(data, 1, rec->nbytes, in) != rec->nbytes) {
+        fprintf(stderr, "%s: Truncated record.\n", filename);
+        exit(-1);
+    }
+    return 1;
+}
+
+//
+// Open the trace file and check the header.
+// Set v1 for the old format.
+//
+static FILE *open_trace(const char *filename, int *v1)
+{
+    char magic[sizeof(TRACE_MAGIC)];
+    FILE *in;
+
+    in = fopen(filename, "rb");
+    if (! in) {
+        perror(filename);
+        exit(-1);
+    }
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic)) {
+        fprintf(stderr, "%s: Not a trace file.\n", filename);
+        exit(-1);
+    }
+    *v1 = (memcmp(magic, TRACE_MAGIC_V1, sizeof(magic)) == 0);
+    if (! *v1 && memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: Not a trace file.\n", filename);
+        exit(-1);
+    }
+    return in;
+}
+
+//
+// Save the ring contents to a file.
+//
+static void trace_save(const char *filename)
+{
+    unsigned char data[65536];
+    unsigned pos;
+    trace_rec_t rec;
+    FILE *out;
+
+    out = fopen(filename, "wb");
+    if (! out) {
+        perror(filename);
+        return;
+    }
+    fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), out);
+    for (pos=ring_tail; pos!=ring_head; pos+=sizeof(rec)+rec.nbytes) {
+        ring_get(pos, &rec, sizeof(rec));
+        ring_get(pos + sizeof(rec), data, rec.nbytes);
+        write_record(out, &rec, data);
+    }
+    fclose(out);
+}
+
+//
+// Dump the trace at exit, when requested or when the session failed.
+//
+static void trace_atexit()
+{
+    if (record_file) {
+        fclose(record_file);
+        record_file = 0;
+    }
+    if (save_filename) {
+        trace_save(save_filename);
+    } else if (! session_ok) {
+        trace_save(TRACE_FILENAME);
+        fprintf(stderr, "Trace saved to file '%s'.\n", TRACE_FILENAME);
+    }
+}
+
+//
+// Append a record to the ring buffer.
+// Print it when tracing is enabled.
+//
+void trace_record(int transport, int type, int request, unsigned addr,
+    unsigned length, const unsigned char *data, unsigned nbytes)
+{
+    trace_rec_t rec;
+
+    if (start_usec == 0) {
+        start_usec = stats_usec();
+        atexit(trace_atexit);
+    }
+    rec.usec      = stats_usec() - start_usec;
+    rec.transport = transport;
+    rec.type      = type;
+    rec.request   = request;
+    rec.reserved  = 0;
+    rec.addr      = addr;
+    rec.length    = length;
+    rec.nbytes    = nbytes;
+
+    // Drop the oldest records to free enough space.
+    while (ring_head + sizeof(rec) + nbytes - ring_tail > RING_SIZE) {
+        trace_rec_t old;
+
+        ring_get(ring_tail, &old, sizeof(old));
+        ring_tail += sizeof(old) + old.nbytes;
+    }
+    ring_put(ring_head, &rec, sizeof(rec));
+    if (nbytes > 0)
+        ring_put(ring_head + sizeof(rec), data, nbytes);
+    ring_head += sizeof(rec) + nbytes;
+
+    if (record_file)
+        write_record(record_file, &rec, data);
+
+    if (trace_flag > 0 && type != TRACE_ERROR) {
+        // DFU trace goes to stdout, for compatibility.
+        print_record(transport == STATS_DFU ? stdout : stderr,
+            &rec, data, trace_flag);
+    }
+}
+
+//
+// Save the trace to a given file at exit.
+//
+void trace_save_on_exit(const char *filename)
+{
+    save_filename = strdup(filename);
+    if (start_usec == 0) {
+        start_usec = stats_usec();
+        atexit(trace_atexit);
+    }
+}
+
+//
+// Session completed successfully: no need to dump the trace.
+//
+void trace_success()
+{
+    session_ok = 1;
+}
+
+//
+// Don't save the trace at exit.
+// Called in forked workers: the trace belongs to the parent.
+//
+void trace_disable()
+{
+    save_filename = 0;
+    session_ok = 1;
+    if (record_file) {
+        // Buffered records will be written by the parent:
+        // redirect the stream to /dev/null, and forget it.
+        int fd = open("/dev/null", O_WRONLY);
+
+        if (fd >= 0) {
+            dup2(fd, fileno(record_file));
+            close(fd);
+        }
+        record_file = 0;
+    }
+}
+
+//
+// Print the trace file in human readable format.
+//
+void trace_decode(const char *filename)
+{
+    unsigned char data[65536];
+    trace_rec_t rec;
+    FILE *in;
+    int v1;
+
+    in = open_trace(filename, &v1);
+    while (read_record(in, filename, v1, &rec, data)) {
+        printf("%4llu.%06u ", (unsigned long long) (rec.usec / 1000000),
+            (unsigned) (rec.usec % 1000000));
+        print_record(stdout, &rec, data, 2);
+    }
+    fclose(in);
+}
+
+//
+// Write all transactions of the session to a file.
+//
+void trace_record_session(const char *filename)
+{
+    record_file = fopen(filename, "wb");
+    if (! record_file) {
+        perror(filename);
+        exit(-1);
+    }
+    fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), record_file);
+    if (start_usec == 0) {
+        start_usec = stats_usec();
+        atexit(trace_atexit);
+    }
+}
+
+//
+// Fetch next record of the replayed session.
+//
+static void replay_next()
+{
+    if (! read_record(replay_file, replay_filename, replay_v1, &replay_rec, replay_data))
+        replay_eof = 1;
+    replay_index++;
+}
+
+//
+// Open a recorded session for replay.
+// Latency is either a number of microseconds per transaction,
+// or "real" to reproduce the recorded timing.
+//
+void replay_open(const char *filename, const char *latency)
+{
+    replay_filename = strdup(filename);
+    replay_file = open_trace(filename, &replay_v1);
+    replay_flag = 1;
+    replay_index = 0;
+    replay_next();
+
+    if (latency) {
+        if (strcmp(latency, "real") == 0)
+            replay_latency = -1;
+        else
+            replay_latency = strtoul(latency, 0, 0);
+    }
+}
+
+//
+// Get transport of the replayed session, or -1 when empty.
+//
+int replay_transport()
+{
+    if (replay_eof)
+        return -1;
+    return replay_rec.transport;
+}
+
+//
+// Replay one transaction: check that the request matches the recording,
+// and return the recorded reply.
+// Return the number of bytes received, or the recorded error code.
+// For requests without a reply, return the length of request.
+//
+int replay_transfer(int transport, int request, unsigned addr, unsigned length,
+    const unsigned char *out, unsigned outlen, unsigned char *in, unsigned inlen)
+{
+    uint64_t send_usec = replay_rec.usec;
+    unsigned index = replay_index;
+    int result;
+
+    if (replay_eof) {
+        fprintf(stderr, "%s: Unexpected end of recorded session.\n", replay_filename);
+        exit(-1);
+    }
+    if (replay_rec.type != TRACE_SEND ||
+        replay_rec.transport != transport ||
+        replay_rec.request != request ||
+        replay_rec.addr != addr ||
+        replay_rec.length != length ||
+        replay_rec.nbytes != outlen ||
+        memcmp(replay_data, out, outlen) != 0)
+    {
+        trace_rec_t rec;
+
+        memset(&rec, 0, sizeof(rec));
+        rec.transport = transport;
+        rec.type      = TRACE_SEND;
+        rec.request   = request;
+        rec.addr      = addr;
+        rec.length    = length;
+        rec.nbytes    = outlen;
+
+        fprintf(stderr, "%s: Request #%u does not match the recorded session.\n",
+            replay_filename, index);
+        fprintf(stderr, "Expected: ");
+        print_record(stderr, &replay_rec, replay_data, 2);
+        fprintf(stderr, "Actual:   ");
+        print_record(stderr, &rec, out, 2);
+        exit(-1);
+    }
+    replay_next();
+
+    // HID timeouts are retried inside the transport: skip them.
+    while (! replay_eof && transport == STATS_HID &&
+           replay_rec.type == TRACE_ERROR && replay_rec.addr == 0)
+        replay_next();
+
+    if (replay_eof || replay_rec.type == TRACE_SEND) {
+        // No reply.
+        result = length;
+    } else {
+        if (replay_latency < 0)
+            usleep(replay_rec.usec - send_usec);
+        if (replay_rec.type == TRACE_ERROR) {
+            result = (int) replay_rec.addr;
+        } else {
+            result = replay_rec.nbytes;
+            memcpy(in, replay_data, ((unsigned)result < inlen) ? result : inlen);
+        }
+        replay_next();
+    }
+    if (replay_latency > 0)
+        usleep(replay_latency);
+    return result;
+}
+
+//
+// Check that the replayed session was completed.
+//
+void replay_finish()
+{
+    if (replay_flag && ! replay_eof) {
+        fprintf(stderr, "%s: Session finished at record #%u, before end of recording.\n",
+            replay_filename, replay_index);
+        exit(-1);
+    }
+}
@@ -32,45 +32,17 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/stat.h>
 #ifdef MINGW32
 #   include <windows.h>
 #else
-#   include <sys/stat.h>
+#   include <sys/mman.h>
 #endif
 #include "util.h"
 
-//
-// CTCSS tones, Hz*10.
-//
-#define NCTCSS  50
-
-static const int CTCSS_TONES [NCTCSS] = {
-     670,  693,  719,  744,  770,  797,  825,  854,  885,  915,
-     948,  974, 1000, 1035, 1072, 1109, 1148, 1188, 1230, 1273,
-    1318, 1365, 1413, 1462, 1514, 1567, 1598, 1622, 1655, 1679,
-    1713, 1738, 1773, 1799, 1835, 1862, 1899, 1928, 1966, 1995,
-    2035, 2065, 2107, 2181, 2257, 2291, 2336, 2418, 2503, 2541,
-};
-
-//
-// DCS codes.
-//
-#define NDCS    (104+1)
-
-static const int DCS_CODES[NDCS] = {
-     23,  25,  26,  31,  32,  36,  43,  47,  51,  53,
-     54,  65,  71,  72,  73,  74, 114, 115, 116, 122,
-    125, 131, 132, 134, 143, 145, 152, 155, 156, 162,
-    165, 172, 174, 205, 212, 223, 225, 226, 243, 244,
-    245, 246, 251, 252, 255, 261, 263, 265, 266, 271,
-    274, 306, 311, 315, 325, 331, 332, 343, 346, 351,
-    356, 364, 365, 371, 411, 412, 413, 423, 431, 432,
-    445, 446, 452, 454, 455, 462, 464, 465, 466, 503,
-    506, 516, 523, 526, 532, 546, 565, 606, 612, 624,
-    627, 631, 632, 654, 662, 664, 703, 712, 723, 731,
-    732, 734, 743, 754,
-     17, // For RD-5R
-};
+#ifndef O_BINARY
+#   define O_BINARY 0
+#endif
 
 //
 // Check for a regular file.
@@ -171,14 +143,27 @@ void mdelay(unsigned msec)
 }
 
 //
-// Round double value to integer.
+// Retry policy for transient i/o errors.
+// Every next attempt waits twice as long as the previous one.
 //
-static int iround(double x)
+#define RETRY_LIMIT     5       // Max number of retries per transaction
+#define RETRY_DELAY     20      // Initial delay in milliseconds
+
+int retry_count;
+
+int retry_backoff(const char *func, int *attempt)
 {
-    if (x >= 0)
-        return (int)(x + 0.5);
+    if (*attempt >= RETRY_LIMIT)
+        return 0;
 
-    return -(int)(-x + 0.5);
+    ++*attempt;
+    ++retry_count;
+    stats_retry();
+    if (trace_flag) {
+        fprintf(stderr, "%s: retry %d of %d\n", func, *attempt, RETRY_LIMIT);
+    }
+    mdelay(RETRY_DELAY << (*attempt - 1));
+    return 1;
 }
 
 //
@@ -236,6 +221,131 @@ int string_in_table(const char *value, const char *tab[], int nelem)
     return -1;
 }
 
+//
+// Hash of a keyword: FNV-1a over lower case ASCII.
+// Stop at given length, or at the terminating zero.
+// Return the length of hashed text via *lenp.
+//
+static unsigned keyword_hash(unsigned seed, const char *str, unsigned *lenp)
+{
+    unsigned h = 2166136261u ^ seed;
+    unsigned n;
+
+    for (n=0; n < *lenp && str[n]; n++) {
+        unsigned c = (unsigned char) str[n];
+
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        h = (h ^ c) * 16777619u;
+    }
+    *lenp = n;
+    return h ^ (h >> 15);
+}
+
+//
+// Build perfect hash index of the vocabulary:
+// find a seed which maps all keywords to distinct slots.
+// Start with an index twice as large as the list,
+// and double it when no seed fits.
+//
+static void keyword_build(keyword_table_t *tab)
+{
+    unsigned nwords, size, seed, i, slot;
+
+    for (nwords=0; tab->words[nwords].name; nwords++)
+        continue;
+    if (nwords >= 255) {
+        fprintf(stderr, "Too many keywords: %u\n", nwords);
+        exit(-1);
+    }
+    for (size=4; size < 2*nwords; size *= 2)
+        continue;
+
+    for (;;) {
+        tab->index = realloc(tab->index, size);
+        if (!tab->index) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(-1);
+        }
+        for (seed=1; seed<1000; seed++) {
+            memset(tab->index, 0, size);
+            for (i=0; i<nwords; i++) {
+                const char *name = tab->words[i].name;
+                unsigned len = ~0u;
+
+                slot = keyword_hash(seed, name, &len) & (size - 1);
+                if (tab->index[slot]) {
+                    if (strcasecmp(tab->words[tab->index[slot] - 1].name, name) == 0) {
+                        fprintf(stderr, "Duplicate keyword: %s\n", name);
+                        exit(-1);
+                    }
+                    break;
+                }
+                tab->index[slot] = i + 1;
+            }
+            if (i == nwords) {
+                tab->seed = seed;
+                tab->mask = size - 1;
+                return;
+            }
+        }
+        size *= 2;
+    }
+}
+
+//
+// Find a keyword of given length, ignoring case.
+// Only one name needs to be compared.
+//
+int keyword_match(keyword_table_t *tab, const char *str, unsigned len)
+{
+    const char *name;
+    unsigned k, i;
+
+    if (!tab->index)
+        keyword_build(tab);
+
+    k = tab->index[keyword_hash(tab->seed, str, &len) & tab->mask];
+    if (k == 0)
+        return -1;
+
+    // Names are plain ASCII, so it's enough to fold the case of letters.
+    name = tab->words[k - 1].name;
+    for (i=0; i<len; i++) {
+        int c = name[i] | 0x20;
+
+        if (name[i] != str[i] &&
+            ((name[i] ^ str[i]) != 0x20 || c < 'a' || c > 'z'))
+            return -1;
+    }
+    if (name[len] != 0)
+        return -1;
+    return tab->words[k - 1].value;
+}
+
+//
+// Find a keyword, ignoring case.
+// Return the value, or -1 when not found.
+//
+int keyword_lookup(keyword_table_t *tab, const char *str)
+{
+    return keyword_match(tab, str, ~0u);
+}
+
+//
+// Find a keyword at the start of the string,
+// up to the first non-letter character.
+//
+int keyword_prefix(keyword_table_t *tab, const char *str)
+{
+    unsigned len;
+
+    for (len=0; (str[len] >= 'A' && str[len] <= 'Z') ||
+                (str[len] >= 'a' && str[len] <= 'z'); len++)
+        continue;
+    return keyword_match(tab, str, len);
+}
+
 //
 // Print description of the parameter.
 //
@@ -335,11 +445,14 @@ void print_ascii(FILE *out, const unsigned char *text, unsigned nchars, int fill
 
 //
 // Get local time in format: YYYYMMDDhhmmss
+// When SOURCE_DATE_EPOCH is set, use it instead of the current time,
+// in UTC: this makes uploads reproducible for session replay.
 //
 void get_timestamp(char p[16])
 {
-    time_t now = time(NULL);
-    struct tm *local = localtime(&now);
+    const char *epoch = getenv("SOURCE_DATE_EPOCH");
+    time_t now = epoch ? (time_t) strtoll(epoch, 0, 10) : time(NULL);
+    struct tm *local = epoch ? gmtime(&now) : localtime(&now);
 
     if (! local) {
         perror("localtime");
@@ -351,6 +464,93 @@ void get_timestamp(char p[16])
     }
 }
 
+//
+// Map text file into memory, as a private writable copy,
+// terminated by zero byte. Pages are copied only when modified.
+// When there is no room for the terminator in the last page,
+// or no mmap, the file is read into allocated buffer.
+// Pipes have no size, and are read until end of file.
+//
+char *file_map(const char *filename, unsigned *nbytes, unsigned *mapsize)
+{
+    struct stat st;
+    unsigned size;
+    char *data;
+    int fd, n;
+
+    fd = open(filename, O_RDONLY | O_BINARY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(filename);
+        exit(-1);
+    }
+    *mapsize = 0;
+    if (! S_ISREG(st.st_mode)) {
+        size = 64*1024;
+        *nbytes = 0;
+        data = malloc(size);
+        for (;;) {
+            if (! data) {
+                fprintf(stderr, "%s: Out of memory.\n", filename);
+                exit(-1);
+            }
+            n = read(fd, data + *nbytes, size - *nbytes - 1);
+            if (n < 0) {
+                perror(filename);
+                exit(-1);
+            }
+            if (n == 0)
+                break;
+            *nbytes += n;
+            if (*nbytes + 1 == size) {
+                size *= 2;
+                data = realloc(data, size);
+            }
+        }
+        close(fd);
+        data[*nbytes] = 0;
+        return data;
+    }
+    *nbytes = st.st_size;
+#ifndef MINGW32
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (*nbytes % page != 0) {
+        data = mmap(0, *nbytes + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(filename);
+            exit(-1);
+        }
+        close(fd);
+        data[*nbytes] = 0;
+        *mapsize = *nbytes + 1;
+        return data;
+    }
+#endif
+    data = malloc(*nbytes + 1);
+    if (! data) {
+        fprintf(stderr, "%s: Out of memory.\n", filename);
+        exit(-1);
+    }
+    if (read(fd, data, *nbytes) != (int)*nbytes) {
+        fprintf(stderr, "%s: Cannot read file.\n", filename);
+        exit(-1);
+    }
+    close(fd);
+    data[*nbytes] = 0;
+    return data;
+}
+
+void file_unmap(char *data, unsigned mapsize)
+{
+#ifndef MINGW32
+    if (mapsize != 0) {
+        munmap(data, mapsize);
+        return;
+    }
+#endif
+    free(data);
+}
+
 //
 // Fetch Unicode symbol from UTF-8 string.
 // Advance string pointer.
@@ -448,202 +648,6 @@ void ascii_decode_uppercase(unsigned char *dst, const char *src, unsigned nsym,
     }
 }
 
-//
-// Convert tone string to BCD format.
-// Four possible formats:
-// nnn.n - CTCSS frequency
-// DnnnN - DCS normal
-// DnnnI - DCS inverted
-// '-'   - Disabled
-//
-int encode_tone(char *str)
-{
-    unsigned val, tag, a, b, c, d;
-
-    if (*str == '-') {
-        // Disabled
-        return 0xffff;
-
-    } else if (*str == 'D' || *str == 'd') {
-        //
-        // DCS tone
-        //
-        char *e;
-        val = strtoul(++str, &e, 10);
-
-        // Find a valid index in DCS table.
-        int i;
-        for (i=0; i<NDCS; i++)
-            if (DCS_CODES[i] == val)
-                break;
-        if (i >= NDCS) {
-            return -1;
-        }
-
-        a = 0;
-        b = val / 100;
-        c = val / 10 % 10;
-        d = val % 10;
-
-        if (*e == 'N' || *e == 'n') {
-            tag = 2;
-        } else if (*e == 'I' || *e == 'i') {
-            tag = 3;
-        } else {
-            return -1;
-        }
-    } else if (*str >= '0' && *str <= '9') {
-        //
-        // CTCSS tone
-        //
-        float hz;
-        if (sscanf(str, "%f", &hz) != 1)
-            return -1;
-
-        // Round to integer.
-        val = hz * 10.0 + 0.5;
-
-        // Find a valid index in CTCSS table.
-        int i;
-        for (i=0; i<NCTCSS; i++)
-            if (CTCSS_TONES[i] == val)
-                break;
-        if (i >= NCTCSS)
-            return -1;
-
-        a = val / 1000;
-        b = val / 100 % 10;
-        c = val / 10 % 10;
-        d = val % 10;
-        tag = 0;
-    } else {
-        return -1;
-    }
-
-    return (a << 12) | (b << 8) | (c << 4) | d | (tag << 14);
-}
-
-//
-// Print frequency (BCD value).
-//
-void print_freq(FILE *out, unsigned data)
-{
-    fprintf(out, "%d%d%d.%d%d%d", (data >> 28) & 15, (data >> 24) & 15,
-        (data >> 20) & 15, (data >> 16) & 15,
-        (data >> 12) & 15, (data >> 8) & 15);
-
-    if ((data & 0xff) == 0) {
-        fputs("  ", out);
-    } else {
-        fprintf(out, "%d", (data >> 4) & 15);
-        if ((data & 0x0f) == 0) {
-            fputs(" ", out);
-        } else {
-            fprintf(out, "%d", data & 15);
-        }
-    }
-}
-
-//
-// Convert frequency in MHz from floating point to
-// a binary coded decimal format (8 digits).
-// Format: abcdefgh
-//
-unsigned mhz_to_abcdefgh(double mhz)
-{
-    unsigned hz = iround(mhz * 1000000.0);
-    unsigned a  = (hz / 100000000) % 10;
-    unsigned b  = (hz / 10000000)  % 10;
-    unsigned c  = (hz / 1000000)   % 10;
-    unsigned d  = (hz / 100000)    % 10;
-    unsigned e  = (hz / 10000)     % 10;
-    unsigned f  = (hz / 1000)      % 10;
-    unsigned g  = (hz / 100)       % 10;
-    unsigned h  = (hz / 10)        % 10;
-
-    return a << 28 | b << 24 | c << 20 | d << 16 | e << 12 | f << 8 | g << 4 | h;
-}
-
-//
-// Convert frequency in MHz from floating point to
-// a binary coded decimal format (8 digits).
-// Format: ghefcdab
-//
-unsigned mhz_to_ghefcdab(double mhz)
-{
-    unsigned hz = iround(mhz * 1000000.0);
-    unsigned a  = (hz / 100000000) % 10;
-    unsigned b  = (hz / 10000000)  % 10;
-    unsigned c  = (hz / 1000000)   % 10;
-    unsigned d  = (hz / 100000)    % 10;
-    unsigned e  = (hz / 10000)     % 10;
-    unsigned f  = (hz / 1000)      % 10;
-    unsigned g  = (hz / 100)       % 10;
-    unsigned h  = (hz / 10)        % 10;
-
-    return g << 28 | h << 24 | e << 20 | f << 16 | c << 12 | d << 8 | a << 4 | b;
-}
-
-//
-// Convert a 4-byte frequency value from binary coded decimal
-// to integer format (in Hertz).
-//
-int freq_to_hz(unsigned bcd)
-{
-    int a = (bcd >> 28) & 15;
-    int b = (bcd >> 24) & 15;
-    int c = (bcd >> 20) & 15;
-    int d = (bcd >> 16) & 15;
-    int e = (bcd >> 12) & 15;
-    int f = (bcd >> 8)  & 15;
-    int g = (bcd >> 4)  & 15;
-    int h =  bcd        & 15;
-
-    return (((((((a*10 + b) * 10 + c) * 10 + d) * 10 + e) * 10 + f) * 10 + g) * 10 + h) * 10;
-}
-
-//
-// Print frequency as MHz.
-//
-void print_mhz(FILE *out, unsigned hz)
-{
-    if (hz % 1000000 == 0)
-        fprintf(out, "%-8u", hz / 1000000);
-    else if (hz % 100000 == 0)
-        fprintf(out, "%-8.1f", hz / 1000000.0);
-    else if (hz % 10000 == 0)
-        fprintf(out, "%-8.2f", hz / 1000000.0);
-    else if (hz % 1000 == 0)
-        fprintf(out, "%-8.3f", hz / 1000000.0);
-    else if (hz % 100 == 0)
-        fprintf(out, "%-8.4f", hz / 1000000.0);
-    else
-        fprintf(out, "%-8.5f", hz / 1000000.0);
-}
-
-//
-// Print the transmit offset or frequency.
-//
-void print_offset(FILE *out, unsigned rx_bcd, unsigned tx_bcd)
-{
-    int rx_hz = freq_to_hz(rx_bcd);
-    int tx_hz = freq_to_hz(tx_bcd);
-    int delta = tx_hz - rx_hz;
-
-    if (delta == 0) {
-        fprintf(out, "+0       ");
-    } else if (delta > 0 && delta/50000 <= 255) {
-        fprintf(out, "+");
-        print_mhz(out, delta);
-    } else if (delta < 0 && -delta/50000 <= 255) {
-        fprintf(out, "-");
-        print_mhz(out, -delta);
-    } else {
-        fprintf(out, " ");
-        print_mhz(out, tx_hz);
-    }
-}
-
 //
 // Compare channel index for qsort().
 // Treat 0 as empty element.
@@ -704,41 +708,6 @@ int compare_index_ffffffff(const void *pa, const void *pb)
     return 0;
 }
 
-//
-// Print CTSS or DCS tone.
-//
-void print_tone(FILE *out, unsigned data)
-{
-    if (data == 0xffff) {
-        fprintf(out, "-    ");
-        return;
-    }
-
-    unsigned tag = data >> 14;
-    unsigned a = (data >> 12) & 3;
-    unsigned b = (data >> 8) & 15;
-    unsigned c = (data >> 4) & 15;
-    unsigned d = data & 15;
-
-    switch (tag) {
-    default:
-        // CTCSS
-        if (a == 0)
-            fprintf(out, "%d%d.%d ", b, c, d);
-        else
-            fprintf(out, "%d%d%d.%d", a, b, c, d);
-        break;
-    case 2:
-        // DCS-N
-        fprintf(out, "D%d%d%dN", b, c, d);
-        break;
-    case 3:
-        // DCS-I
-        fprintf(out, "D%d%d%dI", b, c, d);
-        break;
-    }
-}
-
 //
 // Initialize CSV parser.
 // Check header for correctness.
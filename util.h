@@ -74,6 +74,7 @@ int csv_read(FILE *csv, char **radioid, char **callsign, char **name,
 const char *dfu_init(unsigned vid, unsigned pid);
 void dfu_close(void);
 void dfu_erase(unsigned start, unsigned finish);
+void dfu_erase_image(unsigned start, unsigned finish);
 void dfu_read_block(int bno, unsigned char *data, int nbytes);
 void dfu_write_block(int bno, unsigned char *data, int nbytes);
 void dfu_reboot(void);
@@ -84,7 +85,7 @@ void dfu_reboot(void);
 int hid_init(int vid, int pid);
 const char *hid_identify(void);
 void hid_close(void);
-void hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength);
+int hid_send_recv(const unsigned char *data, unsigned nbytes, unsigned char *rdata, unsigned rlength);
 void hid_read_block(int bno, unsigned char *data, int nbytes);
 void hid_read_finish(void);
 void hid_write_block(int bno, unsigned char *data, int nbytes);
@@ -95,26 +96,194 @@ void hid_write_finish(void);
 //
 int serial_init(int vid, int pid);
 const char *serial_identify(void);
+int serial_find_all(int vid, int pid, char ***paths);
 void serial_close(void);
 void serial_read_region(int addr, unsigned char *data, int nbytes);
 void serial_write_region(int addr, unsigned char *data, int nbytes);
 
+//
+// Data size of read and write commands, as accepted by the radio.
+// Regions are transferred by commands of this size.
+//
+#define SERIAL_READ_SIZE    64
+#define SERIAL_WRITE_SIZE   16
+
+//
+// Serial port name, when given by user.
+// Otherwise the port is found by USB vendor and product id.
+//
+extern char *serial_port;
+
+//
+// Firmware version, as reported by the radio on identification.
+// Empty when unknown.
+//
+extern char serial_firmware[16];
+
 //
 // Delay in milliseconds.
 //
 void mdelay(unsigned msec);
 
+//
+// Retry policy for transient i/o errors.
+// Wait with exponential backoff and return 1 when the failed
+// transaction should be repeated, or 0 when the limit is exhausted.
+// Attempt counter is maintained by the caller, starting from 0.
+//
+int retry_backoff(const char *func, int *attempt);
+
+//
+// Total number of retries in this session.
+//
+extern int retry_count;
+
+//
+// Transfer statistics.
+// Every transport accounts its transactions: number of bytes
+// sent and received, and the time when the request was started.
+//
+enum {
+    STATS_SERIAL,
+    STATS_HID,
+    STATS_DFU,
+    STATS_NTRANSPORTS
+};
+
+//
+// Phases of operation, timed separately.
+//
+enum {
+    STATS_CONNECT,
+    STATS_DOWNLOAD,
+    STATS_PARSE,
+    STATS_VERIFY,
+    STATS_UPLOAD,
+    STATS_READBACK,
+    STATS_DISCONNECT,
+    STATS_NPHASES
+};
+
+void stats_enable(const char *filename);
+void stats_disable(void);
+void stats_print(FILE *out);
+void stats_radio(const char *name);
+void stats_begin(int phase);
+void stats_end(int phase);
+unsigned long long stats_usec(void);
+void stats_transaction(int transport, unsigned nbytes, unsigned long long start_usec);
+void stats_timeout(int transport);
+void stats_retry(void);
+void stats_erase(int transport, unsigned long long start_usec);
+unsigned stats_latency(int transport);
+
+//
+// Dry run: transports count the transactions they would issue,
+// instead of talking to the radio. Time of operation is estimated
+// from latencies measured by --stats on this machine, or from defaults.
+//
+extern int dry_run;
+
+void estimate_calibrate(const char *filename);
+void estimate_dfu_erase(unsigned start, unsigned finish);
+void estimate_dfu_erase_image(unsigned start, unsigned finish);
+void estimate_dfu_block(int write_flag, int nbytes);
+void estimate_hid_block(int write_flag, unsigned addr, int nbytes);
+void estimate_hid_finish(void);
+void estimate_serial_region(int write_flag, int nbytes);
+void estimate_print(FILE *out, const char *radio_name);
+
+//
+// Flight recorder: all transactions are kept in a ring buffer
+// as binary records. The trace is saved to a file on request,
+// or when the session fails. With -t, records are also printed.
+//
+enum {
+    TRACE_SEND,         // Request sent to the radio
+    TRACE_RECV,         // Reply received from the radio
+    TRACE_ERROR,        // Transfer failed: address holds error code
+};
+
+void trace_record(int transport, int type, int request, unsigned addr,
+    unsigned length, const unsigned char *data, unsigned nbytes);
+void trace_save_on_exit(const char *filename);
+void trace_success(void);
+void trace_disable(void);
+void trace_decode(const char *filename);
+
+//
+// Record all transactions of the session to a file.
+//
+void trace_record_session(const char *filename);
+
+//
+// Replay a recorded session instead of talking to the radio.
+// Transports check replay_flag at init, and substitute every
+// transfer by replay_transfer(), which compares the request with
+// the recording and returns the recorded reply.
+//
+extern int replay_flag;
+
+void replay_open(const char *filename, const char *latency);
+int replay_transport(void);
+int replay_transfer(int transport, int request, unsigned addr, unsigned length,
+    const unsigned char *out, unsigned outlen, unsigned char *in, unsigned inlen);
+void replay_finish(void);
+
 //
 // Check for a regular file.
 //
 int is_file(char *filename);
 
 //
-// Convert frequency in MHz from floating point to
-// a binary coded decimal format (8 digits).
+// Frequency in Hertz.
+// Signed, to hold transmit offsets.
 //
-unsigned mhz_to_abcdefgh(double mhz);
-unsigned mhz_to_ghefcdab(double mhz);
+typedef int freq_t;
+
+#define FREQ_MAX_MHZ    2000
+
+//
+// Parse frequency in MHz, with optional sign, into Hertz.
+// Return 0 on syntax error.
+//
+int parse_freq(const char *str, freq_t *hz);
+
+//
+// Convert frequency in Hertz to a binary coded decimal
+// format (8 digits), and back.
+// Formats: abcdefgh and ghefcdab (bytes in reverse order).
+//
+unsigned hz_to_abcdefgh(freq_t hz);
+unsigned hz_to_ghefcdab(freq_t hz);
+freq_t abcdefgh_to_hz(unsigned bcd);
+freq_t ghefcdab_to_hz(unsigned bcd);
+
+//
+// Binary coded decimal, two digits per byte, big endian.
+//
+unsigned bcd_get(const unsigned char *bcd, int nbytes);
+void bcd_put(unsigned char *bcd, int nbytes, unsigned value);
+
+//
+// Number as 8 BCD digits in a 32-bit word, and back.
+// Array versions convert many values at once.
+//
+unsigned bin_to_bcd32(unsigned value);
+unsigned bcd32_to_bin(unsigned bcd);
+void bin_to_bcd32_array(unsigned *bcd, const unsigned *value, int count);
+void bcd32_to_bin_array(unsigned *value, const unsigned *bcd, int count);
+
+//
+// Standard table of CTCSS tones, Hz*10.
+// Find index of a tone (-1 when not found), get tone by index,
+// parse tone nnn.n into Hz*10 (-1 on error).
+//
+#define NCTCSS  51
+
+int ctcss_index(unsigned dhz);
+unsigned ctcss_tone(int index);
+int parse_ctcss(const char *str);
 
 //
 // Get a binary value of the parameter: On/Off,
@@ -140,6 +309,43 @@ void copy_str(unsigned char *dest, const char *src, int nbytes);
 //
 int string_in_table(const char *value, const char *tab[], int nelem);
 
+//
+// Keyword of configuration script, and its value.
+//
+typedef struct {
+    const char *name;
+    int value;
+} keyword_t;
+
+//
+// Vocabulary of keywords with a perfect hash index.
+// Only the list of words needs to be initialized:
+// the index is built on first lookup.
+//
+typedef struct {
+    const keyword_t *words;             // List of keywords, terminated by null name
+    unsigned seed;                      // Seed of hash function
+    unsigned mask;                      // Size of index minus one
+    unsigned char *index;               // Keyword number plus 1 by hash, or 0
+} keyword_table_t;
+
+//
+// Find a keyword, ignoring case.
+// Return the value, or -1 when not found.
+//
+int keyword_lookup(keyword_table_t *tab, const char *str);
+
+//
+// Find a keyword of given length, ignoring case.
+//
+int keyword_match(keyword_table_t *tab, const char *str, unsigned len);
+
+//
+// Find a keyword at the start of the string,
+// up to the first non-letter character.
+//
+int keyword_prefix(keyword_table_t *tab, const char *str);
+
 //
 // Print description of the parameter.
 //
@@ -179,6 +385,14 @@ void utf8_decode(unsigned short *dst, const char *src, unsigned nsym);
 void ascii_decode(unsigned char *dst, const char *src, unsigned nsym, unsigned fill);
 void ascii_decode_uppercase(unsigned char *dst, const char *src, unsigned nsym, unsigned fill);
 
+//
+// Map text file into memory, as a private copy terminated by zero.
+// Size of the mapping is returned for file_unmap(), or 0 when the file
+// was read into allocated memory.
+//
+char *file_map(const char *filename, unsigned *nbytes, unsigned *mapsize);
+void file_unmap(char *data, unsigned mapsize);
+
 //
 // Get local time in format: YYYYMMDDhhmmss
 //
@@ -200,22 +414,100 @@ int encode_tone(char *str);
 //
 void print_freq(FILE *out, unsigned data);
 
-//
-// Convert a 4-byte frequency value from binary coded decimal
-// to integer format (in Hertz).
-//
-int freq_to_hz(unsigned bcd);
-
 //
 // Print frequency as MHz.
 //
-void print_mhz(FILE *out, unsigned hz);
+void print_mhz(FILE *out, freq_t hz);
 
 //
 // Print the transmit offset or frequency.
 //
 void print_offset(FILE *out, unsigned rx_bcd, unsigned tx_bcd);
 
+//
+// SHA-256 message digest.
+//
+typedef struct {
+    unsigned state[8];
+    unsigned long long nbytes;
+    unsigned char buf[64];
+} sha256_t;
+
+void sha256_init(sha256_t *ctx);
+void sha256_update(sha256_t *ctx, const void *data, size_t nbytes);
+void sha256_final(sha256_t *ctx, unsigned char digest[32]);
+void sha256(const void *data, size_t nbytes, unsigned char digest[32]);
+
+//
+// Sparse codeplug image.
+// Erased and zero pages are coded as runs, and the header
+// keeps name of the radio, firmware version, time and checksum.
+//
+int image_is_sparse(const char *filename);
+const char *image_read_sparse(const char *filename, unsigned char *mem, unsigned maxsize, unsigned *size);
+void image_save_sparse(const char *filename, const unsigned char *mem, unsigned size, const char *model);
+
+//
+// Map raw image file for editing in place.
+// Only modified pages are written back by image_commit().
+//
+unsigned char *image_map(const char *filename, unsigned size, int atomic);
+void image_commit(void);
+
+//
+// Save images in sparse format.
+//
+extern int image_sparse_flag;
+
+//
+// Store of codeplug snapshots, deduplicated by pages.
+// Snapshot is named as RADIO/DATE.
+//
+const char *store_save(const unsigned char *mem, unsigned size, const char *model, unsigned radio_id);
+const char *store_load(const char *id, unsigned char *mem, unsigned maxsize, unsigned *size);
+void store_list(FILE *out);
+
+//
+// Directory of snapshot store, when enabled.
+//
+extern char *store_dir;
+
+//
+// Pool of worker processes.
+// Results are passed to the parent in memory from pool_alloc().
+// Worker gets index of the task and its log of error output;
+// done() gets exit status of the worker, or -1 when it crashed.
+//
+void *pool_alloc(unsigned nbytes);
+void pool_free(void *data, unsigned nbytes);
+void pool_last_line(FILE *log, char *buf, int maxlen);
+void pool_run(int ntasks, int nworkers, void (*worker)(int, FILE*),
+    void (*done)(int, int, FILE*));
+
+//
+// Run jobs from the manifest file by a pool of worker processes.
+// Return number of failed jobs.
+//
+int batch_run(const char *filename, int nworkers);
+
+//
+// Audit attached radios against golden images of the same models.
+// Return number of radios which failed.
+//
+int audit_run(char **images, int nimages, int nworkers);
+
+//
+// Apply configuration script to the connected radio on every change,
+// writing only the differences, until interrupted by user.
+//
+void watch_run(const char *filename);
+
+//
+// Query codeplug images: find channels by frequency or contact ID,
+// zones and scan lists by channel. Return number of matches.
+//
+int query_run(const char *query, char **images, int nimages);
+
 //
 // Compare channel index for qsort().
 //
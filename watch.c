@@ -0,0 +1,220 @@
+/*
+ * Watch configuration script, and apply changes to the connected radio.
+ *
+ * Copyright (C) 2018 Serge Vakulenko, KK6ABQ
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#   include <poll.h>
+#   include <sys/inotify.h>
+#endif
+#include "radio.h"
+#include "util.h"
+
+//
+// The radio stays connected. Every time the script is saved,
+// it is parsed again over the current contents of the radio,
+// like -c does, and only the pieces of memory which differ
+// from the radio are written. Script with errors is reported
+// and skipped, leaving the radio unchanged.
+//
+// On Linux the directory of the script is watched by inotify,
+// because editors often save a new file and rename it over
+// the old one. Elsewhere the modification time is polled.
+//
+#define POLL_MSEC       250     // Period of polling for changes
+#define SETTLE_MSEC     50      // Wait until editor finishes saving
+
+static volatile int stop_flag;  // Interrupted by user
+
+static void stop_handler(int sig)
+{
+    stop_flag = 1;
+}
+
+#if defined(__linux__)
+static int notify_fd = -1;      // Inotify instance
+static const char *script_name; // Name of script in the directory
+
+//
+// Start watching the directory of the script.
+//
+static void watch_start(const char *filename)
+{
+    char *dir = strdup(filename), *p;
+
+    if (! dir) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(-1);
+    }
+    p = strrchr(dir, '/');
+    if (p) {
+        script_name = filename + (p - dir) + 1;
+        if (p == dir)
+            p++;
+        *p = 0;
+    } else {
+        script_name = filename;
+        strcpy(dir, ".");
+    }
+
+    notify_fd = inotify_init();
+    if (notify_fd < 0) {
+        perror("inotify_init");
+        exit(-1);
+    }
+    if (inotify_add_watch(notify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror(dir);
+        exit(-1);
+    }
+    free(dir);
+}
+
+//
+// Read pending events, wait at most given time.
+// Return 1 when the script was changed, 0 on timeout or interrupt.
+//
+static int read_events(int timeout_msec)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { notify_fd, POLLIN, 0 };
+    int changed = 0, nbytes, n;
+
+    n = poll(&pfd, 1, timeout_msec);
+    if (n <= 0) {
+        if (n < 0 && errno != EINTR) {
+            perror("poll");
+            exit(-1);
+        }
+        return 0;
+    }
+    nbytes = read(notify_fd, buf, sizeof(buf));
+    if (nbytes < 0) {
+        if (errno == EINTR)
+            return 0;
+        perror("inotify");
+        exit(-1);
+    }
+    for (n=0; n<nbytes; ) {
+        struct inotify_event *e = (struct inotify_event*) &buf[n];
+
+        if (e->len > 0 && strcmp(e->name, script_name) == 0)
+            changed = 1;
+        n += sizeof(*e) + e->len;
+    }
+    return changed;
+}
+
+//
+// Wait until the script is changed.
+// Return 0 when interrupted by user.
+//
+static int watch_wait(const char *filename)
+{
+    while (! stop_flag) {
+        if (read_events(-1)) {
+            // Let the editor finish saving.
+            while (read_events(SETTLE_MSEC))
+                continue;
+            return 1;
+        }
+    }
+    return 0;
+}
+#else
+static time_t last_mtime;       // Modification time of the script
+
+static time_t get_mtime(const char *filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) < 0)
+        return 0;
+    return st.st_mtime;
+}
+
+static void watch_start(const char *filename)
+{
+    last_mtime = get_mtime(filename);
+}
+
+static int watch_wait(const char *filename)
+{
+    while (! stop_flag) {
+        time_t mtime = get_mtime(filename);
+
+        if (mtime != 0 && mtime != last_mtime) {
+            last_mtime = mtime;
+            usleep(SETTLE_MSEC * 1000);
+            return 1;
+        }
+        usleep(POLL_MSEC * 1000);
+    }
+    return 0;
+}
+#endif
+
+//
+// Apply the script to the radio, writing only the differences.
+//
+static void apply(const char *filename)
+{
+    unsigned long long start = stats_usec();
+
+    if (radio_try_config(filename) < 0) {
+        fprintf(stderr, "%s: Errors in script, radio not changed.\n", filename);
+        return;
+    }
+    radio_upload(1);
+    fprintf(stderr, "%s: Applied in %.3f sec.\n", filename,
+        (stats_usec() - start) / 1000000.0);
+}
+
+//
+// Apply the script to the connected radio, and then again
+// on every change, until interrupted by user.
+// Radio memory must be read already.
+//
+void watch_run(const char *filename)
+{
+    radio_track_changes();
+    watch_start(filename);
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    apply(filename);
+    fprintf(stderr, "Watching %s, press Ctrl-C to stop.\n", filename);
+    while (watch_wait(filename))
+        apply(filename);
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+}